@@ -33,6 +33,7 @@
 #include "mednafen/cdrom/CDAccess_CCD.cpp"
 #include "mednafen/cdrom/SimpleFIFO.cpp"
 #include "mednafen/cdrom/audioreader.cpp"
+#include "mednafen/cdrom/xa_adpcm.cpp"
 #include "mednafen/cdrom/cdromif.cpp"
 #include "mednafen/cdrom/misc.cpp"
 #endif
@@ -38,7 +38,21 @@ static unsigned image_offset = 0;
 static int psx_skipbios;
 
 bool psx_cpu_overclock;
+bool psx_cpu_dynarec;
 bool psx_gte_subpixel_precision;
+bool psx_gpu_raster_thread;
+unsigned psx_gpu_raster_cores = 1;
+bool psx_mdec_thread;
+static bool psx_delta_states;
+// 0: raw save states, 1: zlib compressed, 2: also XOR filtered against a keyframe
+static unsigned psx_state_compression;
+// Frames emulated ahead of the one presented, to hide the games' own input lag
+static unsigned psx_run_ahead;
+static StateMem run_ahead_state;     // Snapshot taken by RunAhead()
+
+// Size of a full save state, 0 when it has to be measured again (it depends
+// on the game and the input devices, but not on the internal resolution).
+static size_t serialize_size;
 static bool is_pal;
 enum dither_mode psx_gpu_dither_mode;
 
@@ -108,6 +122,7 @@ static void extract_directory(char *buf, const char *path, size_t size)
 
 #include "mednafen/psx/psx.h"
 #include "mednafen/psx/mdec.h"
+#include "mednafen/psx/gte.h"
 #include "mednafen/psx/frontio.h"
 #include "mednafen/psx/timer.h"
 #include "mednafen/psx/sio.h"
@@ -207,6 +222,8 @@ static MultiAccessSizeMem<512 * 1024, uint32, false> *BIOSROM = NULL;
 static MultiAccessSizeMem<65536, uint32, false> *PIOMem = NULL;
 
 MultiAccessSizeMem<2048 * 1024, uint32, false> MainRAM;
+// 4KiB pages of MainRAM written since the last delta base state
+StateDirtyMap MainRAMDirty(2048 * 1024, 12);
 
 static uint32_t TextMem_Start;
 static std::vector<uint8> TextMem;
@@ -240,7 +257,7 @@ static struct
  };
 } SysControl;
 
-static unsigned DMACycleSteal = 0;   // Doesn't need to be saved in save states, since it's calculated in the ForceEventUpdates() call chain.
+unsigned DMACycleSteal = 0;   // Doesn't need to be saved in save states, since it's calculated in the ForceEventUpdates() call chain.
 
 void PSX_SetDMACycleSteal(unsigned stealage)
 {
@@ -256,104 +273,159 @@ void PSX_SetDMACycleSteal(unsigned stealage)
 
 static int32_t Running;	// Set to -1 when not desiring exit, and 0 when we are.
 
-struct event_list_entry
+// Pending events, in a binary min-heap ordered by event time. Every event
+// type is always in it, PSX_EVENT_MAXTS meaning "not scheduled".
+//
+// Events due at the same time are handled in the order the sorted list this
+// replaced kept them in: an event moved to an earlier time goes after the
+// others already due then, one moved to a later time goes before them. The
+// sequence numbers take care of that, and are renumbered in RebaseTS() so
+// they never wrap.
+struct event_entry
 {
- uint32_t which;
- int32_t event_time;
- event_list_entry *prev;
- event_list_entry *next;
+   int32_t event_time;
+   uint32_t seq;
 };
 
-static event_list_entry events[PSX_EVENT__COUNT];
+#define EVENT_SEQ_BASE 0x80000000U
 
-static void EventReset(void)
+static event_entry events[PSX_EVENT__COUNT];
+static PSX_EventHandlerFunc event_handlers[PSX_EVENT__COUNT];
+static uint8 event_heap[PSX_EVENT__COUNT];  // Event types, heap ordered
+static uint8 event_pos[PSX_EVENT__COUNT];   // Index of each type in event_heap
+static uint32_t event_seq_after;
+static uint32_t event_seq_before;
+static int32_t next_event_time;             // Of event_heap[0]
+
+void PSX_RegisterEvent(const int type, PSX_EventHandlerFunc handler)
 {
-   unsigned i;
-   for(i = 0; i < PSX_EVENT__COUNT; i++)
-   {
-      events[i].which = i;
+   event_handlers[type] = handler;
+}
 
-      if(i == PSX_EVENT__SYNFIRST)
-         events[i].event_time = 0;
-      else if(i == PSX_EVENT__SYNLAST)
-         events[i].event_time = 0x7FFFFFFF;
-      else
-         events[i].event_time = PSX_EVENT_MAXTS;
+static INLINE uint64_t EventKey(const unsigned type)
+{
+   return(((uint64_t)(uint32_t)events[type].event_time << 32) | events[type].seq);
+}
+
+static INLINE void EventSwap(const unsigned i, const unsigned j)
+{
+   const uint8 t = event_heap[i];
+
+   event_heap[i] = event_heap[j];
+   event_heap[j] = t;
+
+   event_pos[event_heap[i]] = i;
+   event_pos[event_heap[j]] = j;
+}
+
+static INLINE void EventSiftUp(unsigned i)
+{
+   const uint64_t key = EventKey(event_heap[i]);
 
-      events[i].prev = (i > 0) ? &events[i - 1] : NULL;
-      events[i].next = (i < (PSX_EVENT__COUNT - 1)) ? &events[i + 1] : NULL;
+   while(i > 0 && key < EventKey(event_heap[(i - 1) >> 1]))
+   {
+      EventSwap(i, (i - 1) >> 1);
+      i = (i - 1) >> 1;
    }
 }
 
-//static void RemoveEvent(event_list_entry *e)
-//{
-// e->prev->next = e->next;
-// e->next->prev = e->prev;
-//}
+static INLINE void EventSiftDown(unsigned i)
+{
+   const uint64_t key = EventKey(event_heap[i]);
 
-static void RebaseTS(const int32_t timestamp)
+   for(;;)
+   {
+      const unsigned l = (i << 1) + 1;
+      const unsigned r = l + 1;
+      unsigned first;
+      uint64_t first_key;
+
+      if(l >= PSX_EVENT__COUNT)
+         break;
+
+      first     = l;
+      first_key = EventKey(event_heap[l]);
+
+      if(r < PSX_EVENT__COUNT && EventKey(event_heap[r]) < first_key)
+      {
+         first     = r;
+         first_key = EventKey(event_heap[r]);
+      }
+
+      if(key < first_key)
+         break;
+
+      EventSwap(i, first);
+      i = first;
+   }
+}
+
+static void EventReset(void)
 {
    unsigned i;
    for(i = 0; i < PSX_EVENT__COUNT; i++)
    {
-      if(i == PSX_EVENT__SYNFIRST || i == PSX_EVENT__SYNLAST)
-         continue;
+      events[i].event_time = PSX_EVENT_MAXTS;
+      events[i].seq        = EVENT_SEQ_BASE + i;
+      event_heap[i]        = i;
+      event_pos[i]         = i;
+   }
+
+   event_seq_after  = EVENT_SEQ_BASE + PSX_EVENT__COUNT;
+   event_seq_before = EVENT_SEQ_BASE - 1;
+   next_event_time  = PSX_EVENT_MAXTS;
+}
 
+static void RebaseTS(const int32_t timestamp)
+{
+   uint32_t rank[PSX_EVENT__COUNT];
+   unsigned i, j;
+
+   for(i = 0; i < PSX_EVENT__COUNT; i++)
+   {
       assert(events[i].event_time > timestamp);
       events[i].event_time -= timestamp;
    }
 
-   CPU->SetEventNT(events[PSX_EVENT__SYNFIRST].next->event_time);
+   // Renumber by overall order, which leaves the heap as it is.
+   for(i = 0; i < PSX_EVENT__COUNT; i++)
+   {
+      rank[i] = 0;
+      for(j = 0; j < PSX_EVENT__COUNT; j++)
+         rank[i] += (EventKey(j) < EventKey(i));
+   }
+
+   for(i = 0; i < PSX_EVENT__COUNT; i++)
+      events[i].seq = EVENT_SEQ_BASE + rank[i];
+
+   event_seq_after  = EVENT_SEQ_BASE + PSX_EVENT__COUNT;
+   event_seq_before = EVENT_SEQ_BASE - 1;
+
+   next_event_time = events[event_heap[0]].event_time;
+
+   CPU->SetEventNT(next_event_time);
 }
 
 void PSX_SetEventNT(const int type, const int32_t next_timestamp)
 {
-   event_list_entry *e = &events[type];
+   event_entry *e = &events[type];
 
    if(next_timestamp < e->event_time)
    {
-      event_list_entry *fe = e;
-
-      do
-      {
-         fe = fe->prev;
-      }while(next_timestamp < fe->event_time);
-
-      // Remove this event from the list, temporarily of course.
-      e->prev->next = e->next;
-      e->next->prev = e->prev;
-
-      // Insert into the list, just after "fe".
-      e->prev = fe;
-      e->next = fe->next;
-      fe->next->prev = e;
-      fe->next = e;
-
       e->event_time = next_timestamp;
+      e->seq        = event_seq_after++;
+      EventSiftUp(event_pos[type]);
    }
    else if(next_timestamp > e->event_time)
    {
-      event_list_entry *fe = e;
-
-      do
-      {
-         fe = fe->next;
-      } while(next_timestamp > fe->event_time);
-
-      // Remove this event from the list, temporarily of course
-      e->prev->next = e->next;
-      e->next->prev = e->prev;
-
-      // Insert into the list, just BEFORE "fe".
-      e->prev = fe->prev;
-      e->next = fe;
-      fe->prev->next = e;
-      fe->prev = e;
-
       e->event_time = next_timestamp;
+      e->seq        = event_seq_before--;
+      EventSiftDown(event_pos[type]);
    }
 
-   CPU->SetEventNT(events[PSX_EVENT__SYNFIRST].next->event_time & Running);
+   next_event_time = events[event_heap[0]].event_time;
+
+   CPU->SetEventNT(next_event_time & Running);
 }
 
 // Called from debug.cpp too.
@@ -368,48 +440,36 @@ void ForceEventUpdates(const int32_t timestamp)
 
    PSX_SetEventNT(PSX_EVENT_FIO, FIO->Update(timestamp));
 
-   CPU->SetEventNT(events[PSX_EVENT__SYNFIRST].next->event_time);
+   CPU->SetEventNT(next_event_time);
 }
 
 bool MDFN_FASTCALL PSX_EventHandler(const int32_t timestamp)
 {
-   event_list_entry *e = events[PSX_EVENT__SYNFIRST].next;
-
-   while(timestamp >= e->event_time)	// If Running = 0, PSX_EventHandler() may be called even if there isn't an event per-se, so while() instead of do { ... } while
+   while(timestamp >= next_event_time)	// If Running = 0, PSX_EventHandler() may be called even if there isn't an event per-se, so while() instead of do { ... } while
    {
-      int32_t nt;
-      event_list_entry *prev = e->prev;
-
-      switch(e->which)
-      {
-         default:
-            abort();
-         case PSX_EVENT_GPU:
-            nt = GPU->Update(e->event_time);
-            break;
-         case PSX_EVENT_CDC:
-            nt = CDC->Update(e->event_time);
-            break;
-         case PSX_EVENT_TIMER:
-            nt = TIMER_Update(e->event_time);
-            break;
-         case PSX_EVENT_DMA:
-            nt = DMA_Update(e->event_time);
-            break;
-         case PSX_EVENT_FIO:
-            nt = FIO->Update(e->event_time);
-            break;
-      }
+      const unsigned type = event_heap[0];
 
-      PSX_SetEventNT(e->which, nt);
-
-      // Order of events can change due to calling PSX_SetEventNT(), this prev business ensures we don't miss an event due to reordering.
-      e = prev->next;
+      PSX_SetEventNT(type, event_handlers[type](events[type].event_time));
    }
 
    return(Running);
 }
 
+static int32_t GPU_EventUpdate(const int32_t timestamp)
+{
+   return GPU->Update(timestamp);
+}
+
+static int32_t CDC_EventUpdate(const int32_t timestamp)
+{
+   return CDC->Update(timestamp);
+}
+
+static int32_t FIO_EventUpdate(const int32_t timestamp)
+{
+   return FIO->Update(timestamp);
+}
+
 
 void PSX_RequestMLExit(void)
 {
@@ -423,7 +483,49 @@ void PSX_RequestMLExit(void)
 //
 
 
+// Devices of the 0x1F801000-0x1F802FFF I/O range, looked up by MemRW() in
+// IOMap, per 4-byte register.
+enum
+{
+   IO_NONE = 0,
+   IO_SYSCONTROL,
+   IO_FIO,
+   IO_SIO,
+   IO_IRQ,
+   IO_DMA,
+   IO_TIMER,
+   IO_CDC,
+   IO_GPU,
+   IO_MDEC,
+   IO_SPU
+};
+
+static uint8 IOMap[0x2000 >> 2];
+
+static void MapIO(uint32_t start, uint32_t end, uint8 device)
+{
+   for(uint32_t A = start; A <= end; A += 4)
+      IOMap[(A - 0x1F801000) >> 2] = device;
+}
+
+static void InitIOMap(void)
+{
+   memset(IOMap, IO_NONE, sizeof(IOMap));
+
+   MapIO(0x1F801000, 0x1F801023, IO_SYSCONTROL);
+   MapIO(0x1F801040, 0x1F80104F, IO_FIO);
+   MapIO(0x1F801050, 0x1F80105F, IO_SIO);
+   MapIO(0x1F801070, 0x1F801077, IO_IRQ);
+   MapIO(0x1F801080, 0x1F8010FF, IO_DMA);
+   MapIO(0x1F801100, 0x1F80113F, IO_TIMER);
+   MapIO(0x1F801800, 0x1F80180F, IO_CDC);
+   MapIO(0x1F801810, 0x1F801817, IO_GPU);
+   MapIO(0x1F801820, 0x1F801827, IO_MDEC);
+   MapIO(0x1F801C00, 0x1F801FFF, IO_SPU);
+}
+
 /* Remember to update MemPeek<>() and MemPoke<>() when we change address decoding in MemRW() */
+/* ... and the CPU's data maps (see InitCommon()) */
 template<typename T, bool IsWrite, bool Access24> static INLINE void MemRW(int32_t &timestamp, uint32_t A, uint32_t &V)
 {
 #if 0
@@ -452,6 +554,9 @@ template<typename T, bool IsWrite, bool Access24> static INLINE void MemRW(int32
             timestamp += 3;
       }
 
+      if(IsWrite)
+         MainRAMDirty.Mark(A & 0x1FFFFF);
+
       if(Access24)
       {
          if(IsWrite)
@@ -483,7 +588,7 @@ template<typename T, bool IsWrite, bool Access24> static INLINE void MemRW(int32
       return;
    }
 
-   if(timestamp >= events[PSX_EVENT__SYNFIRST].next->event_time)
+   if(timestamp >= next_event_time)
       PSX_EventHandler(timestamp);
 
    if(A >= 0x1F801000 && A <= 0x1F802FFF)
@@ -494,207 +599,213 @@ template<typename T, bool IsWrite, bool Access24> static INLINE void MemRW(int32
       //else
       // printf("HW Read%d: %08x\n", (unsigned int)(sizeof(T)*8), (unsigned int)A);
 
-      if(A >= 0x1F801C00 && A <= 0x1F801FFF) // SPU
+      switch(IOMap[(A - 0x1F801000) >> 2])
       {
-         if(sizeof(T) == 4 && !Access24)
+         case IO_SPU:
          {
-            if(IsWrite)
+            if(sizeof(T) == 4 && !Access24)
             {
-               //timestamp += 15;
+               if(IsWrite)
+               {
+                  //timestamp += 15;
 
-               //if(timestamp >= events[PSX_EVENT__SYNFIRST].next->event_time)
-               // PSX_EventHandler(timestamp);
+                  //if(timestamp >= next_event_time)
+                  // PSX_EventHandler(timestamp);
 
-               SPU->Write(timestamp, A | 0, V);
-               SPU->Write(timestamp, A | 2, V >> 16);
-            }
-            else
-            {
-               timestamp += 36;
+                  SPU->Write(timestamp, A | 0, V);
+                  SPU->Write(timestamp, A | 2, V >> 16);
+               }
+               else
+               {
+                  timestamp += 36;
 
-               if(timestamp >= events[PSX_EVENT__SYNFIRST].next->event_time)
-                  PSX_EventHandler(timestamp);
+                  if(timestamp >= next_event_time)
+                     PSX_EventHandler(timestamp);
 
-               V = SPU->Read(timestamp, A) | (SPU->Read(timestamp, A | 2) << 16);
+                  V = SPU->Read(timestamp, A) | (SPU->Read(timestamp, A | 2) << 16);
+               }
             }
-         }
-         else
-         {
-            if(IsWrite)
+            else
             {
-               //timestamp += 8;
+               if(IsWrite)
+               {
+                  //timestamp += 8;
 
-               //if(timestamp >= events[PSX_EVENT__SYNFIRST].next->event_time)
-               // PSX_EventHandler(timestamp);
+                  //if(timestamp >= next_event_time)
+                  // PSX_EventHandler(timestamp);
 
-               SPU->Write(timestamp, A & ~1, V);
-            }
-            else
-            {
-               timestamp += 16; // Just a guess, need to test.
+                  SPU->Write(timestamp, A & ~1, V);
+               }
+               else
+               {
+                  timestamp += 16; // Just a guess, need to test.
 
-               if(timestamp >= events[PSX_EVENT__SYNFIRST].next->event_time)
-                  PSX_EventHandler(timestamp);
+                  if(timestamp >= next_event_time)
+                     PSX_EventHandler(timestamp);
 
-               V = SPU->Read(timestamp, A & ~1);
+                  V = SPU->Read(timestamp, A & ~1);
+               }
             }
-         }
-         return;
-      }		// End SPU
+            return;
+         }		// End SPU
 
 
-      // CDC: TODO - 8-bit access.
-      if(A >= 0x1f801800 && A <= 0x1f80180F)
-      {
-         if(!IsWrite)
+         // CDC: TODO - 8-bit access.
+         case IO_CDC:
          {
-            timestamp += 6 * sizeof(T); //24;
-         }
+            if(!IsWrite)
+            {
+               timestamp += 6 * sizeof(T); //24;
+            }
 
-         if(IsWrite)
-            CDC->Write(timestamp, A & 0x3, V);
-         else
-            V = CDC->Read(timestamp, A & 0x3);
+            if(IsWrite)
+               CDC->Write(timestamp, A & 0x3, V);
+            else
+               V = CDC->Read(timestamp, A & 0x3);
 
-         return;
-      }
+            return;
+         }
 
-      if(A >= 0x1F801810 && A <= 0x1F801817)
-      {
-         if(!IsWrite)
-            timestamp++;
+         case IO_GPU:
+         {
+            if(!IsWrite)
+               timestamp++;
 
-         if(IsWrite)
-            GPU->Write(timestamp, A, V);
-         else
-            V = GPU->Read(timestamp, A);
+            if(IsWrite)
+               GPU->Write(timestamp, A, V);
+            else
+               V = GPU->Read(timestamp, A);
 
-         return;
-      }
+            return;
+         }
 
-      if(A >= 0x1F801820 && A <= 0x1F801827)
-      {
-         if(!IsWrite)
-            timestamp++;
+         case IO_MDEC:
+         {
+            if(!IsWrite)
+               timestamp++;
 
-         if(IsWrite)
-            MDEC_Write(timestamp, A, V);
-         else
-            V = MDEC_Read(timestamp, A);
+            if(IsWrite)
+               MDEC_Write(timestamp, A, V);
+            else
+               V = MDEC_Read(timestamp, A);
 
-         return;
-      }
+            return;
+         }
 
-      if(A >= 0x1F801000 && A <= 0x1F801023)
-      {
-         unsigned index = (A & 0x1F) >> 2;
+         case IO_SYSCONTROL:
+         {
+            unsigned index = (A & 0x1F) >> 2;
 
-         if(!IsWrite)
-            timestamp++;
+            if(!IsWrite)
+               timestamp++;
 
-         //if(A == 0x1F801014 && IsWrite)
-         // fprintf(stderr, "%08x %08x\n",A,V);
+            //if(A == 0x1F801014 && IsWrite)
+            // fprintf(stderr, "%08x %08x\n",A,V);
 
-         if(IsWrite)
-         {
-            V <<= (A & 3) * 8;
-            SysControl.Regs[index] = V & SysControl_Mask[index];
-         }
-         else
-         {
-            V = SysControl.Regs[index] | SysControl_OR[index];
-            V >>= (A & 3) * 8;
+            if(IsWrite)
+            {
+               V <<= (A & 3) * 8;
+               SysControl.Regs[index] = V & SysControl_Mask[index];
+            }
+            else
+            {
+               V = SysControl.Regs[index] | SysControl_OR[index];
+               V >>= (A & 3) * 8;
+            }
+            return;
          }
-         return;
-      }
 
-      if(A >= 0x1F801040 && A <= 0x1F80104F)
-      {
-         if(!IsWrite)
-            timestamp++;
+         case IO_FIO:
+         {
+            if(!IsWrite)
+               timestamp++;
 
-         if(IsWrite)
-            FIO->Write(timestamp, A, V);
-         else
-            V = FIO->Read(timestamp, A);
-         return;
-      }
+            if(IsWrite)
+               FIO->Write(timestamp, A, V);
+            else
+               V = FIO->Read(timestamp, A);
+            return;
+         }
 
-      if(A >= 0x1F801050 && A <= 0x1F80105F)
-      {
-         if(!IsWrite)
-            timestamp++;
+         case IO_SIO:
+         {
+            if(!IsWrite)
+               timestamp++;
 
 #if 0
-         if(IsWrite)
-         {
-            PSX_WARNING("[SIO] Write: 0x%08x 0x%08x %u", A, V, (unsigned)sizeof(T));
-         }
-         else
-         {
-            PSX_WARNING("[SIO] Read: 0x%08x", A);
-         }
+            if(IsWrite)
+            {
+               PSX_WARNING("[SIO] Write: 0x%08x 0x%08x %u", A, V, (unsigned)sizeof(T));
+            }
+            else
+            {
+               PSX_WARNING("[SIO] Read: 0x%08x", A);
+            }
 #endif
 
-         if(IsWrite)
-            SIO_Write(timestamp, A, V);
-         else
-            V = SIO_Read(timestamp, A);
-         return;
-      }
+            if(IsWrite)
+               SIO_Write(timestamp, A, V);
+            else
+               V = SIO_Read(timestamp, A);
+            return;
+         }
 
 #if 0
-      if(A >= 0x1F801060 && A <= 0x1F801063)
-      {
-         if(IsWrite)
+         if(A >= 0x1F801060 && A <= 0x1F801063)
          {
+            if(IsWrite)
+            {
 
-         }
-         else
-         {
+            }
+            else
+            {
 
-         }
+            }
 
-         return;
-      }
+            return;
+         }
 #endif
 
-      if(A >= 0x1F801070 && A <= 0x1F801077)	// IRQ
-      {
-         if(!IsWrite)
-            timestamp++;
+         case IO_IRQ:
+         {
+            if(!IsWrite)
+               timestamp++;
 
-         if(IsWrite)
-            ::IRQ_Write(A, V);
-         else
-            V = ::IRQ_Read(A);
-         return;
-      }
+            if(IsWrite)
+               ::IRQ_Write(A, V);
+            else
+               V = ::IRQ_Read(A);
+            return;
+         }
 
-      if(A >= 0x1F801080 && A <= 0x1F8010FF) 	// DMA
-      {
-         if(!IsWrite)
-            timestamp++;
+         case IO_DMA:
+         {
+            if(!IsWrite)
+               timestamp++;
 
-         if(IsWrite)
-            DMA_Write(timestamp, A, V);
-         else
-            V = DMA_Read(timestamp, A);
+            if(IsWrite)
+               DMA_Write(timestamp, A, V);
+            else
+               V = DMA_Read(timestamp, A);
 
-         return;
-      }
+            return;
+         }
 
-      if(A >= 0x1F801100 && A <= 0x1F80113F)	// Root counters
-      {
-         if(!IsWrite)
-            timestamp++;
+         case IO_TIMER:
+         {
+            if(!IsWrite)
+               timestamp++;
 
-         if(IsWrite)
-            TIMER_Write(timestamp, A, V);
-         else
-            V = TIMER_Read(timestamp, A);
+            if(IsWrite)
+               TIMER_Write(timestamp, A, V);
+            else
+               V = TIMER_Read(timestamp, A);
 
-         return;
+            return;
+         }
+
+         default:
+            break;
       }
    }
 
@@ -954,6 +1065,7 @@ static void PSX_Power(void)
    PSX_PRNG.lcgo = 0xDEADBEEFCAFEBABEULL;
 
    memset(MainRAM.data32, 0, 2048 * 1024);
+   MainRAMDirty.MarkAll();
 
    for(i = 0; i < 9; i++)
       SysControl.Regs[i] = 0;
@@ -982,6 +1094,8 @@ template<typename T, bool Access24> static INLINE void MemPoke(pscpu_timestamp_t
 {
    if(A < 0x00800000)
    {
+      MainRAMDirty.Mark(A & 0x1FFFFF);
+
       if(Access24)
          MainRAM.WriteU24(A & 0x1FFFFF, V);
       else
@@ -1034,6 +1148,11 @@ void PSX_MemPoke32(uint32 A, uint32 V)
 
 void PSX_GPULineHook(const int32_t timestamp, const int32_t line_timestamp, bool vsync, uint32_t *pixels, const MDFN_PixelFormat* const format, const unsigned width, const unsigned pix_clock_offset, const unsigned pix_clock, const unsigned pix_clock_divider)
 {
+   // Light guns sample the line being output, which may still be
+   // queued on the raster thread.
+   if(pixels && FIO->RequireNoFrameskip())
+      GPU->SyncRasterThread();
+
    FIO->GPULineHook(timestamp, line_timestamp, vsync, pixels, format, width, pix_clock_offset, pix_clock, pix_clock_divider);
 }
 
@@ -1297,6 +1416,22 @@ static unsigned CalcDiscSCEx(void)
    return ret_region;
 }
 
+// Keep the selected disc's reader open, and close down the others(a no-op
+// for discs that weren't opened lazily).
+static void CD_UpdateActiveDisc(void)
+{
+   if(!cdifs)
+      return;
+
+   for(unsigned disc = 0; disc < cdifs->size(); disc++)
+   {
+      if(!(*cdifs)[disc])
+         continue;
+
+      (*cdifs)[disc]->SetActive((int)disc == (CD_IsPBP ? 0 : CD_SelectedDisc));
+   }
+}
+
 static void InitCommon(std::vector<CDIF *> *CDInterfaces, const bool EmulateMemcards = true, const bool WantPIOMem = false)
 {
    unsigned region, i;
@@ -1368,6 +1503,8 @@ static void InitCommon(std::vector<CDIF *> *CDInterfaces, const bool EmulateMemc
    }
 
    GPU->EnableSubpixelVertexCache(psx_gte_subpixel_precision);
+   GPU->EnableRasterThread(psx_gpu_raster_thread, psx_gpu_raster_cores);
+   MDEC_EnableDecodeThread(psx_mdec_thread);
 
    CD_TrayOpen        = true;
    CD_SelectedDisc    = -1;
@@ -1378,6 +1515,8 @@ static void InitCommon(std::vector<CDIF *> *CDInterfaces, const bool EmulateMemc
       CD_SelectedDisc = 0;
    }
 
+   CD_UpdateActiveDisc();
+
    CDC->SetDisc(true, NULL, NULL);
    CDC->SetDisc(CD_TrayOpen, (CD_SelectedDisc >= 0 && !CD_TrayOpen) ? (*cdifs)[CD_SelectedDisc] : NULL,
          (CD_SelectedDisc >= 0 && !CD_TrayOpen) ? cdifs_scex_ids[CD_SelectedDisc] : NULL);
@@ -1396,9 +1535,23 @@ static void InitCommon(std::vector<CDIF *> *CDInterfaces, const bool EmulateMemc
       CPU->SetFastMap(MainRAM.data32, 0xA0000000 + ma, 2048 * 1024);
    }
 
-   CPU->SetFastMap(BIOSROM->data32, 0x1FC00000, 512 * 1024);
-   CPU->SetFastMap(BIOSROM->data32, 0x9FC00000, 512 * 1024);
-   CPU->SetFastMap(BIOSROM->data32, 0xBFC00000, 512 * 1024);
+   CPU->SetFastMap(BIOSROM->data32, 0x1FC00000, 512 * 1024);
+   CPU->SetFastMap(BIOSROM->data32, 0x9FC00000, 512 * 1024);
+   CPU->SetFastMap(BIOSROM->data32, 0xBFC00000, 512 * 1024);
+
+   // Loads and stores the CPU can do without MemRW(), keep in sync with it
+   for(uint32_t ma = 0x00000000; ma < 0x00800000; ma += 2048 * 1024)
+      CPU->SetDataMap(MainRAM.data32, ma, 2048 * 1024, true, 3);
+
+   CPU->SetDataMap(BIOSROM->data32, 0x1FC00000, 512 * 1024, false, 0);
+
+   InitIOMap();
+
+   PSX_RegisterEvent(PSX_EVENT_GPU, GPU_EventUpdate);
+   PSX_RegisterEvent(PSX_EVENT_CDC, CDC_EventUpdate);
+   PSX_RegisterEvent(PSX_EVENT_TIMER, TIMER_Update);
+   PSX_RegisterEvent(PSX_EVENT_DMA, DMA_Update);
+   PSX_RegisterEvent(PSX_EVENT_FIO, FIO_EventUpdate);
 
    if(PIOMem)
    {
@@ -1459,6 +1612,17 @@ static void InitCommon(std::vector<CDIF *> *CDInterfaces, const bool EmulateMemc
 #ifdef WANT_DEBUGGER
    DBG_Init();
 #endif
+
+#ifdef WANT_GTE_TRACE
+   {
+      const char *trace_path = MDFN_MakeFName(MDFNMKF_SAV, 0, "gtetrace");
+
+      if(GTE_TraceOpen(trace_path))
+         log_cb(RETRO_LOG_INFO, "Tracing GTE commands to %s\n", trace_path);
+      else
+         log_cb(RETRO_LOG_ERROR, "Could not open GTE trace file %s\n", trace_path);
+   }
+#endif
    PSX_Power();
 }
 
@@ -1666,6 +1830,12 @@ static void Cleanup(void)
      PS_GPU::Destroy(GPU);
    GPU = NULL;
 
+   MDEC_EnableDecodeThread(false);
+
+#ifdef WANT_GTE_TRACE
+   GTE_TraceClose();
+#endif
+
    if(CPU)
       delete CPU;
    CPU = NULL;
@@ -1724,6 +1894,7 @@ static void CloseGame(void)
 static void SetInput(int port, const char *type, void *ptr)
 {
    FIO->SetInput(port, type, ptr);
+   serialize_size = 0;
 }
 
 static int StateAction(StateMem *sm, int load, int data_only)
@@ -1739,7 +1910,7 @@ static int StateAction(StateMem *sm, int load, int data_only)
    {
       SFVAR(CD_TrayOpen),
       SFVAR(CD_SelectedDisc),
-      SFARRAY(MainRAM.data8, 1024 * 2048),
+      SFARRAYDIRTYN(MainRAM.data8, 1024 * 2048, "MainRAM.data8", MainRAMDirty),
       SFARRAY32(SysControl.Regs, 9),
       SFVAR(PSX_PRNG.lcgo),
       SFVAR(PSX_PRNG.x),
@@ -1758,6 +1929,8 @@ static int StateAction(StateMem *sm, int load, int data_only)
       if(!cdifs || CD_SelectedDisc >= (int)cdifs->size())
          CD_SelectedDisc = -1;
 
+      CD_UpdateActiveDisc();
+
       CDC->SetDisc(CD_TrayOpen, (CD_SelectedDisc >= 0 && !CD_TrayOpen) ? (*cdifs)[CD_SelectedDisc] : NULL,
             (CD_SelectedDisc >= 0 && !CD_TrayOpen) ? cdifs_scex_ids[CD_SelectedDisc] : NULL);
    }
@@ -1804,6 +1977,8 @@ static void CDInsertEject(void)
    else
       MDFN_DispMessage(_("Virtual CD Drive Tray Closed"));
 
+   CD_UpdateActiveDisc();
+
    if(CD_IsPBP)
    {
       // only allow one pbp file to be loaded (at index 0)
@@ -2333,15 +2508,17 @@ static bool disk_replace_image_index(unsigned index, const struct retro_game_inf
 
       // Poke into psx.cpp
       CalcDiscSCEx();
+      CD_UpdateActiveDisc();
       return true;
    }
 
    try
    {
-      CDIF *iface = CDIF_Open(info->path, false, false);
+      CDIF *iface = CDIF_OpenLazy(info->path, false);
       delete cdifs->at(index);
       cdifs->at(index) = iface;
       CalcDiscSCEx();
+      CD_UpdateActiveDisc();
 
       /* If we replace, we want the "swap disk manually effect". */
       extract_basename(retro_cd_base_name, info->path, sizeof(retro_cd_base_name));
@@ -2499,6 +2676,11 @@ static void check_variables(bool startup)
       }
    }
 
+   var.key = "beetle_psx_pbp_cache_size";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      setting_pbp_cache_blocks = atoi(var.value);
+
    var.key = "beetle_psx_cpu_overclock";
    
    if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
@@ -2510,6 +2692,18 @@ static void check_variables(bool startup)
    }
    else
       psx_cpu_overclock = false;
+
+   var.key = "beetle_psx_cpu_dynarec";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (strcmp(var.value, "enabled") == 0)
+         psx_cpu_dynarec = true;
+      else if (strcmp(var.value, "disabled") == 0)
+         psx_cpu_dynarec = false;
+   }
+   else
+      psx_cpu_dynarec = false;
    
    var.key = "beetle_psx_skipbios";
 
@@ -2595,6 +2789,81 @@ static void check_variables(bool startup)
    else
       psx_gte_subpixel_precision = false;
 
+   var.key = "beetle_psx_gpu_raster_thread";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (strcmp(var.value, "enabled") == 0)
+         psx_gpu_raster_thread = true;
+      else if (strcmp(var.value, "disabled") == 0)
+         psx_gpu_raster_thread = false;
+   }
+   else
+      psx_gpu_raster_thread = false;
+
+   var.key = "beetle_psx_gpu_raster_cores";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      psx_gpu_raster_cores = atoi(var.value);
+   else
+      psx_gpu_raster_cores = 1;
+
+   var.key = "beetle_psx_mdec_thread";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (strcmp(var.value, "enabled") == 0)
+         psx_mdec_thread = true;
+      else if (strcmp(var.value, "disabled") == 0)
+         psx_mdec_thread = false;
+   }
+   else
+      psx_mdec_thread = false;
+
+   var.key = "beetle_psx_delta_states";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (strcmp(var.value, "enabled") == 0)
+         psx_delta_states = true;
+      else if (strcmp(var.value, "disabled") == 0)
+         psx_delta_states = false;
+   }
+   else
+      psx_delta_states = false;
+
+   var.key = "beetle_psx_state_compression";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      unsigned old_compression = psx_state_compression;
+
+      if (strcmp(var.value, "xor") == 0)
+         psx_state_compression = 2;
+      else if (strcmp(var.value, "enabled") == 0)
+         psx_state_compression = 1;
+      else if (strcmp(var.value, "disabled") == 0)
+         psx_state_compression = 0;
+
+      /* compressed states have their own, larger size bound */
+      if (psx_state_compression != old_compression)
+         serialize_size = 0;
+   }
+   else
+      psx_state_compression = 0;
+
+   var.key = "beetle_psx_run_ahead";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (strcmp(var.value, "disabled") == 0)
+         psx_run_ahead = 0;
+      else
+         psx_run_ahead = atoi(var.value);
+   }
+   else
+      psx_run_ahead = 0;
+
    var.key = "beetle_psx_analog_toggle";
 
    if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
@@ -2836,9 +3105,11 @@ MDFNGI *MDFNI_LoadCD(const char *force_module, const char *devicename)
 
    ReadM3U(file_list, devicename);
 
+   // Only the disc in the drive gets a reader thread/image cache, see
+   // CD_UpdateActiveDisc().
    for(unsigned i = 0; i < file_list.size(); i++)
    {
-    CDInterfaces.push_back(CDIF_Open(file_list[i].c_str(), false, old_cdimagecache));
+    CDInterfaces.push_back(CDIF_OpenLazy(file_list[i].c_str(), old_cdimagecache));
    }
   }
   else if(devicename && strlen(devicename) > 4 && !strcasecmp(devicename + strlen(devicename) - 4, ".pbp"))
@@ -2938,7 +3209,7 @@ static MDFNGI *MDFNI_LoadGame(const char *force_module, const char *name)
    MDFNFILE *GameFile;
 
 #ifdef NEED_CD
-	if(strlen(name) > 4 && (!strcasecmp(name + strlen(name) - 4, ".cue") || !strcasecmp(name + strlen(name) - 4, ".ccd") || !strcasecmp(name + strlen(name) - 4, ".toc") || !strcasecmp(name + strlen(name) - 4, ".m3u") || !strcasecmp(name + strlen(name) - 4, ".pbp")))
+	if(strlen(name) > 4 && (!strcasecmp(name + strlen(name) - 4, ".cue") || !strcasecmp(name + strlen(name) - 4, ".ccd") || !strcasecmp(name + strlen(name) - 4, ".toc") || !strcasecmp(name + strlen(name) - 4, ".m3u") || !strcasecmp(name + strlen(name) - 4, ".pbp") || !strcasecmp(name + strlen(name) - 4, ".chd")))
 	 return(MDFNI_LoadCD(force_module, name));
 #endif
 
@@ -2996,6 +3267,8 @@ bool retro_load_game(const struct retro_game_info *info)
    if (failed_init)
       return false;
 
+   serialize_size = 0;
+
    struct retro_input_descriptor desc[] = {
       { 0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_LEFT,  "D-Pad Left" },
       { 0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_UP,    "D-Pad Up" },
@@ -3254,6 +3527,11 @@ void retro_unload_game(void)
    CDInterfaces.clear();
 #endif
 
+   free(run_ahead_state.data);
+   memset(&run_ahead_state, 0, sizeof(run_ahead_state));
+
+   MDFNSS_CloseCompression();
+
    retro_cd_base_directory[0] = '\0';
    retro_cd_path[0]           = '\0';
    retro_cd_base_name[0]      = '\0';
@@ -3365,6 +3643,145 @@ static void update_input(void)
 static uint64_t video_frames, audio_frames;
 #define SOUND_CHANNELS 2
 
+// Runs the emulation for one frame, returns its length in CPU cycles.
+static int32_t EmulateFrame(EmulateSpecStruct *espec)
+{
+   int32_t timestamp = 0;
+
+   MDFNGameInfo->mouse_sensitivity = MDFN_GetSettingF("psx.input.mouse_sensitivity");
+
+   // Cheats poke MainRAM behind the dirty tracking's back, from then on delta
+   // states compare it against the base instead
+   if(MDFNMP_ApplyPeriodicCheats())
+      MainRAMDirty.untracked = MainRAM.data8;
+
+
+   espec->MasterCycles = 0;
+   espec->SoundBufSize = 0;
+
+   FIO->UpdateInput();
+   GPU->StartFrame(espec);
+
+   Running = -1;
+   timestamp = CPU->Run(timestamp);
+
+   assert(timestamp);
+
+   ForceEventUpdates(timestamp);
+
+   // The frontend is about to look at the framebuffer.
+   GPU->SyncRasterThread();
+
+   if(GPU->GetScanlineNum() < 100)
+      PSX_DBG(PSX_DBG_ERROR, "[BUUUUUUUG] Frame timing end glitch; scanline=%u, st=%u\n", GPU->GetScanlineNum(), timestamp);
+
+   //printf("scanline=%u, st=%u\n", GPU->GetScanlineNum(), timestamp);
+
+   espec->SoundBufSize = IntermediateBufferPos;
+   IntermediateBufferPos = 0;
+
+   CDC->ResetTS();
+   TIMER_ResetTS();
+   DMA_ResetTS();
+   GPU->ResetTS();
+   FIO->ResetTS();
+
+   RebaseTS(timestamp);
+
+   espec->MasterCycles = timestamp;
+
+   return timestamp;
+}
+
+// Called after each frame that really happened (see RunAhead()).
+static void SaveDirtyMemcards(const int32_t timestamp)
+{
+   for(int i = 0; i < players; i++)
+   {
+      uint64_t new_dc = FIO->GetMemcardDirtyCount(i);
+
+      if(new_dc > Memcard_PrevDC[i])
+      {
+         Memcard_PrevDC[i] = new_dc;
+         Memcard_SaveDelay[i] = 0;
+      }
+
+      if(Memcard_SaveDelay[i] >= 0)
+      {
+         Memcard_SaveDelay[i] += timestamp;
+         if(Memcard_SaveDelay[i] >= (33868800 * 2))   // Wait until about 2 seconds of no new writes.
+         {
+            char ext[64];
+            const char *memcard = NULL;
+
+            log_cb(RETRO_LOG_INFO, "Saving memcard %d...\n", i);
+
+            if (i == 0 && !use_mednafen_memcard0_method)
+            {
+               FIO->SaveMemcard(i);
+               Memcard_SaveDelay[i] = -1;
+               Memcard_PrevDC[i] = 0;
+               continue;
+            }
+
+            snprintf(ext, sizeof(ext), "%d.mcr", i);
+            memcard = MDFN_MakeFName(MDFNMKF_SAV, 0, ext);
+            FIO->SaveMemcard(i, memcard);
+            Memcard_SaveDelay[i] = -1;
+            Memcard_PrevDC[i] = 0;
+         }
+      }
+   }
+}
+
+// Run-ahead presents the frame psx_run_ahead frames after the real one, so
+// input shows up on screen that much sooner. Each call emulates the next real
+// frame, whose sound is output, takes a snapshot, then emulates the speculative frames up to the
+// one that is presented and goes back to the snapshot. Speculative sound is
+// dropped and, unless a light gun needs the picture, so is the scanout of
+// all but the presented frame.
+//
+// Snapshots are delta states (see MDFNSS_SaveDeltaSM()), so they mostly
+// consist of the RAM/VRAM pages written to since the base state, and
+// restoring one only copies those back. They have a delta context of their
+// own, so they don't disturb the frontend's delta states.
+static void RunAhead(EmulateSpecStruct *espec)
+{
+   unsigned i;
+   int16_t *interbuf = (int16_t*)&IntermediateBuffer;
+
+   espec->skip = !FIO->RequireNoFrameskip();
+   SaveDirtyMemcards(EmulateFrame(espec));
+
+   audio_frames += espec->SoundBufSize;
+   audio_batch_cb(interbuf, espec->SoundBufSize);
+   espec->SoundBufSize = 0;
+
+   /* the slot grows to fit the first snapshots, then stays allocated */
+   run_ahead_state.loc = 0;
+   run_ahead_state.len = 0;
+
+   if (!MDFNSS_SaveDeltaSM(&run_ahead_state, MDFNSS_CONTEXT_RUNAHEAD))
+   {
+      log_cb(RETRO_LOG_ERROR, "Run-ahead snapshot failed, disabling run-ahead.\n");
+      psx_run_ahead = 0;
+      return;
+   }
+
+   for (i = 0; i < psx_run_ahead; i++)
+   {
+      espec->skip = (i + 1) < psx_run_ahead && !FIO->RequireNoFrameskip();
+      EmulateFrame(espec);
+   }
+
+   espec->SoundBufSize = 0;
+
+   run_ahead_state.loc = 0;
+
+   if (!MDFNSS_LoadSM(&run_ahead_state, 0, 0))
+      log_cb(RETRO_LOG_ERROR, "Run-ahead snapshot could not be restored.\n");
+}
+
 void retro_run(void)
 {
    bool updated = false;
@@ -3412,6 +3829,8 @@ void retro_run(void)
         }
 
       GPU->EnableSubpixelVertexCache(psx_gte_subpixel_precision);
+      GPU->EnableRasterThread(psx_gpu_raster_thread, psx_gpu_raster_cores);
+      MDEC_EnableDecodeThread(psx_mdec_thread);
    }
 
    if (display_internal_framerate)
@@ -3466,86 +3885,14 @@ void retro_run(void)
    spec.VideoFormatChanged = false;
    spec.SoundFormatChanged = false;
 
-   EmulateSpecStruct *espec = (EmulateSpecStruct*)&spec;
-   /* start of Emulate */
-   int32_t timestamp = 0;
-
-   espec->skip = false;
-   MDFNGameInfo->mouse_sensitivity = MDFN_GetSettingF("psx.input.mouse_sensitivity");
-
-   MDFNMP_ApplyPeriodicCheats();
-
-
-   espec->MasterCycles = 0;
-   espec->SoundBufSize = 0;
-
-   FIO->UpdateInput();
-   GPU->StartFrame(espec);
-
-   Running = -1;
-   timestamp = CPU->Run(timestamp);
-
-   assert(timestamp);
-
-   ForceEventUpdates(timestamp);
-   if(GPU->GetScanlineNum() < 100)
-      PSX_DBG(PSX_DBG_ERROR, "[BUUUUUUUG] Frame timing end glitch; scanline=%u, st=%u\n", GPU->GetScanlineNum(), timestamp);
-
-   //printf("scanline=%u, st=%u\n", GPU->GetScanlineNum(), timestamp);
-
-   espec->SoundBufSize = IntermediateBufferPos;
-   IntermediateBufferPos = 0;
-
-   CDC->ResetTS();
-   TIMER_ResetTS();
-   DMA_ResetTS();
-   GPU->ResetTS();
-   FIO->ResetTS();
-
-   RebaseTS(timestamp);
-
-   espec->MasterCycles = timestamp;
-
-   // Save memcards if dirty.
-   for(int i = 0; i < players; i++)
+   if (psx_run_ahead && rsx_intf_is_type() == RSX_SOFTWARE)
+      RunAhead(&spec);
+   else
    {
-      uint64_t new_dc = FIO->GetMemcardDirtyCount(i);
-
-      if(new_dc > Memcard_PrevDC[i])
-      {
-         Memcard_PrevDC[i] = new_dc;
-         Memcard_SaveDelay[i] = 0;
-      }
-
-      if(Memcard_SaveDelay[i] >= 0)
-      {
-         Memcard_SaveDelay[i] += timestamp;
-         if(Memcard_SaveDelay[i] >= (33868800 * 2))   // Wait until about 2 seconds of no new writes.
-         {
-            char ext[64];
-            const char *memcard = NULL;
-
-            log_cb(RETRO_LOG_INFO, "Saving memcard %d...\n", i);
-
-            if (i == 0 && !use_mednafen_memcard0_method)
-            {
-               FIO->SaveMemcard(i);
-               Memcard_SaveDelay[i] = -1;
-               Memcard_PrevDC[i] = 0;
-               continue;
-            }
-
-            snprintf(ext, sizeof(ext), "%d.mcr", i);
-            memcard = MDFN_MakeFName(MDFNMKF_SAV, 0, ext);
-            FIO->SaveMemcard(i, memcard);
-            Memcard_SaveDelay[i] = -1;
-            Memcard_PrevDC[i] = 0;
-         }
-      }
+      spec.skip = false;
+      SaveDirtyMemcards(EmulateFrame(&spec));
    }
 
-   /* end of Emulate */
-
    const void *fb        = NULL;
    unsigned width        = rects[0];
    unsigned height       = spec.DisplayRect.h;
@@ -3753,7 +4100,9 @@ void retro_set_environment(retro_environment_t cb)
    static const struct retro_variable vars[] = {
       { "beetle_psx_renderer", "Renderer (restart); " FIRST_RENDERER EXT_RENDERER },
       { "beetle_psx_cdimagecache", "CD Image Cache (restart); disabled|enabled" },
+      { "beetle_psx_pbp_cache_size", "PBP decompressed block cache (restart); 16|32|64|128|256|4|8" },
       { "beetle_psx_cpu_overclock", "CPU Overclock; disabled|enabled" },
+      { "beetle_psx_cpu_dynarec", "CPU Dynarec; disabled|enabled" },
       { "beetle_psx_skipbios", "Skip BIOS; disabled|enabled" },
       { "beetle_psx_widescreen_hack", "Widescreen mode hack; disabled|enabled" },
       { "beetle_psx_internal_resolution", "Internal GPU resolution; 1x(native)|2x|4x|8x" },
@@ -3763,6 +4112,12 @@ void retro_set_environment(retro_environment_t cb)
       { "beetle_psx_wireframe", "Wireframe mode; disabled|enabled" },
       { "beetle_psx_dither_mode", "Dithering pattern; 1x(native)|internal resolution|disabled" },
       { "beetle_psx_gte_subpixel", "GTE pixel accuracy; 1x(native)|subpixel" },
+      { "beetle_psx_gpu_raster_thread", "Threaded software rasterizer; disabled|enabled" },
+      { "beetle_psx_gpu_raster_cores", "Software rasterizer cores; 1|2|3|4|6|8" },
+      { "beetle_psx_mdec_thread", "Threaded MDEC decoding; disabled|enabled" },
+      { "beetle_psx_delta_states", "Delta save states (rewind/rollback only); disabled|enabled" },
+      { "beetle_psx_state_compression", "Compress save states (xor: rewind/rollback only); disabled|enabled|xor" },
+      { "beetle_psx_run_ahead", "Run-ahead frames (software renderer); disabled|1|2|3" },
       { "beetle_psx_use_mednafen_memcard0_method", "Memcard 0 method; libretro|mednafen" },
       { "beetle_psx_shared_memory_cards", "Shared memcards (restart); disabled|enabled" },
       { "beetle_psx_initial_scanline", "Initial scanline; 0|1|2|3|4|5|6|7|8|9|10|10|11|12|13|14|15|16|17|18|19|20|21|22|23|24|25|26|27|28|29|30|31|32|33|34|35|36|37|38|39|40" },
@@ -3829,41 +4184,56 @@ void retro_set_video_refresh(retro_video_refresh_t cb)
    rsx_intf_set_video_refresh(cb);
 }
 
-static size_t serialize_size;
-
 size_t retro_serialize_size(void)
 {
-   StateMem st;
-   memset(&st, 0, sizeof(st));
-
-   if (!MDFNSS_SaveSM(&st, 0, 0, NULL, NULL, NULL))
+   if (!serialize_size)
    {
-      return 0;
+      /* measure only, nothing gets stored */
+      StateMem st;
+      memset(&st, 0, sizeof(st));
+      st.fixed = true;
+
+      if (!MDFNSS_SaveSM(&st, 0, 0, NULL, NULL, NULL))
+         return 0;
+
+      serialize_size = st.len;
+
+      if (psx_state_compression)
+         serialize_size = MDFNSS_CompressedSize(serialize_size);
    }
 
-   free(st.data);
-   return serialize_size = st.len;
+   return serialize_size;
 }
 
 bool retro_serialize(void *data, size_t size)
 {
-   /* it seems that mednafen can realloc pointers sent to it?
-      since we don't know the disposition of void* data (is it safe to realloc?) we have to manage a new buffer here */
+   /* serialize straight into the frontend's buffer, which must not be realloc'd */
    StateMem st;
    memset(&st, 0, sizeof(st));
-   st.data     = (uint8_t*)malloc(size);
+   st.data     = (uint8_t*)data;
    st.malloced = size;
+   st.fixed    = true;
 
-   bool ret = MDFNSS_SaveSM(&st, 0, 0, NULL, NULL, NULL);
+   /* delta states only hold what changed since the last full (base) state,
+      they can't be loaded into another instance of the core */
+   bool ret;
+
+   if (psx_state_compression)
+      ret = MDFNSS_SaveCompressedSM(&st, psx_delta_states, psx_state_compression == 2);
+   else if (psx_delta_states)
+      ret = MDFNSS_SaveDeltaSM(&st, MDFNSS_CONTEXT_FRONTEND);
+   else
+      ret = MDFNSS_SaveSM(&st, 0, 0, NULL, NULL, NULL);
 
    /* there are still some errors with the save states, the size seems to change on some games for now just log when this happens */
-   if (st.len != size)
+   if (st.len != size && st.delta != MDFNSS_DELTA_PAGES && !psx_state_compression)
       log_cb(RETRO_LOG_WARN, "warning, save state size has changed\n");
 
-   memcpy(data,st.data,size);
-   free(st.data);
-return ret;
+   /* the end of the state didn't fit */
+   if (st.len > size)
+      ret = false;
 
+   return ret;
 }
 bool retro_unserialize(const void *data, size_t size)
 {
@@ -0,0 +1,177 @@
+/* Mednafen - Multi-system Emulator
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_MMAP
+
+#include "mednafen.h"
+#include "Stream.h"
+#include "MappedStream.h"
+
+#include <string.h>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+// How much is read in ahead of the current position; about 3 seconds
+// worth of sectors at 2x CD speed.
+#define MAPPED_WINDOW_SIZE (1024 * 1024)
+
+MappedStream::MappedStream(const char *path) : data(NULL), data_size(0), position(0), read_end(0), window_start(0), window_end(0)
+{
+   struct stat st;
+   int fd = open(path, O_RDONLY);
+
+   if (fd == -1)
+   {
+      ErrnoHolder ene(errno);
+
+      throw(MDFN_Error(ene.Errno(), "Error opening file:\n%s\n%s", path, ene.StrError()));
+   }
+
+   if (fstat(fd, &st) == -1 || st.st_size <= 0)
+   {
+      ErrnoHolder ene(errno);
+
+      ::close(fd);
+      throw(MDFN_Error(ene.Errno(), "Error mapping file:\n%s\n%s", path, ene.StrError()));
+   }
+
+   data_size = st.st_size;
+   data      = (uint8_t *)mmap(NULL, (size_t)data_size, PROT_READ, MAP_SHARED, fd, 0);
+
+   // The mapping keeps the file referenced on its own.
+   ::close(fd);
+
+   if (data == MAP_FAILED)
+   {
+      ErrnoHolder ene(errno);
+
+      data = NULL;
+      throw(MDFN_Error(ene.Errno(), "Error mapping file:\n%s\n%s", path, ene.StrError()));
+   }
+}
+
+MappedStream::~MappedStream()
+{
+   close();
+}
+
+uint64_t MappedStream::attributes(void)
+{
+   return (ATTRIBUTE_READABLE | ATTRIBUTE_SEEKABLE);
+}
+
+void MappedStream::advise(uint64_t pos)
+{
+   const uint64_t page_mask = (uint64_t)sysconf(_SC_PAGESIZE) - 1;
+
+   // Only streaming reads are worth reading ahead for, after a seek that
+   // waits until the next read follows on from this one.
+   if (pos != read_end)
+      return;
+
+   // Still well inside the last window.
+   if (pos >= window_start && pos + MAPPED_WINDOW_SIZE / 2 < window_end)
+      return;
+
+   window_start = pos & ~page_mask;
+   window_end   = std::min<uint64_t>(window_start + MAPPED_WINDOW_SIZE, data_size);
+
+   if (window_end > window_start)
+      madvise(data + window_start, (size_t)(window_end - window_start), MADV_WILLNEED);
+}
+
+void MappedStream::prefetch_all(void)
+{
+   if (!data)
+      return;
+
+   window_start = 0;
+   window_end   = data_size;
+
+   madvise(data, (size_t)data_size, MADV_WILLNEED);
+}
+
+uint64_t MappedStream::read(void *ptr, uint64_t count, bool error_on_eos)
+{
+   if (!data || position >= data_size)
+      return 0;
+
+   if (count > data_size - position)
+      count = data_size - position;
+
+   advise(position);
+
+   memcpy(ptr, data + position, (size_t)count);
+   position += count;
+   read_end  = position;
+
+   return count;
+}
+
+void MappedStream::write(const void *ptr, uint64_t count)
+{
+   throw MDFN_Error(ErrnoHolder(EBADF));
+}
+
+void MappedStream::seek(int64_t offset, int whence)
+{
+   int64_t new_position = 0;
+
+   switch(whence)
+   {
+      case SEEK_SET:
+         new_position = offset;
+         break;
+
+      case SEEK_CUR:
+         new_position = position + offset;
+         break;
+
+      case SEEK_END:
+         new_position = data_size + offset;
+         break;
+   }
+
+   if (new_position < 0)
+      throw MDFN_Error(ErrnoHolder(EINVAL));
+
+   position = new_position;
+}
+
+int64_t MappedStream::tell(void)
+{
+   return position;
+}
+
+int64_t MappedStream::size(void)
+{
+   return data_size;
+}
+
+void MappedStream::close(void)
+{
+   if (!data)
+      return;
+
+   munmap(data, (size_t)data_size);
+   data = NULL;
+}
+
+#endif
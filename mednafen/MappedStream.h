@@ -0,0 +1,60 @@
+/* Mednafen - Multi-system Emulator
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __MDFN_MAPPEDSTREAM_H
+#define __MDFN_MAPPEDSTREAM_H
+
+#include "Stream.h"
+
+// Read-only stream over a memory-mapped file(only built with HAVE_MMAP).
+//
+// Reads are copied straight out of the page cache, which is shared with any
+// other process(or core instance) that has the same file open, instead of
+// going through stdio buffers.  While reads follow on from each other, the
+// kernel is asked to read in the data just past them, a window at a time.
+class MappedStream : public Stream
+{
+   public:
+      MappedStream(const char *path);	// Throws MDFN_Error if the file can't be mapped.
+      virtual ~MappedStream();
+
+      virtual uint64_t attributes(void);
+
+      virtual uint64_t read(void *data, uint64_t count, bool error_on_eos = true);
+      virtual void write(const void *data, uint64_t count);
+      virtual void seek(int64_t offset, int whence);
+      virtual int64_t tell(void);
+      virtual int64_t size(void);
+      virtual void close(void);
+
+      // Asks for the whole file to be read in now, for when it would
+      // otherwise have been loaded into memory up front.
+      void prefetch_all(void);
+
+   private:
+      void advise(uint64_t pos);
+
+      uint8_t *data;
+      uint64_t data_size;
+      uint64_t position;
+      uint64_t read_end;	// Where the last read stopped
+
+      uint64_t window_start;	// Range last asked to be read in
+      uint64_t window_end;
+};
+
+#endif
@@ -29,6 +29,7 @@
 #include "CDAccess_Image.h"
 #include "CDAccess_CCD.h"
 #include "CDAccess_PBP.h"
+#include "CDAccess_CHD.h"
 
 CDAccess::CDAccess()
 {
@@ -48,6 +49,8 @@ CDAccess *cdaccess_open_image(const char *path, bool image_memcache)
   ret = new CDAccess_CCD(path, image_memcache);
  else if(strlen(path) >= 4 && !strcasecmp(path + strlen(path) - 4, ".pbp"))
   ret = new CDAccess_PBP(path, image_memcache);
+ else if(strlen(path) >= 4 && !strcasecmp(path + strlen(path) - 4, ".chd"))
+  ret = new CDAccess_CHD(path, image_memcache);
  else
   ret = new CDAccess_Image(path, image_memcache);
 
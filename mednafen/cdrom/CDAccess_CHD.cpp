@@ -0,0 +1,1959 @@
+/* Mednafen - Multi-system Emulator
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ Notes and TODO:
+
+	Only version 5 CHDs(chdman 0.146 and later) without a parent are supported.
+
+	Supported hunk codecs are "zlib", "lzma", "flac", "cdzl"(deflate for sector data and subcode), "cdlz"(LZMA for sector
+	data, deflate for subcode) and "cdfl"(FLAC for audio sectors, deflate for subcode); that covers what chdman uses for CDs.
+	Huffman("huff") and zstd hunks aren't supported.
+
+	Track layout metadata is read from CHT2 and CHTR entries; the old binary CHCD format isn't supported.
+*/
+
+#include <retro_stat.h>
+
+#include "../mednafen.h"
+
+#include <sys/types.h>
+
+#include <string.h>
+#include <errno.h>
+
+#include <algorithm>
+
+#include "../general.h"
+#include "../math_ops.h"
+#include "../FileStream.h"
+#include "../MemoryStream.h"
+#ifdef HAVE_MMAP
+#include "../MappedStream.h"
+#endif
+
+#include "CDAccess.h"
+#include "CDAccess_CHD.h"
+#include "CDUtility.h"
+
+#include "../../libretro.h"
+
+#include "zlib.h"
+
+extern retro_log_printf_t log_cb;
+
+enum
+{
+   CDRF_SUBM_NONE = 0,
+   CDRF_SUBM_RW = 1,
+   CDRF_SUBM_RW_RAW = 2
+};
+
+// Disk-image(rip) track/sector formats
+enum
+{
+   DI_FORMAT_AUDIO       = 0x00,
+   DI_FORMAT_MODE1       = 0x01,
+   DI_FORMAT_MODE1_RAW   = 0x02,
+   DI_FORMAT_MODE2       = 0x03,
+   DI_FORMAT_MODE2_FORM1 = 0x04,
+   DI_FORMAT_MODE2_FORM2 = 0x05,
+   DI_FORMAT_MODE2_RAW   = 0x06,
+   _DI_FORMAT_COUNT
+};
+
+// Track type names used in CHD metadata.  MODE2_FORM_MIX is stored the same
+// way as MODE2.
+static const char *DI_CHD_Strings[7] =
+{
+   "AUDIO",
+   "MODE1",
+   "MODE1_RAW",
+   "MODE2",
+   "MODE2_FORM1",
+   "MODE2_FORM2",
+   "MODE2_RAW"
+};
+
+#define CHD_MAKE_TAG(a, b, c, d) (((uint32)(a) << 24) | ((uint32)(b) << 16) | ((uint32)(c) << 8) | (uint32)(d))
+
+enum
+{
+   CHD_CODEC_NONE    = 0,
+   CHD_CODEC_ZLIB    = CHD_MAKE_TAG('z', 'l', 'i', 'b'),
+   CHD_CODEC_LZMA    = CHD_MAKE_TAG('l', 'z', 'm', 'a'),
+   CHD_CODEC_FLAC    = CHD_MAKE_TAG('f', 'l', 'a', 'c'),
+   CHD_CODEC_CD_ZLIB = CHD_MAKE_TAG('c', 'd', 'z', 'l'),
+   CHD_CODEC_CD_LZMA = CHD_MAKE_TAG('c', 'd', 'l', 'z'),
+   CHD_CODEC_CD_FLAC = CHD_MAKE_TAG('c', 'd', 'f', 'l')
+};
+
+#define CHD_METADATA_TRACK    CHD_MAKE_TAG('C', 'H', 'T', 'R')
+#define CHD_METADATA_TRACK2   CHD_MAKE_TAG('C', 'H', 'T', '2')
+
+// Map entry compression types, as stored in a version 5 map.
+enum
+{
+   COMPRESSION_TYPE_0 = 0,	// Codec #0 from the header
+   COMPRESSION_TYPE_1,
+   COMPRESSION_TYPE_2,
+   COMPRESSION_TYPE_3,
+   COMPRESSION_NONE,	// Stored as-is
+   COMPRESSION_SELF,	// Same as an earlier hunk
+   COMPRESSION_PARENT,	// Same as a hunk in the parent CHD
+
+   // Only used while decoding the map:
+   COMPRESSION_RLE_SMALL,
+   COMPRESSION_RLE_LARGE,
+   COMPRESSION_SELF_0,
+   COMPRESSION_SELF_1,
+   COMPRESSION_PARENT_SELF,
+   COMPRESSION_PARENT_0,
+   COMPRESSION_PARENT_1
+};
+
+enum
+{
+   CHD_V5_HEADER_SIZE  = 124,
+
+   CD_MAX_SECTOR_DATA  = 2352,
+   CD_MAX_SUBCODE_DATA = 96,
+   CD_FRAME_SIZE       = CD_MAX_SECTOR_DATA + CD_MAX_SUBCODE_DATA,
+   CD_TRACK_PADDING    = 4	// Each track's frames are padded to a multiple of this
+};
+
+static const uint8 cd_sync_header[12] = { 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00 };
+
+static INLINE uint64 de48msb(const uint8 *p)
+{
+   return ((uint64)MDFN_de16msb(p) << 32) | MDFN_de32msb(p + 2);
+}
+
+static INLINE uint64 de64msb(const uint8 *p)
+{
+   return ((uint64)MDFN_de32msb(p) << 32) | MDFN_de32msb(p + 4);
+}
+
+// CRC-16/CCITT, which CHD uses for the map and for each decompressed hunk.
+static uint16 crc16_table[256];
+
+static void crc16_init(void)
+{
+   for(unsigned i = 0; i < 256; i++)
+   {
+      uint16 crc = i << 8;
+
+      for(unsigned b = 0; b < 8; b++)
+         crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+
+      crc16_table[i] = crc;
+   }
+}
+
+static uint16 crc16(const uint8 *data, uint32 len)
+{
+   uint16 crc = 0xFFFF;
+
+   while(len--)
+      crc = (crc << 8) ^ crc16_table[(crc >> 8) ^ *data++];
+
+   return crc;
+}
+
+// MSB-first bit reader, for the compressed map and FLAC frames.  Reading
+// past the end returns zero bits; check overrun() afterwards.
+class CHD_BitReader
+{
+   public:
+
+      CHD_BitReader(const uint8 *data_, uint32 len_) : data(data_), len(len_), pos(0), buffer(0), bits(0)
+      {
+
+      }
+
+      INLINE uint32 peek(unsigned n)
+      {
+         if(bits < (int)n)
+            fill();
+
+         return (uint32)(buffer >> (64 - n));
+      }
+
+      INLINE void skip(unsigned n)
+      {
+         buffer <<= n;
+         bits -= n;
+      }
+
+      INLINE uint32 read(unsigned n)
+      {
+         uint32 ret;
+
+         if(!n)
+            return 0;
+
+         ret = peek(n);
+         skip(n);
+
+         return ret;
+      }
+
+      INLINE int32 read_signed(unsigned n)
+      {
+         if(!n)
+            return 0;
+
+         return (int32)(read(n) << (32 - n)) >> (32 - n);
+      }
+
+      // Counts zero bits up to and including the next one bit.
+      INLINE uint32 read_unary(void)
+      {
+         uint32 count = 0;
+
+         for(;;)
+         {
+            uint32 top;
+
+            if(bits < 32)
+               fill();
+
+            top = (uint32)(buffer >> 32);
+
+            if(top)
+            {
+               unsigned lz = MDFN_lzcount32(top);
+
+               buffer <<= lz + 1;
+               bits -= lz + 1;
+
+               return count + lz;
+            }
+
+            buffer <<= 32;
+            bits -= 32;
+            count += 32;
+
+            if(overrun())
+               return count;
+         }
+      }
+
+      INLINE void align(void)
+      {
+         buffer <<= bits & 7;
+         bits &= ~7;
+      }
+
+      // Bytes consumed so far(meaningful when aligned).
+      INLINE uint32 offset(void) const
+      {
+         return pos - bits / 8;
+      }
+
+      INLINE bool overrun(void) const
+      {
+         return offset() > len;
+      }
+
+   private:
+
+      INLINE void fill(void)
+      {
+         while(bits <= 56)
+         {
+            buffer |= (uint64)((pos < len) ? data[pos] : 0) << (56 - bits);
+            pos++;
+            bits += 8;
+         }
+      }
+
+      const uint8 *data;
+      uint32 len;
+      uint32 pos;
+      uint64 buffer;
+      int bits;
+};
+
+//
+// Per-thread decompression state.
+//
+struct CHD_Decoder
+{
+   CHD_Decoder()
+   {
+      memset(&inflater, 0, sizeof(inflater));
+
+      if(inflateInit2(&inflater, -MAX_WBITS) != Z_OK)
+         throw MDFN_Error(0, _("Error initializing zlib."));
+   }
+
+   ~CHD_Decoder()
+   {
+      inflateEnd(&inflater);
+   }
+
+   bool Inflate(const uint8 *src, uint32 src_len, uint8 *dest, uint32 dest_len);
+
+   bool LZMADecode(const uint8 *src, uint32 src_len, uint8 *dest, uint32 dest_len);
+
+   bool FLACDecode(const uint8 *src, uint32 src_len, uint8 *dest, uint32 samples, bool msb_first, uint32 *consumed);
+   bool FLACDecodeSubframe(CHD_BitReader &br, int32 *s, uint32 blocksize, unsigned bps);
+   bool FLACDecodeResidual(CHD_BitReader &br, int32 *res, uint32 blocksize, unsigned order);
+
+   z_stream inflater;
+
+   std::vector<uint8> compressed;
+   std::vector<uint8> buffer;	// Sector data and subcode, before being interleaved into frames
+   std::vector<int32> samples[2];
+   std::vector<uint16> lzma_probs;
+};
+
+bool CHD_Decoder::Inflate(const uint8 *src, uint32 src_len, uint8 *dest, uint32 dest_len)
+{
+   if(inflateReset(&inflater) != Z_OK)
+      return false;
+
+   inflater.next_in   = (Bytef *)src;
+   inflater.avail_in  = src_len;
+   inflater.next_out  = dest;
+   inflater.avail_out = dest_len;
+
+   inflate(&inflater, Z_FINISH);
+
+   return inflater.total_out == dest_len;
+}
+
+//
+// FLAC, just what CHD needs: a run of frames with no stream header in front,
+// 16 bits per sample, one or two channels.
+//
+bool CHD_Decoder::FLACDecodeResidual(CHD_BitReader &br, int32 *res, uint32 blocksize, unsigned order)
+{
+   const unsigned method = br.read(2);
+   unsigned param_bits, escape, partition_order, partitions;
+
+   if(method > 1)
+      return false;
+
+   param_bits      = method ? 5 : 4;
+   escape          = method ? 31 : 15;
+   partition_order = br.read(4);
+   partitions      = 1 << partition_order;
+
+   if((blocksize & (partitions - 1)) || (blocksize >> partition_order) < order)
+      return false;
+
+   for(unsigned p = 0; p < partitions; p++)
+   {
+      uint32 count = (blocksize >> partition_order) - (p ? 0 : order);
+      unsigned k = br.read(param_bits);
+
+      if(k == escape)
+      {
+         unsigned raw_bits = br.read(5);
+
+         while(count--)
+            *res++ = br.read_signed(raw_bits);
+      }
+      else
+      {
+         while(count--)
+         {
+            uint32 u = (br.read_unary() << k) | br.read(k);
+
+            *res++ = (int32)(u >> 1) ^ -(int32)(u & 1);
+         }
+      }
+
+      if(br.overrun())
+         return false;
+   }
+
+   return true;
+}
+
+bool CHD_Decoder::FLACDecodeSubframe(CHD_BitReader &br, int32 *s, uint32 blocksize, unsigned bps)
+{
+   unsigned type, wasted = 0;
+
+   if(br.read(1))
+      return false;
+
+   type = br.read(6);
+
+   if(br.read(1))
+   {
+      wasted = 1 + br.read_unary();
+
+      if(wasted >= bps)
+         return false;
+
+      bps -= wasted;
+   }
+
+   if(type == 0)	// Constant
+   {
+      int32 v = br.read_signed(bps);
+
+      for(uint32 i = 0; i < blocksize; i++)
+         s[i] = v;
+   }
+   else if(type == 1)	// Verbatim
+   {
+      for(uint32 i = 0; i < blocksize; i++)
+         s[i] = br.read_signed(bps);
+   }
+   else if(type >= 8 && type <= 12)	// Fixed predictor
+   {
+      const unsigned order = type - 8;
+
+      if(order > blocksize)
+         return false;
+
+      for(unsigned i = 0; i < order; i++)
+         s[i] = br.read_signed(bps);
+
+      if(!FLACDecodeResidual(br, s + order, blocksize, order))
+         return false;
+
+      switch(order)
+      {
+         case 1:
+            for(uint32 i = 1; i < blocksize; i++)
+               s[i] += s[i - 1];
+            break;
+
+         case 2:
+            for(uint32 i = 2; i < blocksize; i++)
+               s[i] += 2 * s[i - 1] - s[i - 2];
+            break;
+
+         case 3:
+            for(uint32 i = 3; i < blocksize; i++)
+               s[i] += 3 * s[i - 1] - 3 * s[i - 2] + s[i - 3];
+            break;
+
+         case 4:
+            for(uint32 i = 4; i < blocksize; i++)
+               s[i] += 4 * s[i - 1] - 6 * s[i - 2] + 4 * s[i - 3] - s[i - 4];
+            break;
+      }
+   }
+   else if(type >= 32)	// LPC
+   {
+      const unsigned order = type - 31;
+      unsigned precision;
+      int shift;
+      int32 coefs[32];
+
+      if(order > blocksize)
+         return false;
+
+      for(unsigned i = 0; i < order; i++)
+         s[i] = br.read_signed(bps);
+
+      precision = br.read(4) + 1;
+      shift     = br.read_signed(5);
+
+      if(precision == 16 || shift < 0)
+         return false;
+
+      for(unsigned i = 0; i < order; i++)
+         coefs[i] = br.read_signed(precision);
+
+      if(!FLACDecodeResidual(br, s + order, blocksize, order))
+         return false;
+
+      for(uint32 i = order; i < blocksize; i++)
+      {
+         int64 sum = 0;
+
+         for(unsigned j = 0; j < order; j++)
+            sum += (int64)coefs[j] * s[i - 1 - j];
+
+         s[i] += (int32)(sum >> shift);
+      }
+   }
+   else
+      return false;
+
+   if(wasted)
+   {
+      for(uint32 i = 0; i < blocksize; i++)
+         s[i] <<= wasted;
+   }
+
+   return !br.overrun();
+}
+
+// Decodes "samples" interleaved stereo samples into dest, 16-bit in the
+// byte order asked for, and returns how many bytes of src the frames took.
+bool CHD_Decoder::FLACDecode(const uint8 *src, uint32 src_len, uint8 *dest, uint32 samples_wanted, bool msb_first, uint32 *consumed)
+{
+   static const uint32 blocksize_table[16] = { 0, 192, 576, 1152, 2304, 4608, 0, 0, 256, 512, 1024, 2048, 4096, 8192, 16384, 32768 };
+   CHD_BitReader br(src, src_len);
+   uint32 done = 0;
+
+   while(done < samples_wanted)
+   {
+      unsigned blocksize_code, rate_code, channel_code, size_code, channels;
+      uint32 blocksize, count;
+      uint32 frame_number;
+      int32 *s0, *s1;
+
+      // 14-bit sync code, then a reserved zero bit.
+      if(br.read(15) != 0x7FFC)
+         return false;
+
+      br.read(1);	// Blocking strategy
+      blocksize_code = br.read(4);
+      rate_code      = br.read(4);
+      channel_code   = br.read(4);
+      size_code      = br.read(3);
+      br.read(1);
+
+      // UTF-8 style coded frame/sample number; only its length matters.
+      frame_number = br.read(8);
+      for(uint32 mask = 0x80; (frame_number & mask) && mask > 0x01; mask >>= 1)
+      {
+         if(mask != 0x80)
+            br.read(8);
+      }
+
+      if(blocksize_code == 6)
+         blocksize = br.read(8) + 1;
+      else if(blocksize_code == 7)
+         blocksize = br.read(16) + 1;
+      else
+         blocksize = blocksize_table[blocksize_code];
+
+      if(rate_code == 12)
+         br.read(8);
+      else if(rate_code == 13 || rate_code == 14)
+         br.read(16);
+
+      br.read(8);	// Header CRC-8; the hunk CRC covers everything anyway.
+
+      if(!blocksize || (size_code != 0 && size_code != 4))
+         return false;
+
+      if(channel_code < 8)
+         channels = channel_code + 1;
+      else if(channel_code <= 10)
+         channels = 2;
+      else
+         return false;
+
+      if(channels > 2)
+         return false;
+
+      if(samples[0].size() < blocksize)
+      {
+         samples[0].resize(blocksize);
+         samples[1].resize(blocksize);
+      }
+
+      s0 = &samples[0][0];
+      s1 = &samples[1][0];
+
+      // The side channel of a stereo pair has one extra bit.
+      if(!FLACDecodeSubframe(br, s0, blocksize, 16 + (channel_code == 9)))
+         return false;
+
+      if(channels == 2 && !FLACDecodeSubframe(br, s1, blocksize, 16 + (channel_code == 8 || channel_code == 10)))
+         return false;
+
+      br.align();
+      br.read(16);	// Frame CRC-16
+
+      if(br.overrun())
+         return false;
+
+      count = std::min<uint32>(blocksize, samples_wanted - done);
+
+      for(uint32 i = 0; i < count; i++)
+      {
+         int32 l, r;
+
+         switch(channel_code)
+         {
+            case 0:
+               l = r = s0[i];
+               break;
+
+            case 8:	// Left/side
+               l = s0[i];
+               r = s0[i] - s1[i];
+               break;
+
+            case 9:	// Side/right
+               r = s1[i];
+               l = s0[i] + s1[i];
+               break;
+
+            case 10:	// Mid/side
+               {
+                  int32 mid = (s0[i] << 1) | (s1[i] & 1);
+
+                  l = (mid + s1[i]) >> 1;
+                  r = (mid - s1[i]) >> 1;
+               }
+               break;
+
+            default:
+               l = s0[i];
+               r = s1[i];
+               break;
+         }
+
+         if(msb_first)
+         {
+            MDFN_en16msb(dest + 0, l);
+            MDFN_en16msb(dest + 2, r);
+         }
+         else
+         {
+            MDFN_en16lsb(dest + 0, l);
+            MDFN_en16lsb(dest + 2, r);
+         }
+         dest += 4;
+      }
+
+      done += count;
+   }
+
+   *consumed = br.offset();
+
+   return true;
+}
+
+//
+// LZMA, just what CHD needs: a raw stream(no properties or size header, no
+// end marker) made with lc=3, lp=0, pb=2, decoded straight into the hunk,
+// which doubles as the dictionary.
+//
+class CHD_RangeDecoder
+{
+   public:
+
+      CHD_RangeDecoder(const uint8 *data_, uint32 len_) : data(data_), len(len_), pos(5), range(0xFFFFFFFF), code(0)
+      {
+         if(len >= 5)
+            code = MDFN_de32msb(data + 1);
+      }
+
+      // The first byte is always zero.
+      INLINE bool valid(void) const
+      {
+         return len >= 5 && !data[0] && code != range;
+      }
+
+      INLINE unsigned bit(uint16 *prob)
+      {
+         const uint32 bound = (range >> 11) * *prob;
+         unsigned ret;
+
+         if(code < bound)
+         {
+            range = bound;
+            *prob += (2048 - *prob) >> 5;
+            ret = 0;
+         }
+         else
+         {
+            range -= bound;
+            code -= bound;
+            *prob -= *prob >> 5;
+            ret = 1;
+         }
+
+         normalize();
+
+         return ret;
+      }
+
+      INLINE uint32 direct(unsigned n)
+      {
+         uint32 ret = 0;
+
+         while(n--)
+         {
+            uint32 mask;
+
+            range >>= 1;
+            code -= range;
+            mask = 0 - (code >> 31);
+            code += range & mask;
+            ret = (ret << 1) + (mask + 1);
+
+            normalize();
+         }
+
+         return ret;
+      }
+
+      INLINE uint32 tree(uint16 *probs, unsigned nbits)
+      {
+         uint32 m = 1;
+
+         for(unsigned i = 0; i < nbits; i++)
+            m = (m << 1) | bit(&probs[m]);
+
+         return m - (1 << nbits);
+      }
+
+      INLINE uint32 tree_reverse(uint16 *probs, unsigned nbits)
+      {
+         uint32 m = 1, ret = 0;
+
+         for(unsigned i = 0; i < nbits; i++)
+         {
+            const unsigned b = bit(&probs[m]);
+
+            m = (m << 1) | b;
+            ret |= b << i;
+         }
+
+         return ret;
+      }
+
+      INLINE bool overrun(void) const
+      {
+         return pos > len;
+      }
+
+   private:
+
+      INLINE void normalize(void)
+      {
+         if(range < (1U << 24))
+         {
+            range <<= 8;
+            code = (code << 8) | ((pos < len) ? data[pos] : 0);
+            pos++;
+         }
+      }
+
+      const uint8 *data;
+      uint32 len;
+      uint32 pos;
+      uint32 range;
+      uint32 code;
+};
+
+enum
+{
+   LZMA_LC = 3,
+   LZMA_PB = 2,
+
+   LZMA_STATES = 12,
+   LZMA_POS_STATES_MAX = 16,
+   LZMA_END_POS_MODEL_INDEX = 14,
+   LZMA_FULL_DISTANCES = 128,
+
+   // Length coder: choice, choice 2, low[16][8], mid[16][8], high[256]
+   LZMA_LEN_CHOICE = 0,
+   LZMA_LEN_CHOICE2 = 1,
+   LZMA_LEN_LOW = 2,
+   LZMA_LEN_MID = LZMA_LEN_LOW + (LZMA_POS_STATES_MAX << 3),
+   LZMA_LEN_HIGH = LZMA_LEN_MID + (LZMA_POS_STATES_MAX << 3),
+   LZMA_LEN_PROBS = LZMA_LEN_HIGH + 256,
+
+   LZMA_IS_MATCH = 0,
+   LZMA_IS_REP = LZMA_IS_MATCH + (LZMA_STATES << 4),
+   LZMA_IS_REP_G0 = LZMA_IS_REP + LZMA_STATES,
+   LZMA_IS_REP_G1 = LZMA_IS_REP_G0 + LZMA_STATES,
+   LZMA_IS_REP_G2 = LZMA_IS_REP_G1 + LZMA_STATES,
+   LZMA_IS_REP0_LONG = LZMA_IS_REP_G2 + LZMA_STATES,
+   LZMA_POS_SLOT = LZMA_IS_REP0_LONG + (LZMA_STATES << 4),
+   LZMA_SPEC_POS = LZMA_POS_SLOT + (4 << 6),
+   LZMA_ALIGN = LZMA_SPEC_POS + LZMA_FULL_DISTANCES - LZMA_END_POS_MODEL_INDEX,
+   LZMA_LEN_CODER = LZMA_ALIGN + 16,
+   LZMA_REP_LEN_CODER = LZMA_LEN_CODER + LZMA_LEN_PROBS,
+   LZMA_LITERAL = LZMA_REP_LEN_CODER + LZMA_LEN_PROBS,
+   LZMA_PROBS = LZMA_LITERAL + (0x300 << LZMA_LC)
+};
+
+static INLINE uint32 LZMADecodeLen(CHD_RangeDecoder &rc, uint16 *probs, unsigned pos_state)
+{
+   if(!rc.bit(&probs[LZMA_LEN_CHOICE]))
+      return rc.tree(&probs[LZMA_LEN_LOW + (pos_state << 3)], 3);
+
+   if(!rc.bit(&probs[LZMA_LEN_CHOICE2]))
+      return 8 + rc.tree(&probs[LZMA_LEN_MID + (pos_state << 3)], 3);
+
+   return 16 + rc.tree(&probs[LZMA_LEN_HIGH], 8);
+}
+
+bool CHD_Decoder::LZMADecode(const uint8 *src, uint32 src_len, uint8 *dest, uint32 dest_len)
+{
+   CHD_RangeDecoder rc(src, src_len);
+   uint32 rep0 = 0, rep1 = 0, rep2 = 0, rep3 = 0;
+   unsigned state = 0;
+   uint32 pos = 0;
+   uint16 *probs;
+
+   if(!rc.valid())
+      return false;
+
+   lzma_probs.assign(LZMA_PROBS, 1024);
+   probs = &lzma_probs[0];
+
+   while(pos < dest_len)
+   {
+      const unsigned pos_state = pos & ((1 << LZMA_PB) - 1);
+      uint32 len;
+
+      if(!rc.bit(&probs[LZMA_IS_MATCH + (state << 4) + pos_state]))
+      {
+         const uint8 prev = pos ? dest[pos - 1] : 0;
+         uint16 *lit = &probs[LZMA_LITERAL + 0x300 * (prev >> (8 - LZMA_LC))];
+         uint32 symbol = 1;
+
+         // After a match, the byte that follows the match in the dictionary
+         // steers the coder until the first mismatching bit.
+         if(state >= 7)
+         {
+            uint32 match_byte = dest[pos - rep0 - 1];
+
+            while(symbol < 0x100)
+            {
+               const unsigned match_bit = (match_byte >> 7) & 1;
+               unsigned b;
+
+               match_byte <<= 1;
+               b = rc.bit(&lit[((1 + match_bit) << 8) + symbol]);
+               symbol = (symbol << 1) | b;
+
+               if(b != match_bit)
+                  break;
+            }
+         }
+
+         while(symbol < 0x100)
+            symbol = (symbol << 1) | rc.bit(&lit[symbol]);
+
+         dest[pos++] = symbol;
+         state = (state < 4) ? 0 : ((state < 10) ? (state - 3) : (state - 6));
+         continue;
+      }
+
+      if(rc.bit(&probs[LZMA_IS_REP + state]))
+      {
+         if(!pos)
+            return false;
+
+         if(!rc.bit(&probs[LZMA_IS_REP_G0 + state]))
+         {
+            // Single byte at rep0
+            if(!rc.bit(&probs[LZMA_IS_REP0_LONG + (state << 4) + pos_state]))
+            {
+               state = (state < 7) ? 9 : 11;
+               dest[pos] = dest[pos - rep0 - 1];
+               pos++;
+               continue;
+            }
+         }
+         else
+         {
+            uint32 dist;
+
+            if(!rc.bit(&probs[LZMA_IS_REP_G1 + state]))
+               dist = rep1;
+            else
+            {
+               if(!rc.bit(&probs[LZMA_IS_REP_G2 + state]))
+                  dist = rep2;
+               else
+               {
+                  dist = rep3;
+                  rep3 = rep2;
+               }
+               rep2 = rep1;
+            }
+            rep1 = rep0;
+            rep0 = dist;
+         }
+
+         len = LZMADecodeLen(rc, &probs[LZMA_REP_LEN_CODER], pos_state);
+         state = (state < 7) ? 8 : 11;
+      }
+      else
+      {
+         unsigned pos_slot;
+
+         rep3 = rep2;
+         rep2 = rep1;
+         rep1 = rep0;
+
+         len = LZMADecodeLen(rc, &probs[LZMA_LEN_CODER], pos_state);
+         state = (state < 7) ? 7 : 10;
+
+         pos_slot = rc.tree(&probs[LZMA_POS_SLOT + (std::min<uint32>(len, 3) << 6)], 6);
+
+         if(pos_slot < 4)
+            rep0 = pos_slot;
+         else
+         {
+            const unsigned direct_bits = (pos_slot >> 1) - 1;
+
+            rep0 = (2 | (pos_slot & 1)) << direct_bits;
+
+            if(pos_slot < LZMA_END_POS_MODEL_INDEX)
+               rep0 += rc.tree_reverse(&probs[LZMA_SPEC_POS + rep0 - pos_slot], direct_bits);
+            else
+            {
+               rep0 += rc.direct(direct_bits - 4) << 4;
+               rep0 += rc.tree_reverse(&probs[LZMA_ALIGN], 4);
+            }
+         }
+
+         // Also catches the end marker, which CHD doesn't write.
+         if(rep0 >= pos)
+            return false;
+      }
+
+      len = std::min<uint32>(len + 2, dest_len - pos);
+
+      for(uint32 i = 0; i < len; i++, pos++)
+         dest[pos] = dest[pos - rep0 - 1];
+   }
+
+   return !rc.overrun();
+}
+
+//
+// Map decoding.  A version 5 map is Huffman coded; this is the tree and
+// lookup table for its 16 symbols.
+//
+class CHD_MapHuffman
+{
+   public:
+
+      enum { NUM_CODES = 16, MAX_BITS = 8 };
+
+      bool Import(CHD_BitReader &br)
+      {
+         unsigned cur = 0;
+
+         // Code lengths, run-length coded.
+         while(cur < NUM_CODES)
+         {
+            unsigned nodebits = br.read(4);
+
+            if(nodebits != 1)
+               numbits[cur++] = nodebits;
+            else
+            {
+               nodebits = br.read(4);
+
+               if(nodebits == 1)
+                  numbits[cur++] = nodebits;
+               else
+               {
+                  unsigned repcount = br.read(4) + 3;
+
+                  if(cur + repcount > NUM_CODES)
+                     return false;
+
+                  while(repcount--)
+                     numbits[cur++] = nodebits;
+               }
+            }
+         }
+
+         return BuildLookup();
+      }
+
+      // Returns NUM_CODES for a bit pattern that isn't a code.
+      INLINE unsigned Decode(CHD_BitReader &br)
+      {
+         const uint16 entry = lookup[br.peek(MAX_BITS)];
+
+         br.skip(entry & 0xFF);
+
+         return entry >> 8;
+      }
+
+   private:
+
+      bool BuildLookup(void)
+      {
+         uint32 bithisto[33];
+         uint32 curstart = 0;
+         uint32 codes[NUM_CODES];
+
+         memset(bithisto, 0, sizeof(bithisto));
+
+         for(unsigned i = 0; i < NUM_CODES; i++)
+         {
+            if(numbits[i] > MAX_BITS)
+               return false;
+
+            bithisto[numbits[i]]++;
+         }
+
+         // Canonical codes, longest first.
+         for(int len = 32; len > 0; len--)
+         {
+            uint32 nextstart = (curstart + bithisto[len]) >> 1;
+
+            if(len != 1 && nextstart * 2 != (curstart + bithisto[len]))
+               return false;
+
+            bithisto[len] = curstart;
+            curstart = nextstart;
+         }
+
+         for(unsigned i = 0; i < NUM_CODES; i++)
+         {
+            if(numbits[i])
+               codes[i] = bithisto[numbits[i]]++;
+         }
+
+         for(unsigned i = 0; i < (1U << MAX_BITS); i++)
+            lookup[i] = (NUM_CODES << 8) | MAX_BITS;
+
+         for(unsigned i = 0; i < NUM_CODES; i++)
+         {
+            if(numbits[i])
+            {
+               const unsigned shift = MAX_BITS - numbits[i];
+
+               for(uint32 j = codes[i] << shift; j < ((codes[i] + 1) << shift); j++)
+                  lookup[j] = (i << 8) | numbits[i];
+            }
+         }
+
+         return true;
+      }
+
+      uint8 numbits[NUM_CODES];
+      uint16 lookup[1 << MAX_BITS];
+};
+
+void CDAccess_CHD::ReadMap(uint64_t map_offset)
+{
+   uint8 raw[16];
+   uint32 map_bytes;
+   uint16 map_crc;
+   unsigned length_bits, self_bits, parent_bits;
+   std::vector<uint8> compressed;
+   std::vector<uint8> crcbuf;
+   uint32 repcount = 0;
+   uint8 lastcomp = 0;
+   uint64 curoffset, last_self = 0, last_parent = 0;
+
+   Map.resize(hunk_count);
+
+   // Uncompressed CHDs have a flat map of hunk offsets, in units of hunks.
+   if(compressors[0] == CHD_CODEC_NONE)
+   {
+      std::vector<uint8> flat(hunk_count * 4);
+
+      fp->seek(map_offset, SEEK_SET);
+      if(fp->read(&flat[0], flat.size()) != flat.size())
+         throw MDFN_Error(0, _("CHD map is truncated."));
+
+      for(uint32 i = 0; i < hunk_count; i++)
+      {
+         Map[i].type   = COMPRESSION_NONE;
+         Map[i].offset = (uint64)MDFN_de32msb(&flat[i * 4]) * hunk_bytes;
+         Map[i].length = Map[i].offset ? hunk_bytes : 0;
+         Map[i].crc    = 0;
+      }
+
+      return;
+   }
+
+   fp->seek(map_offset, SEEK_SET);
+   if(fp->read(raw, sizeof(raw)) != sizeof(raw))
+      throw MDFN_Error(0, _("CHD map is truncated."));
+
+   map_bytes    = MDFN_de32msb(&raw[0]);
+   curoffset    = de48msb(&raw[4]);
+   map_crc      = MDFN_de16msb(&raw[10]);
+   length_bits  = raw[12];
+   self_bits    = raw[13];
+   parent_bits  = raw[14];
+
+   if(!map_bytes || length_bits > 32 || self_bits > 32 || parent_bits > 32)
+      throw MDFN_Error(0, _("CHD map header is bad."));
+
+   compressed.resize(map_bytes);
+   if(fp->read(&compressed[0], map_bytes) != map_bytes)
+      throw MDFN_Error(0, _("CHD map is truncated."));
+
+   CHD_BitReader br(&compressed[0], map_bytes);
+   CHD_MapHuffman huff;
+
+   if(!huff.Import(br))
+      throw MDFN_Error(0, _("CHD map Huffman tree is bad."));
+
+   // Compression types first...
+   for(uint32 i = 0; i < hunk_count; i++)
+   {
+      if(repcount > 0)
+      {
+         Map[i].type = lastcomp;
+         repcount--;
+      }
+      else
+      {
+         unsigned val = huff.Decode(br);
+
+         if(val == COMPRESSION_RLE_SMALL)
+         {
+            Map[i].type = lastcomp;
+            repcount = 2 + huff.Decode(br);
+         }
+         else if(val == COMPRESSION_RLE_LARGE)
+         {
+            Map[i].type = lastcomp;
+            repcount = 2 + 16 + (huff.Decode(br) << 4);
+            repcount += huff.Decode(br);
+         }
+         // (A bad code in a repeat count is caught by the map CRC.)
+         else if(val > COMPRESSION_PARENT_1)
+            throw MDFN_Error(0, _("CHD map is corrupt."));
+         else
+            Map[i].type = lastcomp = val;
+      }
+   }
+
+   // ...then the lengths, offsets and CRCs that go with them.
+   for(uint32 i = 0; i < hunk_count; i++)
+   {
+      MapEntry *me = &Map[i];
+
+      me->offset = curoffset;
+      me->length = 0;
+      me->crc = 0;
+
+      switch(me->type)
+      {
+         case COMPRESSION_TYPE_0:
+         case COMPRESSION_TYPE_1:
+         case COMPRESSION_TYPE_2:
+         case COMPRESSION_TYPE_3:
+            me->length = br.read(length_bits);
+            curoffset += me->length;
+            me->crc = br.read(16);
+            break;
+
+         case COMPRESSION_NONE:
+            me->length = hunk_bytes;
+            curoffset += me->length;
+            me->crc = br.read(16);
+            break;
+
+         case COMPRESSION_SELF:
+            last_self = me->offset = br.read(self_bits);
+            break;
+
+         case COMPRESSION_PARENT:
+            me->offset = br.read(parent_bits);
+            last_parent = me->offset;
+            break;
+
+         case COMPRESSION_SELF_1:
+            last_self++;
+         case COMPRESSION_SELF_0:
+            me->type = COMPRESSION_SELF;
+            me->offset = last_self;
+            break;
+
+         case COMPRESSION_PARENT_SELF:
+            me->type = COMPRESSION_PARENT;
+            last_parent = me->offset = ((uint64)i * hunk_bytes) / unit_bytes;
+            break;
+
+         case COMPRESSION_PARENT_1:
+            last_parent += hunk_bytes / unit_bytes;
+         case COMPRESSION_PARENT_0:
+            me->type = COMPRESSION_PARENT;
+            me->offset = last_parent;
+            break;
+
+         default:
+            throw MDFN_Error(0, _("CHD map is corrupt."));
+      }
+   }
+
+   if(br.overrun())
+      throw MDFN_Error(0, _("CHD map is truncated."));
+
+   // The CRC covers the map as it's laid out in memory by MAME: 12 bytes per hunk.
+   crcbuf.resize(hunk_count * 12);
+
+   for(uint32 i = 0; i < hunk_count; i++)
+   {
+      uint8 *e = &crcbuf[i * 12];
+      const MapEntry *me = &Map[i];
+
+      e[0]  = me->type;
+      e[1]  = me->length >> 16;
+      e[2]  = me->length >> 8;
+      e[3]  = me->length >> 0;
+      e[4]  = me->offset >> 40;
+      e[5]  = me->offset >> 32;
+      e[6]  = me->offset >> 24;
+      e[7]  = me->offset >> 16;
+      e[8]  = me->offset >> 8;
+      e[9]  = me->offset >> 0;
+      e[10] = me->crc >> 8;
+      e[11] = me->crc >> 0;
+   }
+
+   if(crc16(&crcbuf[0], crcbuf.size()) != map_crc)
+      throw MDFN_Error(0, _("CHD map failed CRC check."));
+
+   for(uint32 i = 0; i < hunk_count; i++)
+   {
+      const MapEntry *me = &Map[i];
+
+      if(me->type == COMPRESSION_PARENT)
+         throw MDFN_Error(0, _("CHD image refers to a parent image, which isn't supported."));
+
+      if(me->type == COMPRESSION_SELF && me->offset >= i)
+         throw MDFN_Error(0, _("CHD map is corrupt."));
+
+      if(me->type <= COMPRESSION_TYPE_3)
+      {
+         const uint32 codec = compressors[me->type];
+
+         if(codec != CHD_CODEC_ZLIB && codec != CHD_CODEC_LZMA && codec != CHD_CODEC_FLAC &&
+               codec != CHD_CODEC_CD_ZLIB && codec != CHD_CODEC_CD_LZMA && codec != CHD_CODEC_CD_FLAC)
+         {
+            throw MDFN_Error(0, _("CHD image uses the unsupported \"%c%c%c%c\" codec; convert it with \"chdman copy -c cdlz,cdzl,cdfl\"."),
+                  (char)(codec >> 24), (char)(codec >> 16), (char)(codec >> 8), (char)codec);
+         }
+      }
+   }
+}
+
+void CDAccess_CHD::ReadHeader(void)
+{
+   uint8 header[CHD_V5_HEADER_SIZE];
+   uint32 version;
+   uint64 logical_bytes, map_offset, meta_offset;
+
+   fp->seek(0, SEEK_SET);
+
+   if(fp->read(header, 16) != 16 || memcmp(header, "MComprHD", 8))
+      throw MDFN_Error(0, _("Not a CHD file."));
+
+   version = MDFN_de32msb(&header[12]);
+
+   if(version != 5)
+      throw MDFN_Error(0, _("CHD version %u isn't supported, only version 5; convert it with \"chdman copy\"."), version);
+
+   if(MDFN_de32msb(&header[8]) < CHD_V5_HEADER_SIZE || fp->read(header + 16, CHD_V5_HEADER_SIZE - 16) != CHD_V5_HEADER_SIZE - 16)
+      throw MDFN_Error(0, _("CHD header is truncated."));
+
+   for(unsigned i = 0; i < 4; i++)
+      compressors[i] = MDFN_de32msb(&header[16 + i * 4]);
+
+   logical_bytes = de64msb(&header[32]);
+   map_offset    = de64msb(&header[40]);
+   meta_offset   = de64msb(&header[48]);
+   hunk_bytes    = MDFN_de32msb(&header[56]);
+   unit_bytes    = MDFN_de32msb(&header[60]);
+
+   for(unsigned i = 0; i < 20; i++)
+   {
+      if(header[104 + i])
+         throw MDFN_Error(0, _("CHD image refers to a parent image, which isn't supported."));
+   }
+
+   if(unit_bytes != CD_FRAME_SIZE || !hunk_bytes || (hunk_bytes % CD_FRAME_SIZE))
+      throw MDFN_Error(0, _("CHD image isn't a CD image."));
+
+   hunk_count      = (logical_bytes + hunk_bytes - 1) / hunk_bytes;
+   frames_per_hunk = hunk_bytes / CD_FRAME_SIZE;
+
+   ReadMap(map_offset);
+   ReadTrackMetadata(meta_offset);
+}
+
+void CDAccess_CHD::ReadTrackMetadata(uint64_t meta_offset)
+{
+   int32 RunningLBA = 0;
+   uint32 ChdFrame = 0;
+
+   FirstTrack = 100;
+   LastTrack = 0;
+
+   while(meta_offset)
+   {
+      uint8 raw[16];
+      uint32 tag, length;
+      char meta[256];
+      int tkid = 0, frames = 0, pregap = 0, postgap = 0;
+      char type[32], subtype[32], pgtype[32], pgsub[32];
+
+      fp->seek(meta_offset, SEEK_SET);
+      if(fp->read(raw, sizeof(raw)) != sizeof(raw))
+         throw MDFN_Error(0, _("CHD metadata is truncated."));
+
+      tag         = MDFN_de32msb(&raw[0]);
+      length      = MDFN_de32msb(&raw[4]) & 0xFFFFFF;
+      meta_offset = de64msb(&raw[8]);
+
+      if(tag != CHD_METADATA_TRACK && tag != CHD_METADATA_TRACK2)
+         continue;
+
+      if(length >= sizeof(meta))
+         throw MDFN_Error(0, _("CHD track metadata is bad."));
+
+      if(fp->read(meta, length) != length)
+         throw MDFN_Error(0, _("CHD metadata is truncated."));
+      meta[length] = 0;
+
+      pgtype[0] = 0;
+      if(tag == CHD_METADATA_TRACK2)
+      {
+         if(sscanf(meta, "TRACK:%d TYPE:%31s SUBTYPE:%31s FRAMES:%d PREGAP:%d PGTYPE:%31s PGSUB:%31s POSTGAP:%d",
+                  &tkid, type, subtype, &frames, &pregap, pgtype, pgsub, &postgap) != 8)
+            throw MDFN_Error(0, _("CHD track metadata is bad:\n%s"), meta);
+      }
+      else if(sscanf(meta, "TRACK:%d TYPE:%31s SUBTYPE:%31s FRAMES:%d", &tkid, type, subtype, &frames) != 4)
+         throw MDFN_Error(0, _("CHD track metadata is bad:\n%s"), meta);
+
+      if(tkid < 1 || tkid > 99 || frames < 0 || pregap < 0 || postgap < 0)
+         throw MDFN_Error(0, _("CHD track metadata is bad:\n%s"), meta);
+
+      CDRFILE_TRACK_INFO *track = &Tracks[tkid];
+      unsigned format;
+
+      for(format = 0; format < _DI_FORMAT_COUNT; format++)
+      {
+         if(!strcmp(type, DI_CHD_Strings[format]))
+            break;
+      }
+
+      if(format == _DI_FORMAT_COUNT)
+      {
+         if(strcmp(type, "MODE2_FORM_MIX"))
+            throw MDFN_Error(0, _("CHD track %d has unsupported type \"%s\"."), tkid, type);
+
+         format = DI_FORMAT_MODE2;
+      }
+
+      track->DIFormat = format;
+
+      if(!strcmp(subtype, "RW"))
+         track->SubchannelMode = CDRF_SUBM_RW;
+      else if(!strcmp(subtype, "RW_RAW"))
+         track->SubchannelMode = CDRF_SUBM_RW_RAW;
+      else
+         track->SubchannelMode = CDRF_SUBM_NONE;
+
+      // A pregap type starting with 'V' means the pregap's sectors are
+      // stored, at the start of the track's frames.
+      if(pgtype[0] == 'V')
+      {
+         track->pregap = 0;
+         track->pregap_dv = pregap;
+      }
+      else
+      {
+         track->pregap = pregap;
+         track->pregap_dv = 0;
+      }
+
+      if(track->pregap_dv > frames)
+         throw MDFN_Error(0, _("CHD track metadata is bad:\n%s"), meta);
+
+      track->postgap = postgap;
+      track->sectors = frames - track->pregap_dv;
+      track->index[0] = -1;
+      track->index[1] = 0;
+
+      // Stash the track's frame count for the layout pass below.
+      track->LastSamplePos = frames;
+
+      FirstTrack = std::min<int32>(FirstTrack, tkid);
+      LastTrack = std::max<int32>(LastTrack, tkid);
+   }
+
+   if(FirstTrack > LastTrack)
+      throw(MDFN_Error(0, _("No tracks found!\n")));
+
+   NumTracks = 1 + LastTrack - FirstTrack;
+   disc_type = DISC_TYPE_CDDA_OR_M1;
+
+   for(int x = FirstTrack; x <= LastTrack; x++)
+   {
+      CDRFILE_TRACK_INFO *track = &Tracks[x];
+
+      if(!track->LastSamplePos && !track->sectors)
+         throw MDFN_Error(0, _("CHD image is missing metadata for track %d."), x);
+
+      if(track->DIFormat == DI_FORMAT_AUDIO)
+         track->subq_control &= ~SUBQ_CTRLF_DATA;
+      else
+         track->subq_control |= SUBQ_CTRLF_DATA;
+
+      switch(track->DIFormat)
+      {
+         default: break;
+
+         case DI_FORMAT_MODE2:
+         case DI_FORMAT_MODE2_FORM1:
+         case DI_FORMAT_MODE2_FORM2:
+         case DI_FORMAT_MODE2_RAW:
+                  disc_type = DISC_TYPE_CD_XA;
+                  break;
+      }
+
+      RunningLBA += track->pregap;
+      RunningLBA += track->pregap_dv;
+
+      track->LBA = RunningLBA;
+
+      // FileOffset is the CHD frame holding the track's first sector after
+      // any stored pregap.
+      track->FileOffset = ChdFrame + track->pregap_dv;
+
+      RunningLBA += track->sectors;
+      RunningLBA += track->postgap;
+
+      ChdFrame += (track->LastSamplePos + CD_TRACK_PADDING - 1) & ~(CD_TRACK_PADDING - 1);
+      track->LastSamplePos = 0;
+   }
+
+   if((uint64)ChdFrame > (uint64)hunk_count * frames_per_hunk)
+      throw MDFN_Error(0, _("CHD image is smaller than its track metadata says."));
+
+   total_sectors = RunningLBA;
+}
+
+int CDAccess_CHD::LoadSBI(const char* sbi_path)
+{
+   /* Loading SBI file */
+   uint8 header[4];
+   uint8 ed[4 + 10];
+   uint8 tmpq[12];
+   FileStream sbis(sbi_path, MODE_READ);
+
+   sbis.read(header, 4);
+
+   if(memcmp(header, "SBI\0", 4))
+      return -1;
+
+   while(sbis.read(ed, sizeof(ed), false) == sizeof(ed))
+   {
+      /* Bad BCD MSF offset in SBI file. */
+      if(!BCD_is_valid(ed[0]) || !BCD_is_valid(ed[1]) || !BCD_is_valid(ed[2]))
+         return -1;
+
+      /* Unrecognized boogly oogly in SBI file */
+      if(ed[3] != 0x01)
+         return -1;
+
+      memcpy(tmpq, &ed[4], 10);
+
+      subq_generate_checksum(tmpq);
+      tmpq[10] ^= 0xFF;
+      tmpq[11] ^= 0xFF;
+
+      uint32 aba = AMSF_to_ABA(BCD_to_U8(ed[0]), BCD_to_U8(ed[1]), BCD_to_U8(ed[2]));
+
+      memcpy(SubQReplaceMap[aba].data, tmpq, 12);
+   }
+
+   return 0;
+}
+
+void CDAccess_CHD::ImageOpen(const char *path, bool image_memcache)
+{
+   std::string base_dir, file_base, file_ext;
+   char sbi_ext[4] = { 's', 'b', 'i', 0 };
+   std::string sbi_path;
+
+   crc16_init();
+
+#ifdef HAVE_MMAP
+   try
+   {
+      MappedStream *ms = new MappedStream(path);
+
+      if(image_memcache)
+         ms->prefetch_all();
+
+      fp = ms;
+   }
+   catch(std::exception &e)
+   {
+      // Filesystems that can't be mapped.
+   }
+#endif
+
+   if(!fp)
+   {
+      if(image_memcache)
+         fp = new MemoryStream(new FileStream(path, MODE_READ));
+      else
+         fp = new FileStream(path, MODE_READ);
+   }
+
+   ReadHeader();
+
+   //
+   // Load SBI file, if present
+   //
+   MDFN_GetFilePathComponents(path, &base_dir, &file_base, &file_ext);
+
+   if(file_ext.length() == 4 && file_ext[0] == '.')
+   {
+      unsigned i;
+      for(i = 0; i < 3; i++)
+      {
+         if(file_ext[1 + i] >= 'A' && file_ext[1 + i] <= 'Z')
+            sbi_ext[i] += 'A' - 'a';
+      }
+   }
+
+   sbi_path = MDFN_EvalFIP(base_dir, file_base + std::string(".") + std::string(sbi_ext), true);
+
+   if (path_is_valid(sbi_path.c_str()))
+      LoadSBI(sbi_path.c_str());
+
+   fp_lock = slock_new();
+   HunkCache.Start(this, hunk_bytes, hunk_count, CACHE_HUNKS, PREFETCH_HUNKS, DECODE_THREADS);
+}
+
+void CDAccess_CHD::Cleanup(void)
+{
+   CDBlockCacheStats stats;
+
+   // Before fp and the map go away; the decode threads use both.
+   HunkCache.GetStats(&stats);
+   HunkCache.Stop();
+
+   if(stats.hits || stats.misses)
+   {
+      log_cb(RETRO_LOG_INFO, "[CHD] Hunk cache: %llu hits(%llu prefetched), %llu misses.\n",
+            (unsigned long long)stats.hits, (unsigned long long)stats.prefetch_hits, (unsigned long long)stats.misses);
+   }
+
+   if(fp_lock)
+   {
+      slock_free(fp_lock);
+      fp_lock = NULL;
+   }
+
+   if(fp)
+   {
+      delete fp;
+      fp = NULL;
+   }
+}
+
+CDAccess_CHD::CDAccess_CHD(const char *path, bool image_memcache) : fp(NULL), fp_lock(NULL), NumTracks(0), FirstTrack(0), LastTrack(0),
+   total_sectors(0)
+{
+   memset(Tracks, 0, sizeof(Tracks));
+
+   try
+   {
+      ImageOpen(path, image_memcache);
+   }
+   catch(...)
+   {
+      Cleanup();
+      throw;
+   }
+}
+
+CDAccess_CHD::~CDAccess_CHD()
+{
+   Cleanup();
+}
+
+void *CDAccess_CHD::CreateBlockDecoder(void)
+{
+   return new CHD_Decoder();
+}
+
+void CDAccess_CHD::DestroyBlockDecoder(void *dec)
+{
+   delete (CHD_Decoder *)dec;
+}
+
+bool CDAccess_CHD::DecodeBlock(void *dec, uint32_t block, uint8_t *dest)
+{
+   DecodeHunk((CHD_Decoder *)dec, block, dest);
+   return true;
+}
+
+// Decodes hunk "hunknum" into dest(hunk_bytes long); throws on error.  Safe
+// to call from several threads at once, each with its own decoder.
+void CDAccess_CHD::DecodeHunk(CHD_Decoder *dec, uint32_t hunknum, uint8_t *dest)
+{
+   const MapEntry *me = &Map[hunknum];
+   const uint8 *src;
+   bool ok = false;
+
+   if(me->type == COMPRESSION_SELF)
+   {
+      DecodeHunk(dec, me->offset, dest);
+      return;
+   }
+
+   if(!me->length)	// Never written, in an uncompressed CHD.
+   {
+      memset(dest, 0, hunk_bytes);
+      return;
+   }
+
+   if(dec->compressed.size() < me->length)
+      dec->compressed.resize(me->length);
+
+   slock_lock(fp_lock);
+   try
+   {
+      fp->seek(me->offset, SEEK_SET);
+      ok = (fp->read(&dec->compressed[0], me->length) == me->length);
+   }
+   catch(...)
+   {
+      slock_unlock(fp_lock);
+      throw;
+   }
+   slock_unlock(fp_lock);
+
+   if(!ok)
+      throw MDFN_Error(0, _("CHD hunk %u is truncated."), hunknum);
+
+   src = &dec->compressed[0];
+
+   if(me->type == COMPRESSION_NONE)
+      memcpy(dest, src, hunk_bytes);
+   else
+   {
+      const uint32 codec = compressors[me->type];
+      const uint32 frames = frames_per_hunk;
+      uint32 consumed = 0;
+
+      ok = false;
+
+      if(dec->buffer.size() < hunk_bytes)
+         dec->buffer.resize(hunk_bytes);
+
+      switch(codec)
+      {
+         case CHD_CODEC_ZLIB:
+            ok = dec->Inflate(src, me->length, dest, hunk_bytes);
+            break;
+
+         case CHD_CODEC_LZMA:
+            ok = dec->LZMADecode(src, me->length, dest, hunk_bytes);
+            break;
+
+         case CHD_CODEC_FLAC:
+            // Leading byte gives the byte order the samples were stored in.
+            ok = me->length > 1 && (src[0] == 'L' || src[0] == 'B') &&
+               dec->FLACDecode(src + 1, me->length - 1, dest, hunk_bytes / 4, src[0] == 'B', &consumed);
+            break;
+
+         case CHD_CODEC_CD_ZLIB:
+         case CHD_CODEC_CD_LZMA:
+            {
+               // Header: a bit per frame whose sync and ECC were stripped, then the
+               // compressed size of the sector data; the subcode follows it.
+               const uint32 ecc_bytes = (frames + 7) / 8;
+               const uint32 complen_bytes = (hunk_bytes < 65536) ? 2 : 3;
+               const uint32 header_bytes = ecc_bytes + complen_bytes;
+               uint32 complen_base;
+
+               if(me->length < header_bytes)
+                  break;
+
+               complen_base = (src[ecc_bytes + 0] << 8) | src[ecc_bytes + 1];
+               if(complen_bytes > 2)
+                  complen_base = (complen_base << 8) | src[ecc_bytes + 2];
+
+               if(complen_base > me->length - header_bytes)
+                  break;
+
+               if(codec == CHD_CODEC_CD_LZMA)
+                  ok = dec->LZMADecode(src + header_bytes, complen_base, &dec->buffer[0], frames * CD_MAX_SECTOR_DATA);
+               else
+                  ok = dec->Inflate(src + header_bytes, complen_base, &dec->buffer[0], frames * CD_MAX_SECTOR_DATA);
+
+               ok = ok && dec->Inflate(src + header_bytes + complen_base, me->length - header_bytes - complen_base,
+                        &dec->buffer[frames * CD_MAX_SECTOR_DATA], frames * CD_MAX_SUBCODE_DATA);
+            }
+            break;
+
+         case CHD_CODEC_CD_FLAC:
+            {
+               // Sector data as 16-bit big-endian stereo samples, then deflated subcode.
+               ok = dec->FLACDecode(src, me->length, &dec->buffer[0], frames * CD_MAX_SECTOR_DATA / 4, true, &consumed) &&
+                  consumed <= me->length &&
+                  dec->Inflate(src + consumed, me->length - consumed, &dec->buffer[frames * CD_MAX_SECTOR_DATA], frames * CD_MAX_SUBCODE_DATA);
+            }
+            break;
+      }
+
+      if(!ok)
+         throw MDFN_Error(0, _("Error decompressing CHD hunk %u."), hunknum);
+
+      if(codec == CHD_CODEC_CD_ZLIB || codec == CHD_CODEC_CD_LZMA || codec == CHD_CODEC_CD_FLAC)
+      {
+         for(uint32 f = 0; f < frames; f++)
+         {
+            uint8 *sector = dest + f * CD_FRAME_SIZE;
+
+            memcpy(sector, &dec->buffer[f * CD_MAX_SECTOR_DATA], CD_MAX_SECTOR_DATA);
+            memcpy(sector + CD_MAX_SECTOR_DATA, &dec->buffer[frames * CD_MAX_SECTOR_DATA + f * CD_MAX_SUBCODE_DATA], CD_MAX_SUBCODE_DATA);
+
+            if(codec != CHD_CODEC_CD_FLAC && (src[f / 8] & (1 << (f % 8))))
+            {
+               memcpy(sector, cd_sync_header, sizeof(cd_sync_header));
+               encode_mode1_parity(sector);
+            }
+         }
+      }
+   }
+
+   if(compressors[0] != CHD_CODEC_NONE && crc16(dest, hunk_bytes) != me->crc)
+      throw MDFN_Error(0, _("CHD hunk %u failed CRC check."), hunknum);
+}
+
+void CDAccess_CHD::ReadFrame(uint8_t *buf, uint32_t frame)
+{
+   const uint32 hunknum = frame / frames_per_hunk;
+   const uint32 hunk_offset = (frame % frames_per_hunk) * CD_FRAME_SIZE;
+
+   if(hunknum >= hunk_count)
+      throw MDFN_Error(0, _("CHD frame %u is past the end of the image."), frame);
+
+   HunkCache.Read(hunknum, hunk_offset, buf, CD_FRAME_SIZE);
+}
+
+void CDAccess_CHD::Read_Raw_Sector(uint8 *buf, int32 lba)
+{
+   int32_t track;
+   bool TrackFound = FALSE;
+
+   memset(buf + 2352, 0, 96);
+
+   MakeSubPQ(lba, buf + 2352);
+
+   for(track = FirstTrack; track < (FirstTrack + NumTracks); track++)
+   {
+      CDRFILE_TRACK_INFO *ct = &Tracks[track];
+
+      if(lba >= (ct->LBA - ct->pregap_dv - ct->pregap) && lba < (ct->LBA + ct->sectors + ct->postgap))
+      {
+         TrackFound = TRUE;
+
+         // Handle pregap and postgap reading
+         if(lba < (ct->LBA - ct->pregap_dv) || lba >= (ct->LBA + ct->sectors))
+         {
+            memset(buf, 0, 2352);	// Null sector data, per spec
+         }
+         else
+         {
+            uint8_t frame[CD_FRAME_SIZE];
+
+            ReadFrame(frame, ct->FileOffset + (lba - ct->LBA));
+
+            // Sector data is stored at the start of the frame, whatever its size.
+            switch(ct->DIFormat)
+            {
+               case DI_FORMAT_AUDIO:
+                  memcpy(buf, frame, 2352);
+                  Endian_A16_Swap(buf, 588 * 2);	// Stored MSB-first.
+                  break;
+
+               case DI_FORMAT_MODE1:
+                  memcpy(buf + 12 + 3 + 1, frame, 2048);
+                  encode_mode1_sector(lba + 150, buf);
+                  break;
+
+               case DI_FORMAT_MODE1_RAW:
+               case DI_FORMAT_MODE2_RAW:
+                  memcpy(buf, frame, 2352);
+                  break;
+
+               case DI_FORMAT_MODE2:
+                  memcpy(buf + 16, frame, 2336);
+                  encode_mode2_sector(lba + 150, buf);
+                  break;
+
+               // The subheader isn't stored for these; make up one with just
+               // the form bit.
+               case DI_FORMAT_MODE2_FORM1:
+                  memset(buf + 16, 0, 8);
+                  memcpy(buf + 24, frame, 2048);
+                  encode_mode2_form1_sector(lba + 150, buf);
+                  break;
+
+               case DI_FORMAT_MODE2_FORM2:
+                  memset(buf + 16, 0, 8);
+                  buf[16 + 2] = buf[20 + 2] = 0x20;
+                  memcpy(buf + 24, frame, 2324);
+                  encode_mode2_form2_sector(lba + 150, buf);
+                  break;
+            }
+
+            if(ct->SubchannelMode == CDRF_SUBM_RW_RAW)
+               memcpy(buf + 2352, frame + CD_MAX_SECTOR_DATA, 96);
+            else if(ct->SubchannelMode == CDRF_SUBM_RW)
+            {
+               uint8_t subpw[96];
+
+               // Cooked R-W only; P and Q are still simulated.
+               subpw_interleave(frame + CD_MAX_SECTOR_DATA, subpw);
+
+               for(unsigned i = 0; i < 96; i++)
+                  buf[2352 + i] |= subpw[i] & 0x3F;
+            }
+         }
+         break;
+      } // End if LBA is in range
+   } // end track search loop
+
+   if(!TrackFound)
+      throw(MDFN_Error(0, _("Could not find track for sector %u!"), lba));
+}
+
+// Note: this function makes use of the current contents(as in |=) in SubPWBuf.
+void CDAccess_CHD::MakeSubPQ(int32 lba, uint8 *SubPWBuf)
+{
+   unsigned i;
+   uint8_t buf[0xC], adr, control;
+   int32_t track;
+   uint32_t lba_relative;
+   uint32_t ma, sa, fa;
+   uint32_t m, s, f;
+   uint8_t pause_or = 0x00;
+   bool track_found = FALSE;
+
+   for(track = FirstTrack; track < (FirstTrack + NumTracks); track++)
+   {
+      if(lba >= (Tracks[track].LBA - Tracks[track].pregap_dv - Tracks[track].pregap) && lba < (Tracks[track].LBA + Tracks[track].sectors + Tracks[track].postgap))
+      {
+         track_found = TRUE;
+         break;
+      }
+   }
+
+   if(!track_found)
+   {
+      printf("MakeSubPQ error for sector %u!", lba);
+      track = FirstTrack;
+   }
+
+   lba_relative = abs((int32)lba - Tracks[track].LBA);
+
+   f            = (lba_relative % 75);
+   s            = ((lba_relative / 75) % 60);
+   m            = (lba_relative / 75 / 60);
+
+   fa           = (lba + 150) % 75;
+   sa           = ((lba + 150) / 75) % 60;
+   ma           = ((lba + 150) / 75 / 60);
+
+   adr          = 0x1; // Q channel data encodes position
+   control      = Tracks[track].subq_control;
+
+   // Handle pause(D7 of interleaved subchannel byte) bit, should be set to 1 when in pregap or postgap.
+   if((lba < Tracks[track].LBA) || (lba >= Tracks[track].LBA + Tracks[track].sectors))
+      pause_or = 0x80;
+
+   // Handle pregap between audio->data track
+   {
+      int32_t pg_offset = (int32)lba - Tracks[track].LBA;
+
+      // If we're more than 2 seconds(150 sectors) from the real "start" of the track/INDEX 01, and the track is a data track,
+      // and the preceding track is an audio track, encode it as audio(by taking the SubQ control field from the preceding track).
+      if(pg_offset < -150)
+      {
+         if((Tracks[track].subq_control & SUBQ_CTRLF_DATA) && (FirstTrack < track) && !(Tracks[track - 1].subq_control & SUBQ_CTRLF_DATA))
+            control = Tracks[track - 1].subq_control;
+      }
+   }
+
+   memset(buf, 0, 0xC);
+   buf[0] = (adr << 0) | (control << 4);
+   buf[1] = U8_to_BCD(track);
+
+   if(lba < Tracks[track].LBA) // Index is 00 in pregap
+      buf[2] = U8_to_BCD(0x00);
+   else
+      buf[2] = U8_to_BCD(0x01);
+
+   /* Track relative MSF address */
+   buf[3] = U8_to_BCD(m);
+   buf[4] = U8_to_BCD(s);
+   buf[5] = U8_to_BCD(f);
+   buf[6] = 0;
+   /* Absolute MSF address */
+   buf[7] = U8_to_BCD(ma);
+   buf[8] = U8_to_BCD(sa);
+   buf[9] = U8_to_BCD(fa);
+
+   subq_generate_checksum(buf);
+
+   if(!SubQReplaceMap.empty())
+   {
+      std::map<uint32, cpp11_array_doodad>::const_iterator it = SubQReplaceMap.find(LBA_to_ABA(lba));
+
+      if(it != SubQReplaceMap.end())
+         memcpy(buf, it->second.data, 12);
+   }
+
+   for (i = 0; i < 96; i++)
+      SubPWBuf[i] |= (((buf[i >> 3] >> (7 - (i & 0x7))) & 1) ? 0x40 : 0x00) | pause_or;
+}
+
+void CDAccess_CHD::Read_TOC(TOC *toc)
+{
+   unsigned i;
+
+   TOC_Clear(toc);
+
+   toc->first_track = FirstTrack;
+   toc->last_track = FirstTrack + NumTracks - 1;
+   toc->disc_type = disc_type;
+
+   for(i = toc->first_track; i <= toc->last_track; i++)
+   {
+      toc->tracks[i].lba = Tracks[i].LBA;
+      toc->tracks[i].adr = ADR_CURPOS;
+      toc->tracks[i].control = Tracks[i].subq_control;
+   }
+
+   toc->tracks[100].lba = total_sectors;
+   toc->tracks[100].adr = ADR_CURPOS;
+   toc->tracks[100].control = toc->tracks[toc->last_track].control & 0x4;
+
+   // Convenience leadout track duplication.
+   if(toc->last_track < 99)
+      toc->tracks[toc->last_track + 1] = toc->tracks[100];
+}
+
+void CDAccess_CHD::Eject(bool eject_status)
+{
+
+}
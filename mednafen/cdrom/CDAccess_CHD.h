@@ -0,0 +1,93 @@
+#ifndef __MDFN_CDACCESS_CHD_H
+#define __MDFN_CDACCESS_CHD_H
+
+#include <map>
+#include <vector>
+
+#include <rthreads/rthreads.h>
+
+#include "CDAccess_Image.h"
+#include "CDBlockCache.h"
+
+class Stream;
+struct CHD_Decoder;
+
+// MAME CHD(v5) CD images.  Sectors are stored in compressed hunks of a few
+// frames each, which go through a CDBlockCache once decoded.
+class CDAccess_CHD : public CDAccess, public CDBlockSource
+{
+   public:
+
+      CDAccess_CHD(const char *path, bool image_memcache);
+      virtual ~CDAccess_CHD();
+
+      virtual void Read_Raw_Sector(uint8_t *buf, int32_t lba);
+
+      virtual void Read_TOC(TOC *toc);
+
+      virtual void Eject(bool eject_status);
+
+      // CDBlockSource:
+      virtual void *CreateBlockDecoder(void);
+      virtual void DestroyBlockDecoder(void *dec);
+      virtual bool DecodeBlock(void *dec, uint32_t block, uint8_t *dest);
+
+   private:
+
+      struct MapEntry
+      {
+         uint8_t type;
+         uint32_t length;
+         uint64_t offset;
+         uint16_t crc;
+      };
+
+      enum
+      {
+         CACHE_HUNKS    = 32,	// Decoded hunk cache size
+         PREFETCH_HUNKS = 4,	// How far past the current hunk gets decoded ahead
+         DECODE_THREADS = 2
+      };
+
+      Stream *fp;
+      slock_t *fp_lock;	// Held only while compressed data is read, not while it's decoded.
+
+      uint32_t hunk_bytes;
+      uint32_t unit_bytes;
+      uint32_t hunk_count;
+      uint32_t frames_per_hunk;
+      uint32_t compressors[4];
+      std::vector<MapEntry> Map;
+
+      CDBlockCache HunkCache;
+
+      int32_t NumTracks;
+      int32_t FirstTrack;
+      int32_t LastTrack;
+      int32_t total_sectors;
+      uint8_t disc_type;
+      CDRFILE_TRACK_INFO Tracks[100]; // Track #0(HMM?) through 99
+
+      struct cpp11_array_doodad
+      {
+         uint8 data[12];
+      };
+
+      std::map<uint32, cpp11_array_doodad> SubQReplaceMap;
+
+      void ImageOpen(const char *path, bool image_memcache);
+      void ReadHeader(void);
+      void ReadMap(uint64_t map_offset);
+      void ReadTrackMetadata(uint64_t meta_offset);
+      int LoadSBI(const char* sbi_path);
+      void Cleanup(void);
+
+      // MakeSubPQ will OR the simulated P and Q subchannel data into SubPWBuf.
+      void MakeSubPQ(int32_t lba, uint8_t *SubPWBuf);
+
+      void ReadFrame(uint8_t *buf, uint32_t frame);
+      void DecodeHunk(CHD_Decoder *dec, uint32_t hunknum, uint8_t *dest);
+};
+
+
+#endif
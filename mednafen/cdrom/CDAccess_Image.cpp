@@ -43,6 +43,9 @@
 #include "../general.h"
 #include "../FileStream.h"
 #include "../MemoryStream.h"
+#ifdef HAVE_MMAP
+#include "../MappedStream.h"
+#endif
 
 #include "CDAccess.h"
 #include "CDAccess_Image.h"
@@ -194,6 +197,33 @@ uint32 CDAccess_Image::GetSectorCount(CDRFILE_TRACK_INFO *track)
    return((size - track->FileOffset) / DI_Size_Table[track->DIFormat]);
 }
 
+// Opens a track's data file.  Where possible the file is memory-mapped, so
+// the image lives in the page cache rather than on the heap, and "memcache"
+// only means having all of it read in up front.
+static Stream *OpenTrackStream(const std::string &path, bool image_memcache)
+{
+#ifdef HAVE_MMAP
+   try
+   {
+      MappedStream *ms = new MappedStream(path.c_str());
+
+      if(image_memcache)
+         ms->prefetch_all();
+
+      return ms;
+   }
+   catch(std::exception &e)
+   {
+      // Empty files, or filesystems that can't be mapped.
+   }
+#endif
+
+   if(image_memcache)
+      return new MemoryStream(new FileStream(path.c_str(), MODE_READ));
+
+   return new FileStream(path.c_str(), MODE_READ);
+}
+
 void CDAccess_Image::ParseTOCFileLineInfo(CDRFILE_TRACK_INFO *track, const int tracknum, const std::string &filename, const char *binoffset, const char *msfoffset, const char *length, bool image_memcache, std::map<std::string, Stream*> &toc_streamcache)
 {
    long offset = 0; // In bytes!
@@ -219,10 +249,7 @@ void CDAccess_Image::ParseTOCFileLineInfo(CDRFILE_TRACK_INFO *track, const int t
 
       efn = MDFN_EvalFIP(base_dir, filename);
 
-      if(image_memcache)
-         track->fp = new MemoryStream(new FileStream(efn.c_str(), MODE_READ));
-      else
-         track->fp = new FileStream(efn.c_str(), MODE_READ);
+      track->fp = OpenTrackStream(efn, image_memcache);
 
       toc_streamcache[filename] = track->fp;
    }
@@ -588,12 +615,9 @@ void CDAccess_Image::ImageOpen(const char *path, bool image_memcache)
             }
 
             std::string efn = MDFN_EvalFIP(base_dir, args[0]);
-            TmpTrack.fp = new FileStream(efn.c_str(), MODE_READ);
+            TmpTrack.fp = OpenTrackStream(efn, image_memcache);
             TmpTrack.FirstFileInstance = 1;
 
-            if(image_memcache)
-               TmpTrack.fp = new MemoryStream(TmpTrack.fp);
-
             if(!strcasecmp(args[1].c_str(), "BINARY"))
             {
                //TmpTrack.Format = TRACK_FORMAT_DATA;
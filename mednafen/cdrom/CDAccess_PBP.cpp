@@ -51,6 +51,12 @@ extern retro_log_printf_t log_cb;
 extern int CD_SelectedDisc;
 int PBP_DiscCount;
 
+struct PBP_BlockDecoder
+{
+   z_stream z;
+   uint8_t compressed[2352 * 16];
+};
+
 // Disk-image(rip) track/sector formats
 enum
 {
@@ -193,8 +199,38 @@ void CDAccess_PBP::ImageOpen(const char *path, bool image_memcache)
    }
 }
 
+void *CDAccess_PBP::CreateBlockDecoder(void)
+{
+   return new PBP_BlockDecoder();
+}
+
+void CDAccess_PBP::DestroyBlockDecoder(void *v_dec)
+{
+   PBP_BlockDecoder *dec = (PBP_BlockDecoder *)v_dec;
+
+   if(dec->z.zalloc != NULL)
+      inflateEnd(&dec->z);
+
+   delete dec;
+}
+
 void CDAccess_PBP::Cleanup(void)
 {
+   CDBlockCacheStats stats;
+
+   // Before fp and the index table go away; the prefetch thread uses both.
+   BlockCache.GetStats(&stats);
+   BlockCache.Stop();
+
+   if(stats.hits || stats.misses)
+   {
+      log_cb(RETRO_LOG_INFO, "[PBP] Block cache: %llu hits(%llu prefetched), %llu misses.\n",
+            (unsigned long long)stats.hits, (unsigned long long)stats.prefetch_hits, (unsigned long long)stats.misses);
+   }
+
+   if(fp_lock != NULL)
+      slock_free(fp_lock);
+
    if(fp != NULL)
    {
       fp->close();   // need to manually close for FileStreams?
@@ -206,11 +242,28 @@ void CDAccess_PBP::Cleanup(void)
 
 CDAccess_PBP::CDAccess_PBP(const char *path, bool image_memcache) : NumTracks(0), FirstTrack(0), LastTrack(0), total_sectors(0)
 {
+   uint32_t cache_blocks = MDFN_GetSettingUI("cdrom.pbp_cache_blocks");
+
    is_official = false;
    index_table = NULL;
+   index_len = 0;
    fp = NULL;
+   fp_lock = slock_new();
+
    kirk_init();
-   ImageOpen(path, image_memcache);
+
+   try
+   {
+      ImageOpen(path, image_memcache);
+   }
+   catch(...)
+   {
+      Cleanup();
+      throw;
+   }
+
+   // Nothing to read until Read_TOC() has set up the index table.
+   BlockCache.Start(this, BLOCK_SIZE, 0, cache_blocks, PREFETCH_BLOCKS, 1);
 }
 
 CDAccess_PBP::~CDAccess_PBP()
@@ -323,9 +376,9 @@ void CDAccess_PBP::MakeSubPQ(int32 lba, uint8 *SubPWBuf)
       SubPWBuf[i] |= (((buf[i >> 3] >> (7 - (i & 0x7))) & 1) ? 0x40 : 0x00) | pause_or;
 }
 
-int CDAccess_PBP::decompress2(void *out, uint32_t *out_size, void *in, uint32_t in_size)
+int CDAccess_PBP::decompress2(PBP_BlockDecoder *dec, void *out, uint32_t *out_size, void *in, uint32_t in_size)
 {
-   static z_stream z;
+   z_stream &z = dec->z;
    int ret = 0;
 
    if (z.zalloc == NULL) {
@@ -353,82 +406,101 @@ int CDAccess_PBP::decompress2(void *out, uint32_t *out_size, void *in, uint32_t
    return ret == 1 ? 0 : ret;
 }
 
-void CDAccess_PBP::Read_Raw_Sector(uint8 *buf, int32 lba)
+// Reads and decompresses "block" into dest(BLOCK_SIZE bytes), fixing up
+// its sectors for official images.  Safe to call from both the read and
+// prefetch threads, each with its own decoder.
+bool CDAccess_PBP::DecodeBlock(void *v_dec, uint32_t block, uint8_t *dest)
 {
-   uint8_t SimuQ[0xC];
-
-   int32_t block = lba >> 4;
-   sector_in_blk = lba & 0xf;
-
-   memset(buf + 2352, 0, 96);
-   MakeSubPQ(lba, buf + 2352);
-   subq_deinterleave(buf + 2352, SimuQ);
+   PBP_BlockDecoder *dec = (PBP_BlockDecoder *)v_dec;
+   uint32_t start_byte = index_table[block];
+   uint32_t size = index_table[block+1] - start_byte;
+   bool is_compressed = true;
+   uint64_t got;
 
-   if (block != current_block)
+   if (size > BLOCK_SIZE)
    {
-      uint32_t start_byte = index_table[block];
-      uint32_t size = index_table[block+1] - start_byte;
-      bool is_compressed = true;
-
-      if (lba >= index_len * 16)
-      {
-         log_cb(RETRO_LOG_ERROR, "[PBP] sector %d is past img end\n", lba);
-         return;
-      }
-
-      if (size > sizeof(buff_compressed))
-      {
-         log_cb(RETRO_LOG_ERROR, "[PBP] %u: block %d is too large (%u)\n", lba, block, size);
-         return;
-      }
-      else if(size == sizeof(buff_compressed))
-         is_compressed = false;  // should be the case here?
+      log_cb(RETRO_LOG_ERROR, "[PBP] block %d is too large (%u)\n", block, size);
+      return false;
+   }
+   else if(size == BLOCK_SIZE)
+      is_compressed = false;  // should be the case here?
 
+   slock_lock(fp_lock);
+   try
+   {
       fp->seek(start_byte, SEEK_SET);
-      fp->read(is_compressed ? buff_compressed : buff_raw[0], size);
+      got = fp->read(is_compressed ? dec->compressed : dest, size, false);
+   }
+   catch(std::exception &e)
+   {
+      got = 0;
+   }
+   slock_unlock(fp_lock);
 
-//log_cb(RETRO_LOG_DEBUG, "lba = %d, block = %u, start_byte = %#x, index_table[%i] = %#x\n", lba, block, start_byte, block, index_table[block]);
+   if (got != size)
+   {
+      log_cb(RETRO_LOG_ERROR, "[PBP] error reading block %d\n", block);
+      return false;
+   }
 
-      if (is_compressed)
+   if (is_compressed)
+   {
+      if(is_official)
+         decompress(dest, dec->compressed, BLOCK_SIZE);
+      else
       {
-         if(is_official)
+         uint32_t cdbuffer_size_expect = BLOCK_SIZE;
+         uint32_t cdbuffer_size = cdbuffer_size_expect;
+         int ret = decompress2(dec, dest, &cdbuffer_size, dec->compressed, size);
+         if (ret != 0)
          {
-            decompress(buff_raw[0], buff_compressed, sizeof(buff_compressed));
-            fixed_sectors = 0;
+            log_cb(RETRO_LOG_ERROR, "[PBP] uncompress failed with %d for block %d (%u)\n", ret, block, size);
+            return false;
          }
-         else
+         if (cdbuffer_size != cdbuffer_size_expect)
          {
-            uint32_t cdbuffer_size_expect = sizeof(buff_raw[0]) << 4;
-            uint32_t cdbuffer_size = cdbuffer_size_expect;
-            int ret = decompress2(buff_raw[0], &cdbuffer_size, buff_compressed, size);
-            if (ret != 0)
-            {
-               log_cb(RETRO_LOG_ERROR, "[PBP] uncompress failed with %d for block %d, sector %d (%u)\n", ret, block, lba, size);
-               return;
-            }
-            if (cdbuffer_size != cdbuffer_size_expect)
-            {
-               log_cb(RETRO_LOG_WARN, "[PBP] cdbuffer_size: %lu != %lu, sector %d\n", cdbuffer_size, cdbuffer_size_expect, lba);
-               return;
-            }
+            log_cb(RETRO_LOG_WARN, "[PBP] cdbuffer_size: %lu != %lu, block %d\n", cdbuffer_size, cdbuffer_size_expect, block);
+            return false;
          }
       }
-      current_block = block;
    }
 
+   // Done here once, rather than every time one of the sectors is read.
    if(is_official)
    {
-      // this will probably rarely get caught but better than trying to do it every time I guess...
-      if(!(fixed_sectors & (0x1 << sector_in_blk)))
+      for(uint32_t i = 0; i < BLOCK_SECTORS; i++)
       {
-         if(fix_sector(buff_raw[sector_in_blk], lba) != 0)
-            log_cb(RETRO_LOG_WARN, "[PBP] Failed to fix sector %d\n", lba);
-         else
-            fixed_sectors |= (0x1 << sector_in_blk);
+         if(fix_sector(dest + i * 2352, block * BLOCK_SECTORS + i) != 0)
+            log_cb(RETRO_LOG_WARN, "[PBP] Failed to fix sector %d\n", block * BLOCK_SECTORS + i);
       }
    }
 
-   memcpy(buf, buff_raw[sector_in_blk], 2352);
+   return true;
+}
+
+void CDAccess_PBP::GetCacheStats(CDBlockCacheStats *stats_out)
+{
+   BlockCache.GetStats(stats_out);
+}
+
+void CDAccess_PBP::Read_Raw_Sector(uint8 *buf, int32 lba)
+{
+   uint8_t SimuQ[0xC];
+
+   uint32_t block = lba >> 4;
+   uint32_t sector_in_blk = lba & 0xf;
+
+   memset(buf + 2352, 0, 96);
+   MakeSubPQ(lba, buf + 2352);
+   subq_deinterleave(buf + 2352, SimuQ);
+
+   if (lba < 0 || block >= index_len)
+   {
+      log_cb(RETRO_LOG_ERROR, "[PBP] sector %d is past img end\n", lba);
+      return;
+   }
+
+   BlockCache.Read(block, sector_in_blk * 2352, buf, 2352);
 }
 
 void CDAccess_PBP::Read_TOC(TOC *toc)
@@ -465,20 +537,37 @@ void CDAccess_PBP::Read_TOC(TOC *toc)
    TOC_Clear(toc);
    memset(Tracks, 0, sizeof(Tracks));
 
-   fp->seek(psisoimg_offset + 0x400, SEEK_SET);
-   fp->read(iso_header, 0xB6600);
-   if(iso_header[0] == 0 && iso_header[1] == 'P' && iso_header[2] == 'G' && iso_header[3] == 'D')
-   {
-      log_cb(RETRO_LOG_DEBUG, "[PBP] decrypting iso header...\n");
-      int pdg_size = decrypt_pgd(iso_header, 0xB6600);
+   // The index table is about to change(on a disc change, to another disc's).
+   BlockCache.Flush();
 
-      if(pdg_size < 1 || pdg_size > 0xB6600)
-            throw(MDFN_Error(0, _("[PBP] Failed to decrypt multi-disc iso map")));
+   std::map<uint32_t, std::vector<uint8_t> >::const_iterator dh = DecryptedHeaders.find(psisoimg_offset);
+
+   if(dh != DecryptedHeaders.end())
+   {
+      memcpy(iso_header, &dh->second[0], 0xB6600);
 
-      is_official = true;
       toc_offset += 0x90;
       index_table_offset += 0x90;
    }
+   else
+   {
+      fp->seek(psisoimg_offset + 0x400, SEEK_SET);
+      fp->read(iso_header, 0xB6600);
+      if(iso_header[0] == 0 && iso_header[1] == 'P' && iso_header[2] == 'G' && iso_header[3] == 'D')
+      {
+         log_cb(RETRO_LOG_DEBUG, "[PBP] decrypting iso header...\n");
+         int pdg_size = decrypt_pgd(iso_header, 0xB6600);
+
+         if(pdg_size < 1 || pdg_size > 0xB6600)
+               throw(MDFN_Error(0, _("[PBP] Failed to decrypt multi-disc iso map")));
+
+         is_official = true;
+         toc_offset += 0x90;
+         index_table_offset += 0x90;
+
+         DecryptedHeaders[psisoimg_offset].assign(iso_header, iso_header + 0xB6600);
+      }
+   }
 
    // initialize opposites
    FirstTrack = 99;
@@ -570,8 +659,6 @@ void CDAccess_PBP::Read_TOC(TOC *toc)
    read_offset = index_table_offset;
 
    // set class variables
-   fixed_sectors = 0;
-   current_block = (uint32_t)-1;
    index_len = 0xAFC80 / sizeof(index_entry);   // disc map table has a fixed size of 0xAFC80 (22500 entries)?
 
    if(index_table != NULL)
@@ -595,6 +682,8 @@ void CDAccess_PBP::Read_TOC(TOC *toc)
       index_table[i] = cdimg_base + index_entry.offset;
    }
    index_table[i] = cdimg_base + index_entry.offset + index_entry.size;
+   index_len = i;   // Blocks actually in the image
+   BlockCache.SetBlockCount(index_len);
 
    toc->tracks[100].lba = total_sectors;
    toc->tracks[100].adr = ADR_CURPOS;
@@ -2,11 +2,17 @@
 #define __MDFN_CDACCESS_PBP_H
 
 #include <map>
+#include <vector>
+
+#include <rthreads/rthreads.h>
+
 #include "CDAccess_Image.h"
+#include "CDBlockCache.h"
 
 class Stream;
+struct PBP_BlockDecoder;
 
-class CDAccess_PBP : public CDAccess
+class CDAccess_PBP : public CDAccess, public CDBlockSource
 {
    public:
 
@@ -19,8 +25,16 @@ class CDAccess_PBP : public CDAccess
 
       virtual void Eject(bool eject_status);
 
+      void GetCacheStats(CDBlockCacheStats *stats);
+
+      // CDBlockSource:
+      virtual void *CreateBlockDecoder(void);
+      virtual void DestroyBlockDecoder(void *dec);
+      virtual bool DecodeBlock(void *dec, uint32_t block, uint8_t *dest);
+
    private:
       Stream* fp;
+      slock_t *fp_lock;
 
       enum PBP_FILES{
          PARAM_SFO,
@@ -37,12 +51,23 @@ class CDAccess_PBP : public CDAccess
       uint32_t pbp_file_offsets[PBP_NUM_FILES];
 
       ////////////////
-      uint8_t buff_raw[16][2352];
-      uint8_t buff_compressed[2352 * 16];
+      enum
+      {
+         BLOCK_SECTORS   = 16,
+         BLOCK_SIZE      = 2352 * BLOCK_SECTORS,
+         PREFETCH_BLOCKS = 2	// How far past the current block gets decompressed ahead
+      };
+
       uint32_t *index_table;
       uint32_t index_len;
-      uint32_t current_block;
-      uint32_t sector_in_blk;
+
+      // Decompressed blocks, with any official-image sector fixups already
+      // applied.
+      CDBlockCache BlockCache;
+
+      // Decrypted ISO headers of official images, by disc offset; decrypting
+      // one takes a while, and it's needed again on every disc change.
+      std::map<uint32_t, std::vector<uint8_t> > DecryptedHeaders;
       ////////////////
 
       int32_t NumTracks;
@@ -55,7 +80,6 @@ class CDAccess_PBP : public CDAccess
       uint32_t discs_start_offset[5];
       uint32_t psisoimg_offset;
 
-      uint16_t fixed_sectors;
       bool is_official;    // TODO: find more consistent ways to check for used compression algorithm, compressed (and/or encrypted?) audio tracks and messed up sectors
 
       void ImageOpen(const char *path, bool image_memcache);
@@ -70,7 +94,7 @@ class CDAccess_PBP : public CDAccess
       std::map<uint32, cpp11_array_doodad> SubQReplaceMap;
       void MakeSubPQ(int32 lba, uint8 *SubPWBuf);
 
-      int decompress2(void *out, uint32_t *out_size, void *in, uint32_t in_size);
+      int decompress2(PBP_BlockDecoder *dec, void *out, uint32_t *out_size, void *in, uint32_t in_size);
 
       int decode_range(unsigned int *range, unsigned int *code, unsigned char **src);
       int decode_bit(unsigned int *range, unsigned int *code, int *index, unsigned char **src, unsigned char *c);
@@ -0,0 +1,372 @@
+/* Mednafen - Multi-system Emulator
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "../mednafen.h"
+
+#include <string.h>
+
+#include "CDBlockCache.h"
+
+static void PrefetchThreadStart_C(void *v_arg)
+{
+   ((CDBlockCache *)v_arg)->PrefetchThreadStart();
+}
+
+CDBlockCache::CDBlockCache() : source(NULL), block_bytes(0), block_count(0), prefetch_blocks(0), cache_data(NULL), cache_clock(0),
+   cache_lock(NULL), cache_cond(NULL), read_decoder(NULL), prefetch_cond(NULL), prefetch_quit(false)
+{
+   memset(&stats, 0, sizeof(stats));
+}
+
+CDBlockCache::~CDBlockCache()
+{
+   Stop();
+}
+
+void CDBlockCache::Start(CDBlockSource *source_, uint32_t block_bytes_, uint32_t block_count_, uint32_t cache_blocks,
+      uint32_t prefetch_blocks_, unsigned threads)
+{
+   source          = source_;
+   block_bytes     = block_bytes_;
+   block_count     = block_count_;
+   prefetch_blocks = prefetch_blocks_;
+
+   // At least enough for the block being read and the ones being prefetched.
+   if(cache_blocks < prefetch_blocks + 2)
+      cache_blocks = prefetch_blocks + 2;
+
+   cache_data  = new uint8_t[(size_t)cache_blocks * block_bytes];
+   cache_clock = 0;
+
+   Cache.resize(cache_blocks);
+   for(uint32_t i = 0; i < cache_blocks; i++)
+   {
+      Cache[i].block      = 0;
+      Cache[i].state      = BLOCK_EMPTY;
+      Cache[i].prefetched = false;
+      Cache[i].last_used  = 0;
+      Cache[i].data       = cache_data + (size_t)i * block_bytes;
+   }
+
+   cache_lock    = slock_new();
+   cache_cond    = scond_new();
+   prefetch_cond = scond_new();
+   prefetch_quit = false;
+
+   read_decoder = source->CreateBlockDecoder();
+
+   for(unsigned i = 0; i < threads; i++)
+   {
+      sthread_t *thread = sthread_create(PrefetchThreadStart_C, this);
+
+      if(thread)
+         PrefetchThreads.push_back(thread);
+   }
+}
+
+void CDBlockCache::Stop(void)
+{
+   if(cache_lock)
+   {
+      slock_lock(cache_lock);
+      prefetch_quit = true;
+      scond_broadcast(prefetch_cond);
+      slock_unlock(cache_lock);
+   }
+
+   for(size_t i = 0; i < PrefetchThreads.size(); i++)
+      sthread_join(PrefetchThreads[i]);
+   PrefetchThreads.clear();
+
+   if(read_decoder)
+   {
+      source->DestroyBlockDecoder(read_decoder);
+      read_decoder = NULL;
+   }
+
+   if(cache_data)
+   {
+      delete[] cache_data;
+      cache_data = NULL;
+   }
+   Cache.clear();
+   PrefetchQueue.clear();
+
+   if(prefetch_cond)
+   {
+      scond_free(prefetch_cond);
+      prefetch_cond = NULL;
+   }
+
+   if(cache_cond)
+   {
+      scond_free(cache_cond);
+      cache_cond = NULL;
+   }
+
+   if(cache_lock)
+   {
+      slock_free(cache_lock);
+      cache_lock = NULL;
+   }
+}
+
+//
+// All of these are called with cache_lock held.
+//
+CDBlockCache::CachedBlock *CDBlockCache::FindCacheEntry(uint32_t block)
+{
+   for(size_t i = 0; i < Cache.size(); i++)
+   {
+      if(Cache[i].state != BLOCK_EMPTY && Cache[i].block == block)
+         return &Cache[i];
+   }
+
+   return NULL;
+}
+
+// Takes over the least recently used entry that isn't being decoded into.
+CDBlockCache::CachedBlock *CDBlockCache::ClaimCacheEntry(uint32_t block)
+{
+   CachedBlock *victim = NULL;
+
+   for(size_t i = 0; i < Cache.size(); i++)
+   {
+      CachedBlock *cb = &Cache[i];
+
+      if(cb->state == BLOCK_DECODING)
+         continue;
+
+      if(cb->state == BLOCK_EMPTY)
+      {
+         victim = cb;
+         break;
+      }
+
+      if(!victim || cb->last_used < victim->last_used)
+         victim = cb;
+   }
+
+   if(victim)
+   {
+      victim->block = block;
+      victim->state = BLOCK_DECODING;
+      victim->prefetched = false;
+      victim->last_used = ++cache_clock;
+   }
+
+   return victim;
+}
+
+// Replaces the prefetch queue with the blocks after "block" that aren't
+// cached yet; anything still queued from before a seek is stale.
+void CDBlockCache::QueuePrefetch(uint32_t block)
+{
+   PrefetchQueue.clear();
+
+   for(uint32_t i = 1; i <= prefetch_blocks && (block + i) < block_count; i++)
+   {
+      if(!FindCacheEntry(block + i))
+         PrefetchQueue.push_back(block + i);
+   }
+
+   if(!PrefetchQueue.empty())
+      scond_broadcast(prefetch_cond);
+}
+
+void CDBlockCache::PrefetchThreadStart(void)
+{
+   void *dec;
+
+   try
+   {
+      dec = source->CreateBlockDecoder();
+   }
+   catch(std::exception &e)
+   {
+      return;
+   }
+
+   slock_lock(cache_lock);
+
+   while(!prefetch_quit)
+   {
+      CachedBlock *cb;
+      uint32_t block;
+      bool ok = false;
+
+      if(PrefetchQueue.empty())
+      {
+         scond_wait(prefetch_cond, cache_lock);
+         continue;
+      }
+
+      block = PrefetchQueue.front();
+      PrefetchQueue.pop_front();
+
+      if(FindCacheEntry(block) || !(cb = ClaimCacheEntry(block)))
+         continue;
+
+      slock_unlock(cache_lock);
+
+      try
+      {
+         ok = source->DecodeBlock(dec, block, cb->data);
+      }
+      catch(std::exception &e)
+      {
+         // Left for the read thread to retry and report.
+      }
+
+      slock_lock(cache_lock);
+
+      cb->state = ok ? BLOCK_READY : BLOCK_EMPTY;
+      cb->prefetched = ok;
+      scond_broadcast(cache_cond);
+   }
+
+   slock_unlock(cache_lock);
+
+   source->DestroyBlockDecoder(dec);
+}
+
+bool CDBlockCache::Read(uint32_t block, uint32_t offset, uint8_t *buf, uint32_t len)
+{
+   CachedBlock *cb;
+
+   slock_lock(cache_lock);
+
+   for(;;)
+   {
+      bool ok;
+
+      cb = FindCacheEntry(block);
+
+      if(cb && cb->state == BLOCK_DECODING)
+      {
+         scond_wait(cache_cond, cache_lock);
+         continue;
+      }
+
+      if(cb)
+      {
+         stats.hits++;
+         if(cb->prefetched)
+         {
+            stats.prefetch_hits++;
+            cb->prefetched = false;
+         }
+         break;
+      }
+
+      // Not cached or on its way; decode it here.
+      if(!(cb = ClaimCacheEntry(block)))
+      {
+         scond_wait(cache_cond, cache_lock);
+         continue;
+      }
+
+      stats.misses++;
+
+      slock_unlock(cache_lock);
+
+      try
+      {
+         ok = source->DecodeBlock(read_decoder, block, cb->data);
+      }
+      catch(...)
+      {
+         slock_lock(cache_lock);
+         cb->state = BLOCK_EMPTY;
+         scond_broadcast(cache_cond);
+         slock_unlock(cache_lock);
+         throw;
+      }
+
+      slock_lock(cache_lock);
+
+      cb->state = ok ? BLOCK_READY : BLOCK_EMPTY;
+      scond_broadcast(cache_cond);
+
+      if(!ok)
+      {
+         slock_unlock(cache_lock);
+         return false;
+      }
+      break;
+   }
+
+   cb->last_used = ++cache_clock;
+   memcpy(buf, cb->data + offset, len);
+
+   // Only worth reading ahead of what looks like a sequential read(the
+   // block before is still cached); random access would just waste the
+   // decoding.
+   if(block == 0 || FindCacheEntry(block - 1))
+      QueuePrefetch(block);
+
+   slock_unlock(cache_lock);
+
+   return true;
+}
+
+// Waits out any decoding in progress, then empties the cache.
+void CDBlockCache::Flush(void)
+{
+   if(!cache_lock)
+      return;
+
+   slock_lock(cache_lock);
+
+   PrefetchQueue.clear();
+
+   for(size_t i = 0; i < Cache.size(); i++)
+   {
+      while(Cache[i].state == BLOCK_DECODING)
+         scond_wait(cache_cond, cache_lock);
+
+      Cache[i].state = BLOCK_EMPTY;
+   }
+
+   slock_unlock(cache_lock);
+}
+
+void CDBlockCache::SetBlockCount(uint32_t block_count_)
+{
+   if(!cache_lock)
+   {
+      block_count = block_count_;
+      return;
+   }
+
+   slock_lock(cache_lock);
+   block_count = block_count_;
+   slock_unlock(cache_lock);
+}
+
+void CDBlockCache::GetStats(CDBlockCacheStats *stats_out)
+{
+   if(!cache_lock)
+   {
+      *stats_out = stats;
+      return;
+   }
+
+   slock_lock(cache_lock);
+   *stats_out = stats;
+   slock_unlock(cache_lock);
+}
@@ -0,0 +1,108 @@
+#ifndef __MDFN_CDROM_CDBLOCKCACHE_H
+#define __MDFN_CDROM_CDBLOCKCACHE_H
+
+#include <stdint.h>
+
+#include <vector>
+#include <deque>
+
+#include <rthreads/rthreads.h>
+
+struct CDBlockCacheStats
+{
+   uint64_t hits;	// Block was already decoded when read
+   uint64_t prefetch_hits;	// ...and it was a prefetch thread that did it
+   uint64_t misses;	// Block had to be decoded on the spot
+};
+
+// What CDBlockCache decodes blocks from: a compressed image backend.
+class CDBlockSource
+{
+   public:
+
+      virtual ~CDBlockSource() { }
+
+      // Per-thread decoding state, handed back to DecodeBlock().
+      virtual void *CreateBlockDecoder(void) = 0;
+      virtual void DestroyBlockDecoder(void *dec) = 0;
+
+      // Decodes "block" into dest(block_bytes long).  Called from several
+      // threads at once, each with its own decoder.  Errors are returned as
+      // false or thrown, and reach whoever read the block.
+      virtual bool DecodeBlock(void *dec, uint32_t block, uint8_t *dest) = 0;
+};
+
+// LRU cache of decoded image blocks, shared by the compressed image formats
+// (CHD, PBP).  When reads look sequential, the blocks just past the one read
+// are decoded ahead of time on worker threads.
+class CDBlockCache
+{
+   public:
+
+      CDBlockCache();
+      ~CDBlockCache();
+
+      void Start(CDBlockSource *source, uint32_t block_bytes, uint32_t block_count, uint32_t cache_blocks,
+            uint32_t prefetch_blocks, unsigned threads);
+
+      // Waits for the prefetch threads to finish; the source can go away after this.
+      void Stop(void);
+
+      // Copies len bytes at offset in "block" to buf.  Returns false(or
+      // throws) if the block couldn't be decoded.
+      bool Read(uint32_t block, uint32_t offset, uint8_t *buf, uint32_t len);
+
+      // Drops every cached block, for when what the block numbers refer to
+      // is about to change.
+      void Flush(void);
+
+      // Blocks past the end aren't prefetched.
+      void SetBlockCount(uint32_t block_count);
+
+      void GetStats(CDBlockCacheStats *stats_out);
+
+      // FIXME: Semi-private:
+      void PrefetchThreadStart(void);
+
+   private:
+
+      enum
+      {
+         BLOCK_EMPTY = 0,
+         BLOCK_DECODING,
+         BLOCK_READY
+      };
+
+      struct CachedBlock
+      {
+         uint32_t block;
+         int state;
+         bool prefetched;	// Decoded by a prefetch thread and not read yet
+         uint32_t last_used;
+         uint8_t *data;
+      };
+
+      CDBlockSource *source;
+      uint32_t block_bytes;
+      uint32_t block_count;
+      uint32_t prefetch_blocks;
+
+      std::vector<CachedBlock> Cache;
+      uint8_t *cache_data;
+      uint32_t cache_clock;
+      slock_t *cache_lock;
+      scond_t *cache_cond;	// A block finished decoding.
+      CDBlockCacheStats stats;
+
+      void *read_decoder;	// For blocks the read thread has to decode itself
+      std::deque<uint32_t> PrefetchQueue;
+      scond_t *prefetch_cond;
+      std::vector<sthread_t *> PrefetchThreads;
+      bool prefetch_quit;
+
+      CachedBlock *FindCacheEntry(uint32_t block);
+      CachedBlock *ClaimCacheEntry(uint32_t block);
+      void QueuePrefetch(uint32_t block);
+};
+
+#endif
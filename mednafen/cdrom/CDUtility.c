@@ -134,6 +134,13 @@ void encode_mode2_form2_sector(uint32_t aba, uint8_t *sector_data)
    lec_encode_mode2_form2_sector(aba, sector_data);
 }
 
+void encode_mode1_parity(uint8_t *sector_data)
+{
+   CDUtility_Init();
+
+   lec_encode_mode1_parity(sector_data);
+}
+
 bool edc_check(const uint8_t *sector_data, bool xa)
 {
    CDUtility_Init();
@@ -174,6 +174,7 @@ void encode_mode1_sector(uint32_t aba, uint8_t *sector_data);	// 2048 bytes of u
 void encode_mode2_sector(uint32_t aba, uint8_t *sector_data);	// 2336 bytes of user data at offset 16 
 void encode_mode2_form1_sector(uint32_t aba, uint8_t *sector_data);	// 2048+8 bytes of user data at offset 16
 void encode_mode2_form2_sector(uint32_t aba, uint8_t *sector_data);	// 2324+8 bytes of user data at offset 16
+void encode_mode1_parity(uint8_t *sector_data);	// Only the P/Q parity of an otherwise complete mode 1 sector
 
 
 // out_buf must be able to contain 2352+96 bytes.
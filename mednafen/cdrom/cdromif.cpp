@@ -20,9 +20,11 @@
 #include <sys/types.h>
 #include "cdromif.h"
 #include "CDAccess.h"
+#include "xa_adpcm.h"
 #include "../general.h"
 
 #include <algorithm>
+#include <map>
 
 #include <rthreads/rthreads.h>
 #include <retro_miscellaneous.h>
@@ -41,6 +43,7 @@ enum
    // Command messages.
    CDIF_MSG_DIEDIEDIE,
    CDIF_MSG_READ_SECTOR,
+   CDIF_MSG_HINT_SECTOR,
    CDIF_MSG_EJECT
 };
 
@@ -101,6 +104,9 @@ class CDIF_MT : public CDIF
       // Returns false on failure(usually drive error of some kind; not completely fatal, can try again).
       virtual bool Eject(bool eject_status);
 
+      virtual void GetReadStats(CDIF_ReadStats *stats);
+      virtual bool ReadDecodedXA(const uint8 *sector, int16 previous[2][2], int16 *out_l, int16 *out_r, int32 *out_count);
+
       // FIXME: Semi-private:
       int ReadThreadStart(void);
 
@@ -116,22 +122,63 @@ class CDIF_MT : public CDIF
       CDIF_Queue EmuThreadQueue;
 
 
+      // Sector LBA N is always buffered in SectorBuffers[N % SBSize], so a
+      // lookup is a single tag compare instead of a scan.  The read-ahead
+      // window is kept well under SBSize, so a sector isn't overwritten
+      // before the emulator gets to it.
       enum { SBSize = 256 };
       CDIF_Sector_Buffer SectorBuffers[SBSize];
 
-      uint32 SBWritePos;
-
       slock_t *SBMutex;
       scond_t *SBCond;
 
+      // Decoded audio of the CD-XA ADPCM sectors read ahead, in
+      // XABuffers[LBA % XABSize](allocated when the first one turns up);
+      // protected by SBMutex, like the sector buffers.
+      struct XA_Buffer
+      {
+         bool valid;
+         uint32 lba;
+         int16 prev_in[2][2];	// Predictor state the decode started from, and ended with.
+         int16 prev_out[2][2];
+         int32 count;
+         uint8 source[XA_ADPCM_SOURCE_SIZE];
+         int16 samples[2][XA_ADPCM_MAX_SAMPLES];
+      };
+
+      enum { XABSize = 64 };
+      XA_Buffer *XABuffers[XABSize];
+
+      //
+      // Emu-thread-only:
+      //
+      uint32 last_emu_lba;
+      CDIF_ReadStats stats;
+
       //
       // Read-thread-only:
       //
       void RT_EjectDisc(bool eject_status, bool skip_actual_eject = false);
+      void RT_ResetReadAhead(void);
+      void RT_ReadSector(uint32 new_lba, bool missed);
+      void RT_HintSector(uint32 new_lba);
 
       uint32 ra_lba;
       int ra_count;
+      int ra_window;
       uint32 last_read_lba;
+
+      // Predictor state per interleaved file/channel stream, as if each were
+      // played through from where the read thread first saw it.
+      struct XA_Predictor
+      {
+         int16 previous[2][2];
+      };
+
+      void RT_DecodeXA(uint32 lba, const uint8 *buf);
+
+      std::map<uint16, XA_Predictor> xa_streams;
+      XA_Buffer *xa_decode_buf;
 };
 
 /* TODO: prohibit copy constructor */
@@ -161,6 +208,16 @@ CDIF::~CDIF()
 
 }
 
+bool CDIF::ReadDecodedXA(const uint8 *sector, int16 previous[2][2], int16 *out_l, int16 *out_r, int32 *out_count)
+{
+   return false;
+}
+
+void CDIF::GetReadStats(CDIF_ReadStats *stats)
+{
+   memset(stats, 0, sizeof(CDIF_ReadStats));
+}
+
 
 CDIF_Message::CDIF_Message()
 {
@@ -262,14 +319,124 @@ void CDIF_MT::RT_EjectDisc(bool eject_status, bool skip_actual_eject)
             throw(MDFN_Error(0, _("TOC first(%d)/last(%d) track numbers bad."), disc_toc.first_track, disc_toc.last_track));
       }
 
-      SBWritePos = 0;
-      ra_lba = 0;
-      ra_count = 0;
-      last_read_lba = ~0U;
+      RT_ResetReadAhead();
+
+      slock_lock((slock_t*)SBMutex);
       memset(SectorBuffers, 0, SBSize * sizeof(CDIF_Sector_Buffer));
+
+      for(unsigned i = 0; i < XABSize; i++)
+      {
+         if(XABuffers[i])
+            XABuffers[i]->valid = false;
+      }
+      slock_unlock((slock_t*)SBMutex);
+
+      xa_streams.clear();
    }
 }
 
+// Read-ahead policy.  While the emulator reads sequentially, the read thread
+// stays ra_window sectors ahead of it; the window doubles whenever a
+// sequential read still had to wait on the thread, and halves when a seek
+// throws away most of what had been read ahead(games that hop around the
+// disc don't gain anything from a large window).  A seek, or a Setloc hint
+// from the CDC, starts a full window at the target straight away instead of
+// waiting for the emulator to ask for each sector.
+enum
+{
+   RA_WINDOW_MIN = 1,
+   RA_WINDOW_INITIAL = 16,
+   RA_WINDOW_MAX = 64
+};
+
+void CDIF_MT::RT_ResetReadAhead(void)
+{
+   ra_lba = 0;
+   ra_count = 0;
+   ra_window = RA_WINDOW_INITIAL;
+   last_read_lba = ~0U;
+}
+
+void CDIF_MT::RT_ReadSector(uint32 new_lba, bool missed)
+{
+   const bool sequential = (last_read_lba != ~0U && new_lba == (last_read_lba + 1));
+   const bool pending = (uint32)(new_lba - ra_lba) < (uint32)ra_count;
+   const int32 how_far_ahead = (int32)(ra_lba - new_lba);
+   const CDIF_Sector_Buffer *sb = &SectorBuffers[new_lba % SBSize];
+   bool buffered;
+
+   // "missed" was decided before the message got here; a hint handled in the meantime may have read another sector
+   // into the slot since, and the emulator waits on new_lba either way.
+   slock_lock((slock_t*)SBMutex);
+   buffered = sb->valid && sb->lba == new_lba;
+   slock_unlock((slock_t*)SBMutex);
+
+   if(sequential)
+   {
+      if(missed)
+         ra_window = MIN(ra_window * 2, (int)RA_WINDOW_MAX);
+   }
+   else if(new_lba != last_read_lba && last_read_lba != ~0U)
+   {
+      const int32 unused = (int32)(ra_lba - (last_read_lba + 1));
+
+      if(unused >= ra_window / 2 && unused <= RA_WINDOW_MAX)
+         ra_window = MAX(ra_window / 2, (int)RA_WINDOW_MIN);
+   }
+
+   if(pending)
+   {
+      // Going to be read shortly anyway.
+   }
+   else if(missed || !buffered)
+   {
+      ra_lba = new_lba;
+      ra_count = 0;
+   }
+   else if(how_far_ahead <= 0 || how_far_ahead > RA_WINDOW_MAX)
+   {
+      // A hint moved the read position away from the sectors being streamed.
+      ra_lba = new_lba + 1;
+      ra_count = 0;
+   }
+
+   ra_count = MAX(ra_count, ra_window - (int32)(ra_lba - new_lba));
+   last_read_lba = new_lba;
+}
+
+void CDIF_MT::RT_HintSector(uint32 new_lba)
+{
+   if((uint32)(new_lba - ra_lba) < (uint32)ra_count)
+      return;
+
+   ra_lba = new_lba;
+   ra_count = ra_window;
+}
+
+void CDIF_MT::RT_DecodeXA(uint32 lba, const uint8 *buf)
+{
+   const XA_Subheader *sh = (const XA_Subheader *)&buf[12 + 4];
+   XA_Predictor *pred = &xa_streams[(sh->file << 8) | sh->channel];
+   XA_Buffer *xb;
+
+   if(!xa_decode_buf)
+      xa_decode_buf = new XA_Buffer;
+
+   xb = xa_decode_buf;
+   xb->lba = lba;
+   memcpy(xb->prev_in, pred->previous, sizeof(xb->prev_in));
+   memcpy(xb->source, buf + 12 + 4, sizeof(xb->source));
+   xb->count = XA_DecodeSector(buf, xb->samples[0], xb->samples[1], pred->previous);
+   memcpy(xb->prev_out, pred->previous, sizeof(xb->prev_out));
+   xb->valid = true;
+
+   // Swap it in; whatever was in the slot becomes the next decode buffer.
+   slock_lock((slock_t*)SBMutex);
+   xa_decode_buf = XABuffers[lba % XABSize];
+   XABuffers[lba % XABSize] = xb;
+   slock_unlock((slock_t*)SBMutex);
+}
+
 struct RTS_Args
 {
    CDIF_MT *cdif_ptr;
@@ -287,10 +454,7 @@ int CDIF_MT::ReadThreadStart()
    bool Running = TRUE;
 
    DiscEjected = true;
-   SBWritePos = 0;
-   ra_lba = 0;
-   ra_count = 0;
-   last_read_lba = ~0U;
+   RT_ResetReadAhead();
 
    try
    {
@@ -331,31 +495,11 @@ int CDIF_MT::ReadThreadStart()
                break;
 
             case CDIF_MSG_READ_SECTOR:
-               {
-                  static const int       max_ra = 16;
-                  static const int   initial_ra = 1;
-                  static const int speedmult_ra = 2;
-                  uint32_t              new_lba = msg.args[0];
-
-                  assert((unsigned int)max_ra < (SBSize / 4));
-
-                  if(last_read_lba != ~0U && new_lba == (last_read_lba + 1))
-                  {
-                     int how_far_ahead = ra_lba - new_lba;
-
-                     if(how_far_ahead <= max_ra)
-                        ra_count = MIN(speedmult_ra, 1 + max_ra - how_far_ahead);
-                     else
-                        ra_count++;
-                  }
-                  else if(new_lba != last_read_lba)
-                  {
-                     ra_lba = new_lba;
-                     ra_count = initial_ra;
-                  }
-
-                  last_read_lba = new_lba;
-               }
+               RT_ReadSector(msg.args[0], msg.args[1]);
+               break;
+
+            case CDIF_MSG_HINT_SECTOR:
+               RT_HintSector(msg.args[0]);
                break;
          }
       }
@@ -383,13 +527,19 @@ int CDIF_MT::ReadThreadStart()
             error_condition = true;
          }
 
+         // Before the sector itself shows up, so the audio is ready by the
+         // time the CDC gets to it.
+         if(!error_condition && XA_IsADPCMSector(tmpbuf))
+            RT_DecodeXA(ra_lba, tmpbuf);
+
          slock_lock((slock_t*)SBMutex);
 
-         SectorBuffers[SBWritePos].lba = ra_lba;
-         memcpy(SectorBuffers[SBWritePos].data, tmpbuf, 2352 + 96);
-         SectorBuffers[SBWritePos].valid = TRUE;
-         SectorBuffers[SBWritePos].error = error_condition;
-         SBWritePos = (SBWritePos + 1) % SBSize;
+         CDIF_Sector_Buffer *sb = &SectorBuffers[ra_lba % SBSize];
+
+         sb->lba = ra_lba;
+         memcpy(sb->data, tmpbuf, 2352 + 96);
+         sb->valid = TRUE;
+         sb->error = error_condition;
 
          scond_signal((scond_t*)SBCond);
          slock_unlock((slock_t*)SBMutex);
@@ -402,8 +552,11 @@ int CDIF_MT::ReadThreadStart()
    return(1);
 }
 
-CDIF_MT::CDIF_MT(CDAccess *cda) : disc_cdaccess(cda), CDReadThread(NULL), SBMutex(NULL), SBCond(NULL)
+CDIF_MT::CDIF_MT(CDAccess *cda) : disc_cdaccess(cda), CDReadThread(NULL), SBMutex(NULL), SBCond(NULL), last_emu_lba(~0U), xa_decode_buf(NULL)
 {
+   memset(&stats, 0, sizeof(stats));
+   memset(XABuffers, 0, sizeof(XABuffers));
+
    try
    {
       CDIF_Message msg;
@@ -466,12 +619,37 @@ CDIF_MT::~CDIF_MT()
    if(!thread_deaded_failed)
       sthread_join((sthread_t*)CDReadThread);
 
+   if(stats.hits || stats.misses)
+      log_cb(RETRO_LOG_INFO, "CD sector reads: %llu hits, %llu misses, %llu stalls.\n",
+            (unsigned long long)stats.hits, (unsigned long long)stats.misses, (unsigned long long)stats.stalls);
+
    if(SBMutex)
    {
       slock_free((slock_t*)SBMutex);
       SBMutex = NULL;
    }
 
+   if(SBCond)
+   {
+      scond_free((scond_t*)SBCond);
+      SBCond = NULL;
+   }
+
+   for(unsigned i = 0; i < XABSize; i++)
+   {
+      if(XABuffers[i])
+      {
+         delete XABuffers[i];
+         XABuffers[i] = NULL;
+      }
+   }
+
+   if(xa_decode_buf)
+   {
+      delete xa_decode_buf;
+      xa_decode_buf = NULL;
+   }
+
    if(disc_cdaccess)
    {
       delete disc_cdaccess;
@@ -494,8 +672,9 @@ bool CDIF::ValidateRawSector(uint8 *buf)
 
 bool CDIF_MT::ReadRawSector(uint8 *buf, uint32 lba)
 {
-   bool found = FALSE;
+   CDIF_Sector_Buffer *sb = &SectorBuffers[lba % SBSize];
    bool error_condition = false;
+   bool missed;
 
    if(UnrecoverableError)
    {
@@ -511,29 +690,33 @@ bool CDIF_MT::ReadRawSector(uint8 *buf, uint32 lba)
       return(FALSE);
    }
 
-   ReadThreadQueue.Write(CDIF_Message(CDIF_MSG_READ_SECTOR, lba));
-
    slock_lock((slock_t*)SBMutex);
 
-   do
-   {
-      int i;
-      for(i = 0; i < SBSize; i++)
-      {
-         if(SectorBuffers[i].valid && SectorBuffers[i].lba == lba)
-         {
-            error_condition = SectorBuffers[i].error;
-            memcpy(buf, SectorBuffers[i].data, 2352 + 96);
-            found = TRUE;
-         }
-      }
+   missed = !(sb->valid && sb->lba == lba);
 
-      if(!found)
-         scond_wait((scond_t*)SBCond, (slock_t*)SBMutex);
-   } while(!found);
+   // Tell the read thread whether it's keeping up, so it can size its read-ahead.
+   ReadThreadQueue.Write(CDIF_Message(CDIF_MSG_READ_SECTOR, lba, missed));
+
+   while(!(sb->valid && sb->lba == lba))
+      scond_wait((scond_t*)SBCond, (slock_t*)SBMutex);
+
+   error_condition = sb->error;
+   memcpy(buf, sb->data, 2352 + 96);
 
    slock_unlock((slock_t*)SBMutex);
 
+   if(missed)
+   {
+      stats.misses++;
+
+      if(last_emu_lba != ~0U && lba == (last_emu_lba + 1))
+         stats.stalls++;
+   }
+   else
+      stats.hits++;
+
+   last_emu_lba = lba;
+
    return(!error_condition);
 }
 
@@ -565,10 +748,45 @@ bool CDIF_MT::ReadRawSectorPWOnly(uint8 *buf, uint32 lba, bool hint_fullread)
 
 void CDIF_MT::HintReadSector(uint32 lba)
 {
-   if(UnrecoverableError)
+   if(UnrecoverableError || lba >= disc_toc.tracks[100].lba)
       return;
 
-   ReadThreadQueue.Write(CDIF_Message(CDIF_MSG_READ_SECTOR, lba));
+   ReadThreadQueue.Write(CDIF_Message(CDIF_MSG_HINT_SECTOR, lba));
+}
+
+void CDIF_MT::GetReadStats(CDIF_ReadStats *stats_out)
+{
+   *stats_out = stats;
+}
+
+bool CDIF_MT::ReadDecodedXA(const uint8 *sector, int16 previous[2][2], int16 *out_l, int16 *out_r, int32 *out_count)
+{
+   const int32 lba = AMSF_to_LBA(BCD_to_U8(sector[12 + 0]), BCD_to_U8(sector[12 + 1]), BCD_to_U8(sector[12 + 2]));
+   bool ret = false;
+
+   if(lba < 0)
+      return false;
+
+   slock_lock((slock_t*)SBMutex);
+   {
+      const XA_Buffer *xb = XABuffers[lba % XABSize];
+
+      // Same sector data and same starting state means the same output, so
+      // this is exact; anything else falls back to decoding it again.
+      if(xb && xb->valid && xb->lba == (uint32)lba &&
+            !memcmp(xb->prev_in, previous, sizeof(xb->prev_in)) &&
+            !memcmp(xb->source, sector + 12 + 4, sizeof(xb->source)))
+      {
+         memcpy(out_l, xb->samples[0], xb->count * sizeof(int16));
+         memcpy(out_r, xb->samples[1], xb->count * sizeof(int16));
+         memcpy(previous, xb->prev_out, sizeof(xb->prev_out));
+         *out_count = xb->count;
+         ret = true;
+      }
+   }
+   slock_unlock((slock_t*)SBMutex);
+
+   return ret;
 }
 
 int CDIF::ReadSector(uint8* pBuf, uint32 lba, uint32 nSectors)
@@ -749,6 +967,205 @@ bool CDIF_ST::Eject(bool eject_status)
 }
 
 
+// Disc of a multi-disc set that isn't in the drive.  Only the TOC is kept
+// around; the real reader(with its thread, or its in-memory copy of the
+// image) is opened when the disc is made active, and thrown away again when
+// another disc takes its place.
+class CDIF_Lazy : public CDIF
+{
+   public:
+
+      CDIF_Lazy(const char *path, bool image_memcache);
+      virtual ~CDIF_Lazy();
+
+      virtual void HintReadSector(uint32 lba);
+      virtual bool ReadRawSector(uint8 *buf, uint32 lba);
+      virtual bool ReadRawSectorPWOnly(uint8 *buf, uint32 lba, bool hint_fullread);
+      virtual bool Eject(bool eject_status);
+      virtual void GetReadStats(CDIF_ReadStats *stats);
+      virtual bool ReadDecodedXA(const uint8 *sector, int16 previous[2][2], int16 *out_l, int16 *out_r, int32 *out_count);
+      virtual void SetActive(bool active);
+
+   private:
+
+      CDAccess *Probe(void);
+
+      std::string path;
+      bool image_memcache;
+
+      CDIF *live;		// Non-NULL while active.
+      CDAccess *probe;	// Direct, uncached access for the odd read while inactive.
+};
+
+CDIF_Lazy::CDIF_Lazy(const char *path_arg, bool image_memcache_arg) : path(path_arg), image_memcache(image_memcache_arg), live(NULL), probe(NULL)
+{
+   UnrecoverableError = false;
+   DiscEjected = false;
+
+   Probe()->Read_TOC(&disc_toc);
+
+   if(disc_toc.first_track < 1 || disc_toc.last_track > 99 || disc_toc.first_track > disc_toc.last_track)
+   {
+      delete probe;
+      probe = NULL;
+      throw(MDFN_Error(0, _("TOC first(%d)/last(%d) track numbers bad."), disc_toc.first_track, disc_toc.last_track));
+   }
+}
+
+CDIF_Lazy::~CDIF_Lazy()
+{
+   if(live)
+   {
+      delete live;
+      live = NULL;
+   }
+
+   if(probe)
+   {
+      delete probe;
+      probe = NULL;
+   }
+}
+
+CDAccess *CDIF_Lazy::Probe(void)
+{
+   if(!probe)
+      probe = cdaccess_open_image(path.c_str(), false);
+
+   return probe;
+}
+
+void CDIF_Lazy::SetActive(bool active)
+{
+   if(!active)
+   {
+      if(live)
+      {
+         delete live;
+         live = NULL;
+      }
+
+      if(probe)
+      {
+         delete probe;
+         probe = NULL;
+      }
+      return;
+   }
+
+   if(live)
+      return;
+
+   if(probe)
+   {
+      delete probe;
+      probe = NULL;
+   }
+
+   try
+   {
+      live = CDIF_Open(path.c_str(), false, image_memcache);
+
+      if(DiscEjected)
+         live->Eject(true);
+      else
+         live->ReadTOC(&disc_toc);
+   }
+   catch(std::exception &e)
+   {
+      log_cb(RETRO_LOG_ERROR, "Error opening disc \"%s\": %s\n", path.c_str(), e.what());
+
+      if(live)
+      {
+         delete live;
+         live = NULL;
+      }
+   }
+}
+
+void CDIF_Lazy::HintReadSector(uint32 lba)
+{
+   if(live)
+      live->HintReadSector(lba);
+}
+
+bool CDIF_Lazy::ReadRawSector(uint8 *buf, uint32 lba)
+{
+   if(live)
+      return live->ReadRawSector(buf, lba);
+
+   try
+   {
+      Probe()->Read_Raw_Sector(buf, lba);
+   }
+   catch(std::exception &e)
+   {
+      log_cb(RETRO_LOG_ERROR, "Sector %u read error: %s\n", lba, e.what());
+      memset(buf, 0, 2352 + 96);
+      return(false);
+   }
+
+   return(true);
+}
+
+bool CDIF_Lazy::ReadRawSectorPWOnly(uint8 *buf, uint32 lba, bool hint_fullread)
+{
+   uint8 tmpbuf[2352 + 96];
+   bool ret;
+
+   if(live)
+      return live->ReadRawSectorPWOnly(buf, lba, hint_fullread);
+
+   if(lba >= disc_toc.tracks[100].lba)
+   {
+      memset(buf, 0, 96);
+      return(false);
+   }
+
+   ret = ReadRawSector(tmpbuf, lba);
+   memcpy(buf, tmpbuf + 2352, 96);
+
+   return ret;
+}
+
+bool CDIF_Lazy::Eject(bool eject_status)
+{
+   // An inactive disc just remembers the tray state, it's applied once the
+   // disc is opened for real.
+   if(live)
+   {
+      if(!live->Eject(eject_status))
+         return(false);
+
+      live->ReadTOC(&disc_toc);
+   }
+
+   DiscEjected = eject_status;
+
+   return(true);
+}
+
+void CDIF_Lazy::GetReadStats(CDIF_ReadStats *stats)
+{
+   if(live)
+      live->GetReadStats(stats);
+   else
+      CDIF::GetReadStats(stats);
+}
+
+bool CDIF_Lazy::ReadDecodedXA(const uint8 *sector, int16 previous[2][2], int16 *out_l, int16 *out_r, int32 *out_count)
+{
+   if(live)
+      return live->ReadDecodedXA(sector, previous, out_l, out_r, out_count);
+
+   return false;
+}
+
+void CDIF::SetActive(bool active)
+{
+
+}
+
 class CDIF_Stream_Thing : public Stream
 {
    public:
@@ -894,3 +1311,8 @@ CDIF *CDIF_Open(const char *path, const bool is_device, bool image_memcache)
       return new CDIF_MT(cda);
    return new CDIF_ST(cda); 
 }
+
+CDIF *CDIF_OpenLazy(const char *path, bool image_memcache)
+{
+   return new CDIF_Lazy(path, image_memcache);
+}
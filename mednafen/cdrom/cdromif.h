@@ -25,6 +25,13 @@
 
 typedef TOC CD_TOC;
 
+struct CDIF_ReadStats
+{
+   uint64_t hits;	// Sector was already buffered when asked for
+   uint64_t misses;	// Had to wait for the sector to be read
+   uint64_t stalls;	// Misses during sequential reads, where read-ahead didn't keep up
+};
+
 class CDIF
 {
    public:
@@ -53,6 +60,19 @@ class CDIF
       // Returns false on failure(usually drive error of some kind; not completely fatal, can try again).
       virtual bool Eject(bool eject_status) = 0;
 
+      // Sector read counters, only kept by the threaded reader.
+      virtual void GetReadStats(CDIF_ReadStats *stats);
+
+      // CD-XA ADPCM audio sectors are decoded by the read thread as they're read
+      // ahead.  If "sector" was, and its decode started from the same predictor
+      // state as "previous", copy out the samples, advance "previous" and return
+      // true; otherwise the caller has to decode it with XA_DecodeSector().
+      virtual bool ReadDecodedXA(const uint8_t *sector, int16_t previous[2][2], int16_t *out_l, int16_t *out_r, int32_t *out_count);
+
+      // Discs opened with CDIF_OpenLazy() only hold on to a reader(and its thread
+      // and caches) while active; a no-op for everything else.
+      virtual void SetActive(bool active);
+
       // For Mode 1, or Mode 2 Form 1.
       // No reference counting or whatever is done, so if you destroy the CDIF object before you destroy the returned Stream, things will go BOOM.
       Stream *MakeStream(uint32_t lba, uint32_t sector_count);
@@ -65,4 +85,8 @@ class CDIF
 
 CDIF *CDIF_Open(const char *path, const bool is_device, bool image_memcache);
 
+// Reads just the TOC up front, for discs of a multi-disc set that may never be
+// inserted.  See CDIF::SetActive().
+CDIF *CDIF_OpenLazy(const char *path, bool image_memcache);
+
 #endif
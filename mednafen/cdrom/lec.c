@@ -525,6 +525,15 @@ void lec_encode_mode2_form2_sector(uint32_t adr, uint8_t *sector)
    set_sector_header(2, adr, sector);
 }
 
+/* Regenerates the P and Q parities of a MODE 1 sector.
+ * 'sector' must be 2352 byte wide
+ */
+void lec_encode_mode1_parity(uint8_t *sector)
+{
+   calc_P_parity(sector);
+   calc_Q_parity(sector);
+}
+
 /* Scrambles and byte swaps an encoded sector.
  * 'sector' must be 2352 byte wide.
  */
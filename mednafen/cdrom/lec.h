@@ -65,6 +65,11 @@ void lec_encode_mode2_form1_sector(uint32_t adr, uint8_t *sector);
  */
 void lec_encode_mode2_form2_sector(uint32_t adr, uint8_t *sector);
 
+/* Regenerates only the P and Q parities of a MODE 1 sector from what is
+ * already in its header, user data, EDC and intermediate fields.
+ */
+void lec_encode_mode1_parity(uint8_t *sector);
+
 /* Scrambles and byte swaps an encoded sector.
  * 'sector' must be 2352 byte wide.
  */
@@ -0,0 +1,118 @@
+/* Mednafen - Multi-system Emulator
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "../mednafen.h"
+#include "../clamp.h"
+#include "xa_adpcm.h"
+
+#include <string.h>
+
+//
+// output should be readable at -2 and -1
+static void DecodeXAADPCM(const uint8 *input, int16 *output, const unsigned shift, const unsigned weight)
+{
+   // Weights copied over from SPU channel ADPCM playback code, 
+   // may not be entirely the same for CD-XA ADPCM, we need to run tests.
+   static const int32 Weights[16][2] =
+   {
+      // s-1    s-2
+      {   0,    0 },
+      {  60,    0 },
+      { 115,  -52 },
+      {  98,  -55 },
+      { 122,  -60 },
+   };
+
+   for(int i = 0; i < 28; i++)
+   {
+      int32 sample = (int16)(input[i] << 8);
+      sample >>= shift;
+
+      sample += ((output[i - 1] * Weights[weight][0]) >> 6) + ((output[i - 2] * Weights[weight][1]) >> 6);
+
+      clamp(&sample, -32768, 32767);
+      output[i] = sample;
+   }
+}
+
+unsigned XA_DecodeSector(const uint8 *sdata, int16 *out_l, int16 *out_r, int16 previous[2][2])
+{
+   const XA_Subheader *sh = (const XA_Subheader *)&sdata[12 + 4];
+   const unsigned unit_index_shift = (sh->coding & XA_CODING_8BIT) ? 0 : 1;
+   int16 *out[2] = { out_l, out_r };
+   unsigned count = 18 * (4 << unit_index_shift) * 28;
+
+   if(sh->coding & XA_CODING_STEREO)
+      count >>= 1;
+
+   for(unsigned group = 0; group < 18; group++)
+   {
+      const XA_SoundGroup *sg = (const XA_SoundGroup *)&sdata[12 + 4 + 8 + group * 128];
+
+      for(unsigned unit = 0; unit < (4U << unit_index_shift); unit++)
+      {
+         const uint8 param = sg->params[(unit & 3) | ((unit & 4) << 1)];
+         const uint8 param_copy = sg->params[4 | (unit & 3) | ((unit & 4) << 1)];
+         uint8 ibuffer[28];
+         int16 obuffer[2 + 28];
+
+         for(unsigned i = 0; i < 28; i++)
+         {
+            uint8 tmp = sg->samples[i * 4 + (unit >> unit_index_shift)];
+
+            if(unit_index_shift)
+            {
+               tmp <<= (unit & 1) ? 0 : 4;
+               tmp &= 0xf0;
+            }
+
+            ibuffer[i] = tmp;
+         }
+
+         const bool ocn = (bool)(unit & 1) && (sh->coding & XA_CODING_STEREO);
+
+         obuffer[0] = previous[ocn][0];
+         obuffer[1] = previous[ocn][1];
+
+         DecodeXAADPCM(ibuffer, &obuffer[2], param & 0x0F, param >> 4);
+
+         previous[ocn][0] = obuffer[28];
+         previous[ocn][1] = obuffer[29];
+
+         if(param != param_copy)
+            memset(obuffer, 0, sizeof(obuffer));
+
+         if(sh->coding & XA_CODING_STEREO)
+         {
+            for(unsigned s = 0; s < 28; s++)
+            {
+               out[ocn][group * (2 << unit_index_shift) * 28 + (unit >> 1) * 28 + s] = obuffer[2 + s];
+            }
+         }
+         else
+         {
+            for(unsigned s = 0; s < 28; s++)
+            {
+               out_l[group * (4 << unit_index_shift) * 28 + unit * 28 + s] = obuffer[2 + s];
+               out_r[group * (4 << unit_index_shift) * 28 + unit * 28 + s] = obuffer[2 + s];
+            }
+         }
+      }
+   }
+
+   return count;
+}
@@ -0,0 +1,68 @@
+#ifndef __MDFN_CDROM_XA_ADPCM_H
+#define __MDFN_CDROM_XA_ADPCM_H
+
+#include "../mednafen-types.h"
+
+struct XA_Subheader
+{
+   uint8 file;
+   uint8 channel;
+   uint8 submode;
+   uint8 coding;
+
+   uint8 file_dup;
+   uint8 channel_dup;
+   uint8 submode_dup;
+   uint8 coding_dup;
+};
+
+struct XA_SoundGroup
+{
+   uint8 params[16];
+   uint8 samples[112];
+};
+
+#define XA_SUBMODE_EOF		0x80
+#define XA_SUBMODE_REALTIME	0x40
+#define XA_SUBMODE_FORM		0x20
+#define XA_SUBMODE_TRIGGER	0x10
+#define XA_SUBMODE_DATA		0x08
+#define XA_SUBMODE_AUDIO	0x04
+#define XA_SUBMODE_VIDEO	0x02
+#define XA_SUBMODE_EOR		0x01
+
+#define XA_CODING_EMPHASIS	0x40
+
+//#define XA_CODING_BPS_MASK	0x30
+//#define XA_CODING_BPS_4BIT	0x00
+//#define XA_CODING_BPS_8BIT	0x10
+//#define XA_CODING_SR_MASK	0x0C
+//#define XA_CODING_SR_378	0x00
+//#define XA_CODING_SR_
+
+#define XA_CODING_8BIT		0x10
+#define XA_CODING_189		0x04
+#define XA_CODING_STEREO	0x01
+
+enum
+{
+   // Bytes of the sector the decoded audio depends on(subheader and sound groups), starting at offset 12 + 4.
+   XA_ADPCM_SOURCE_SIZE = 8 + 18 * 128,
+
+   // Most samples per channel a sector decodes to(4-bit mono).
+   XA_ADPCM_MAX_SAMPLES = 18 * 8 * 28
+};
+
+// Raw mode 2 form 2 sector with the audio submode bit set.
+static INLINE bool XA_IsADPCMSector(const uint8 *sdata)
+{
+   return (sdata[12 + 3] == 0x2) && ((sdata[12 + 6] & 0x64) == 0x64);
+}
+
+// Decodes the 18 sound groups of a CD-XA ADPCM sector into out_l/out_r(the
+// same samples go to both for mono).  previous[][] holds the last two
+// samples decoded for each channel, and is updated to carry on into the next
+// sector of the stream.  Returns the number of samples written per channel.
+unsigned XA_DecodeSector(const uint8 *sdata, int16 *out_l, int16 *out_r, int16 previous[2][2]);
+
+#endif
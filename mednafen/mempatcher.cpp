@@ -374,12 +374,14 @@ static bool TestConditions(const char *string)
  return(passed);
 }
 
-void MDFNMP_ApplyPeriodicCheats(void)
+// Returns true if any RAM was written.
+bool MDFNMP_ApplyPeriodicCheats(void)
 {
    std::vector<CHEATF>::iterator chit;
+   bool written = false;
 
    if(!CheatsActive)
-      return;
+      return(false);
 
    for(chit = cheats.begin(); chit != cheats.end(); chit++)
    {
@@ -399,10 +401,13 @@ void MDFNMP_ApplyPeriodicCheats(void)
                      tmpval >>= x * 8;
 
                   RAMPtrs[page][(chit->addr + x) % PageSize] = tmpval;
+                  written = true;
                }
             }
       }
    }
+
+   return(written);
 }
 
 
@@ -22,7 +22,7 @@ void MDFNMP_Kill(void);
 void MDFNMP_InstallReadPatches(void);
 void MDFNMP_RemoveReadPatches(void);
 
-void MDFNMP_ApplyPeriodicCheats(void);
+bool MDFNMP_ApplyPeriodicCheats(void);
 
 extern MDFNSetting MDFNMP_Settings[];
 
@@ -51,6 +51,7 @@
 #include "psx.h"
 #include "cdc.h"
 #include "spu.h"
+#include "../cdrom/xa_adpcm.h"
 
 PS_CDC::PS_CDC() : DMABuffer(4096)
 {
@@ -578,47 +579,6 @@ void PS_CDC::GetCDAudio(int32 samples[2])
 }
 
 
-struct XA_Subheader
-{
-   uint8 file;
-   uint8 channel;
-   uint8 submode;
-   uint8 coding;
-
-   uint8 file_dup;
-   uint8 channel_dup;
-   uint8 submode_dup;
-   uint8 coding_dup;
-};
-
-struct XA_SoundGroup
-{
-   uint8 params[16];
-   uint8 samples[112];
-};
-
-#define XA_SUBMODE_EOF		0x80
-#define XA_SUBMODE_REALTIME	0x40
-#define XA_SUBMODE_FORM		0x20
-#define XA_SUBMODE_TRIGGER	0x10
-#define XA_SUBMODE_DATA		0x08
-#define XA_SUBMODE_AUDIO	0x04
-#define XA_SUBMODE_VIDEO	0x02
-#define XA_SUBMODE_EOR		0x01
-
-#define XA_CODING_EMPHASIS	0x40
-
-//#define XA_CODING_BPS_MASK	0x30
-//#define XA_CODING_BPS_4BIT	0x00
-//#define XA_CODING_BPS_8BIT	0x10
-//#define XA_CODING_SR_MASK	0x0C
-//#define XA_CODING_SR_378	0x00
-//#define XA_CODING_SR_
-
-#define XA_CODING_8BIT		0x10
-#define XA_CODING_189		0x04
-#define XA_CODING_STEREO	0x01
-
 // Special regression prevention test cases:
 //	Um Jammer Lammy (start doing poorly)
 //	Yarudora Series Vol.1 - Double Cast (non-FMV speech)
@@ -670,120 +630,19 @@ void PS_CDC::ClearAudioBuffers(void)
    ADPCM_ResampCurPos = 0;
 }
 
-//
-// output should be readable at -2 and -1
-static void DecodeXAADPCM(const uint8 *input, int16 *output, const unsigned shift, const unsigned weight)
-{
-   // Weights copied over from SPU channel ADPCM playback code, 
-   // may not be entirely the same for CD-XA ADPCM, we need to run tests.
-   static const int32 Weights[16][2] =
-   {
-      // s-1    s-2
-      {   0,    0 },
-      {  60,    0 },
-      { 115,  -52 },
-      {  98,  -55 },
-      { 122,  -60 },
-   };
-
-   for(int i = 0; i < 28; i++)
-   {
-      int32 sample = (int16)(input[i] << 8);
-      sample >>= shift;
-
-      sample += ((output[i - 1] * Weights[weight][0]) >> 6) + ((output[i - 2] * Weights[weight][1]) >> 6);
-
-      clamp(&sample, -32768, 32767);
-      output[i] = sample;
-   }
-}
-
 void PS_CDC::XA_ProcessSector(const uint8 *sdata, CD_Audio_Buffer *ab)
 {
    const XA_Subheader *sh = (const XA_Subheader *)&sdata[12 + 4];
-   const unsigned unit_index_shift = (sh->coding & XA_CODING_8BIT) ? 0 : 1;
 
    ab->ReadPos = 0;
-   ab->Size = 18 * (4 << unit_index_shift) * 28;
-
-   if(sh->coding & XA_CODING_STEREO)
-      ab->Size >>= 1;
-
    ab->Freq = (sh->coding & XA_CODING_189) ? 3 : 6;
 
-   //fprintf(stderr, "Coding: %02x %02x\n", sh->coding, sh->coding_dup);
-
-   for(unsigned group = 0; group < 18; group++)
-   {
-      const XA_SoundGroup *sg = (const XA_SoundGroup *)&sdata[12 + 4 + 8 + group * 128];
-
-      for(unsigned unit = 0; unit < (4U << unit_index_shift); unit++)
-      {
-         const uint8 param = sg->params[(unit & 3) | ((unit & 4) << 1)];
-         const uint8 param_copy = sg->params[4 | (unit & 3) | ((unit & 4) << 1)];
-         uint8 ibuffer[28];
-         int16 obuffer[2 + 28];
-
-         if(param != param_copy)
-         {
-            PSX_WARNING("[CDC] CD-XA param != param_copy --- %d %02x %02x\n", unit, param, param_copy);
-         }
-
-         for(unsigned i = 0; i < 28; i++)
-         {
-            uint8 tmp = sg->samples[i * 4 + (unit >> unit_index_shift)];
-
-            if(unit_index_shift)
-            {
-               tmp <<= (unit & 1) ? 0 : 4;
-               tmp &= 0xf0;
-            }
-
-            ibuffer[i] = tmp;
-         }
-
-         const bool ocn = (bool)(unit & 1) && (sh->coding & XA_CODING_STEREO);
-
-         obuffer[0] = xa_previous[ocn][0];
-         obuffer[1] = xa_previous[ocn][1];
-
-         DecodeXAADPCM(ibuffer, &obuffer[2], param & 0x0F, param >> 4);
-
-         xa_previous[ocn][0] = obuffer[28];
-         xa_previous[ocn][1] = obuffer[29];
-
-         if(param != param_copy)
-            memset(obuffer, 0, sizeof(obuffer));
-
-         if(sh->coding & XA_CODING_STEREO)
-         {
-            for(unsigned s = 0; s < 28; s++)
-            {
-               ab->Samples[ocn][group * (2 << unit_index_shift) * 28 + (unit >> 1) * 28 + s] = obuffer[2 + s];
-            }
-         }
-         else
-         {
-            for(unsigned s = 0; s < 28; s++)
-            {
-               ab->Samples[0][group * (4 << unit_index_shift) * 28 + unit * 28 + s] = obuffer[2 + s];
-               ab->Samples[1][group * (4 << unit_index_shift) * 28 + unit * 28 + s] = obuffer[2 + s];
-            }
-         }
-      }
-   }
-
-#if 0
-   // Test
-   for(unsigned i = 0; i < ab->Size; i++)
-   {
-      static unsigned counter = 0;
+   // Usually already decoded on the CD read thread, as the sector was read
+   // ahead; that only fails after seeks, or with the single-threaded reader.
+   if(Cur_CDIF->ReadDecodedXA(sdata, xa_previous, ab->Samples[0], ab->Samples[1], &ab->Size))
+      return;
 
-      ab->Samples[0][i] = (counter & 2) ? -0x6000 : 0x6000;
-      ab->Samples[1][i] = rand();
-      counter++;
-   }
-#endif
+   ab->Size = XA_DecodeSector(sdata, ab->Samples[0], ab->Samples[1], xa_previous);
 }
 
 void PS_CDC::ClearAIP(void)
@@ -1563,6 +1422,11 @@ int32 PS_CDC::Command_Setloc(const int arg_count, const uint8 *args)
    CommandLoc = f + 75 * s + 75 * 60 * m - 150;
    CommandLoc_Dirty = true;
 
+   // Start the CD read thread on the target now; the seek that follows would
+   // otherwise have to wait for it.
+   if(Cur_CDIF)
+      Cur_CDIF->HintReadSector(CommandLoc);
+
    WriteResult(MakeStatus());
    WriteIRQ(CDCIRQ_ACKNOWLEDGE);
 
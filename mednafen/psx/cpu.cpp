@@ -20,6 +20,7 @@
 
 
 extern bool psx_cpu_overclock;
+extern bool psx_cpu_dynarec;
 
 /* TODO
 	Make sure load delays are correct.
@@ -36,13 +37,21 @@ extern bool psx_cpu_overclock;
 
 						// Does lock mode prevent the actual data payload from being modified, while allowing tags to be modified/updated???
 
+#ifdef PS_CPU_DYNAREC
+#include "cpu_dynarec.cpp"
+#endif
+
 PS_CPU::PS_CPU()
 {
    uint64_t a;
    unsigned i;
    Halted = false;
+   ICacheGen = 0;
 
    memset(FastMap, 0, sizeof(FastMap));
+   memset(ReadMap, 0, sizeof(ReadMap));
+   memset(WriteMap, 0, sizeof(WriteMap));
+   memset(ReadMapLatency, 0, sizeof(ReadMapLatency));
    memset(DummyPage, 0xFF, sizeof(DummyPage));	// 0xFF to trigger an illegal instruction exception, so we'll know what's up when debugging.
 
    for(a = 0x00000000; a < (UINT64_C(1) << 32); a += FAST_MAP_PSIZE)
@@ -69,8 +78,9 @@ PS_CPU::PS_CPU()
 
 PS_CPU::~PS_CPU()
 {
-
-
+#ifdef PS_CPU_DYNAREC
+   PS_CPU_Dynarec::Kill();
+#endif
 }
 
 void PS_CPU::SetFastMap(void *region_mem, uint32_t region_address, uint32_t region_size)
@@ -83,6 +93,20 @@ void PS_CPU::SetFastMap(void *region_mem, uint32_t region_address, uint32_t regi
       FastMap[A >> FAST_MAP_SHIFT] = ((uint8_t *)region_mem - region_address);
 }
 
+void PS_CPU::SetDataMap(void *region_mem, uint32_t region_address, uint32_t region_size, bool writable, uint8_t latency)
+{
+   uint64_t A;
+
+   assert(((uint64)region_address + region_size) <= DATA_MAP_LIMIT);
+
+   for(A = region_address; A < (uint64)region_address + region_size; A += FAST_MAP_PSIZE)
+   {
+      ReadMap[A >> FAST_MAP_SHIFT]        = ((uint8_t *)region_mem - region_address);
+      WriteMap[A >> FAST_MAP_SHIFT]       = writable ? ((uint8_t *)region_mem - region_address) : NULL;
+      ReadMapLatency[A >> FAST_MAP_SHIFT] = latency;
+   }
+}
+
 INLINE void PS_CPU::RecalcIPCache(void)
 {
    IPCache = 0;
@@ -147,10 +171,18 @@ void PS_CPU::Power(void)
       ICache[i].TV = 0x2 | ((BIU & 0x800) ? 0x0 : 0x1);
       ICache[i].Data = 0;
    }
+   RecalcICacheOPF();
+   ICacheGen++;
 
    GTE_Power();
 }
 
+void PS_CPU::RecalcICacheOPF(void)
+{
+   for(unsigned i = 0; i < 1024; i++)
+      ICache_OPF[i] = DecodeOPF(ICache[i].Data);
+}
+
 int PS_CPU::StateAction(StateMem *sm, int load, int data_only)
 {
    SFORMAT StateRegs[] =
@@ -193,7 +225,8 @@ int PS_CPU::StateAction(StateMem *sm, int load, int data_only)
 
    if(load)
    {
-
+      RecalcICacheOPF();
+      ICacheGen++;
    }
 
    return(ret);
@@ -231,6 +264,7 @@ void PS_CPU::SetBIU(uint32_t val)
          for(i = 0; i < 1024; i++)
             ICache[i].TV |= 0x1;
       }
+      ICacheGen++;
    }
 
    PSX_DBG(PSX_DBG_SPARSE, "[CPU] Set BIU=0x%08x\n", BIU);
@@ -306,7 +340,26 @@ INLINE T PS_CPU::ReadMemory(int32_t &timestamp, uint32_t address, bool DS24, boo
 
    int32_t lts = timestamp;
 
-   if(sizeof(T) == 1)
+   if(address < DATA_MAP_LIMIT && ReadMap[address >> FAST_MAP_SHIFT])
+   {
+      // MainRAM/BIOS, same timing as MemRW()
+      const uint8_t *mem = ReadMap[address >> FAST_MAP_SHIFT] + address;
+
+      lts += DMACycleSteal;
+
+      if(!psx_cpu_overclock)
+         lts += ReadMapLatency[address >> FAST_MAP_SHIFT];
+
+      if(sizeof(T) == 1)
+         ret = *mem;
+      else if(sizeof(T) == 2)
+         ret = LoadU16_LE((const uint16 *)mem);
+      else if(DS24)
+         ret = mem[0] | (mem[1] << 8) | (mem[2] << 16);
+      else
+         ret = LoadU32_LE((const uint32 *)mem);
+   }
+   else if(sizeof(T) == 1)
       ret = PSX_MemRead8(lts, address);
    else if(sizeof(T) == 2)
       ret = PSX_MemRead16(lts, address);
@@ -358,7 +411,27 @@ INLINE void PS_CPU::WriteMemory(int32_t &timestamp, uint32_t address, uint32_t v
       //WriteAbsorb |= (3U << (WriteAbsorbCount * 8));
       //WriteAbsorbCount++;
 
-      if(sizeof(T) == 1)
+      if(address < DATA_MAP_LIMIT && WriteMap[address >> FAST_MAP_SHIFT])
+      {
+         // MainRAM
+         uint8_t *mem = WriteMap[address >> FAST_MAP_SHIFT] + address;
+
+         MainRAMDirty.Mark(address & 0x1FFFFF);
+
+         if(sizeof(T) == 1)
+            *mem = value;
+         else if(sizeof(T) == 2)
+            StoreU16_LE((uint16 *)mem, value);
+         else if(DS24)
+         {
+            mem[0] = value >> 0;
+            mem[1] = value >> 8;
+            mem[2] = value >> 16;
+         }
+         else
+            StoreU32_LE((uint32 *)mem, value);
+      }
+      else if(sizeof(T) == 1)
          PSX_MemWrite8(timestamp, address, value);
       else if(sizeof(T) == 2)
          PSX_MemWrite16(timestamp, address, value);
@@ -384,10 +457,13 @@ INLINE void PS_CPU::WriteMemory(int32_t &timestamp, uint32_t address, uint32_t v
             ICI[1].TV = ((valid_bits & 0x02) ? 0x00 : 0x02) | ((BIU & 0x800) ? 0x0 : 0x1);
             ICI[2].TV = ((valid_bits & 0x04) ? 0x00 : 0x02) | ((BIU & 0x800) ? 0x0 : 0x1);
             ICI[3].TV = ((valid_bits & 0x08) ? 0x00 : 0x02) | ((BIU & 0x800) ? 0x0 : 0x1);
+            ICacheGen++;
          }
          else if(!(BIU & 0x1))
          {
             ICache[(address & 0xFFC) >> 2].Data = value << ((address & 0x3) * 8);
+            ICache_OPF[(address & 0xFFC) >> 2] = DecodeOPF(ICache[(address & 0xFFC) >> 2].Data);
+            ICacheGen++;
          }
       }
 
@@ -493,6 +569,31 @@ int32_t PS_CPU::RunReal(int32_t timestamp_in)
          uint32_t instr;
          uint32_t opf;
 
+#ifdef PS_CPU_DYNAREC
+         // Only enter compiled code on an instruction boundary outside of a branch delay slot, with no
+         // interrupt pending and the cache not isolated.
+         if(!DebugMode && psx_cpu_dynarec && new_PC_mask == ~0U && new_PC == 4 && !IPCache && !(CP0.SR & 0x10000))
+         {
+            DynarecBlock block = PS_CPU_Dynarec::Lookup(this, PC);
+
+            if(block)
+            {
+               int32_t ts;
+
+               ACTIVE_TO_BACKING;
+               ts = block(this, timestamp);
+
+               // Negative if nothing was executed, e.g. when the instruction cache no longer holds the block's code.
+               if(ts >= 0)
+               {
+                  timestamp = ts;
+                  BACKING_TO_ACTIVE;
+                  continue;
+               }
+            }
+         }
+#endif
+
          // Zero must be zero...until the Master Plan is enacted.
          GPR[0] = 0;
 
@@ -527,6 +628,7 @@ int32_t PS_CPU::RunReal(int32_t timestamp_in)
          }
 
          instr = ICache[(PC & 0xFFC) >> 2].Data;
+         opf = ICache_OPF[(PC & 0xFFC) >> 2];
 
          if(ICache[(PC & 0xFFC) >> 2].TV != PC)
          {
@@ -540,6 +642,7 @@ int32_t PS_CPU::RunReal(int32_t timestamp_in)
             if(PC >= 0xA0000000 || !(BIU & 0x800))
             {
                instr = LoadU32_LE((uint32_t *)&FastMap[PC >> FAST_MAP_SHIFT][PC]);
+               opf = DecodeOPF(instr);
 
                if (!psx_cpu_overclock)
                {
@@ -553,6 +656,7 @@ int32_t PS_CPU::RunReal(int32_t timestamp_in)
             else
             {
                __ICache *ICI = &ICache[((PC & 0xFF0) >> 2)];
+               uint8_t *ICO = &ICache_OPF[((PC & 0xFF0) >> 2)];
                const uint32_t *FMP = (uint32_t *)&FastMap[(PC &~ 0xF) >> FAST_MAP_SHIFT][PC &~ 0xF];
 
                // | 0x2 to simulate (in)validity bits.
@@ -560,6 +664,7 @@ int32_t PS_CPU::RunReal(int32_t timestamp_in)
                ICI[0x01].TV = (PC &~ 0xF) | 0x04 | 0x2;
                ICI[0x02].TV = (PC &~ 0xF) | 0x08 | 0x2;
                ICI[0x03].TV = (PC &~ 0xF) | 0x0C | 0x2;
+               ICacheGen++;
 
                // When overclock is enabled, remove code cache fetch latency
                if (!psx_cpu_overclock)
@@ -572,24 +677,29 @@ int32_t PS_CPU::RunReal(int32_t timestamp_in)
                         timestamp++;
                      ICI[0x00].TV &= ~0x2;
                      ICI[0x00].Data = LoadU32_LE(&FMP[0]);
+                     ICO[0x00] = DecodeOPF(ICI[0x00].Data);
                   case 0x4:
                      if (!psx_cpu_overclock)
                         timestamp++;
                      ICI[0x01].TV &= ~0x2;
                      ICI[0x01].Data = LoadU32_LE(&FMP[1]);
+                     ICO[0x01] = DecodeOPF(ICI[0x01].Data);
                   case 0x8:
                      if (!psx_cpu_overclock)
                         timestamp++;
                      ICI[0x02].TV &= ~0x2;
                      ICI[0x02].Data = LoadU32_LE(&FMP[2]);
+                     ICO[0x02] = DecodeOPF(ICI[0x02].Data);
                   case 0xC:
                      if (!psx_cpu_overclock)
                         timestamp++;
                      ICI[0x03].TV &= ~0x2;
                      ICI[0x03].Data = LoadU32_LE(&FMP[3]);
+                     ICO[0x03] = DecodeOPF(ICI[0x03].Data);
                      break;
                }
                instr = ICache[(PC & 0xFFC) >> 2].Data;
+               opf = ICache_OPF[(PC & 0xFFC) >> 2];
             }
          }
 
@@ -598,11 +708,6 @@ int32_t PS_CPU::RunReal(int32_t timestamp_in)
          // printf("%02x : %08x\n", i, GPR[i]);
          //printf("\n");
 
-         opf = instr & 0x3F;
-
-         if(instr & (0x3F << 26))
-            opf = 0x40 | (instr >> 26);
-
          opf |= IPCache;
 
 #if 0
@@ -5,9 +5,16 @@
 
 #define PS_CPU_EMULATE_ICACHE 1
 
+#if defined(__x86_64__) && !defined(_WIN32)
+#define PS_CPU_DYNAREC 1
+#endif
+
 #define FAST_MAP_SHIFT        16
 #define FAST_MAP_PSIZE        (1 << FAST_MAP_SHIFT)
 
+/* Physical addresses covered by the data access maps */
+#define DATA_MAP_LIMIT        0x20000000
+
 #define CP0REG_BPC            3   /* PC breakpoint address */
 #define CP0REG_BDA            5   /* Data load/store breakpoint address */
 #define CP0REG_TAR            6   /* Target address */
@@ -44,8 +51,15 @@
 #define GSREG_CAUSE          38
 #define GSREG_EPC            39
 
+class PS_CPU;
+
+// Compiled block entry point; returns the new timestamp, or -1 if the block is stale.
+typedef int32_t (*DynarecBlock)(PS_CPU *cpu, int32_t timestamp);
+
 class PS_CPU
 {
+   friend class PS_CPU_Dynarec;
+
    public:
 
       PS_CPU();
@@ -53,6 +67,12 @@ class PS_CPU
 
       void SetFastMap(void *region_mem, uint32_t region_address, uint32_t region_size);
 
+      // Lets loads (and, for MainRAM, stores) to a region of physical
+      // memory bypass PSX_MemRead*()/PSX_MemWrite*(). latency is the extra
+      // read time MemRW() charges for the region on top of DMA cycle
+      // stealing, waived when overclocking.
+      void SetDataMap(void *region_mem, uint32_t region_address, uint32_t region_size, bool writable, uint8_t latency);
+
       INLINE void SetEventNT(const int32_t next_event_ts_arg)
       {
          next_event_ts = next_event_ts_arg;
@@ -110,6 +130,21 @@ class PS_CPU
          uint32_t ICache_Bulk[2048];
       };
 
+      // Dispatch table index for each ICache[].Data, kept in sync with it so cache hits skip the decode.
+      uint8_t ICache_OPF[1024];
+
+      // Incremented whenever ICache[] changes; compiled blocks only recheck the instruction words they were
+      // compiled from once it has.
+      uint64_t ICacheGen;
+
+      static INLINE uint8_t DecodeOPF(const uint32_t instr)
+      {
+         if(instr & (0x3F << 26))
+            return 0x40 | (instr >> 26);
+
+         return instr & 0x3F;
+      }
+      void RecalcICacheOPF(void);
 
       struct
       {
@@ -150,6 +185,13 @@ class PS_CPU
       uint8_t *FastMap[1 << (32 - FAST_MAP_SHIFT)];
       uint8_t DummyPage[FAST_MAP_PSIZE];
 
+      // Same layout as FastMap, but for data accesses and NULL for pages
+      // that have to go through MemRW(). Writes through WriteMap are marked
+      // in MainRAMDirty, so only MainRAM may be mapped writable.
+      uint8_t *ReadMap[DATA_MAP_LIMIT >> FAST_MAP_SHIFT];
+      uint8_t *WriteMap[DATA_MAP_LIMIT >> FAST_MAP_SHIFT];
+      uint8_t ReadMapLatency[DATA_MAP_LIMIT >> FAST_MAP_SHIFT];
+
 
       uint32_t Exception(uint32_t code, uint32_t PC, const uint32_t NP, const uint32_t NPM, const uint32_t instr) MDFN_WARN_UNUSED_RESULT;
 
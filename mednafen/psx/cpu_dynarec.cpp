@@ -0,0 +1,1792 @@
+// x86-64 dynamic recompiler for PS_CPU, included from cpu.cpp.
+//
+// Blocks are compiled from what the instruction cache holds(or, past the end of what's
+// cached, from memory).  Nothing a block executes can change the cache(the cache isn't
+// isolated, and a store that disables it ends the block), so it's checked once on entry:
+// PS_CPU::ICacheGen is compared against the value it had when the block's words were last
+// all found in the cache, and only if it moved are they compared again.  A word that isn't
+// cached leaves the whole block to the interpreter, which does the refill with the usual
+// timing; a block that keeps missing past its first word is recompiled from only what's
+// cached.  A tag hit with a different instruction word means the code was rewritten, and
+// the block is thrown away to be recompiled on a later visit.
+//
+// The generated code mirrors RunReal() instruction for instruction: ReadAbsorb/ReadFudge
+// and the load delay slot(BACKED_LDWhich/BACKED_LDValue) are kept exactly as the
+// interpreter would have them at each instruction boundary, and anything that could raise
+// an exception exits back to the interpreter before the instruction has any side effects.
+// The timestamp is checked against next_event_ts at the start of the block, at branch
+// targets inside it, after helpers(which can take any number of cycles or schedule an
+// event) and at least every DYNAREC_EVENT_SPAN instructions.  Every other instruction takes
+// at most one cycle, so each check looks ahead to the next one; only if the interpreter
+// could stop anywhere in between does the block switch to an out-of-line copy of those
+// instructions that checks before every one of them.
+// Memory accesses, multiply/divide and GTE instructions are done by helper functions
+// that are copies of the corresponding RunReal() opcode bodies.
+
+#include <sys/mman.h>
+
+#define DYNAREC_CODE_SIZE     (16 * 1024 * 1024)
+#define DYNAREC_TABLE_SIZE    65536
+#define DYNAREC_MAX_BLOCK     256
+#define DYNAREC_MAX_INSN_SIZE 512   // Generous upper bound on host code bytes per instruction, including its exit stubs.
+#define DYNAREC_EVENT_SPAN    16    // Most instructions between two next_event_ts checks.
+#define DYNAREC_MAX_MISSES    4     // Entries a block can be refused for words past its first not being cached.
+
+enum
+{
+   DR_KIND_NONE = 0,    // Not compiled, block ends before it.
+   DR_KIND_INLINE,
+   DR_KIND_HELPER,
+   DR_KIND_BRANCH
+};
+
+enum
+{
+   DR_CHECK_IPCACHE = 0x1,
+   DR_CHECK_BIU     = 0x2
+};
+
+// x86-64 register numbers
+enum { RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12 };
+
+// x86 condition codes
+enum { CC_O = 0x0, CC_B = 0x2, CC_E = 0x4, CC_NE = 0x5, CC_S = 0x8, CC_NS = 0x9, CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF };
+
+// x86 group 1 ALU /digit values, shift group /digit values
+enum { ALU_ADD = 0, ALU_OR = 1, ALU_ADC = 2, ALU_AND = 4, ALU_SUB = 5, ALU_XOR = 6, ALU_CMP = 7 };
+enum { SH_SHL = 4, SH_SHR = 5, SH_SAR = 7 };
+
+// Kept in the code buffer just before each block's code.
+struct DynarecBlockInfo
+{
+   uint64_t icache_gen;  // PS_CPU::ICacheGen as of the last time all of instr[] was found in the cache
+   uint32_t start;
+   uint32_t count;
+   uint32_t instr[DYNAREC_MAX_BLOCK];   // Only count of them are stored.
+};
+
+struct DynarecEntry
+{
+   uint32_t pc;
+   uint8_t visits;
+   uint8_t misses;
+   bool nocompile;
+   bool cached_only;    // Compile only what's in the instruction cache.
+   DynarecBlock code;
+};
+
+class PS_CPU_Dynarec
+{
+   public:
+
+      static INLINE DynarecBlock Lookup(PS_CPU *cpu, uint32_t PC)
+      {
+         DynarecEntry *e = &table[(PC >> 2) & (DYNAREC_TABLE_SIZE - 1)];
+
+         if(MDFN_LIKELY(e->pc == PC && e->code))
+            return e->code;
+
+         return LookupSlow(cpu, PC, e);
+      }
+
+      static void Kill(void);
+
+   private:
+
+      static void Invalidate(uint32_t PC);
+      static bool Validate(PS_CPU *cpu, DynarecBlockInfo *info);
+
+      static DynarecBlock LookupSlow(PS_CPU *cpu, uint32_t PC, DynarecEntry *e) NO_INLINE;
+      static DynarecBlock Compile(PS_CPU *cpu, uint32_t start, bool cached_only, bool *nocompile);
+      static void Flush(void);
+      static unsigned Classify(uint32_t instr);
+      static bool FetchInstr(PS_CPU *cpu, uint32_t pc, bool cached_only, uint32_t *instr);
+
+      //
+      // Code emission
+      //
+      static void Emit8(uint8_t v) { *code_ptr++ = v; }
+      static void Emit32(uint32_t v) { MDFN_en32lsb(code_ptr, v); code_ptr += 4; }
+      static void Emit64(uint64_t v) { MDFN_en64lsb(code_ptr, v); code_ptr += 8; }
+      static void EmitREX(bool w, unsigned reg, unsigned base);
+      static void EmitMem(unsigned reg, int32_t disp);
+      static void EmitMemIdx(unsigned reg, int32_t disp, unsigned scale);
+
+      static void MovRegMem(unsigned reg, int32_t disp);
+      static void MovMemReg(int32_t disp, unsigned reg);
+      static void MovMemImm(int32_t disp, uint32_t imm);
+      static void MovMem8Imm(int32_t disp, uint8_t imm);
+      static void MovMem8Reg(int32_t disp, unsigned reg);
+      static void MovzxRegMem8(unsigned reg, int32_t disp);
+      static void MovRegImm(unsigned reg, uint32_t imm);
+      static void AluRegReg(unsigned op, unsigned dst, unsigned src);
+      static void AluRegImm(unsigned op, unsigned reg, uint32_t imm);
+      static void AluMemImm(unsigned op, int32_t disp, uint32_t imm);
+      static void AluMem8Imm(unsigned op, int32_t disp, uint8_t imm);
+      static void ShiftRegImm(unsigned op, unsigned reg, unsigned count);
+      static void ShiftRegCL(unsigned op, unsigned reg);
+      static void SetccMovzx(unsigned cc, unsigned reg);
+      static uint8_t *Jcc(unsigned cc);
+      static uint8_t *Jmp(void);
+      static void Bind(uint8_t *rel32, const uint8_t *target);
+
+      //
+      // MIPS-level code generation
+      //
+      static void LoadGPR(unsigned reg, unsigned r);
+      static void GenReadAbsorbStep(void);
+      static void GenDepRes(unsigned a, unsigned b, unsigned c);
+      static void GenDoLDS(void);
+      static uint8_t *GenEventCheck(unsigned span);
+      static void GenInsnStart(unsigned i);
+      static void GenInsns(unsigned first, unsigned end);
+      static void GenEntryTrapCheck(uint32_t instr);
+      static void GenExitTo(uint8_t *rel32, uint32_t pc);
+      static void GenExitIf(unsigned cc, uint32_t pc);
+      static void GenChecks(unsigned checks, uint32_t pc);
+      static void GenCallHelper(int32_t (*helper)(PS_CPU *, int32_t, uint32_t), uint32_t instr);
+      static unsigned GenInsn(uint32_t pc, uint32_t instr);
+      static void GenBranch(unsigned i);
+
+      //
+      // Helpers called from generated code; copies of the RunReal() opcode bodies.
+      //
+      template<typename T> static int32_t Load(PS_CPU *cpu, int32_t timestamp, uint32_t instr);
+      template<typename T> static int32_t Store(PS_CPU *cpu, int32_t timestamp, uint32_t instr);
+      static int32_t LWL(PS_CPU *cpu, int32_t timestamp, uint32_t instr);
+      static int32_t LWR(PS_CPU *cpu, int32_t timestamp, uint32_t instr);
+      static int32_t SWL(PS_CPU *cpu, int32_t timestamp, uint32_t instr);
+      static int32_t SWR(PS_CPU *cpu, int32_t timestamp, uint32_t instr);
+      static int32_t MULT(PS_CPU *cpu, int32_t timestamp, uint32_t instr);
+      static int32_t MULTU(PS_CPU *cpu, int32_t timestamp, uint32_t instr);
+      static int32_t DIV(PS_CPU *cpu, int32_t timestamp, uint32_t instr);
+      static int32_t DIVU(PS_CPU *cpu, int32_t timestamp, uint32_t instr);
+      template<bool hi> static int32_t MFHILO(PS_CPU *cpu, int32_t timestamp, uint32_t instr);
+      static int32_t COP2(PS_CPU *cpu, int32_t timestamp, uint32_t instr);
+      static int32_t LWC2(PS_CPU *cpu, int32_t timestamp, uint32_t instr);
+      static int32_t SWC2(PS_CPU *cpu, int32_t timestamp, uint32_t instr);
+
+      static DynarecEntry table[DYNAREC_TABLE_SIZE];
+
+      static uint8_t *code_buf;
+      static uint8_t *code_ptr;
+      static bool code_buf_failed;
+
+      //
+      // Per-compile state
+      //
+      struct Insn
+      {
+         uint32_t instr;
+         uint8_t kind;
+         bool delay_slot;
+         bool join;            // Target of a branch inside the block
+         int32_t target;       // Index of the in-block branch target, or -1
+         unsigned span;        // Instructions covered by the next_event_ts check before this one, 0 if none
+         uint8_t *step_rel32;  // Jump to the copy of those instructions that checks before each one
+         int step_ld_which;    // What was known about the CPU state at the check, to generate the copy with
+         bool step_gpr0_dirty;
+         bool step_ra_dummy_stale;
+         uint8_t *start;
+      };
+
+      enum
+      {
+         FIXUP_EXIT = -1,      // Exit stub for pc
+         FIXUP_EPILOGUE = -2,
+         FIXUP_FAIL = -3       // Return without having executed anything
+      };
+
+      struct Fixup
+      {
+         uint8_t *rel32;
+         int32_t index;        // Instruction index to jump to, or one of FIXUP_*
+         uint32_t pc;
+      };
+
+      static Insn insns[DYNAREC_MAX_BLOCK];
+      static unsigned insn_count;
+      static uint32_t block_start;
+      static Fixup fixups[DYNAREC_MAX_BLOCK * 16];
+      static unsigned fixup_count;
+
+      // What is statically known about the CPU state at the current point in the block.
+      static int ld_which;      // Pending load register, 0x20 for none, or -1 if unknown.
+      static bool gpr0_dirty;   // GPR[0] may have been written.
+      static bool ra_dummy_stale;  // ReadAbsorb[0x20] may not equal LDAbsorb.
+      static bool stepping;     // Generating a copy that checks next_event_ts before every instruction.
+
+      // Offsets of PS_CPU members, relative to rbp.
+      static int32_t ofs_gpr, ofs_lo, ofs_hi, ofs_pc, ofs_new_pc, ofs_new_pc_mask, ofs_ipcache;
+      static int32_t ofs_ldwhich, ofs_ldvalue, ofs_ldabsorb, ofs_next_event_ts, ofs_biu;
+      static int32_t ofs_icache_gen, ofs_readabsorb, ofs_readabsorbwhich, ofs_readfudge;
+};
+
+DynarecEntry PS_CPU_Dynarec::table[DYNAREC_TABLE_SIZE];
+uint8_t *PS_CPU_Dynarec::code_buf = NULL;
+uint8_t *PS_CPU_Dynarec::code_ptr = NULL;
+bool PS_CPU_Dynarec::code_buf_failed = false;
+PS_CPU_Dynarec::Insn PS_CPU_Dynarec::insns[DYNAREC_MAX_BLOCK];
+unsigned PS_CPU_Dynarec::insn_count;
+uint32_t PS_CPU_Dynarec::block_start;
+PS_CPU_Dynarec::Fixup PS_CPU_Dynarec::fixups[DYNAREC_MAX_BLOCK * 16];
+unsigned PS_CPU_Dynarec::fixup_count;
+int PS_CPU_Dynarec::ld_which;
+bool PS_CPU_Dynarec::gpr0_dirty;
+bool PS_CPU_Dynarec::ra_dummy_stale;
+bool PS_CPU_Dynarec::stepping;
+int32_t PS_CPU_Dynarec::ofs_gpr, PS_CPU_Dynarec::ofs_lo, PS_CPU_Dynarec::ofs_hi, PS_CPU_Dynarec::ofs_pc;
+int32_t PS_CPU_Dynarec::ofs_new_pc, PS_CPU_Dynarec::ofs_new_pc_mask, PS_CPU_Dynarec::ofs_ipcache;
+int32_t PS_CPU_Dynarec::ofs_ldwhich, PS_CPU_Dynarec::ofs_ldvalue, PS_CPU_Dynarec::ofs_ldabsorb;
+int32_t PS_CPU_Dynarec::ofs_next_event_ts, PS_CPU_Dynarec::ofs_biu, PS_CPU_Dynarec::ofs_icache_gen;
+int32_t PS_CPU_Dynarec::ofs_readabsorb, PS_CPU_Dynarec::ofs_readabsorbwhich, PS_CPU_Dynarec::ofs_readfudge;
+
+#define DR_DO_LDS() { cpu->GPR[cpu->BACKED_LDWhich] = cpu->BACKED_LDValue; cpu->ReadAbsorb[cpu->BACKED_LDWhich] = cpu->LDAbsorb; cpu->ReadFudge = cpu->BACKED_LDWhich; cpu->ReadAbsorbWhich |= cpu->BACKED_LDWhich & 0x1F; cpu->BACKED_LDWhich = 0x20; }
+#define DR_DEPRES(a, b) { uint8_t back = cpu->ReadAbsorb[0]; cpu->ReadAbsorb[(a)] = 0; cpu->ReadAbsorb[(b)] = 0; cpu->ReadAbsorb[0] = back; }
+#define DR_ITYPE const uint32_t rs MDFN_NOWARN_UNUSED = (instr >> 21) & 0x1F; const uint32_t rt MDFN_NOWARN_UNUSED = (instr >> 16) & 0x1F; const uint32_t immediate MDFN_NOWARN_UNUSED = (int32)(int16)(instr & 0xFFFF);
+
+//
+// Helpers
+//
+template<typename T>
+int32_t PS_CPU_Dynarec::Load(PS_CPU *cpu, int32_t timestamp, uint32_t instr)
+{
+   DR_ITYPE;
+   const uint32_t address = cpu->GPR[rs] + immediate;
+
+   DR_DEPRES(rs, rs);
+   DR_DO_LDS();
+
+   cpu->BACKED_LDWhich = rt;
+   cpu->BACKED_LDValue = (int32)cpu->ReadMemory<T>(timestamp, address);
+
+   return timestamp;
+}
+
+template<typename T>
+int32_t PS_CPU_Dynarec::Store(PS_CPU *cpu, int32_t timestamp, uint32_t instr)
+{
+   DR_ITYPE;
+   const uint32_t address = cpu->GPR[rs] + immediate;
+
+   DR_DEPRES(rs, rt);
+
+   cpu->WriteMemory<T>(timestamp, address, cpu->GPR[rt]);
+   DR_DO_LDS();
+
+   return timestamp;
+}
+
+int32_t PS_CPU_Dynarec::LWL(PS_CPU *cpu, int32_t timestamp, uint32_t instr)
+{
+   DR_ITYPE;
+   const uint32_t address = cpu->GPR[rs] + immediate;
+   uint32_t v = cpu->GPR[rt];
+
+   DR_DEPRES(rs, rs);
+
+   if(cpu->BACKED_LDWhich == rt)
+   {
+      v = cpu->BACKED_LDValue;
+      cpu->ReadFudge = 0;
+   }
+   else
+   {
+      DR_DO_LDS();
+   }
+
+   cpu->BACKED_LDWhich = rt;
+   switch(address & 0x3)
+   {
+      case 0:
+         cpu->BACKED_LDValue = (v & ~(0xFF << 24)) | (cpu->ReadMemory<uint8>(timestamp, address & ~3) << 24);
+         break;
+      case 1:
+         cpu->BACKED_LDValue = (v & ~(0xFFFF << 16)) | (cpu->ReadMemory<uint16>(timestamp, address & ~3) << 16);
+         break;
+      case 2:
+         cpu->BACKED_LDValue = (v & ~(0xFFFFFF << 8)) | (cpu->ReadMemory<uint32>(timestamp, address & ~3, true) << 8);
+         break;
+      case 3:
+         cpu->BACKED_LDValue = (v & ~(0xFFFFFFFF << 0)) | (cpu->ReadMemory<uint32>(timestamp, address & ~3) << 0);
+         break;
+   }
+
+   return timestamp;
+}
+
+int32_t PS_CPU_Dynarec::LWR(PS_CPU *cpu, int32_t timestamp, uint32_t instr)
+{
+   DR_ITYPE;
+   const uint32_t address = cpu->GPR[rs] + immediate;
+   uint32_t v = cpu->GPR[rt];
+
+   DR_DEPRES(rs, rs);
+
+   if(cpu->BACKED_LDWhich == rt)
+   {
+      v = cpu->BACKED_LDValue;
+      cpu->ReadFudge = 0;
+   }
+   else
+   {
+      DR_DO_LDS();
+   }
+
+   cpu->BACKED_LDWhich = rt;
+   switch(address & 0x3)
+   {
+      case 0:
+         cpu->BACKED_LDValue = (v & ~(0xFFFFFFFF)) | cpu->ReadMemory<uint32>(timestamp, address);
+         break;
+      case 1:
+         cpu->BACKED_LDValue = (v & ~(0xFFFFFF)) | cpu->ReadMemory<uint32>(timestamp, address, true);
+         break;
+      case 2:
+         cpu->BACKED_LDValue = (v & ~(0xFFFF)) | cpu->ReadMemory<uint16>(timestamp, address);
+         break;
+      case 3:
+         cpu->BACKED_LDValue = (v & ~(0xFF)) | cpu->ReadMemory<uint8>(timestamp, address);
+         break;
+   }
+
+   return timestamp;
+}
+
+int32_t PS_CPU_Dynarec::SWL(PS_CPU *cpu, int32_t timestamp, uint32_t instr)
+{
+   DR_ITYPE;
+   const uint32_t address = cpu->GPR[rs] + immediate;
+
+   DR_DEPRES(rs, rt);
+
+   switch(address & 0x3)
+   {
+      case 0:
+         cpu->WriteMemory<uint8>(timestamp, address & ~3, cpu->GPR[rt] >> 24);
+         break;
+      case 1:
+         cpu->WriteMemory<uint16>(timestamp, address & ~3, cpu->GPR[rt] >> 16);
+         break;
+      case 2:
+         cpu->WriteMemory<uint32>(timestamp, address & ~3, cpu->GPR[rt] >> 8, true);
+         break;
+      case 3:
+         cpu->WriteMemory<uint32>(timestamp, address & ~3, cpu->GPR[rt] >> 0);
+         break;
+   }
+   DR_DO_LDS();
+
+   return timestamp;
+}
+
+int32_t PS_CPU_Dynarec::SWR(PS_CPU *cpu, int32_t timestamp, uint32_t instr)
+{
+   DR_ITYPE;
+   const uint32_t address = cpu->GPR[rs] + immediate;
+
+   DR_DEPRES(rs, rt);
+
+   switch(address & 0x3)
+   {
+      case 0:
+         cpu->WriteMemory<uint32>(timestamp, address, cpu->GPR[rt]);
+         break;
+      case 1:
+         cpu->WriteMemory<uint32>(timestamp, address, cpu->GPR[rt], true);
+         break;
+      case 2:
+         cpu->WriteMemory<uint16>(timestamp, address, cpu->GPR[rt]);
+         break;
+      case 3:
+         cpu->WriteMemory<uint8>(timestamp, address, cpu->GPR[rt]);
+         break;
+   }
+   DR_DO_LDS();
+
+   return timestamp;
+}
+
+int32_t PS_CPU_Dynarec::MULT(PS_CPU *cpu, int32_t timestamp, uint32_t instr)
+{
+   DR_ITYPE;
+   uint64 result;
+
+   DR_DEPRES(rs, rt);
+
+   result = (int64)(int32)cpu->GPR[rs] * (int32)cpu->GPR[rt];
+   cpu->muldiv_ts_done = timestamp + cpu->MULT_Tab24[MDFN_lzcount32((cpu->GPR[rs] ^ ((int32)cpu->GPR[rs] >> 31)) | 0x400)];
+   DR_DO_LDS();
+
+   cpu->LO = result;
+   cpu->HI = result >> 32;
+
+   return timestamp;
+}
+
+int32_t PS_CPU_Dynarec::MULTU(PS_CPU *cpu, int32_t timestamp, uint32_t instr)
+{
+   DR_ITYPE;
+   uint64 result;
+
+   DR_DEPRES(rs, rt);
+
+   result = (uint64)cpu->GPR[rs] * cpu->GPR[rt];
+   cpu->muldiv_ts_done = timestamp + cpu->MULT_Tab24[MDFN_lzcount32(cpu->GPR[rs] | 0x400)];
+   DR_DO_LDS();
+
+   cpu->LO = result;
+   cpu->HI = result >> 32;
+
+   return timestamp;
+}
+
+int32_t PS_CPU_Dynarec::DIV(PS_CPU *cpu, int32_t timestamp, uint32_t instr)
+{
+   DR_ITYPE;
+
+   DR_DEPRES(rs, rt);
+
+   if(!cpu->GPR[rt])
+   {
+      if(cpu->GPR[rs] & 0x80000000)
+         cpu->LO = 1;
+      else
+         cpu->LO = 0xFFFFFFFF;
+
+      cpu->HI = cpu->GPR[rs];
+   }
+   else if(cpu->GPR[rs] == 0x80000000 && cpu->GPR[rt] == 0xFFFFFFFF)
+   {
+      cpu->LO = 0x80000000;
+      cpu->HI = 0;
+   }
+   else
+   {
+      cpu->LO = (int32)cpu->GPR[rs] / (int32)cpu->GPR[rt];
+      cpu->HI = (int32)cpu->GPR[rs] % (int32)cpu->GPR[rt];
+   }
+   cpu->muldiv_ts_done = timestamp + 37;
+
+   DR_DO_LDS();
+
+   return timestamp;
+}
+
+int32_t PS_CPU_Dynarec::DIVU(PS_CPU *cpu, int32_t timestamp, uint32_t instr)
+{
+   DR_ITYPE;
+
+   DR_DEPRES(rs, rt);
+
+   if(!cpu->GPR[rt])
+   {
+      cpu->LO = 0xFFFFFFFF;
+      cpu->HI = cpu->GPR[rs];
+   }
+   else
+   {
+      cpu->LO = cpu->GPR[rs] / cpu->GPR[rt];
+      cpu->HI = cpu->GPR[rs] % cpu->GPR[rt];
+   }
+   cpu->muldiv_ts_done = timestamp + 37;
+
+   DR_DO_LDS();
+
+   return timestamp;
+}
+
+template<bool hi>
+int32_t PS_CPU_Dynarec::MFHILO(PS_CPU *cpu, int32_t timestamp, uint32_t instr)
+{
+   const uint32_t rd = (instr >> 11) & 0x1F;
+
+   DR_DEPRES(rd, rd);
+   DR_DO_LDS();
+
+   if(timestamp < cpu->muldiv_ts_done)
+   {
+      if(timestamp == cpu->muldiv_ts_done - 1)
+         cpu->muldiv_ts_done--;
+      else
+      {
+         do
+         {
+            if(cpu->ReadAbsorb[cpu->ReadAbsorbWhich])
+               cpu->ReadAbsorb[cpu->ReadAbsorbWhich]--;
+            timestamp++;
+         } while(timestamp < cpu->muldiv_ts_done);
+      }
+   }
+
+   cpu->GPR[rd] = hi ? cpu->HI : cpu->LO;
+
+   return timestamp;
+}
+
+int32_t PS_CPU_Dynarec::COP2(PS_CPU *cpu, int32_t timestamp, uint32_t instr)
+{
+   const uint32_t sub_op = (instr >> 21) & 0x1F;
+   const uint32_t rt = (instr >> 16) & 0x1F;
+   const uint32_t rd = (instr >> 11) & 0x1F;
+
+   if(sub_op >= 0x10 && sub_op <= 0x1F)
+   {
+      if(timestamp < cpu->gte_ts_done)
+         timestamp = cpu->gte_ts_done;
+      cpu->gte_ts_done = timestamp + GTE_Instruction(instr);
+      DR_DO_LDS();
+   }
+   else switch(sub_op)
+   {
+      default:
+         DR_DO_LDS();
+         break;
+
+      case 0x00:		// MFC2
+      case 0x02:		// CFC2
+         DR_DO_LDS();
+
+         if(timestamp < cpu->gte_ts_done)
+         {
+            cpu->LDAbsorb = cpu->gte_ts_done - timestamp;
+            timestamp = cpu->gte_ts_done;
+         }
+         else
+            cpu->LDAbsorb = 0;
+
+         cpu->BACKED_LDWhich = rt;
+         cpu->BACKED_LDValue = sub_op ? GTE_ReadCR(rd) : GTE_ReadDR(rd);
+         break;
+
+      case 0x04:		// MTC2
+      case 0x06:		// CTC2
+         {
+            const uint32_t val = cpu->GPR[rt];
+
+            if(timestamp < cpu->gte_ts_done)
+               timestamp = cpu->gte_ts_done;
+
+            if(sub_op == 0x04)
+               GTE_WriteDR(rd, val);
+            else
+               GTE_WriteCR(rd, val);
+            DR_DO_LDS();
+         }
+         break;
+   }
+
+   return timestamp;
+}
+
+int32_t PS_CPU_Dynarec::LWC2(PS_CPU *cpu, int32_t timestamp, uint32_t instr)
+{
+   DR_ITYPE;
+   const uint32_t address = cpu->GPR[rs] + immediate;
+
+   DR_DO_LDS();
+
+   if(timestamp < cpu->gte_ts_done)
+      timestamp = cpu->gte_ts_done;
+
+   GTE_WriteDR(rt, cpu->ReadMemory<uint32>(timestamp, address, false, true));
+
+   return timestamp;
+}
+
+int32_t PS_CPU_Dynarec::SWC2(PS_CPU *cpu, int32_t timestamp, uint32_t instr)
+{
+   DR_ITYPE;
+   const uint32_t address = cpu->GPR[rs] + immediate;
+
+   if(timestamp < cpu->gte_ts_done)
+      timestamp = cpu->gte_ts_done;
+
+   cpu->WriteMemory<uint32>(timestamp, address, GTE_ReadDR(rt));
+   DR_DO_LDS();
+
+   return timestamp;
+}
+
+#undef DR_DO_LDS
+#undef DR_DEPRES
+#undef DR_ITYPE
+
+//
+// Table management
+//
+void PS_CPU_Dynarec::Flush(void)
+{
+   memset(table, 0, sizeof(table));
+   code_ptr = code_buf;
+}
+
+void PS_CPU_Dynarec::Invalidate(uint32_t PC)
+{
+   DynarecEntry *e = &table[(PC >> 2) & (DYNAREC_TABLE_SIZE - 1)];
+
+   if(e->pc == PC)
+   {
+      e->code = NULL;
+      e->visits = 0;
+   }
+}
+
+// Called on entry to a block when the instruction cache has changed since it was last checked.
+bool PS_CPU_Dynarec::Validate(PS_CPU *cpu, DynarecBlockInfo *info)
+{
+   for(uint32_t i = 0; i < info->count; i++)
+   {
+      const uint32_t pc = info->start + i * 4;
+      const PS_CPU::__ICache *ic = &cpu->ICache[(pc & 0xFFC) >> 2];
+
+      if(ic->TV != pc)
+      {
+         DynarecEntry *e = &table[(info->start >> 2) & (DYNAREC_TABLE_SIZE - 1)];
+
+         // Words that don't stay cached(e.g. on a path that's rarely taken) would otherwise keep the whole block
+         // out of use.
+         if(i && e->pc == info->start && !e->cached_only && ++e->misses >= DYNAREC_MAX_MISSES)
+         {
+            Invalidate(info->start);
+            e->cached_only = true;
+         }
+
+         return false;
+      }
+
+      // A tag hit on a different instruction word means the code was rewritten since compiling.
+      if(ic->Data != info->instr[i])
+      {
+         Invalidate(info->start);
+         return false;
+      }
+   }
+
+   info->icache_gen = cpu->ICacheGen;
+
+   return true;
+}
+
+void PS_CPU_Dynarec::Kill(void)
+{
+   if(code_buf)
+      munmap(code_buf, DYNAREC_CODE_SIZE);
+
+   code_buf = NULL;
+   code_ptr = NULL;
+   code_buf_failed = false;
+   memset(table, 0, sizeof(table));
+}
+
+DynarecBlock PS_CPU_Dynarec::LookupSlow(PS_CPU *cpu, uint32_t PC, DynarecEntry *e)
+{
+   bool nocompile = false;
+
+   // Uncached fetches always go through the interpreter, as does the refill of a missed cache line.
+   if(PC >= 0xA0000000 || !(cpu->BIU & 0x800) || cpu->ICache[(PC & 0xFFC) >> 2].TV != PC)
+      return NULL;
+
+   if(e->pc != PC)
+   {
+      e->pc = PC;
+      e->visits = 0;
+      e->misses = 0;
+      e->nocompile = false;
+      e->cached_only = false;
+      e->code = NULL;
+   }
+
+   // Only compile code that has been seen before, so the interpreter has had a chance to pull the rest of
+   // it into the instruction cache.
+   if(e->nocompile || ++e->visits < 2)
+      return NULL;
+
+   if(!code_buf)
+   {
+      if(code_buf_failed)
+         return NULL;
+
+      code_buf = (uint8_t *)mmap(NULL, DYNAREC_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+      if(code_buf == MAP_FAILED)
+      {
+         PSX_WARNING("[CPU] Unable to allocate dynarec code buffer, using the interpreter.");
+         code_buf = NULL;
+         code_buf_failed = true;
+         return NULL;
+      }
+
+      Flush();
+   }
+
+   if((size_t)(code_buf + DYNAREC_CODE_SIZE - code_ptr) < sizeof(DynarecBlockInfo) + DYNAREC_MAX_BLOCK * DYNAREC_MAX_INSN_SIZE + 4096)
+   {
+      Flush();
+      e->pc = PC;
+   }
+
+   e->code = Compile(cpu, PC, e->cached_only, &nocompile);
+   e->nocompile = nocompile;
+
+   return e->code;
+}
+
+unsigned PS_CPU_Dynarec::Classify(uint32_t instr)
+{
+   if(instr >> 26)
+   {
+      switch(instr >> 26)
+      {
+         case 0x01: // BCOND
+         case 0x02: // J
+         case 0x03: // JAL
+         case 0x04: // BEQ
+         case 0x05: // BNE
+         case 0x06: // BLEZ
+         case 0x07: // BGTZ
+            return DR_KIND_BRANCH;
+
+         case 0x08: case 0x09: case 0x0A: case 0x0B:
+         case 0x0C: case 0x0D: case 0x0E: case 0x0F:
+            return DR_KIND_INLINE;
+
+         case 0x12: // COP2
+         case 0x20: case 0x21: case 0x22: case 0x23: case 0x24: case 0x25: case 0x26:
+         case 0x28: case 0x29: case 0x2A: case 0x2B: case 0x2E:
+         case 0x32: // LWC2
+         case 0x3A: // SWC2
+            return DR_KIND_HELPER;
+      }
+      return DR_KIND_NONE;
+   }
+
+   switch(instr & 0x3F)
+   {
+      case 0x00: case 0x02: case 0x03: case 0x04: case 0x06: case 0x07:
+      case 0x11: case 0x13:
+      case 0x20: case 0x21: case 0x22: case 0x23: case 0x24: case 0x25: case 0x26: case 0x27:
+      case 0x2A: case 0x2B:
+         return DR_KIND_INLINE;
+
+      case 0x08: // JR
+      case 0x09: // JALR
+         return DR_KIND_BRANCH;
+
+      case 0x10: case 0x12:
+      case 0x18: case 0x19: case 0x1A: case 0x1B:
+         return DR_KIND_HELPER;
+   }
+
+   return DR_KIND_NONE;
+}
+
+// What the CPU would execute at pc if it were reached without leaving the instruction cache's
+// current contents; past what's cached, unless cached_only, assume a refill from RAM or BIOS.
+bool PS_CPU_Dynarec::FetchInstr(PS_CPU *cpu, uint32_t pc, bool cached_only, uint32_t *instr)
+{
+   const PS_CPU::__ICache *ic = &cpu->ICache[(pc & 0xFFC) >> 2];
+   const uint32_t phys = pc & 0x1FFFFFFF;
+
+   if(ic->TV == pc)
+   {
+      *instr = ic->Data;
+      return true;
+   }
+
+   if(cached_only || pc >= 0xA0000000 || (phys >= 0x00800000 && (phys < 0x1FC00000 || phys >= 0x1FC80000)))
+      return false;
+
+   *instr = cpu->PeekMemory<uint32>(pc);
+   return true;
+}
+
+//
+// x86-64 encoding
+//
+void PS_CPU_Dynarec::EmitREX(bool w, unsigned reg, unsigned base)
+{
+   if(w || reg >= 8 || base >= 8)
+      Emit8(0x40 | (w << 3) | ((reg >> 3) << 2) | (base >> 3));
+}
+
+// [rbp + disp]
+void PS_CPU_Dynarec::EmitMem(unsigned reg, int32_t disp)
+{
+   if(disp >= -128 && disp <= 127)
+   {
+      Emit8(0x45 | ((reg & 7) << 3));
+      Emit8(disp);
+   }
+   else
+   {
+      Emit8(0x85 | ((reg & 7) << 3));
+      Emit32(disp);
+   }
+}
+
+// [rbp + rax * (1 << scale) + disp]
+void PS_CPU_Dynarec::EmitMemIdx(unsigned reg, int32_t disp, unsigned scale)
+{
+   Emit8(0x84 | ((reg & 7) << 3));
+   Emit8((scale << 6) | (RAX << 3) | RBP);
+   Emit32(disp);
+}
+
+void PS_CPU_Dynarec::MovRegMem(unsigned reg, int32_t disp)
+{
+   EmitREX(false, reg, 0);
+   Emit8(0x8B);
+   EmitMem(reg, disp);
+}
+
+void PS_CPU_Dynarec::MovMemReg(int32_t disp, unsigned reg)
+{
+   EmitREX(false, reg, 0);
+   Emit8(0x89);
+   EmitMem(reg, disp);
+}
+
+void PS_CPU_Dynarec::MovMemImm(int32_t disp, uint32_t imm)
+{
+   Emit8(0xC7);
+   EmitMem(0, disp);
+   Emit32(imm);
+}
+
+void PS_CPU_Dynarec::MovMem8Imm(int32_t disp, uint8_t imm)
+{
+   Emit8(0xC6);
+   EmitMem(0, disp);
+   Emit8(imm);
+}
+
+// reg must be one of al/cl/dl/bl
+void PS_CPU_Dynarec::MovMem8Reg(int32_t disp, unsigned reg)
+{
+   Emit8(0x88);
+   EmitMem(reg, disp);
+}
+
+void PS_CPU_Dynarec::MovzxRegMem8(unsigned reg, int32_t disp)
+{
+   EmitREX(false, reg, 0);
+   Emit8(0x0F);
+   Emit8(0xB6);
+   EmitMem(reg, disp);
+}
+
+void PS_CPU_Dynarec::MovRegImm(unsigned reg, uint32_t imm)
+{
+   EmitREX(false, 0, reg);
+   Emit8(0xB8 | (reg & 7));
+   Emit32(imm);
+}
+
+void PS_CPU_Dynarec::AluRegReg(unsigned op, unsigned dst, unsigned src)
+{
+   EmitREX(false, src, dst);
+   Emit8((op << 3) | 0x01);
+   Emit8(0xC0 | ((src & 7) << 3) | (dst & 7));
+}
+
+void PS_CPU_Dynarec::AluRegImm(unsigned op, unsigned reg, uint32_t imm)
+{
+   EmitREX(false, 0, reg);
+
+   if((int32)imm >= -128 && (int32)imm <= 127)
+   {
+      Emit8(0x83);
+      Emit8(0xC0 | (op << 3) | (reg & 7));
+      Emit8(imm);
+   }
+   else
+   {
+      Emit8(0x81);
+      Emit8(0xC0 | (op << 3) | (reg & 7));
+      Emit32(imm);
+   }
+}
+
+void PS_CPU_Dynarec::AluMemImm(unsigned op, int32_t disp, uint32_t imm)
+{
+   if((int32)imm >= -128 && (int32)imm <= 127)
+   {
+      Emit8(0x83);
+      EmitMem(op, disp);
+      Emit8(imm);
+   }
+   else
+   {
+      Emit8(0x81);
+      EmitMem(op, disp);
+      Emit32(imm);
+   }
+}
+
+void PS_CPU_Dynarec::AluMem8Imm(unsigned op, int32_t disp, uint8_t imm)
+{
+   Emit8(0x80);
+   EmitMem(op, disp);
+   Emit8(imm);
+}
+
+void PS_CPU_Dynarec::ShiftRegImm(unsigned op, unsigned reg, unsigned count)
+{
+   EmitREX(false, 0, reg);
+   Emit8(0xC1);
+   Emit8(0xC0 | (op << 3) | (reg & 7));
+   Emit8(count);
+}
+
+void PS_CPU_Dynarec::ShiftRegCL(unsigned op, unsigned reg)
+{
+   EmitREX(false, 0, reg);
+   Emit8(0xD3);
+   Emit8(0xC0 | (op << 3) | (reg & 7));
+}
+
+// setcc reg8; movzx reg32, reg8
+void PS_CPU_Dynarec::SetccMovzx(unsigned cc, unsigned reg)
+{
+   EmitREX(false, 0, reg);
+   Emit8(0x0F);
+   Emit8(0x90 | cc);
+   Emit8(0xC0 | (reg & 7));
+
+   EmitREX(false, reg, reg);
+   Emit8(0x0F);
+   Emit8(0xB6);
+   Emit8(0xC0 | ((reg & 7) << 3) | (reg & 7));
+}
+
+uint8_t *PS_CPU_Dynarec::Jcc(unsigned cc)
+{
+   Emit8(0x0F);
+   Emit8(0x80 | cc);
+   Emit32(0);
+   return code_ptr - 4;
+}
+
+uint8_t *PS_CPU_Dynarec::Jmp(void)
+{
+   Emit8(0xE9);
+   Emit32(0);
+   return code_ptr - 4;
+}
+
+void PS_CPU_Dynarec::Bind(uint8_t *rel32, const uint8_t *target)
+{
+   MDFN_en32lsb(rel32, (uint32)(target - (rel32 + 4)));
+}
+
+//
+// MIPS-level code generation
+//
+#define GPR_OFS(r)   (ofs_gpr + (r) * 4)
+#define RA_OFS(r)    (ofs_readabsorb + (r))
+
+void PS_CPU_Dynarec::LoadGPR(unsigned reg, unsigned r)
+{
+   // GPR[0] is always zero here; it's cleared at the start of every instruction and only written
+   // after the operands have been read.
+   if(!r)
+      AluRegReg(ALU_XOR, reg, reg);
+   else
+      MovRegMem(reg, GPR_OFS(r));
+}
+
+// if(ReadAbsorb[ReadAbsorbWhich]) ReadAbsorb[ReadAbsorbWhich]--; else timestamp++;
+void PS_CPU_Dynarec::GenReadAbsorbStep(void)
+{
+   MovzxRegMem8(RAX, ofs_readabsorbwhich);
+   Emit8(0x0F); Emit8(0xB6); EmitMemIdx(RCX, ofs_readabsorb, 0);   // movzx ecx, byte [rbp + rax + ReadAbsorb]
+   AluRegImm(ALU_CMP, RCX, 1);
+   AluRegImm(ALU_ADC, RBX, 0);
+   AluRegImm(ALU_SUB, RCX, 1);
+   AluRegImm(ALU_ADC, RCX, 0);
+   Emit8(0x88); EmitMemIdx(RCX, ofs_readabsorb, 0);                // mov [rbp + rax + ReadAbsorb], cl
+}
+
+// GPR_DEPRES_BEGIN ... GPR_DEPRES_END; ReadAbsorb[0] is preserved.
+void PS_CPU_Dynarec::GenDepRes(unsigned a, unsigned b, unsigned c)
+{
+   if(a)
+      MovMem8Imm(RA_OFS(a), 0);
+   if(b && b != a)
+      MovMem8Imm(RA_OFS(b), 0);
+   if(c && c != a && c != b)
+      MovMem8Imm(RA_OFS(c), 0);
+}
+
+void PS_CPU_Dynarec::GenDoLDS(void)
+{
+   if(ld_which < 0)
+   {
+      MovRegMem(RAX, ofs_ldwhich);
+      MovRegMem(RCX, ofs_ldvalue);
+      Emit8(0x89); EmitMemIdx(RCX, ofs_gpr, 2);           // mov [rbp + rax * 4 + GPR], ecx
+      MovRegMem(RCX, ofs_ldabsorb);
+      Emit8(0x88); EmitMemIdx(RCX, ofs_readabsorb, 0);    // mov [rbp + rax + ReadAbsorb], cl
+      MovMem8Reg(ofs_readfudge, RAX);
+      AluRegImm(ALU_AND, RAX, 0x1F);
+      Emit8(0x08); EmitMem(RAX, ofs_readabsorbwhich);     // or [ReadAbsorbWhich], al
+      MovMemImm(ofs_ldwhich, 0x20);
+      gpr0_dirty = true;
+      ra_dummy_stale = true;
+   }
+   else if(ld_which == 0x20)
+   {
+      // GPR[0x20] is a dummy that's never read, but ReadAbsorb[0x20] ends up in save states.
+      if(ra_dummy_stale)
+      {
+         MovRegMem(RAX, ofs_ldabsorb);
+         MovMem8Reg(RA_OFS(0x20), RAX);
+         ra_dummy_stale = false;
+      }
+      MovMem8Imm(ofs_readfudge, 0x20);
+   }
+   else
+   {
+      MovRegMem(RAX, ofs_ldvalue);
+      MovMemReg(GPR_OFS(ld_which), RAX);
+      MovRegMem(RAX, ofs_ldabsorb);
+      MovMem8Reg(RA_OFS(ld_which), RAX);
+      MovMem8Imm(ofs_readfudge, ld_which);
+      if(ld_which)
+         AluMem8Imm(ALU_OR, ofs_readabsorbwhich, ld_which);
+      MovMemImm(ofs_ldwhich, 0x20);
+
+      if(!ld_which)
+         gpr0_dirty = true;
+   }
+
+   ld_which = 0x20;
+}
+
+void PS_CPU_Dynarec::GenExitTo(uint8_t *rel32, uint32_t pc)
+{
+   fixups[fixup_count].rel32 = rel32;
+   fixups[fixup_count].index = FIXUP_EXIT;
+   fixups[fixup_count].pc = pc;
+   fixup_count++;
+}
+
+void PS_CPU_Dynarec::GenExitIf(unsigned cc, uint32_t pc)
+{
+   GenExitTo(Jcc(cc), pc);
+}
+
+// Leave the block before the instruction at pc if an interrupt became pending or the
+// instruction cache was turned off by a helper.
+void PS_CPU_Dynarec::GenChecks(unsigned checks, uint32_t pc)
+{
+   if(checks & DR_CHECK_IPCACHE)
+   {
+      AluMemImm(ALU_CMP, ofs_ipcache, 0);
+      GenExitIf(CC_NE, pc);
+   }
+
+   if(checks & DR_CHECK_BIU)
+   {
+      Emit8(0xF6); EmitMem(0, ofs_biu + 1); Emit8(0x08);   // test byte [BIU + 1], 0x08
+      GenExitIf(CC_E, pc);
+   }
+}
+
+// Jumps if timestamp + span - 1 >= next_event_ts, i.e. if the interpreter could stop before any of the next span
+// instructions; returns the jump to bind.
+uint8_t *PS_CPU_Dynarec::GenEventCheck(unsigned span)
+{
+   if(span > 1)
+   {
+      Emit8(0x8D); Emit8(0x43); Emit8(span - 1);     // lea eax, [rbx + span - 1]
+      Emit8(0x3B); EmitMem(RAX, ofs_next_event_ts);  // cmp eax, [next_event_ts]
+   }
+   else
+   {
+      Emit8(0x3B); EmitMem(RBX, ofs_next_event_ts);  // cmp ebx, [next_event_ts]
+   }
+   return Jcc(CC_GE);
+}
+
+// The first instruction raising an exception on entry to the block would otherwise exit back to the same
+// PC without any progress; leave those to the interpreter.
+void PS_CPU_Dynarec::GenEntryTrapCheck(uint32_t instr)
+{
+   const unsigned rs = (instr >> 21) & 0x1F;
+   const unsigned rt = (instr >> 16) & 0x1F;
+   const uint32_t imm_se = (int32)(int16)(instr & 0xFFFF);
+   unsigned cc;
+
+   switch(instr >> 26)
+   {
+      default:
+         return;
+
+      case 0x00:
+         if((instr & 0x3F) != 0x20 && (instr & 0x3F) != 0x22)   // ADD, SUB
+            return;
+         LoadGPR(RDX, rs);
+         LoadGPR(RCX, rt);
+         AluRegReg(((instr & 0x3F) == 0x20) ? ALU_ADD : ALU_SUB, RDX, RCX);
+         cc = CC_O;
+         break;
+
+      case 0x08: // ADDI
+         LoadGPR(RDX, rs);
+         AluRegImm(ALU_ADD, RDX, imm_se);
+         cc = CC_O;
+         break;
+
+      case 0x21: case 0x25: case 0x29:
+         LoadGPR(RDX, rs);
+         AluRegImm(ALU_ADD, RDX, imm_se);
+         Emit8(0xF6); Emit8(0xC2); Emit8(0x01);   // test dl, 1
+         cc = CC_NE;
+         break;
+
+      case 0x23: case 0x2B: case 0x32: case 0x3A:
+         LoadGPR(RDX, rs);
+         AluRegImm(ALU_ADD, RDX, imm_se);
+         Emit8(0xF6); Emit8(0xC2); Emit8(0x03);   // test dl, 3
+         cc = CC_NE;
+         break;
+   }
+
+   fixups[fixup_count].rel32 = Jcc(cc);
+   fixups[fixup_count].index = FIXUP_FAIL;
+   fixups[fixup_count].pc = 0;
+   fixup_count++;
+}
+
+void PS_CPU_Dynarec::GenInsnStart(unsigned i)
+{
+   const uint32_t pc = block_start + i * 4;
+
+   if(!stepping)
+      insns[i].start = code_ptr;
+
+   if(!i || insns[i].join)
+   {
+      ld_which = -1;
+      gpr0_dirty = true;
+      ra_dummy_stale = true;
+   }
+
+   // while(timestamp < next_event_ts)
+   if(stepping || insns[i].span == 1)
+      GenExitTo(GenEventCheck(1), pc);
+   else if(insns[i].span)
+   {
+      insns[i].step_rel32 = GenEventCheck(insns[i].span);
+      insns[i].step_ld_which = ld_which;
+      insns[i].step_gpr0_dirty = gpr0_dirty;
+      insns[i].step_ra_dummy_stale = ra_dummy_stale;
+   }
+
+   if(gpr0_dirty)
+   {
+      MovMemImm(GPR_OFS(0), 0);
+      gpr0_dirty = false;
+   }
+}
+
+void PS_CPU_Dynarec::GenCallHelper(int32_t (*helper)(PS_CPU *, int32_t, uint32_t), uint32_t instr)
+{
+   Emit8(0x48); Emit8(0x89); Emit8(0xEF);   // mov rdi, rbp
+   Emit8(0x89); Emit8(0xDE);                // mov esi, ebx
+   MovRegImm(RDX, instr);
+   Emit8(0x48); Emit8(0xB8); Emit64((uintptr_t)helper);   // mov rax, helper
+   Emit8(0xFF); Emit8(0xD0);                // call rax
+   Emit8(0x89); Emit8(0xC3);                // mov ebx, eax
+}
+
+// Everything but the branches; returns the checks needed before the next instruction.
+unsigned PS_CPU_Dynarec::GenInsn(uint32_t pc, uint32_t instr)
+{
+   const unsigned rs = (instr >> 21) & 0x1F;
+   const unsigned rt = (instr >> 16) & 0x1F;
+   const unsigned rd = (instr >> 11) & 0x1F;
+   const unsigned shamt = (instr >> 6) & 0x1F;
+   const uint32_t imm_se = (int32)(int16)(instr & 0xFFFF);
+   const uint32_t imm_ze = instr & 0xFFFF;
+   int32_t (*helper)(PS_CPU *, int32_t, uint32_t) = NULL;
+   unsigned checks = 0;
+   unsigned new_ld = 0x20;
+   unsigned align_mask = 0;
+
+   if(!(instr >> 26))
+   {
+      const unsigned funct = instr & 0x3F;
+
+      switch(funct)
+      {
+         case 0x10: helper = MFHILO<true>; break;
+         case 0x12: helper = MFHILO<false>; break;
+         case 0x18: helper = MULT; break;
+         case 0x19: helper = MULTU; break;
+         case 0x1A: helper = DIV; break;
+         case 0x1B: helper = DIVU; break;
+
+         case 0x11: // MTHI
+         case 0x13: // MTLO
+            LoadGPR(RDX, rs);
+            GenReadAbsorbStep();
+            GenDepRes(rs, 0, 0);
+            MovMemReg((funct == 0x11) ? ofs_hi : ofs_lo, RDX);
+            GenDoLDS();
+            return 0;
+
+         default:
+            switch(funct)
+            {
+               case 0x00: LoadGPR(RDX, rt); if(shamt) ShiftRegImm(SH_SHL, RDX, shamt); break;
+               case 0x02: LoadGPR(RDX, rt); if(shamt) ShiftRegImm(SH_SHR, RDX, shamt); break;
+               case 0x03: LoadGPR(RDX, rt); if(shamt) ShiftRegImm(SH_SAR, RDX, shamt); break;
+               case 0x04: LoadGPR(RCX, rs); LoadGPR(RDX, rt); ShiftRegCL(SH_SHL, RDX); break;
+               case 0x06: LoadGPR(RCX, rs); LoadGPR(RDX, rt); ShiftRegCL(SH_SHR, RDX); break;
+               case 0x07: LoadGPR(RCX, rs); LoadGPR(RDX, rt); ShiftRegCL(SH_SAR, RDX); break;
+
+               case 0x20: // ADD
+               case 0x22: // SUB
+                  LoadGPR(RDX, rs);
+                  LoadGPR(RCX, rt);
+                  AluRegReg((funct == 0x20) ? ALU_ADD : ALU_SUB, RDX, RCX);
+                  GenExitIf(CC_O, pc);
+                  break;
+
+               case 0x21: LoadGPR(RDX, rs); LoadGPR(RCX, rt); AluRegReg(ALU_ADD, RDX, RCX); break;
+               case 0x23: LoadGPR(RDX, rs); LoadGPR(RCX, rt); AluRegReg(ALU_SUB, RDX, RCX); break;
+               case 0x24: LoadGPR(RDX, rs); LoadGPR(RCX, rt); AluRegReg(ALU_AND, RDX, RCX); break;
+               case 0x25: LoadGPR(RDX, rs); LoadGPR(RCX, rt); AluRegReg(ALU_OR, RDX, RCX); break;
+               case 0x26: LoadGPR(RDX, rs); LoadGPR(RCX, rt); AluRegReg(ALU_XOR, RDX, RCX); break;
+               case 0x27: LoadGPR(RDX, rs); LoadGPR(RCX, rt); AluRegReg(ALU_OR, RDX, RCX); Emit8(0xF7); Emit8(0xD2); break; // not edx
+               case 0x2A: LoadGPR(RDX, rs); LoadGPR(RCX, rt); AluRegReg(ALU_CMP, RDX, RCX); SetccMovzx(CC_L, RDX); break;
+               case 0x2B: LoadGPR(RDX, rs); LoadGPR(RCX, rt); AluRegReg(ALU_CMP, RDX, RCX); SetccMovzx(CC_B, RDX); break;
+            }
+            GenReadAbsorbStep();
+            // The shifts by immediate only depend on rt; the rs field is zero for well-formed instructions,
+            // but the interpreter doesn't touch it either way.
+            GenDepRes((funct <= 0x03) ? 0 : rs, rt, rd);
+            GenDoLDS();
+            MovMemReg(GPR_OFS(rd), RDX);
+            if(!rd)
+               gpr0_dirty = true;
+            return 0;
+      }
+   }
+   else switch(instr >> 26)
+   {
+      case 0x08: // ADDI
+      case 0x09: // ADDIU
+      case 0x0A: // SLTI
+      case 0x0B: // SLTIU
+      case 0x0C: // ANDI
+      case 0x0D: // ORI
+      case 0x0E: // XORI
+      case 0x0F: // LUI
+         switch(instr >> 26)
+         {
+            case 0x08: LoadGPR(RDX, rs); AluRegImm(ALU_ADD, RDX, imm_se); GenExitIf(CC_O, pc); break;
+            case 0x09: LoadGPR(RDX, rs); AluRegImm(ALU_ADD, RDX, imm_se); break;
+            case 0x0A: LoadGPR(RDX, rs); AluRegImm(ALU_CMP, RDX, imm_se); SetccMovzx(CC_L, RDX); break;
+            case 0x0B: LoadGPR(RDX, rs); AluRegImm(ALU_CMP, RDX, imm_se); SetccMovzx(CC_B, RDX); break;
+            case 0x0C: LoadGPR(RDX, rs); AluRegImm(ALU_AND, RDX, imm_ze); break;
+            case 0x0D: LoadGPR(RDX, rs); AluRegImm(ALU_OR, RDX, imm_ze); break;
+            case 0x0E: LoadGPR(RDX, rs); AluRegImm(ALU_XOR, RDX, imm_ze); break;
+            case 0x0F: MovRegImm(RDX, imm_ze << 16); break;
+         }
+         GenReadAbsorbStep();
+         GenDepRes(((instr >> 26) == 0x0F) ? 0 : rs, rt, 0);
+         GenDoLDS();
+         MovMemReg(GPR_OFS(rt), RDX);
+         if(!rt)
+            gpr0_dirty = true;
+         return 0;
+
+      case 0x12: helper = COP2; break;
+
+      case 0x20: helper = Load<int8>; new_ld = rt; checks = DR_CHECK_IPCACHE; break;
+      case 0x21: helper = Load<int16>; new_ld = rt; checks = DR_CHECK_IPCACHE; align_mask = 1; break;
+      case 0x22: helper = LWL; new_ld = rt; checks = DR_CHECK_IPCACHE; break;
+      case 0x23: helper = Load<uint32>; new_ld = rt; checks = DR_CHECK_IPCACHE; align_mask = 3; break;
+      case 0x24: helper = Load<uint8>; new_ld = rt; checks = DR_CHECK_IPCACHE; break;
+      case 0x25: helper = Load<uint16>; new_ld = rt; checks = DR_CHECK_IPCACHE; align_mask = 1; break;
+      case 0x26: helper = LWR; new_ld = rt; checks = DR_CHECK_IPCACHE; break;
+      case 0x28: helper = Store<uint8>; checks = DR_CHECK_IPCACHE | DR_CHECK_BIU; break;
+      case 0x29: helper = Store<uint16>; checks = DR_CHECK_IPCACHE | DR_CHECK_BIU; align_mask = 1; break;
+      case 0x2A: helper = SWL; checks = DR_CHECK_IPCACHE | DR_CHECK_BIU; break;
+      case 0x2B: helper = Store<uint32>; checks = DR_CHECK_IPCACHE | DR_CHECK_BIU; align_mask = 3; break;
+      case 0x2E: helper = SWR; checks = DR_CHECK_IPCACHE | DR_CHECK_BIU; break;
+      case 0x32: helper = LWC2; checks = DR_CHECK_IPCACHE; align_mask = 3; break;
+      case 0x3A: helper = SWC2; checks = DR_CHECK_IPCACHE | DR_CHECK_BIU; align_mask = 3; break;
+   }
+
+   // MFC2/CFC2 go through the load delay slot.
+   if((instr >> 26) == 0x12 && (rs == 0x00 || rs == 0x02))
+      new_ld = rt;
+
+   if(align_mask)
+   {
+      LoadGPR(RDX, rs);
+      AluRegImm(ALU_ADD, RDX, imm_se);
+      Emit8(0xF6); Emit8(0xC2); Emit8(align_mask);   // test dl, align_mask
+      GenExitIf(CC_NE, pc);
+   }
+
+   GenReadAbsorbStep();
+
+   // The helper does its own DO_LDS(), off of the load delay state in memory.
+   GenCallHelper(helper, instr);
+
+   if(ld_which != 0x20)
+      gpr0_dirty = true;
+   if(!(instr >> 26) && (instr & 0x3F) <= 0x12 && !rd)   // MFHI/MFLO to r0
+      gpr0_dirty = true;
+
+   ld_which = new_ld;
+   ra_dummy_stale = true;
+
+   return checks;
+}
+
+// A branch or jump at index i, together with its delay slot at i + 1.
+void PS_CPU_Dynarec::GenBranch(unsigned i)
+{
+   const uint32_t pc = block_start + i * 4;
+   const uint32_t instr = insns[i].instr;
+   const unsigned rs = (instr >> 21) & 0x1F;
+   const unsigned rt = (instr >> 16) & 0x1F;
+   const unsigned rd = (instr >> 11) & 0x1F;
+   const uint32_t imm_se = (int32)(int16)(instr & 0xFFFF);
+   bool conditional = true;
+   bool indirect = false;
+   unsigned link = 0;
+   uint32_t new_pc = imm_se << 2;
+   uint32_t new_pc_mask = ~0U & ~3;
+   uint32_t target;
+   unsigned checks;
+   uint8_t *not_taken = NULL;
+
+   if(!(instr >> 26))
+   {
+      // JR, JALR
+      conditional = false;
+      indirect = true;
+      new_pc_mask = 0;
+      LoadGPR(RDX, rs);
+      GenReadAbsorbStep();
+      GenDepRes(rs, rd, 0);
+      GenDoLDS();
+      if((instr & 0x3F) == 0x09)
+      {
+         MovMemImm(GPR_OFS(rd), pc + 8);
+         if(!rd)
+            gpr0_dirty = true;
+      }
+      MovMemReg(ofs_new_pc, RDX);
+   }
+   else
+   {
+      switch(instr >> 26)
+      {
+         case 0x01: // BCOND
+            LoadGPR(RDX, rs);
+            AluRegReg(ALU_OR, RDX, RDX);
+            SetccMovzx((rt & 1) ? CC_NS : CC_S, R12);
+            if(rt & 0x10)
+               link = 31;
+            break;
+
+         case 0x02: // J
+         case 0x03: // JAL
+            conditional = false;
+            new_pc = (instr & ((1 << 26) - 1)) << 2;
+            new_pc_mask = 0xF0000000;
+            break;
+
+         case 0x04: // BEQ
+         case 0x05: // BNE
+            LoadGPR(RDX, rs);
+            LoadGPR(RCX, rt);
+            AluRegReg(ALU_CMP, RDX, RCX);
+            SetccMovzx(((instr >> 26) == 0x04) ? CC_E : CC_NE, R12);
+            break;
+
+         case 0x06: // BLEZ
+         case 0x07: // BGTZ
+            LoadGPR(RDX, rs);
+            AluRegReg(ALU_OR, RDX, RDX);
+            SetccMovzx(((instr >> 26) == 0x06) ? CC_LE : CC_G, R12);
+            break;
+      }
+
+      GenReadAbsorbStep();
+
+      if((instr >> 26) == 0x03)
+         MovMem8Imm(RA_OFS(31), 0);
+      else if((instr >> 26) == 0x01)
+         GenDepRes(rs, link, 0);
+      else if((instr >> 26) >= 0x04)
+         GenDepRes(rs, ((instr >> 26) <= 0x05) ? rt : 0, 0);
+
+      GenDoLDS();
+
+      if((instr >> 26) == 0x03 || link)
+         MovMemImm(GPR_OFS(31), pc + 8);
+
+      if(conditional)
+      {
+         Emit8(0x45); Emit8(0x85); Emit8(0xE4);   // test r12d, r12d
+         not_taken = Jcc(CC_E);
+      }
+      MovMemImm(ofs_new_pc, new_pc);
+      MovMemImm(ofs_new_pc_mask, new_pc_mask);
+      if(not_taken)
+         Bind(not_taken, code_ptr);
+   }
+
+   if(indirect)
+      MovMemImm(ofs_new_pc_mask, new_pc_mask);
+
+   //
+   // Delay slot
+   //
+   GenInsnStart(i + 1);
+   checks = GenInsn(pc + 4, insns[i + 1].instr);
+
+   target = ((pc + 4) & new_pc_mask) + new_pc;
+
+   if(indirect)
+   {
+      MovRegMem(RAX, ofs_new_pc);
+      MovMemReg(ofs_pc, RAX);
+      MovMemImm(ofs_new_pc, 4);
+      MovMemImm(ofs_new_pc_mask, ~0U);
+      fixups[fixup_count].rel32 = Jmp();
+      fixups[fixup_count].index = FIXUP_EPILOGUE;
+      fixups[fixup_count].pc = 0;
+      fixup_count++;
+      return;
+   }
+
+   if(conditional)
+   {
+      Emit8(0x45); Emit8(0x85); Emit8(0xE4);   // test r12d, r12d
+      not_taken = Jcc(CC_E);
+   }
+
+   MovMemImm(ofs_new_pc, 4);
+   MovMemImm(ofs_new_pc_mask, ~0U);
+
+   if(insns[i].target >= 0)
+   {
+      GenChecks(checks, target);
+      fixups[fixup_count].rel32 = Jmp();
+      fixups[fixup_count].index = insns[i].target;
+      fixups[fixup_count].pc = target;
+      fixup_count++;
+   }
+   else
+      GenExitTo(Jmp(), target);
+
+   if(conditional)
+   {
+      Bind(not_taken, code_ptr);
+      GenChecks(checks, pc + 8);
+   }
+}
+
+void PS_CPU_Dynarec::GenInsns(unsigned first, unsigned end)
+{
+   for(unsigned i = first; i < end; i++)
+   {
+      const uint32_t pc = block_start + i * 4;
+
+      GenInsnStart(i);
+
+      if(insns[i].kind == DR_KIND_BRANCH)
+      {
+         GenBranch(i);
+         i++;
+      }
+      else
+         GenChecks(GenInsn(pc, insns[i].instr), pc + 4);
+   }
+}
+
+DynarecBlock PS_CPU_Dynarec::Compile(PS_CPU *cpu, uint32_t start, bool cached_only, bool *nocompile)
+{
+   DynarecBlockInfo *info;
+   uint8_t *block_code;
+   uint8_t *validate;
+   uint8_t *validated;
+   uint8_t *fail;
+   uint8_t *epilogue;
+   unsigned last_check;
+   uint32_t pc = start;
+   bool ends_with_jump = false;
+   unsigned i;
+
+   ofs_gpr = (uint8_t *)&cpu->GPR[0] - (uint8_t *)cpu;
+   ofs_lo = (uint8_t *)&cpu->LO - (uint8_t *)cpu;
+   ofs_hi = (uint8_t *)&cpu->HI - (uint8_t *)cpu;
+   ofs_pc = (uint8_t *)&cpu->BACKED_PC - (uint8_t *)cpu;
+   ofs_new_pc = (uint8_t *)&cpu->BACKED_new_PC - (uint8_t *)cpu;
+   ofs_new_pc_mask = (uint8_t *)&cpu->BACKED_new_PC_mask - (uint8_t *)cpu;
+   ofs_ipcache = (uint8_t *)&cpu->IPCache - (uint8_t *)cpu;
+   ofs_ldwhich = (uint8_t *)&cpu->BACKED_LDWhich - (uint8_t *)cpu;
+   ofs_ldvalue = (uint8_t *)&cpu->BACKED_LDValue - (uint8_t *)cpu;
+   ofs_ldabsorb = (uint8_t *)&cpu->LDAbsorb - (uint8_t *)cpu;
+   ofs_next_event_ts = (uint8_t *)&cpu->next_event_ts - (uint8_t *)cpu;
+   ofs_biu = (uint8_t *)&cpu->BIU - (uint8_t *)cpu;
+   ofs_icache_gen = (uint8_t *)&cpu->ICacheGen - (uint8_t *)cpu;
+   ofs_readabsorb = (uint8_t *)&cpu->ReadAbsorb[0] - (uint8_t *)cpu;
+   ofs_readabsorbwhich = (uint8_t *)&cpu->ReadAbsorbWhich - (uint8_t *)cpu;
+   ofs_readfudge = (uint8_t *)&cpu->ReadFudge - (uint8_t *)cpu;
+
+   //
+   // Find the extent of the block.
+   //
+   insn_count = 0;
+   block_start = start;
+
+   while(insn_count < DYNAREC_MAX_BLOCK)
+   {
+      uint32_t instr, ds_instr;
+      unsigned kind, ds_kind;
+
+      if(!FetchInstr(cpu, pc, cached_only, &instr))
+         break;
+
+      kind = Classify(instr);
+
+      if(kind == DR_KIND_NONE)
+         break;
+
+      if(kind == DR_KIND_BRANCH)
+      {
+         if(insn_count + 2 > DYNAREC_MAX_BLOCK || !FetchInstr(cpu, pc + 4, cached_only, &ds_instr))
+            break;
+
+         ds_kind = Classify(ds_instr);
+
+         if(ds_kind == DR_KIND_NONE || ds_kind == DR_KIND_BRANCH)
+            break;
+
+         insns[insn_count].instr = instr;
+         insns[insn_count].kind = kind;
+         insns[insn_count].delay_slot = false;
+         insns[insn_count + 1].instr = ds_instr;
+         insns[insn_count + 1].kind = ds_kind;
+         insns[insn_count + 1].delay_slot = true;
+         insn_count += 2;
+         pc += 8;
+
+         // J, JAL, JR, JALR
+         if((instr >> 26) == 0x02 || (instr >> 26) == 0x03 || !(instr >> 26))
+         {
+            ends_with_jump = true;
+            break;
+         }
+         continue;
+      }
+
+      insns[insn_count].instr = instr;
+      insns[insn_count].kind = kind;
+      insns[insn_count].delay_slot = false;
+      insn_count++;
+      pc += 4;
+   }
+
+   if(!insn_count)
+   {
+      *nocompile = true;
+      return NULL;
+   }
+
+   //
+   // Resolve branches into the block itself.
+   //
+   for(i = 0; i < insn_count; i++)
+   {
+      insns[i].join = false;
+      insns[i].target = -1;
+   }
+
+   for(i = 0; i < insn_count; i++)
+   {
+      const uint32_t instr = insns[i].instr;
+      const uint32_t bpc = start + i * 4;
+      uint32_t target;
+
+      if(insns[i].kind != DR_KIND_BRANCH || !(instr >> 26))
+         continue;
+
+      if((instr >> 26) == 0x02 || (instr >> 26) == 0x03)
+         target = ((bpc + 4) & 0xF0000000) + ((instr & ((1 << 26) - 1)) << 2);
+      else
+         target = bpc + 4 + ((int32)(int16)(instr & 0xFFFF) << 2);
+
+      if(target >= start && target < pc && !insns[(target - start) >> 2].delay_slot)
+      {
+         insns[i].target = (target - start) >> 2;
+         insns[insns[i].target].join = true;
+      }
+   }
+
+   //
+   // Place the next_event_ts checks: on entry, at branch targets, after helpers, and often enough in between
+   // that the lookahead doesn't send the block to the stepping copies too far ahead of an event.  Delay slots
+   // are left out, so that a span never ends between a branch and its delay slot.
+   //
+   last_check = 0;
+   for(i = 0; i < insn_count; i++)
+   {
+      insns[i].span = 0;
+
+      if(!i || insns[i].join || insns[i - 1].kind == DR_KIND_HELPER || (i - last_check >= DYNAREC_EVENT_SPAN - 1 && !insns[i].delay_slot))
+      {
+         insns[i].span = 1;
+         last_check = i;
+      }
+   }
+
+   for(i = insn_count, last_check = insn_count; i-- > 0;)
+   {
+      if(insns[i].span)
+      {
+         insns[i].span = last_check - i;
+         last_check = i;
+      }
+   }
+
+   //
+   // The instruction words the block is compiled from, for Validate().
+   //
+   code_ptr += (8 - ((uintptr_t)code_ptr & 7)) & 7;
+   info = (DynarecBlockInfo *)code_ptr;
+   info->icache_gen = ~(uint64)0;
+   info->start = start;
+   info->count = insn_count;
+   for(i = 0; i < insn_count; i++)
+      info->instr[i] = insns[i].instr;
+   code_ptr = (uint8_t *)&info->instr[insn_count];
+
+   //
+   // Prologue
+   //
+   fixup_count = 0;
+   block_code = code_ptr;
+
+   Emit8(0x53);                             // push rbx
+   Emit8(0x55);                             // push rbp
+   Emit8(0x41); Emit8(0x54);                // push r12
+   Emit8(0x48); Emit8(0x89); Emit8(0xFD);   // mov rbp, rdi
+   Emit8(0x89); Emit8(0xF3);                // mov ebx, esi
+
+   Emit8(0x48); Emit8(0x8B); Emit8(0x05); Emit32((uint8_t *)&info->icache_gen - (code_ptr + 4));   // mov rax, [rip + icache_gen]
+   Emit8(0x48); Emit8(0x3B); EmitMem(RAX, ofs_icache_gen);                                         // cmp rax, [ICacheGen]
+   validate = Jcc(CC_NE);
+   validated = code_ptr;
+
+   GenEntryTrapCheck(insns[0].instr);
+
+   //
+   // Body
+   //
+   stepping = false;
+   GenInsns(0, insn_count);
+
+   if(!ends_with_jump)
+      GenExitTo(Jmp(), pc);
+
+   //
+   // Stepping copies, for when an event is due within a span; they rejoin the body at the next check.
+   //
+   stepping = true;
+   for(i = 0; i < insn_count; i++)
+   {
+      if(insns[i].span <= 1)
+         continue;
+
+      Bind(insns[i].step_rel32, code_ptr);
+      ld_which = insns[i].step_ld_which;
+      gpr0_dirty = insns[i].step_gpr0_dirty;
+      ra_dummy_stale = insns[i].step_ra_dummy_stale;
+
+      GenInsns(i, i + insns[i].span);
+
+      if(i + insns[i].span < insn_count)
+      {
+         fixups[fixup_count].rel32 = Jmp();
+         fixups[fixup_count].index = i + insns[i].span;
+         fixups[fixup_count].pc = 0;
+         fixup_count++;
+      }
+      else if(!ends_with_jump)
+         GenExitTo(Jmp(), pc);
+   }
+   stepping = false;
+
+   //
+   // Exit stubs and epilogue
+   //
+   epilogue = code_ptr;
+   Emit8(0x89); Emit8(0xD8);                // mov eax, ebx
+   Emit8(0x41); Emit8(0x5C);                // pop r12
+   Emit8(0x5D);                             // pop rbp
+   Emit8(0x5B);                             // pop rbx
+   Emit8(0xC3);                             // ret
+
+   fail = code_ptr;
+   MovRegImm(RBX, ~0U);
+   Bind(Jmp(), epilogue);
+
+   Bind(validate, code_ptr);
+   Emit8(0x48); Emit8(0x89); Emit8(0xEF);                     // mov rdi, rbp
+   Emit8(0x48); Emit8(0xBE); Emit64((uintptr_t)info);         // mov rsi, info
+   Emit8(0x48); Emit8(0xB8); Emit64((uintptr_t)Validate);     // mov rax, Validate
+   Emit8(0xFF); Emit8(0xD0);                                  // call rax
+   Emit8(0x84); Emit8(0xC0);                                  // test al, al
+   Bind(Jcc(CC_E), fail);
+   Bind(Jmp(), validated);
+
+   for(i = 0; i < fixup_count; i++)
+   {
+      Fixup *f = &fixups[i];
+
+      if(f->index >= 0)
+         Bind(f->rel32, insns[f->index].start);
+      else if(f->index == FIXUP_EPILOGUE)
+         Bind(f->rel32, epilogue);
+      else if(f->index == FIXUP_FAIL)
+         Bind(f->rel32, fail);
+      else
+      {
+         unsigned j;
+
+         // Share stubs between exits to the same PC.
+         for(j = 0; j < i; j++)
+         {
+            if(fixups[j].index == FIXUP_EXIT && fixups[j].pc == f->pc)
+               break;
+         }
+
+         if(j < i)
+            MDFN_en32lsb(f->rel32, MDFN_de32lsb(fixups[j].rel32) + (uint32)(fixups[j].rel32 - f->rel32));
+         else
+         {
+            Bind(f->rel32, code_ptr);
+            MovMemImm(ofs_pc, f->pc);
+            Bind(Jmp(), epilogue);
+         }
+      }
+   }
+
+   return (DynarecBlock)block_code;
+}
+
+#undef GPR_OFS
+#undef RA_OFS
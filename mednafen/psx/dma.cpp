@@ -434,7 +434,10 @@ static INLINE void RunChannel(int32_t timestamp, int32_t clocks, int ch)
             ChRW(ch, CRModeCache, &vtmp, &voffs);
 
             if(!(CRModeCache & 0x1))
+            {
+               MainRAMDirty.Mark((DMACH[ch].CurAddr + (voffs << 2)) & 0x1FFFFC);
                MainRAM.WriteU32((DMACH[ch].CurAddr + (voffs << 2)) & 0x1FFFFC, vtmp);
+            }
          }
 
          if(CRModeCache & 0x2)
@@ -32,6 +32,22 @@
 
 #include "input/multitap.h"
 
+#include "../../libretro.h"
+#include <rthreads/rthreads.h>
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32) && !defined(_XBOX)
+#include <windows.h>
+#include <io.h>
+#elif !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+extern retro_log_printf_t log_cb;
+
 //#define PSX_FIODBGINFO(format, ...) { /* printf(format " -- timestamp=%d -- PAD temp\n", ## __VA_ARGS__, timestamp); */  }
 static void PSX_FIODBGINFO(const char *format, ...)
 {
@@ -332,6 +348,196 @@ void FrontIO::MapDevicesToPorts(void)
    }
 }
 
+//
+// Memory card files are written by a background thread, so the emulation thread only has to copy the card's contents;
+// a card saved again before its previous snapshot was written out just has that snapshot replaced.  Each file is
+// written under a temporary name first and then renamed over the old one, so a failed or interrupted write can't
+// leave a truncated card behind.
+//
+struct memcard_save
+{
+   std::string path;
+   std::vector<uint8_t> data;
+   bool pending;
+   bool failed;	// The last write of this card didn't make it to disk, so it still needs saving.
+};
+
+static memcard_save MemcardSaves[8];
+static bool MemcardSaveExit;
+
+static slock_t *MemcardSaveMutex = NULL;
+static scond_t *MemcardSaveCond = NULL;
+static sthread_t *MemcardSaveThread = NULL;
+
+static bool ReplaceMemcardFile(const char *tmp_path, const char *path)
+{
+#if defined(_WIN32) && !defined(_XBOX)
+   return(MoveFileExA(tmp_path, path, MOVEFILE_REPLACE_EXISTING) != 0);
+#else
+   return(rename(tmp_path, path) == 0);
+#endif
+}
+
+// Makes sure what was written to fp is on the disk, so that renaming the file over the card can't leave it truncated
+// after a crash or power loss.
+static bool SyncMemcardFile(FILE *fp)
+{
+   if(fflush(fp) != 0)
+      return(false);
+
+#if defined(_WIN32) && !defined(_XBOX)
+   return(FlushFileBuffers((HANDLE)_get_osfhandle(_fileno(fp))) != 0);
+#elif !defined(_WIN32)
+   return(fsync(fileno(fp)) == 0);
+#else
+   return(true);
+#endif
+}
+
+static bool WriteMemcardFile(const char *path, const uint8_t *data, size_t size)
+{
+   const std::string tmp_path = std::string(path) + ".tmp";
+   FILE *fp = fopen(tmp_path.c_str(), "wb");
+   bool ok;
+
+   if(!fp)
+   {
+      log_cb(RETRO_LOG_ERROR, "Error saving memcard: could not open %s\n", tmp_path.c_str());
+      return(false);
+   }
+
+   ok = fwrite(data, 1, size, fp) == size && SyncMemcardFile(fp);
+   ok = (fclose(fp) == 0) && ok;
+
+   if(!ok || !ReplaceMemcardFile(tmp_path.c_str(), path))
+   {
+      remove(tmp_path.c_str());
+      log_cb(RETRO_LOG_ERROR, "Error saving memcard to %s\n", path);
+      return(false);
+   }
+
+   log_cb(RETRO_LOG_INFO, "Saved memcard to %s\n", path);
+   return(true);
+}
+
+static void MemcardSaveThreadEntry(void *arg)
+{
+   std::vector<uint8_t> data;
+   std::string path;
+
+   slock_lock(MemcardSaveMutex);
+
+   for(;;)
+   {
+      int which = -1;
+      bool ok;
+
+      for(unsigned i = 0; i < 8; i++)
+      {
+         if(MemcardSaves[i].pending)
+         {
+            which = i;
+            break;
+         }
+      }
+
+      // Pending saves are still written out when exiting.
+      if(which < 0)
+      {
+         if(MemcardSaveExit)
+            break;
+
+         scond_wait(MemcardSaveCond, MemcardSaveMutex);
+         continue;
+      }
+
+      data.swap(MemcardSaves[which].data);
+      path = MemcardSaves[which].path;
+      MemcardSaves[which].pending = false;
+      slock_unlock(MemcardSaveMutex);
+
+      ok = WriteMemcardFile(path.c_str(), &data[0], data.size());
+
+      slock_lock(MemcardSaveMutex);
+
+      // A newer snapshot queued in the meantime supersedes this one, whatever happened to it.
+      if(!MemcardSaves[which].pending)
+         MemcardSaves[which].failed = !ok;
+   }
+
+   slock_unlock(MemcardSaveMutex);
+}
+
+static void StartMemcardSaveThread(void)
+{
+   MemcardSaveExit = false;
+
+   MemcardSaveMutex = slock_new();
+   MemcardSaveCond = scond_new();
+   MemcardSaveThread = sthread_create(MemcardSaveThreadEntry, NULL);
+
+   if(!MemcardSaveThread)
+   {
+      scond_free(MemcardSaveCond);
+      slock_free(MemcardSaveMutex);
+      MemcardSaveCond = NULL;
+      MemcardSaveMutex = NULL;
+   }
+}
+
+// Waits for all queued saves to be written out.
+static void StopMemcardSaveThread(void)
+{
+   if(!MemcardSaveThread)
+      return;
+
+   slock_lock(MemcardSaveMutex);
+   MemcardSaveExit = true;
+   scond_signal(MemcardSaveCond);
+   slock_unlock(MemcardSaveMutex);
+
+   sthread_join(MemcardSaveThread);
+   MemcardSaveThread = NULL;
+
+   scond_free(MemcardSaveCond);
+   slock_free(MemcardSaveMutex);
+   MemcardSaveCond = NULL;
+   MemcardSaveMutex = NULL;
+}
+
+static void QueueMemcardSave(unsigned which, const char *path, const uint8_t *data, size_t size)
+{
+   if(!MemcardSaveThread)
+      StartMemcardSaveThread();
+
+   if(!MemcardSaveThread)
+   {
+      MemcardSaves[which].failed = !WriteMemcardFile(path, data, size);
+      return;
+   }
+
+   slock_lock(MemcardSaveMutex);
+   MemcardSaves[which].data.assign(data, data + size);
+   MemcardSaves[which].path = path;
+   MemcardSaves[which].pending = true;
+   scond_signal(MemcardSaveCond);
+   slock_unlock(MemcardSaveMutex);
+}
+
+static bool MemcardSaveFailed(unsigned which)
+{
+   bool ret;
+
+   if(!MemcardSaveThread)
+      return(MemcardSaves[which].failed);
+
+   slock_lock(MemcardSaveMutex);
+   ret = MemcardSaves[which].failed;
+   slock_unlock(MemcardSaveMutex);
+
+   return(ret);
+}
+
 FrontIO::FrontIO(bool emulate_memcards_[8], bool emulate_multitap_[2])
 {
    int i;
@@ -342,6 +548,7 @@ FrontIO::FrontIO(bool emulate_memcards_[8], bool emulate_multitap_[2])
 
    for(i = 0; i < 8; i++)
    {
+      MemcardSaves[i].failed = false;
       DeviceData[i] = NULL;
       Devices[i] = new InputDevice();
       DevicesMC[i] = Device_Memcard_Create();
@@ -372,6 +579,8 @@ void FrontIO::SetCrosshairsColor(unsigned port, uint32_t color)
 FrontIO::~FrontIO()
 {
    int i;
+
+   StopMemcardSaveThread();
    for(i = 0; i < 8; i++)
    {
       if(Devices[i])
@@ -910,20 +1119,17 @@ void FrontIO::SaveMemcard(unsigned int which)
  }
 }
 
+// Queues the card's current contents to be written to path; see QueueMemcardSave().
 void FrontIO::SaveMemcard(unsigned int which, const char *path)
 {
  assert(which < 8);
 
- if(DevicesMC[which]->GetNVSize() && DevicesMC[which]->GetNVDirtyCount())
+ if(DevicesMC[which]->GetNVSize() && (DevicesMC[which]->GetNVDirtyCount() || MemcardSaveFailed(which)))
  {
-  FileStream mf(path, MODE_WRITE);	// TODO: MODE_WRITE_ATOMIC_OVERWRITE
-
   DevicesMC[which]->ReadNV(DevicesMC[which]->GetNVData(), 0, (1 << 17));
-  mf.write(DevicesMC[which]->GetNVData(), (1 << 17));
-
-  mf.close();	// Call before resetting the NV dirty count!
-
   DevicesMC[which]->ResetNVDirtyCount();
+
+  QueueMemcardSave(which, path, DevicesMC[which]->GetNVData(), (1 << 17));
  }
 }
 
@@ -90,6 +90,15 @@ PS_GPU::PS_GPU(bool pal_clock_and_tv, int sls, int sle, uint8_t upscale_shift)
    this->upscale_shift = upscale_shift;
    this->dither_upscale_shift = 0;
    this->SubpixelVertexCache = NULL;
+   this->SubpixelVertexCacheGen = 0;
+   this->VRAMDirty = new StateDirtyMap(1024 * 512 * sizeof(uint16), 14);
+   this->StateVRAM = NULL;
+   this->RasterThread = NULL;
+   this->RasterQueued = false;
+   this->vram = vram_storage;
+
+   BandY0 = -(1 << 30);
+   BandY1 = 1 << 30;
 }
 
 PS_GPU::PS_GPU(const PS_GPU &g, uint8 ushift)
@@ -100,6 +109,16 @@ PS_GPU::PS_GPU(const PS_GPU &g, uint8 ushift)
    // Be careful not to copy the dynamically allocated vertex cache
    this->SubpixelVertexCache = NULL;
 
+   // ...nor the raster thread, or the other GPU's VRAM pointer
+   this->RasterThread = NULL;
+   this->RasterQueued = false;
+   this->vram = vram_storage;
+
+   // The old delta base doesn't survive this, the next delta state will
+   // be a full one
+   this->VRAMDirty = new StateDirtyMap(1024 * 512 * sizeof(uint16), 14);
+   this->StateVRAM = NULL;
+
    // Override the upscaling factor
    upscale_shift = ushift;
 
@@ -115,13 +134,19 @@ PS_GPU::PS_GPU(const PS_GPU &g, uint8 ushift)
      EnableSubpixelVertexCache(true);
      if (SubpixelVertexCache) {
        memcpy(SubpixelVertexCache, g.SubpixelVertexCache,
-	      0x1000 * 0x1000 * sizeof(*SubpixelVertexCache));
+	      SUBPIXEL_VERTEX_CACHE_SIZE * sizeof(*SubpixelVertexCache));
+       SubpixelVertexCacheGen = g.SubpixelVertexCacheGen;
      }
    }
 }
 
 PS_GPU::~PS_GPU()
 {
+   EnableRasterThread(false, 1);
+   EnableSubpixelVertexCache(false);
+
+   delete VRAMDirty;
+   delete [] StateVRAM;
 }
 
 void PS_GPU::BuildDitherTable()
@@ -152,8 +177,10 @@ void PS_GPU::EnableSubpixelVertexCache(bool enable) {
   // The cache is useless at 1x
   if (enable && upscale_shift > 0) {
     if (SubpixelVertexCache == NULL) {
-      SubpixelVertexCache = new subpixel_vertex[0x1000 * 0x1000];
-      ResetSubpixelVertexCache();
+      SubpixelVertexCache = new subpixel_vertex_entry[SUBPIXEL_VERTEX_CACHE_SIZE];
+      for (unsigned i = 0; i < SUBPIXEL_VERTEX_CACHE_SIZE; i++)
+	SubpixelVertexCache[i].key = 0;
+      SubpixelVertexCacheGen = 1;
     }
   } else {
     if (SubpixelVertexCache) {
@@ -168,10 +195,14 @@ void PS_GPU::ResetSubpixelVertexCache() {
     return;
   }
 
-  for (int16 x = -0x800; x < 0x800; x++) {
-      for (int16 y = -0x800; y < 0x800; y++) {
-	AddSubpixelVertex(x, y, (float)x, (float)y, 0);
-      }
+  // Entries from older generations never match, only clear them when
+  // the generation wraps around.
+  SubpixelVertexCacheGen = (SubpixelVertexCacheGen + 1) & 0xFF;
+
+  if (SubpixelVertexCacheGen == 0) {
+    for (unsigned i = 0; i < SUBPIXEL_VERTEX_CACHE_SIZE; i++)
+      SubpixelVertexCache[i].key = 0;
+    SubpixelVertexCacheGen = 1;
   }
 }
 
@@ -206,6 +237,8 @@ void PS_GPU::Destroy(PS_GPU *gpu) {
 // Build a new GPU with a different upscale_shift
 PS_GPU *PS_GPU::Rescale(uint8 ushift)
 {
+   SyncRasterThread();
+
    void *buffer = PS_GPU::Alloc(ushift);
 
    return new (buffer) PS_GPU(*this, ushift);
@@ -324,7 +357,10 @@ void PS_GPU::SoftReset(void) // Control command 0x00
 
 void PS_GPU::Power(void)
 {
+   SyncRasterThread();
+
    memset(vram, 0, vram_npixels() * sizeof(*vram));
+   VRAMDirty->MarkAll();
 
    memset(CLUT_Cache, 0, sizeof(CLUT_Cache));
    CLUT_Cache_VB = ~0U;
@@ -428,6 +464,7 @@ void PS_GPU::ResetTS(void)
    lastts = 0;
 }
 
+#include "gpu_thread.cpp"
 #include "gpu_common.cpp"
 #include "gpu_polygon.cpp"
 #include "gpu_sprite.cpp"
@@ -482,11 +519,11 @@ static void G_Command_IRQ(PS_GPU* g, const uint32 *cb)
    IRQ_Assert(IRQ_GPU, g->IRQPending);
 }
 
-// Special RAM write mode(16 pixels at a time),
-// does *not* appear to use mask drawing environment settings.
-static void G_Command_FBFill(PS_GPU* gpu, const uint32 *cb)
+// VRAM side of FBFill, run inline or on the raster thread.
+static void R_FBFill(PS_GPU* gpu, const gpu_raster_cmd *cmd)
 {
    int32_t x, y;
+   const uint32 *cb          = cmd->cb;
    int32_t r                 = cb[0] & 0xFF;
    int32_t g                 = (cb[0] >> 8) & 0xFF;
    int32_t b                 = (cb[0] >> 16) & 0xFF;
@@ -496,18 +533,13 @@ static void G_Command_FBFill(PS_GPU* gpu, const uint32 *cb)
    int32_t width             = (((cb[2] >> 0) & 0x3FF) + 0xF) & ~0xF;
    int32_t height            = (cb[2] >> 16) & 0x1FF;
 
-   //printf("[GPU] FB Fill %d:%d w=%d, h=%d\n", destX, destY, width, height);
-   gpu->DrawTimeAvail       -= 46; // Approximate
-
-   for(y = 0; y < height; y++)
+   for(y = std::max<int32>(0, gpu->BandY0); y < std::min<int32>(height, gpu->BandY1); y++)
    {
       const int32 d_y = (y + destY) & 511;
 
       if(LineSkipTest(gpu, d_y))
          continue;
 
-      gpu->DrawTimeAvail -= (width >> 3) + 9;
-
       for(x = 0; x < width; x++)
       {
          const int32 d_x = (x + destX) & 1023;
@@ -515,12 +547,52 @@ static void G_Command_FBFill(PS_GPU* gpu, const uint32 *cb)
          gpu->texel_put(d_x, d_y, fill_value);
       }
    }
+}
+
+// Special RAM write mode(16 pixels at a time),
+// does *not* appear to use mask drawing environment settings.
+static void G_Command_FBFill(PS_GPU* gpu, const uint32 *cb)
+{
+   gpu_raster_cmd cmd;
+   int32_t y;
+   int32_t destX             = (cb[1] >>  0) & 0x3F0;
+   int32_t destY             = (cb[1] >> 16) & 0x3FF;
+   int32_t width             = (((cb[2] >> 0) & 0x3FF) + 0xF) & ~0xF;
+   int32_t height            = (cb[2] >> 16) & 0x1FF;
+
+   //printf("[GPU] FB Fill %d:%d w=%d, h=%d\n", destX, destY, width, height);
+   gpu->DrawTimeAvail       -= 46; // Approximate
+
+   for(y = 0; y < height; y++)
+   {
+      const int32 d_y = (y + destY) & 511;
+
+      if(LineSkipTest(gpu, d_y))
+         continue;
+
+      gpu->DrawTimeAvail -= (width >> 3) + 9;
+   }
+
+   gpu->MarkVRAMRows(destY & 511, (destY & 511) + height);
+
+   cmd.func   = R_FBFill;
+   memcpy(cmd.cb, cb, 3 * sizeof(uint32));
+   cmd.y0     = 0;
+   cmd.y1     = height;
+   cmd.pixels = (width * height) << (2 * gpu->upscale_shift);
+
+   if(gpu->RasterThread)
+      gpu->QueueRaster(&cmd);
+   else
+      R_FBFill(gpu, &cmd);
 
    rsx_intf_fill_rect(cb[0], destX, destY, width, height);
 }
 
-static void G_Command_FBCopy(PS_GPU* g, const uint32 *cb)
+// VRAM side of FBCopy, run inline or on the raster thread.
+static void R_FBCopy(PS_GPU* g, const gpu_raster_cmd *cmd)
 {
+   const uint32 *cb = cmd->cb;
    int32_t sourceX = (cb[1] >> 0) & 0x3FF;
    int32_t sourceY = (cb[1] >> 16) & 0x3FF;
    int32_t destX   = (cb[2] >> 0) & 0x3FF;
@@ -534,11 +606,6 @@ static void G_Command_FBCopy(PS_GPU* g, const uint32 *cb)
    if(!height)
       height = 0x200;
 
-   g->InvalidateTexCache();
-   //printf("FB Copy: %d %d %d %d %d %d\n", sourceX, sourceY, destX, destY, width, height);
-
-   g->DrawTimeAvail -= (width * height) * 2;
-
    for(int32 y = 0; y < height; y++)
    {
       for(int32 x = 0; x < width; x += 128)
@@ -565,6 +632,39 @@ static void G_Command_FBCopy(PS_GPU* g, const uint32 *cb)
          }
       }
    }
+}
+
+static void G_Command_FBCopy(PS_GPU* g, const uint32 *cb)
+{
+   gpu_raster_cmd cmd;
+   int32_t sourceX = (cb[1] >> 0) & 0x3FF;
+   int32_t sourceY = (cb[1] >> 16) & 0x3FF;
+   int32_t destX   = (cb[2] >> 0) & 0x3FF;
+   int32_t destY   = (cb[2] >> 16) & 0x3FF;
+   int32_t width   = (cb[3] >> 0) & 0x3FF;
+   int32_t height  = (cb[3] >> 16) & 0x1FF;
+
+   if(!width)
+      width = 0x400;
+
+   if(!height)
+      height = 0x200;
+
+   g->InvalidateTexCache();
+   //printf("FB Copy: %d %d %d %d %d %d\n", sourceX, sourceY, destX, destY, width, height);
+
+   g->DrawTimeAvail -= (width * height) * 2;
+
+   g->MarkVRAMRows(destY & 511, (destY & 511) + height);
+
+   cmd.func = R_FBCopy;
+   memcpy(cmd.cb, cb, 4 * sizeof(uint32));
+   cmd.pixels = 0;
+
+   if(g->RasterThread)
+      g->QueueRaster(&cmd);
+   else
+      R_FBCopy(g, &cmd);
 
    rsx_intf_copy_rect(sourceX, sourceY, destX, destY, width, height);
 }
@@ -573,6 +673,10 @@ static void G_Command_FBWrite(PS_GPU* g, const uint32 *cb)
 {
    //assert(InCmd == INCMD_NONE);
 
+   // The upload is written from the emulation thread, and nothing else
+   // gets queued until it completes.
+   g->SyncRasterThread();
+
    g->FBRW_X = (cb[1] >>  0) & 0x3FF;
    g->FBRW_Y = (cb[1] >> 16) & 0x3FF;
 
@@ -602,6 +706,8 @@ static void G_Command_FBRead(PS_GPU* g, const uint32 *cb)
 {
    //assert(g->InCmd == INCMD_NONE);
 
+   g->SyncRasterThread();
+
    g->FBRW_X = (cb[1] >>  0) & 0x3FF;
    g->FBRW_Y = (cb[1] >> 16) & 0x3FF;
 
@@ -844,6 +950,11 @@ void PS_GPU::ProcessFIFO(void)
          return;
 
       case INCMD_FBWRITE:
+         // G_Command_FBWrite() synced already, but display lines may have
+         // been queued since the upload started.
+         if(RasterQueued)
+            SyncRasterThread();
+
          InData = BlitterFIFO.Read();
 
          for(i = 0; i < 2; i++)
@@ -851,7 +962,10 @@ void PS_GPU::ProcessFIFO(void)
             bool fetch = texel_fetch(FBRW_CurX & 1023, FBRW_CurY & 511) & MaskEvalAND;
 
             if (!fetch)
+            {
+               VRAMDirty->Mark((FBRW_CurY & 511) << 11);
                texel_put(FBRW_CurX & 1023, FBRW_CurY & 511, InData | MaskSetOR);
+            }
 
             FBRW_CurX++;
             if(FBRW_CurX == (FBRW_X + FBRW_W))
@@ -1304,6 +1418,35 @@ INLINE void PS_GPU::ReorderRGB_Var(uint32_t out_Rshift,
    }
 }
 
+// Output one (upscaled) display line, run inline or on the raster thread.
+static void R_Scanout(PS_GPU *g, const gpu_raster_cmd *cmd)
+{
+   for (uint32_t i = 0; i < g->upscale(); i++)
+   {
+      uint32_t x;
+      const uint16_t *src = g->vram +
+         ((cmd->scanout.y + i) << (10 + g->upscale_shift));
+      uint32_t *dest = cmd->scanout.dest + i * cmd->scanout.pitch32;
+
+      memset(dest, 0, cmd->scanout.dx_start * sizeof(int32));
+
+      if (cmd->scanout.reorder)
+         g->ReorderRGB_Var(
+               RED_SHIFT,
+               GREEN_SHIFT,
+               BLUE_SHIFT,
+               cmd->scanout.bpp24,
+               src,
+               dest,
+               cmd->scanout.dx_start,
+               cmd->scanout.dx_end,
+               cmd->scanout.fb_x);
+
+      for(x = cmd->scanout.dx_end; x < cmd->scanout.dmw; x++)
+         dest[x] = 0;
+   }
+}
+
 int32_t PS_GPU::Update(const int32_t sys_timestamp)
 {
    int32 gpu_clocks;
@@ -1591,47 +1734,32 @@ int32_t PS_GPU::Update(const int32_t sys_timestamp)
 
                //printf("dx_start base: %d, dmw: %d\n", dx_start, dmw);
 
+               // Nobody will look at a skipped frame (the light guns, which
+               // read the output, don't let the driver skip any).
+               if(!espec->skip)
                {
                   // Convert the necessary variables to the upscaled version
-                  uint32_t x;
-                  uint32_t y      = DisplayFB_CurLineYReadout << upscale_shift;
-                  uint32_t udmw   = dmw      << upscale_shift;
-                  int32 udx_start = dx_start << upscale_shift;
-                  int32 udx_end   = dx_end   << upscale_shift;
-                  int32 ufb_x     = fb_x     << upscale_shift;
-
-                  for (uint32_t i = 0; i < upscale(); i++)
-                  {
-                     const uint16_t *src = vram +
-                        ((y + i) << (10 + upscale_shift));
-
-                     // printf("surface: %dx%d (%d) %u %u + %u\n",
-                     // 	   surface->w, surface->h, surface->pitchinpix,
-                     // 	   dest_line, y, i);
-
-                     dest = surface->pixels +
-                        ((dest_line << upscale_shift) + i) * surface->pitch32;
-
-                     memset(dest, 0, udx_start * sizeof(int32));
-
-                     if (rsx_intf_is_type() == RSX_SOFTWARE)
-                        //printf("%d %d %d - %d %d\n", scanline, dx_start, dx_end, HorizStart, HorizEnd);
-                        ReorderRGB_Var(
-                              RED_SHIFT,
-                              GREEN_SHIFT,
-                              BLUE_SHIFT,
-                              DisplayMode & DISP_RGB24,
-                              src,
-                              dest,
-                              udx_start,
-                              udx_end,
-                              ufb_x);
-
-                     //printf("dx_end: %d, dmw: %d\n", udx_end, udmw);
-                     //
-                     for(x = udx_end; x < udmw; x++)
-                        dest[x] = 0;
-                  }
+                  gpu_raster_cmd cmd;
+
+                  cmd.func             = R_Scanout;
+                  cmd.scanout.dest     = surface->pixels +
+                     (dest_line << upscale_shift) * surface->pitch32;
+                  cmd.scanout.pitch32  = surface->pitch32;
+                  cmd.scanout.y        = DisplayFB_CurLineYReadout << upscale_shift;
+                  cmd.scanout.dmw      = dmw      << upscale_shift;
+                  cmd.scanout.dx_start = dx_start << upscale_shift;
+                  cmd.scanout.dx_end   = dx_end   << upscale_shift;
+                  cmd.scanout.fb_x     = fb_x     << upscale_shift;
+                  cmd.scanout.bpp24    = DisplayMode & DISP_RGB24;
+                  cmd.scanout.reorder  = rsx_intf_is_type() == RSX_SOFTWARE;
+                  cmd.pixels           = 0;
+
+                  if(RasterThread)
+                     QueueRaster(&cmd);
+                  else
+                     R_Scanout(this, &cmd);
+
+                  dest = cmd.scanout.dest + (upscale() - 1) * surface->pitch32;
                }
 
                //if(scanline == 64)
@@ -1699,6 +1827,8 @@ int PS_GPU::StateAction(StateMem *sm, int load, int data_only)
 
    uint16 *vram_new = NULL;
 
+   SyncRasterThread();
+
    if (upscale_shift == 0)
    {
       // No upscaling, we can dump the VRAM contents directly
@@ -1708,13 +1838,21 @@ int PS_GPU::StateAction(StateMem *sm, int load, int data_only)
    {
       // We have increased internal resolution, savestates are always
       // made at 1x for compatibility
-      vram_new = new uint16[1024 * 512];
+      if (!StateVRAM)
+         StateVRAM = new uint16[1024 * 512];
+
+      vram_new = StateVRAM;
 
       if (!load)
       {
          // We must downscale the current VRAM contents back to 1x
          for (unsigned y = 0; y < 512; y++)
          {
+            // Delta states only save the bands written since their base
+            if (sm->delta == MDFNSS_DELTA_PAGES &&
+                  !VRAMDirty->changed[sm->context][(y << 11) >> VRAMDirty->page_shift])
+               continue;
+
             for (unsigned x = 0; x < 1024; x++)
                vram_new[y * 1024 + x] = texel_fetch(x, y);
          }
@@ -1733,7 +1871,7 @@ int PS_GPU::StateAction(StateMem *sm, int load, int data_only)
    {
       // Hardcode entry name to remain backward compatible with the
       // previous fixed internal resolution code
-      SFARRAY16N(vram_new, 1024 * 512, "&GPURAM[0][0]"),
+      SFARRAY16DIRTYN(vram_new, 1024 * 512, "&GPURAM[0][0]", *VRAMDirty),
 
       SFVAR(DMAControl),
 
@@ -1841,13 +1979,15 @@ int PS_GPU::StateAction(StateMem *sm, int load, int data_only)
          // Restore upscaled VRAM from savestate
          for (unsigned y = 0; y < 512; y++)
          {
+            // Delta states only touch some of the bands
+            if (sm->delta == MDFNSS_DELTA_PAGES &&
+                  !VRAMDirty->loaded[(y << 11) >> VRAMDirty->page_shift])
+               continue;
+
             for (unsigned x = 0; x < 1024; x++)
                texel_put(x, y, vram_new[y * 1024 + x]);
          }
       }
-
-      delete [] vram_new;
-      vram_new = NULL;
    }
 
    if(load)
@@ -17,6 +17,7 @@
 #include "../../rsx/rsx.h"
 
 class PS_GPU;
+class PS_GPU_RasterThread;
 
 #define INCMD_NONE     0
 #define INCMD_PLINE    1
@@ -67,6 +68,63 @@ struct line_point
    _b = tmp;                \
 }                           \
 
+// Drawing state a deferred raster command depends on, captured when the
+// command is queued so the raster thread never reads live GPU registers.
+struct gpu_raster_state
+{
+   int32 ClipX0, ClipY0, ClipX1, ClipY1;
+   uint32 TexPageX, TexPageY, TexMode;
+   uint32 MaskSetOR, MaskEvalAND;
+   uint32 DisplayMode, DisplayFB_YStart;
+   uint8 tww, twh, twx, twy;
+   uint8 dither_upscale_shift;
+   bool dtd, dfe, field_ram_readout;
+};
+
+struct gpu_raster_cmd
+{
+   void (*func)(PS_GPU *g, const gpu_raster_cmd *cmd);
+   gpu_raster_state state;
+
+   // Rows [y0, y1) written, in the units of PS_GPU::BandY0/BandY1, and
+   // roughly how many (upscaled) pixels. Commands with pixels == 0 are
+   // never split across raster cores.
+   int32 y0, y1;
+   uint32 pixels;
+
+   union
+   {
+      struct
+      {
+         tri_vertex vertices[3];
+         uint32 clut;
+      } tri;
+
+      struct
+      {
+         int32 x, y, w, h;
+         uint8 u, v;
+         uint32 color, clut;
+      } sprite;
+
+      line_point points[2];
+
+      uint32 cb[4];
+
+      struct
+      {
+         uint32 *dest;
+         uint32 pitch32;
+         uint32 y;
+         int32 dx_start, dx_end;
+         uint32 dmw;
+         int32 fb_x;
+         bool bpp24;
+         bool reorder;
+      } scanout;
+   };
+};
+
 struct subpixel_vertex {
   float x;
   float y;
@@ -79,8 +137,22 @@ struct subpixel_vertex {
   }
 };
 
+struct subpixel_vertex_entry {
+  // Cache generation in the top 8 bits, then the 12-bit integer y and x
+  // coordinates this vertex was computed for.
+  uint32 key;
+  subpixel_vertex v;
+};
+
+// Number of entries in the (direct-mapped) subpixel vertex cache. Vertices
+// are generally drawn shortly after the GTE computes them so this only
+// needs to cover a frame's worth or so.
+#define SUBPIXEL_VERTEX_CACHE_SIZE 0x4000
+
 class PS_GPU
 {
+   friend class PS_GPU_RasterThread;
+
   private:
       // Private constructors and destructors since we need to use
       // custom allocators to allocate the flexible vram
@@ -90,8 +162,27 @@ class PS_GPU
 
       static void *Alloc(uint8 upscale_shift) MDFN_COLD;
 
+      // 8-line bands of (1x) VRAM written since the last delta base
+      // state, NULL in raster thread copies
+      StateDirtyMap *VRAMDirty;
+
+      // 1x copy of the VRAM for save states when upscaling, allocated on
+      // first use
+      uint16 *StateVRAM;
+
       // Cache for subpixel precision vertices (when enabled)
-      subpixel_vertex *SubpixelVertexCache;
+      subpixel_vertex_entry *SubpixelVertexCache;
+      uint32 SubpixelVertexCacheGen;
+
+      static INLINE uint32 SubpixelVertexKey(uint32 gen, int32 x, int32 y)
+      {
+	return (gen << 24) | ((y & 0xFFF) << 12) | (x & 0xFFF);
+      }
+
+      static INLINE unsigned SubpixelVertexIndex(int32 x, int32 y)
+      {
+	return ((x & 0xFFF) ^ ((y & 0xFFF) * 0x9E5)) & (SUBPIXEL_VERTEX_CACHE_SIZE - 1);
+      }
 
    public:
 
@@ -101,7 +192,7 @@ class PS_GPU
       {
 	if (SubpixelVertexCache) {
 
-	  // The cache is a 0x1000 * 0x1000 array
+	  // The cache is keyed on 12-bit coordinates
 	  if (x < -0x800 || x >= 0x800 || y < -0x800 || y >= 0x800) {
 	    // Out of range
 	    return;
@@ -113,10 +204,10 @@ class PS_GPU
 	    return;
 	  }
 
-	  unsigned cx = x + 0x800;
-	  unsigned cy = y + 0x800;
+	  subpixel_vertex_entry *e = &SubpixelVertexCache[SubpixelVertexIndex(x, y)];
 
-	  SubpixelVertexCache[cy * 0x1000 + cx] = subpixel_vertex(fx, fy, z);
+	  e->key = SubpixelVertexKey(SubpixelVertexCacheGen, x, y);
+	  e->v = subpixel_vertex(fx, fy, z);
 	}
       }
 
@@ -132,15 +223,31 @@ class PS_GPU
 	  return NULL;
 	}
 
-	unsigned cx = x + 0x800;
-	unsigned cy = y + 0x800;
+	const subpixel_vertex_entry *e = &SubpixelVertexCache[SubpixelVertexIndex(x, y)];
 
-	return &SubpixelVertexCache[cy * 0x1000 + cx];
+	if (e->key != SubpixelVertexKey(SubpixelVertexCacheGen, x, y)) {
+	  // Not cached (anymore), use the integer coordinates
+	  return NULL;
+	}
+
+	return &e->v;
       }
 
       void EnableSubpixelVertexCache(bool enable);
       void ResetSubpixelVertexCache();
 
+      // Software rasterization through a command list (NULL when
+      // disabled), replayed on a worker thread and/or split across
+      // several cores. While enabled the emulation thread only runs the
+      // timing side of the draw routines and queues the VRAM writes.
+      PS_GPU_RasterThread *RasterThread;
+      bool RasterQueued;	// Commands were queued since the last SyncRasterThread()
+
+      void EnableRasterThread(bool threaded, unsigned cores);
+      void SyncRasterThread(void);
+      void QueueRaster(gpu_raster_cmd *cmd);
+      bool SamplesOwnTarget(int32 x0, int32 x1, int32 y0, int32 y1, uint32 clut_offset, uint32 tex_mode);
+
       static PS_GPU *Build(bool pal_clock_and_tv, int sls, int sle, uint8 upscale_shift) MDFN_COLD;
       static void Destroy(PS_GPU *gpu) MDFN_COLD;
 
@@ -204,9 +311,20 @@ class PS_GPU
 
       INLINE void PokeRAM(uint32 A, uint16 V)
       {
+         MarkVRAMRows((A >> 10) & 0x1FF, ((A >> 10) & 0x1FF) + 1);
          texel_put(A & 0x3FF, (A >> 10) & 0x1FF, V);
       }
 
+      // Flag VRAM lines [y0, y1) as written, wrapping around at 512
+      INLINE void MarkVRAMRows(int32 y0, int32 y1)
+      {
+         if(!VRAMDirty)
+            return;
+
+         for(int32 y = y0 & ~7; y < y1; y += 8)
+            VRAMDirty->Mark((y & 511) << 11);
+      }
+
       // Return a pixel from VRAM, ignoring the internal upscaling
       INLINE uint16 texel_fetch(uint32 x, uint32 y) const {
 	return vram_fetch(x << upscale_shift,
@@ -257,6 +375,13 @@ class PS_GPU
       int32 ClipX1;
       int32 ClipY1;
 
+      // Rows [BandY0, BandY1) the draw routines are restricted to when a
+      // command is split across raster cores: upscaled lines for
+      // triangles, native lines for sprites and lines relative to the
+      // top of the rectangle for fills. Unbounded otherwise.
+      int32 BandY0;
+      int32 BandY1;
+
       int32 OffsX;
       int32 OffsY;
 
@@ -431,8 +556,14 @@ class PS_GPU
       uint16 ModTexel(uint16 texel, int32 r, int32 g, int32 b, const int32 dither_x, const int32 dither_y);
 
       template<bool goraud, bool textured, int BlendMode, bool TexMult, uint32 TexMode, bool MaskEval_TA>
-         void DrawSpan(int y, uint32 clut_offset, const int32 x_start, const int32 x_bound, i_group ig, const i_deltas &idl);
+         void DrawSpan(int y, uint32 clut_offset, const int32 x_start, const int32 x_bound, i_group ig, const i_deltas &idl, bool self_texturing);
+
+#if defined(__SSE2__)
+      template<bool goraud, bool textured, int BlendMode, bool TexMult, uint32 TexMode, bool MaskEval_TA>
+         int32 DrawSpan_SSE2(int y, uint32 clut_offset, int32 x, const int32 x_bound, i_group &ig, const i_deltas &idl);
+#endif
 
+   public:
       template<bool shaded, bool textured, int BlendMode, bool TexMult, uint32 TexMode_TA, bool MaskEval_TA>
          void DrawTriangle(tri_vertex *vertices, uint32 clut);
 
@@ -442,7 +573,6 @@ class PS_GPU
       template<bool goraud, int BlendMode, bool MaskEval_TA>
          void DrawLine(line_point *vertices);
 
-   public:
       template<int numvertices, bool shaded, bool textured, int BlendMode, bool TexMult, uint32 TexMode_TA, bool MaskEval_TA>
          void Command_DrawPolygon(const uint32 *cb);
 
@@ -469,11 +599,9 @@ class PS_GPU
       void Command_MaskSetting(const uint32 *cb);
 
 
-   private:
-
-
       void ReorderRGB_Var(uint32 out_Rshift, uint32 out_Gshift, uint32 out_Bshift, bool bpp24, const uint16 *src, uint32 *dest, const int32 dx_start, const int32 dx_end, int32 fb_x);
 
+   private:
       template<uint32 out_Rshift, uint32 out_Gshift, uint32 out_Bshift>
          void ReorderRGB(bool bpp24, const uint16 *src, uint32 *dest, const int32 dx_start, const int32 dx_end, int32 fb_x) NO_INLINE;
 
@@ -481,11 +609,14 @@ class PS_GPU
 
    public:
 
+      // Points at vram_storage below, except for the raster thread's
+      // private copy of the GPU which draws into its owner's VRAM.
+      uint16 *vram;
+
       // "Flexible" array at the end of the struct. This lets us
       // having a dynamically sized vram (depending on the internal
-      // upscaling ratio) without having an additional level of
-      // indirection since it'll be allocated right after the struct
-      uint16 vram[0];
+      // upscaling ratio) allocated right after the struct.
+      uint16 vram_storage[0];
 
 };
 
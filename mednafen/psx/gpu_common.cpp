@@ -112,9 +112,14 @@ INLINE void PS_GPU::Update_CLUT_Cache(uint16 raw_clut)
 
          DrawTimeAvail -= count;
 
-         for(unsigned i = 0; i < count; i++)
+         // Nothing reads the cached entries back (GetTexel samples VRAM
+         // directly), so don't race the raster thread for them.
+         if(!RasterThread)
          {
-            CLUT_Cache[i] = texel_fetch((cxo + i) & 0x3FF, y);
+            for(unsigned i = 0; i < count; i++)
+            {
+               CLUT_Cache[i] = texel_fetch((cxo + i) & 0x3FF, y);
+            }
          }
 
          CLUT_Cache_VB = new_ccvb;
@@ -229,6 +234,51 @@ INLINE uint16_t PS_GPU::GetTexel(const uint32_t clut_offset, int32_t u_arg, int3
    return(fbw);
 }
 
+static bool RangesOverlap(int32 a0, int32 a1, int32 b0, int32 b1, int32 period)
+{
+   const int32 a_len = a1 - a0;
+   const int32 b_len = b1 - b0;
+
+   if(a_len >= period || b_len >= period)
+      return true;
+
+   a0 &= period - 1;
+   b0 &= period - 1;
+   a1 = a0 + a_len;
+   b1 = b0 + b_len;
+
+   for(int32 k = -period; k <= period; k += period)
+   {
+      if(a0 < (b1 + k) && (b0 + k) < a1)
+         return true;
+   }
+
+   return false;
+}
+
+// Whether a textured primitive drawing to the native VRAM rectangle
+// [x0, x1) x [y0, y1) (rows wrap at 512) may sample texels or CLUT
+// entries it draws over itself. Such a primitive must be drawn strictly
+// pixel by pixel, in order.
+bool PS_GPU::SamplesOwnTarget(int32 x0, int32 x1, int32 y0, int32 y1, uint32 clut_offset, uint32 tex_mode)
+{
+   const int32 tex_w = (tex_mode >= 2) ? 256 : (64 << tex_mode);
+   const int32 clut_w = tex_mode ? 256 : 16;
+   const int32 clut_x = clut_offset & 1023;
+   const int32 clut_y = (clut_offset >> 10) & 511;
+
+   if(RangesOverlap(y0, y1, TexPageY, TexPageY + 256, 512)
+         && RangesOverlap(x0, x1, TexPageX, TexPageX + tex_w, 1024))
+      return true;
+
+   if(tex_mode < 2
+         && RangesOverlap(y0, y1, clut_y, clut_y + 1, 512)
+         && RangesOverlap(x0, x1, clut_x, clut_x + clut_w, 1024))
+      return true;
+
+   return false;
+}
+
 static INLINE bool LineSkipTest(PS_GPU* g, unsigned y)
 {
 #if 0
@@ -101,6 +101,16 @@ static INLINE void AddLineStep(line_fxp_coord *point, const line_fxp_step *step)
    }
 }
 
+template<bool goraud, int BlendMode, bool MaskEval_TA>
+static void R_DrawLine(PS_GPU *g, const gpu_raster_cmd *cmd)
+{
+   line_point points[2];
+
+   memcpy(points, cmd->points, sizeof(points));
+
+   g->DrawLine<goraud, BlendMode, MaskEval_TA>(points);
+}
+
 template<bool goraud, int BlendMode, bool MaskEval_TA>
 void PS_GPU::DrawLine(line_point *points)
 {
@@ -121,6 +131,21 @@ void PS_GPU::DrawLine(line_point *points)
 
    DrawTimeAvail -= k * 2;
 
+   MarkVRAMRows(std::max<int32_t>(std::min(points[0].y, points[1].y), ClipY0),
+         std::min<int32_t>(std::max(points[0].y, points[1].y) + 1, ClipY1 + 1));
+
+   if(RasterThread)
+   {
+      gpu_raster_cmd cmd;
+
+      cmd.func = R_DrawLine<goraud, BlendMode, MaskEval_TA>;
+      memcpy(cmd.points, points, sizeof(cmd.points));
+      cmd.pixels = 0;
+
+      QueueRaster(&cmd);
+      return;
+   }
+
    line_points_to_fixed_point_step<goraud>(&points[0], &points[1], k, &step);
    line_point_to_fixed_point_coord<goraud>(&points[0], &step, &cur_point);
 
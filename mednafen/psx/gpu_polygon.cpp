@@ -1,5 +1,9 @@
 #include <math.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define COORD_FBS 12
 #define COORD_MF_INT(n) ((n) << COORD_FBS)
 #define COORD_POST_PADDING	12
@@ -130,8 +134,203 @@ static INLINE void AddIDeltas_DY(i_group &ig, const i_deltas &idl, uint32_t coun
    }
 }
 
+#if defined(__SSE2__)
+// Eight interpolated 8-bit color components, saturated like RGB8SAT.
+static INLINE __m128i SpanColor_SSE2(uint32_t c, uint32_t dc)
+{
+   __m128i lo = _mm_setr_epi32(c, c + dc, c + 2 * dc, c + 3 * dc);
+   __m128i hi = _mm_add_epi32(lo, _mm_set1_epi32(4 * dc));
+   __m128i ret;
+
+   lo  = _mm_srai_epi32(lo, COORD_FBS);
+   hi  = _mm_srai_epi32(hi, COORD_FBS);
+   ret = _mm_packs_epi32(lo, hi);
+   ret = _mm_max_epi16(ret, _mm_setzero_si128());
+   ret = _mm_min_epi16(ret, _mm_set1_epi16(0xFF));
+
+   return ret;
+}
+
+// DitherLUT lookup: (v + dither offset) >> 3, saturated to 5 bits.
+static INLINE __m128i SpanDither_SSE2(__m128i v, __m128i dither_offset)
+{
+   v = _mm_srai_epi16(_mm_add_epi16(v, dither_offset), 3);
+   v = _mm_max_epi16(v, _mm_setzero_si128());
+   v = _mm_min_epi16(v, _mm_set1_epi16(0x1F));
+
+   return v;
+}
+
+// PlotPixelBlend on eight pixels; the 16-bit wraparound doesn't affect
+// the result as only the low 16 bits of it are kept.
+template<int BlendMode>
+static INLINE __m128i SpanBlend_SSE2(__m128i bg_pix, __m128i fore_pix)
+{
+   __m128i sum, carry;
+
+   switch(BlendMode)
+   {
+      case BLEND_MODE_AVERAGE:
+         bg_pix = _mm_or_si128(bg_pix, _mm_set1_epi16((int16)0x8000));
+         return _mm_add_epi16(_mm_and_si128(fore_pix, bg_pix),
+               _mm_srli_epi16(_mm_andnot_si128(_mm_set1_epi16(0x0421),
+                     _mm_xor_si128(fore_pix, bg_pix)), 1));
+
+      case BLEND_MODE_SUBTRACT:
+         {
+            __m128i diff, borrow;
+
+            bg_pix   = _mm_or_si128(bg_pix, _mm_set1_epi16((int16)0x8000));
+            fore_pix = _mm_and_si128(fore_pix, _mm_set1_epi16(0x7FFF));
+            diff     = _mm_add_epi16(_mm_sub_epi16(bg_pix, fore_pix), _mm_set1_epi16((int16)0x8420));
+            borrow   = _mm_and_si128(_mm_sub_epi16(diff,
+                     _mm_and_si128(_mm_xor_si128(bg_pix, fore_pix), _mm_set1_epi16((int16)0x8420))),
+                  _mm_set1_epi16((int16)0x8420));
+
+            // The borrow out of bit 20 is always set, and lands in bit 15.
+            return _mm_and_si128(_mm_sub_epi16(diff, borrow),
+                  _mm_sub_epi16(borrow, _mm_or_si128(_mm_srli_epi16(borrow, 5),
+                        _mm_set1_epi16((int16)0x8000))));
+         }
+
+      case BLEND_MODE_ADD_FOURTH:
+         fore_pix = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(fore_pix, 2),
+                  _mm_set1_epi16(0x1CE7)), _mm_set1_epi16((int16)0x8000));
+         // Fall through
+
+      case BLEND_MODE_ADD:
+      default:
+         bg_pix = _mm_and_si128(bg_pix, _mm_set1_epi16(0x7FFF));
+         sum    = _mm_add_epi16(fore_pix, bg_pix);
+         carry  = _mm_and_si128(_mm_sub_epi16(sum,
+                  _mm_and_si128(_mm_xor_si128(fore_pix, bg_pix), _mm_set1_epi16((int16)0x8421))),
+               _mm_set1_epi16((int16)0x8420));
+         return _mm_or_si128(_mm_sub_epi16(sum, carry),
+               _mm_sub_epi16(carry, _mm_srli_epi16(carry, 5)));
+   }
+}
+
+// Draws as much of the span as it can eight pixels at a time, and
+// returns where it stopped, with ig advanced accordingly. Same results
+// as the per-pixel loop in DrawSpan.
+template<bool goraud, bool textured, int BlendMode, bool TexMult, uint32_t TexMode_TA, bool MaskEval_TA>
+INLINE int32 PS_GPU::DrawSpan_SSE2(int y, uint32_t clut_offset, int32_t x, const int32_t x_bound, i_group &ig, const i_deltas &idl)
+{
+   const bool dither           = DitherEnabled() && (textured ? TexMult : goraud);
+   const int32_t dither_y      = (y >> dither_upscale_shift) & 3;
+   uint16_t *row               = &vram[(y & ((512 << upscale_shift) - 1)) << (10 + upscale_shift)];
+   const __m128i mask_set_or   = _mm_set1_epi16((int16)MaskSetOR);
+   __m128i dither_offset       = _mm_setzero_si128();
+   __m128i r, g, b;
+
+   if(!goraud)
+   {
+      r = _mm_set1_epi16(COORD_GET_INT(ig.r));
+      g = _mm_set1_epi16(COORD_GET_INT(ig.g));
+      b = _mm_set1_epi16(COORD_GET_INT(ig.b));
+   }
+
+   for(; (x + 8) <= x_bound; x += 8)
+   {
+      __m128i fore_pix, bg_pix, write;
+
+      if(goraud)
+      {
+         r = SpanColor_SSE2(ig.r, idl.dr_dx);
+         g = SpanColor_SSE2(ig.g, idl.dg_dx);
+         b = SpanColor_SSE2(ig.b, idl.db_dx);
+      }
+
+      if(dither)
+      {
+         int16 offsets[8];
+
+         for(unsigned i = 0; i < 8; i++)
+            offsets[i] = dither_table[dither_y][((x + i) >> dither_upscale_shift) & 3];
+
+         dither_offset = _mm_loadu_si128((const __m128i *)offsets);
+      }
+
+      if(textured)
+      {
+         uint16_t texels[8];
+         uint32_t u = ig.u;
+         uint32_t v = ig.v;
+
+         for(unsigned i = 0; i < 8; i++)
+         {
+            texels[i] = GetTexel<TexMode_TA>(clut_offset, COORD_GET_INT(u), COORD_GET_INT(v));
+            u += idl.du_dx;
+            v += idl.dv_dx;
+         }
+
+         fore_pix = _mm_loadu_si128((const __m128i *)texels);
+
+         // Fully transparent texels aren't drawn.
+         write = _mm_andnot_si128(_mm_cmpeq_epi16(fore_pix, _mm_setzero_si128()),
+               _mm_set1_epi16(-1));
+
+         if(TexMult)
+         {
+            const __m128i five = _mm_set1_epi16(0x1F);
+            __m128i tr, tg, tb;
+
+            tr = _mm_srli_epi16(_mm_mullo_epi16(_mm_and_si128(fore_pix, five), r), 4);
+            tg = _mm_srli_epi16(_mm_mullo_epi16(_mm_and_si128(_mm_srli_epi16(fore_pix, 5), five), g), 4);
+            tb = _mm_srli_epi16(_mm_mullo_epi16(_mm_and_si128(_mm_srli_epi16(fore_pix, 10), five), b), 4);
+
+            fore_pix = _mm_or_si128(_mm_and_si128(fore_pix, _mm_set1_epi16((int16)0x8000)),
+                  _mm_or_si128(SpanDither_SSE2(tr, dither_offset),
+                     _mm_or_si128(_mm_slli_epi16(SpanDither_SSE2(tg, dither_offset), 5),
+                        _mm_slli_epi16(SpanDither_SSE2(tb, dither_offset), 10))));
+         }
+      }
+      else
+      {
+         fore_pix = _mm_or_si128(_mm_set1_epi16((int16)0x8000),
+               _mm_or_si128(SpanDither_SSE2(r, dither_offset),
+                  _mm_or_si128(_mm_slli_epi16(SpanDither_SSE2(g, dither_offset), 5),
+                     _mm_slli_epi16(SpanDither_SSE2(b, dither_offset), 10))));
+         write = _mm_set1_epi16(-1);
+      }
+
+      bg_pix = _mm_loadu_si128((const __m128i *)&row[x]);
+
+      if(BlendMode >= 0)
+      {
+         const __m128i blended = SpanBlend_SSE2<BlendMode>(bg_pix, fore_pix);
+
+         if(textured)
+         {
+            // Only semi-transparent texels are blended.
+            const __m128i semi = _mm_srai_epi16(fore_pix, 15);
+
+            fore_pix = _mm_or_si128(_mm_and_si128(semi, blended), _mm_andnot_si128(semi, fore_pix));
+         }
+         else
+            fore_pix = blended;
+      }
+
+      if(!textured)
+         fore_pix = _mm_and_si128(fore_pix, _mm_set1_epi16(0x7FFF));
+
+      fore_pix = _mm_or_si128(fore_pix, mask_set_or);
+
+      if(MaskEval_TA)
+         write = _mm_andnot_si128(_mm_srai_epi16(bg_pix, 15), write);
+
+      _mm_storeu_si128((__m128i *)&row[x],
+            _mm_or_si128(_mm_and_si128(write, fore_pix), _mm_andnot_si128(write, bg_pix)));
+
+      AddIDeltas_DX<goraud, textured>(ig, idl, 8);
+   }
+
+   return x;
+}
+#endif
+
 template<bool goraud, bool textured, int BlendMode, bool TexMult, uint32_t TexMode_TA, bool MaskEval_TA>
-INLINE void PS_GPU::DrawSpan(int y, uint32_t clut_offset, const int32_t x_start, const int32_t x_bound, i_group ig, const i_deltas &idl)
+INLINE void PS_GPU::DrawSpan(int y, uint32_t clut_offset, const int32_t x_start, const int32_t x_bound, i_group ig, const i_deltas &idl, bool self_texturing)
 {
    int32_t xs = x_start, xb = x_bound;
    int32 clipx0 = ClipX0 << upscale_shift;
@@ -162,6 +361,10 @@ INLINE void PS_GPU::DrawSpan(int y, uint32_t clut_offset, const int32_t x_start,
          }
       }
 
+      // Timing only, the raster thread does the drawing.
+      if(RasterThread)
+         return;
+
       if(textured)
       {
          ig.u += (xs * idl.du_dx) + (y * idl.du_dy);
@@ -175,8 +378,16 @@ INLINE void PS_GPU::DrawSpan(int y, uint32_t clut_offset, const int32_t x_start,
          ig.b += (xs * idl.db_dx) + (y * idl.db_dy);
       }
 
+      int32_t x = xs;
+
+#if defined(__SSE2__)
+      // Texels are all fetched before any of the pixels they end up in
+      // are written, so that can't be done if they may be the same.
+      if(!self_texturing)
+         x = DrawSpan_SSE2<goraud, textured, BlendMode, TexMult, TexMode_TA, MaskEval_TA>(y, clut_offset, x, xb, ig, idl);
+#endif
 
-      for(int32_t x = xs; MDFN_LIKELY(x < xb); x++)
+      for(; MDFN_LIKELY(x < xb); x++)
       {
          uint32_t r, g, b;
 
@@ -232,11 +443,53 @@ INLINE void PS_GPU::DrawSpan(int y, uint32_t clut_offset, const int32_t x_start,
    }
 }
 
+template<bool goraud, bool textured, int BlendMode, bool TexMult, uint32_t TexMode_TA, bool MaskEval_TA>
+static void R_DrawTriangle(PS_GPU *g, const gpu_raster_cmd *cmd)
+{
+   tri_vertex vertices[3];
+
+   memcpy(vertices, cmd->tri.vertices, sizeof(vertices));
+
+   g->DrawTriangle<goraud, textured, BlendMode, TexMult, TexMode_TA, MaskEval_TA>(vertices, cmd->tri.clut);
+}
+
 template<bool goraud, bool textured, int BlendMode, bool TexMult, uint32_t TexMode_TA, bool MaskEval_TA>
 void PS_GPU::DrawTriangle(tri_vertex *vertices, uint32_t clut)
 {
    i_deltas idl;
 
+   // Clipped bounding box (upscaled)
+   const int32 bx0 = std::max<int32>(std::min(vertices[0].x, std::min(vertices[1].x, vertices[2].x)), ClipX0 << upscale_shift);
+   const int32 bx1 = std::min<int32>(std::max(vertices[0].x, std::max(vertices[1].x, vertices[2].x)), (ClipX1 << upscale_shift) + 1);
+   const int32 by0 = std::max<int32>(std::min(vertices[0].y, std::min(vertices[1].y, vertices[2].y)), ClipY0 << upscale_shift);
+   const int32 by1 = std::min<int32>(std::max(vertices[0].y, std::max(vertices[1].y, vertices[2].y)), (ClipY1 << upscale_shift) + 1);
+
+   const bool self_texturing = textured && bx1 > bx0 && by1 > by0 &&
+      SamplesOwnTarget(bx0 >> upscale_shift, ((bx1 - 1) >> upscale_shift) + 1,
+            by0 >> upscale_shift, ((by1 - 1) >> upscale_shift) + 1,
+            clut, TexMode_TA);
+
+   if(by1 > by0)
+      MarkVRAMRows(by0 >> upscale_shift, ((by1 - 1) >> upscale_shift) + 1);
+
+   if(RasterThread)
+   {
+      gpu_raster_cmd cmd;
+
+      cmd.func = R_DrawTriangle<goraud, textured, BlendMode, TexMult, TexMode_TA, MaskEval_TA>;
+      memcpy(cmd.tri.vertices, vertices, sizeof(cmd.tri.vertices));
+      cmd.tri.clut = clut;
+
+      cmd.y0     = by0;
+      cmd.y1     = by1;
+      cmd.pixels = 0;
+
+      if(bx1 > bx0 && by1 > by0 && !self_texturing)
+         cmd.pixels = ((by1 - by0) * (bx1 - bx0)) >> 1;
+
+      QueueRaster(&cmd);
+   }
+
    //
    // Sort vertices by y.
    //
@@ -266,8 +519,8 @@ void PS_GPU::DrawTriangle(tri_vertex *vertices, uint32_t clut)
       return;
    }
 
-   int32 clipy0 = ClipY0 << upscale_shift;
-   int32 clipy1 = ClipY1 << upscale_shift;
+   int32 clipy0 = std::max<int32>(ClipY0 << upscale_shift, BandY0);
+   int32 clipy1 = std::min<int32>(ClipY1 << upscale_shift, BandY1 - 1);
 
    if(!CalcIDeltas(idl, vertices[0], vertices[1], vertices[2]))
       return;
@@ -388,14 +641,14 @@ void PS_GPU::DrawTriangle(tri_vertex *vertices, uint32_t clut)
    {
       for(int32_t y = y_start; y < y_middle; y++)
       {
-         DrawSpan<goraud, textured, BlendMode, TexMult, TexMode_TA, MaskEval_TA>(y, clut, GetPolyXFP_Int(base_coord), GetPolyXFP_Int(bound_coord_ul), ig, idl);
+         DrawSpan<goraud, textured, BlendMode, TexMult, TexMode_TA, MaskEval_TA>(y, clut, GetPolyXFP_Int(base_coord), GetPolyXFP_Int(bound_coord_ul), ig, idl, self_texturing);
          base_coord += base_step;
          bound_coord_ul += bound_coord_us;
       }
 
       for(int32_t y = y_middle; y < y_bound; y++)
       {
-         DrawSpan<goraud, textured, BlendMode, TexMult, TexMode_TA, MaskEval_TA>(y, clut, GetPolyXFP_Int(base_coord), GetPolyXFP_Int(bound_coord_ll), ig, idl);
+         DrawSpan<goraud, textured, BlendMode, TexMult, TexMode_TA, MaskEval_TA>(y, clut, GetPolyXFP_Int(base_coord), GetPolyXFP_Int(bound_coord_ll), ig, idl, self_texturing);
          base_coord += base_step;
          bound_coord_ll += bound_coord_ls;
       }
@@ -404,14 +657,14 @@ void PS_GPU::DrawTriangle(tri_vertex *vertices, uint32_t clut)
    {
       for(int32_t y = y_start; y < y_middle; y++)
       {
-         DrawSpan<goraud, textured, BlendMode, TexMult, TexMode_TA, MaskEval_TA>(y, clut, GetPolyXFP_Int(bound_coord_ul), GetPolyXFP_Int(base_coord), ig, idl);
+         DrawSpan<goraud, textured, BlendMode, TexMult, TexMode_TA, MaskEval_TA>(y, clut, GetPolyXFP_Int(bound_coord_ul), GetPolyXFP_Int(base_coord), ig, idl, self_texturing);
          base_coord += base_step;
          bound_coord_ul += bound_coord_us;
       }
 
       for(int32_t y = y_middle; y < y_bound; y++)
       {
-         DrawSpan<goraud, textured, BlendMode, TexMult, TexMode_TA, MaskEval_TA>(y, clut, GetPolyXFP_Int(bound_coord_ll), GetPolyXFP_Int(base_coord), ig, idl);
+         DrawSpan<goraud, textured, BlendMode, TexMult, TexMode_TA, MaskEval_TA>(y, clut, GetPolyXFP_Int(bound_coord_ll), GetPolyXFP_Int(base_coord), ig, idl, self_texturing);
          base_coord += base_step;
          bound_coord_ll += bound_coord_ls;
       }
@@ -1,9 +1,50 @@
 
+template<bool textured, int BlendMode, bool TexMult, uint32_t TexMode_TA,
+   bool MaskEval_TA, bool FlipX, bool FlipY>
+static void R_DrawSprite(PS_GPU *g, const gpu_raster_cmd *cmd)
+{
+   g->DrawSprite<textured, BlendMode, TexMult, TexMode_TA, MaskEval_TA, FlipX, FlipY>(
+         cmd->sprite.x, cmd->sprite.y, cmd->sprite.w, cmd->sprite.h,
+         cmd->sprite.u, cmd->sprite.v, cmd->sprite.color, cmd->sprite.clut);
+}
+
 template<bool textured, int BlendMode, bool TexMult, uint32_t TexMode_TA,
    bool MaskEval_TA, bool FlipX, bool FlipY>
 void PS_GPU::DrawSprite(int32_t x_arg, int32_t y_arg, int32_t w, int32_t h,
       uint8_t u_arg, uint8_t v_arg, uint32_t color, uint32_t clut_offset)
 {
+   MarkVRAMRows(std::max<int32_t>(y_arg, ClipY0), std::min<int32_t>(y_arg + h, ClipY1 + 1));
+
+   if(RasterThread)
+   {
+      gpu_raster_cmd cmd;
+
+      cmd.func         = R_DrawSprite<textured, BlendMode, TexMult, TexMode_TA, MaskEval_TA, FlipX, FlipY>;
+      cmd.sprite.x     = x_arg;
+      cmd.sprite.y     = y_arg;
+      cmd.sprite.w     = w;
+      cmd.sprite.h     = h;
+      cmd.sprite.u     = u_arg;
+      cmd.sprite.v     = v_arg;
+      cmd.sprite.color = color;
+      cmd.sprite.clut  = clut_offset;
+
+      {
+         const int32_t x0 = std::max<int32_t>(x_arg, ClipX0);
+         const int32_t x1 = std::min<int32_t>(x_arg + w, ClipX1 + 1);
+
+         cmd.y0     = std::max<int32_t>(y_arg, ClipY0);
+         cmd.y1     = std::min<int32_t>(y_arg + h, ClipY1 + 1);
+         cmd.pixels = 0;
+
+         if(cmd.y1 > cmd.y0 && x1 > x0 && (!textured ||
+                  !SamplesOwnTarget(x0, x1, cmd.y0, cmd.y1, clut_offset, TexMode_TA)))
+            cmd.pixels = ((cmd.y1 - cmd.y0) * (x1 - x0)) << (2 * upscale_shift);
+      }
+
+      QueueRaster(&cmd);
+   }
+
    uint8_t u, v;
    const int32_t r           = color & 0xFF;
    const int32_t g           = (color >> 8) & 0xFF;
@@ -15,6 +56,8 @@ void PS_GPU::DrawSprite(int32_t x_arg, int32_t y_arg, int32_t w, int32_t h,
    int32_t x_bound           = x_arg + w;
    int32_t y_start           = y_arg;
    int32_t y_bound           = y_arg + h;
+   const int32_t clip_y0     = std::max<int32_t>(ClipY0, BandY0);
+   const int32_t clip_y1     = std::min<int32_t>(ClipY1 + 1, BandY1);
 
    //printf("[GPU] Sprite: x=%d, y=%d, w=%d, h=%d\n", x_arg, y_arg, w, h);
 
@@ -48,19 +91,19 @@ void PS_GPU::DrawSprite(int32_t x_arg, int32_t y_arg, int32_t w, int32_t h,
       x_start = ClipX0;
    }
 
-   if(y_start < ClipY0)
+   if(y_start < clip_y0)
    {
       if(textured)
-         v += (ClipY0 - y_start) * v_inc;
+         v += (clip_y0 - y_start) * v_inc;
 
-      y_start = ClipY0;
+      y_start = clip_y0;
    }
 
    if(x_bound > (ClipX1 + 1))
       x_bound = ClipX1 + 1;
 
-   if(y_bound > (ClipY1 + 1))
-      y_bound = ClipY1 + 1;
+   if(y_bound > clip_y1)
+      y_bound = clip_y1;
 
    //HeightMode && !dfe && ((y & 1) == ((DisplayFB_YStart + !field_atvs) & 1)) && !DisplayOff
    //printf("%d:%d, %d, %d ---- heightmode=%d displayfb_ystart=%d field_atvs=%d displayoff=%d\n", w, h, scanline, dfe, HeightMode, DisplayFB_YStart, field_atvs, DisplayOff);
@@ -87,6 +130,11 @@ void PS_GPU::DrawSprite(int32_t x_arg, int32_t y_arg, int32_t w, int32_t h,
             DrawTimeAvail -= suck_time;
          }
 
+         // Timing only (u/v are of no interest then), the raster
+         // thread does the drawing.
+         if(RasterThread)
+            continue;
+
          for(int32_t x = x_start; MDFN_LIKELY(x < x_bound); x++)
          {
             if(textured)
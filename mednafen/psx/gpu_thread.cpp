@@ -0,0 +1,451 @@
+/* Software rasterizer command list.
+ *
+ * Draw commands are still decoded and timed on the emulation thread, so
+ * DrawTimeAvail (and therefore everything the CPU can observe) does not
+ * depend on whether this is enabled. Only the VRAM writes are recorded,
+ * together with a snapshot of the drawing state they depend on, and
+ * replayed through private copies of the GPU whose vram pointer aliases
+ * the real one.
+ *
+ * When threaded, the commands go through a ring that a worker replays,
+ * and the emulation thread waits for it to drain before anything reads
+ * or writes VRAM directly: FB reads and writes, save states, resets,
+ * rescaling, and the end of each emulated frame.
+ *
+ * With more than one core, large primitives are additionally split into
+ * horizontal bands of the rows they cover, one per core, and the next
+ * command only starts once all bands are done. Every pixel belongs to
+ * exactly one band and, save for textures (see SamplesOwnTarget), a pixel
+ * only ever depends on its own previous value, so the result is the same
+ * as drawing the primitive in one go.
+ */
+
+#include <rthreads/rthreads.h>
+
+struct gpu_raster_target
+{
+   PS_GPU *g;
+   gpu_raster_state state;
+};
+
+struct gpu_raster_band
+{
+   PS_GPU_RasterThread *owner;
+   unsigned index;
+   gpu_raster_target target;
+   sthread_t *thread;
+};
+
+class PS_GPU_RasterThread
+{
+   public:
+
+      PS_GPU_RasterThread(PS_GPU *gpu, bool threaded, unsigned cores);
+      ~PS_GPU_RasterThread();
+
+      bool Matches(bool threaded, unsigned cores) const;
+
+      void Queue(const gpu_raster_cmd *cmd);
+      void Sync(void);
+
+   private:
+
+      static void NewTarget(PS_GPU *gpu, gpu_raster_target *t);
+      static void ApplyState(gpu_raster_target *t, const gpu_raster_state *s);
+      static void ThreadEntry(void *data);
+      static void BandEntry(void *data);
+      void Run(void);
+      void RunBands(gpu_raster_band *band);
+      void Execute(const gpu_raster_cmd *cmd);
+      void ExecuteBand(gpu_raster_target *t, const gpu_raster_cmd *cmd, unsigned index);
+
+      enum { RingSize = 1024 };
+
+      // Below this, waking up the other cores costs more than it saves.
+      enum { SplitPixels = 8192 };
+
+      const bool Threaded;
+      const unsigned Cores;
+
+      gpu_raster_cmd Ring[RingSize];
+
+      // Protected by Mutex; positions wrap at 2 * RingSize.
+      uint32 ReadPos;
+      uint32 WritePos;
+      bool Busy;
+      bool Exit;
+
+      slock_t *Mutex;
+      scond_t *WorkCond;
+      scond_t *IdleCond;
+      sthread_t *Thread;
+
+      //
+      // Whichever thread executes commands (the worker when threaded):
+      //
+      gpu_raster_target Main;
+
+      //
+      // Band workers for cores 1 ... Cores - 1, protected by BandMutex.
+      //
+      gpu_raster_band *Bands;
+      const gpu_raster_cmd *BandCmd;
+      uint32 BandGeneration;
+      unsigned BandPending;
+      bool BandExit;
+
+      slock_t *BandMutex;
+      scond_t *BandWorkCond;
+      scond_t *BandDoneCond;
+};
+
+void PS_GPU_RasterThread::NewTarget(PS_GPU *gpu, gpu_raster_target *t)
+{
+   void *buffer = new char[sizeof(PS_GPU)];
+
+   // The copy shares the owner's VRAM through the vram pointer, and must
+   // not spawn threads or touch the subpixel cache of its own.
+   t->g = new (buffer) PS_GPU(*gpu);
+   t->g->RasterThread = NULL;
+   t->g->SubpixelVertexCache = NULL;
+   t->g->VRAMDirty = NULL;
+   t->g->StateVRAM = NULL;
+
+   memset(&t->state, 0, sizeof(t->state));
+   t->state.tww = t->g->tww;
+   t->state.twh = t->g->twh;
+   t->state.twx = t->g->twx;
+   t->state.twy = t->g->twy;
+   t->state.TexPageX = t->g->TexPageX;
+   t->state.TexPageY = t->g->TexPageY;
+   t->state.TexMode = t->g->TexMode;
+}
+
+void PS_GPU_RasterThread::ApplyState(gpu_raster_target *t, const gpu_raster_state *s)
+{
+   PS_GPU *rg = t->g;
+
+   if(!memcmp(s, &t->state, sizeof(t->state)))
+      return;
+
+   const bool tw_changed = s->tww != t->state.tww || s->twh != t->state.twh
+      || s->twx != t->state.twx || s->twy != t->state.twy
+      || s->TexPageX != t->state.TexPageX || s->TexPageY != t->state.TexPageY
+      || s->TexMode != t->state.TexMode;
+
+   t->state = *s;
+
+   rg->ClipX0 = s->ClipX0;
+   rg->ClipY0 = s->ClipY0;
+   rg->ClipX1 = s->ClipX1;
+   rg->ClipY1 = s->ClipY1;
+   rg->TexPageX = s->TexPageX;
+   rg->TexPageY = s->TexPageY;
+   rg->TexMode = s->TexMode;
+   rg->MaskSetOR = s->MaskSetOR;
+   rg->MaskEvalAND = s->MaskEvalAND;
+   rg->DisplayMode = s->DisplayMode;
+   rg->DisplayFB_YStart = s->DisplayFB_YStart;
+   rg->tww = s->tww;
+   rg->twh = s->twh;
+   rg->twx = s->twx;
+   rg->twy = s->twy;
+   rg->dither_upscale_shift = s->dither_upscale_shift;
+   rg->dtd = s->dtd;
+   rg->dfe = s->dfe;
+   rg->field_ram_readout = s->field_ram_readout;
+
+   if(tw_changed)
+      rg->RecalcTexWindowStuff();
+}
+
+PS_GPU_RasterThread::PS_GPU_RasterThread(PS_GPU *gpu, bool threaded, unsigned cores)
+   : Threaded(threaded), Cores(cores)
+{
+   NewTarget(gpu, &Main);
+
+   ReadPos = 0;
+   WritePos = 0;
+   Busy = false;
+   Exit = false;
+
+   Mutex = NULL;
+   WorkCond = NULL;
+   IdleCond = NULL;
+   Thread = NULL;
+
+   if(Threaded)
+   {
+      Mutex = slock_new();
+      WorkCond = scond_new();
+      IdleCond = scond_new();
+      Thread = sthread_create(ThreadEntry, this);
+   }
+
+   BandCmd = NULL;
+   BandGeneration = 0;
+   BandPending = 0;
+   BandExit = false;
+
+   BandMutex = slock_new();
+   BandWorkCond = scond_new();
+   BandDoneCond = scond_new();
+
+   Bands = new gpu_raster_band[Cores - 1];
+
+   for(unsigned i = 0; i < Cores - 1; i++)
+   {
+      Bands[i].owner = this;
+      Bands[i].index = i + 1;
+      NewTarget(gpu, &Bands[i].target);
+      Bands[i].thread = sthread_create(BandEntry, &Bands[i]);
+   }
+}
+
+PS_GPU_RasterThread::~PS_GPU_RasterThread()
+{
+   if(Threaded)
+   {
+      slock_lock(Mutex);
+      Exit = true;
+      scond_signal(WorkCond);
+      slock_unlock(Mutex);
+
+      sthread_join(Thread);
+
+      scond_free(IdleCond);
+      scond_free(WorkCond);
+      slock_free(Mutex);
+   }
+
+   slock_lock(BandMutex);
+   BandExit = true;
+   scond_broadcast(BandWorkCond);
+   slock_unlock(BandMutex);
+
+   for(unsigned i = 0; i < Cores - 1; i++)
+   {
+      sthread_join(Bands[i].thread);
+      PS_GPU::Destroy(Bands[i].target.g);
+   }
+
+   delete[] Bands;
+
+   scond_free(BandDoneCond);
+   scond_free(BandWorkCond);
+   slock_free(BandMutex);
+
+   PS_GPU::Destroy(Main.g);
+}
+
+bool PS_GPU_RasterThread::Matches(bool threaded, unsigned cores) const
+{
+   return Threaded == threaded && Cores == cores;
+}
+
+void PS_GPU_RasterThread::ThreadEntry(void *data)
+{
+   ((PS_GPU_RasterThread *)data)->Run();
+}
+
+void PS_GPU_RasterThread::BandEntry(void *data)
+{
+   gpu_raster_band *band = (gpu_raster_band *)data;
+
+   band->owner->RunBands(band);
+}
+
+void PS_GPU_RasterThread::Queue(const gpu_raster_cmd *cmd)
+{
+   if(!Threaded)
+   {
+      Execute(cmd);
+      return;
+   }
+
+   slock_lock(Mutex);
+
+   while((WritePos - ReadPos) % (2 * RingSize) == RingSize)
+      scond_wait(IdleCond, Mutex);
+
+   Ring[WritePos % RingSize] = *cmd;
+   WritePos = (WritePos + 1) % (2 * RingSize);
+
+   scond_signal(WorkCond);
+   slock_unlock(Mutex);
+}
+
+void PS_GPU_RasterThread::Sync(void)
+{
+   if(!Threaded)
+      return;
+
+   slock_lock(Mutex);
+
+   while(ReadPos != WritePos || Busy)
+      scond_wait(IdleCond, Mutex);
+
+   slock_unlock(Mutex);
+}
+
+void PS_GPU_RasterThread::Run(void)
+{
+   slock_lock(Mutex);
+
+   for(;;)
+   {
+      while(ReadPos == WritePos && !Exit)
+         scond_wait(WorkCond, Mutex);
+
+      if(ReadPos == WritePos)
+         break;
+
+      uint32 end = WritePos;
+      uint32 pos = ReadPos;
+
+      Busy = true;
+      slock_unlock(Mutex);
+
+      // Entries up to "end" are ours until ReadPos moves past them.
+      while(pos != end)
+      {
+         Execute(&Ring[pos % RingSize]);
+         pos = (pos + 1) % (2 * RingSize);
+      }
+
+      slock_lock(Mutex);
+      ReadPos = end;
+      Busy = false;
+      scond_signal(IdleCond);
+   }
+
+   slock_unlock(Mutex);
+}
+
+void PS_GPU_RasterThread::Execute(const gpu_raster_cmd *cmd)
+{
+   if(Cores < 2 || cmd->pixels < SplitPixels || (cmd->y1 - cmd->y0) < (int32)Cores)
+   {
+      ApplyState(&Main, &cmd->state);
+      cmd->func(Main.g, cmd);
+      return;
+   }
+
+   slock_lock(BandMutex);
+   BandCmd = cmd;
+   BandPending = Cores - 1;
+   BandGeneration++;
+   scond_broadcast(BandWorkCond);
+   slock_unlock(BandMutex);
+
+   ExecuteBand(&Main, cmd, 0);
+
+   slock_lock(BandMutex);
+   while(BandPending)
+      scond_wait(BandDoneCond, BandMutex);
+   slock_unlock(BandMutex);
+}
+
+void PS_GPU_RasterThread::ExecuteBand(gpu_raster_target *t, const gpu_raster_cmd *cmd, unsigned index)
+{
+   const int64 rows = cmd->y1 - cmd->y0;
+   const int32 band_y0 = t->g->BandY0;
+   const int32 band_y1 = t->g->BandY1;
+
+   ApplyState(t, &cmd->state);
+
+   t->g->BandY0 = cmd->y0 + (int32)(rows * index / Cores);
+   t->g->BandY1 = cmd->y0 + (int32)(rows * (index + 1) / Cores);
+
+   cmd->func(t->g, cmd);
+
+   t->g->BandY0 = band_y0;
+   t->g->BandY1 = band_y1;
+}
+
+void PS_GPU_RasterThread::RunBands(gpu_raster_band *band)
+{
+   uint32 generation = 0;
+
+   slock_lock(BandMutex);
+
+   for(;;)
+   {
+      while(BandGeneration == generation && !BandExit)
+         scond_wait(BandWorkCond, BandMutex);
+
+      if(BandExit)
+         break;
+
+      const gpu_raster_cmd *cmd = BandCmd;
+
+      generation = BandGeneration;
+      slock_unlock(BandMutex);
+
+      ExecuteBand(&band->target, cmd, band->index);
+
+      slock_lock(BandMutex);
+
+      if(!--BandPending)
+         scond_signal(BandDoneCond);
+   }
+
+   slock_unlock(BandMutex);
+}
+
+void PS_GPU::EnableRasterThread(bool threaded, unsigned cores)
+{
+   bool enable;
+
+   if(cores < 1)
+      cores = 1;
+
+   enable = threaded || cores > 1;
+
+   if(RasterThread && (!enable || !RasterThread->Matches(threaded, cores)))
+   {
+      delete RasterThread;
+      RasterThread = NULL;
+   }
+
+   if(enable && !RasterThread)
+      RasterThread = new PS_GPU_RasterThread(this, threaded, cores);
+}
+
+void PS_GPU::SyncRasterThread(void)
+{
+   if(RasterThread)
+      RasterThread->Sync();
+
+   RasterQueued = false;
+}
+
+void PS_GPU::QueueRaster(gpu_raster_cmd *cmd)
+{
+   gpu_raster_state *s = &cmd->state;
+
+   memset(s, 0, sizeof(*s));
+
+   s->ClipX0 = ClipX0;
+   s->ClipY0 = ClipY0;
+   s->ClipX1 = ClipX1;
+   s->ClipY1 = ClipY1;
+   s->TexPageX = TexPageX;
+   s->TexPageY = TexPageY;
+   s->TexMode = TexMode;
+   s->MaskSetOR = MaskSetOR;
+   s->MaskEvalAND = MaskEvalAND;
+   s->DisplayMode = DisplayMode;
+   s->DisplayFB_YStart = DisplayFB_YStart;
+   s->tww = tww;
+   s->twh = twh;
+   s->twx = twx;
+   s->twy = twy;
+   s->dither_upscale_shift = dither_upscale_shift;
+   s->dtd = dtd;
+   s->dfe = dfe;
+   s->field_ram_readout = field_ram_readout;
+
+   RasterQueued = true;
+   RasterThread->Queue(cmd);
+}
@@ -22,6 +22,16 @@ extern bool psx_cpu_overclock;
 
 #include "../clamp.h"
 
+#if defined(__SSE2__)
+#include <xmmintrin.h>
+#include <emmintrin.h>
+#endif
+
+#ifdef WANT_GTE_TRACE
+#include "gte_trace.h"
+#include <streams/file_stream.h>
+#endif
+
 /* Notes:
 
  AVSZ3/AVSZ4:
@@ -138,6 +148,106 @@ static uint32_t Reg23;
 
 extern "C" unsigned char widescreen_hack;
 
+#ifdef WANT_GTE_TRACE
+//
+// Command trace(see gte_trace.h); records are buffered, and written out when the buffer fills up or tracing stops.
+//
+static RFILE *TraceFile = NULL;
+static uint8_t TraceBuffer[0x10000];
+static uint32_t TraceBufferPos;
+
+static void TraceFlush(void)
+{
+   if(TraceBufferPos)
+   {
+      filestream_write(TraceFile, TraceBuffer, TraceBufferPos);
+      TraceBufferPos = 0;
+   }
+}
+
+static INLINE void TraceRecord(uint8_t tag, const uint32_t *values, unsigned count)
+{
+   if(TraceBufferPos + 1 + count * 4 > sizeof(TraceBuffer))
+      TraceFlush();
+
+   TraceBuffer[TraceBufferPos++] = tag;
+
+   for(unsigned i = 0; i < count; i++)
+   {
+      MDFN_en32lsb(&TraceBuffer[TraceBufferPos], values[i]);
+      TraceBufferPos += 4;
+   }
+}
+
+static void TraceState(void)
+{
+   uint32_t regs[64];
+
+   if(!TraceFile)
+      return;
+
+   for(unsigned i = 0; i < 32; i++)
+   {
+      regs[i] = GTE_ReadCR(i);
+      regs[32 + i] = GTE_ReadDR(i);
+   }
+
+   TraceRecord(GTE_TRACE_STATE << GTE_TRACE_TYPE_SHIFT, regs, 64);
+}
+
+static void TraceInstruction(uint32_t instr, int32_t ret)
+{
+   uint8_t flags = 0;
+   uint32_t hash;
+
+   if(psx_cpu_overclock)
+      flags |= GTE_TRACE_FLAG_OVERCLOCK;
+
+   if(widescreen_hack)
+      flags |= GTE_TRACE_FLAG_WIDESCREEN;
+
+   hash = GTE_TraceHash();
+
+   if(TraceBufferPos + 1 + 4 + 1 + 4 > sizeof(TraceBuffer))
+      TraceFlush();
+
+   TraceBuffer[TraceBufferPos] = (GTE_TRACE_INSTRUCTION << GTE_TRACE_TYPE_SHIFT) | flags;
+   MDFN_en32lsb(&TraceBuffer[TraceBufferPos + 1], instr);
+   TraceBuffer[TraceBufferPos + 5] = ret;
+   MDFN_en32lsb(&TraceBuffer[TraceBufferPos + 6], hash);
+   TraceBufferPos += 1 + 4 + 1 + 4;
+}
+
+bool GTE_TraceOpen(const char *path)
+{
+   uint8_t header[12];
+
+   GTE_TraceClose();
+
+   if(!(TraceFile = filestream_open(path, RFILE_MODE_WRITE, -1)))
+      return(false);
+
+   memcpy(header, GTE_TRACE_MAGIC, 8);
+   MDFN_en32lsb(&header[8], GTE_TRACE_VERSION);
+   filestream_write(TraceFile, header, sizeof(header));
+
+   TraceBufferPos = 0;
+   TraceState();
+
+   return(true);
+}
+
+void GTE_TraceClose(void)
+{
+   if(!TraceFile)
+      return;
+
+   TraceFlush();
+   filestream_close(TraceFile);
+   TraceFile = NULL;
+}
+#endif
+
 static INLINE uint8_t Sat5(int16_t cc)
 {
    if(cc < 0)
@@ -213,6 +323,10 @@ void GTE_Power(void)
    LZCR = 0;
 
    Reg23 = 0;
+
+#ifdef WANT_GTE_TRACE
+   TraceState();
+#endif
 }
 
 // TODO: Don't save redundant state, regarding CR cache variables
@@ -267,7 +381,9 @@ int GTE_StateAction(StateMem *sm, int load, int data_only)
 
    if(load)
    {
-
+#ifdef WANT_GTE_TRACE
+      TraceState();
+#endif
    }
 
    return(ret);
@@ -292,6 +408,11 @@ void GTE_WriteCR(unsigned int which, uint32_t value)
 
    //PSX_WARNING("[GTE] Write CR %d, 0x%08x", which, value);
 
+#ifdef WANT_GTE_TRACE
+   if(TraceFile)
+      TraceRecord((GTE_TRACE_WRITE_CR << GTE_TRACE_TYPE_SHIFT) | (which & 0x1F), &value, 1);
+#endif
+
    value &= mask_table[which];
 
    CR[which] = value | (CR[which] & ~mask_table[which]);
@@ -400,6 +521,11 @@ uint32_t GTE_ReadCR(unsigned int which)
 
 void GTE_WriteDR(unsigned int which, uint32_t value)
 {
+#ifdef WANT_GTE_TRACE
+   if(TraceFile)
+      TraceRecord((GTE_TRACE_WRITE_DR << GTE_TRACE_TYPE_SHIFT) | (which & 0x1F), &value, 1);
+#endif
+
    switch(which & 0x1F)
    {
       case 0:
@@ -975,6 +1101,297 @@ static INLINE void MultiplyMatrixByVector_PT(const gtematrix *matrix, const int1
    Z_FIFO[3] = Lm_D(tmp[2] >> 12, TRUE);
 }
 
+#if defined(__SSE2__)
+//
+// SIMD versions of the above, for RTPT, NCT, NCCT, NCDT and MVMVA.  Each 32-bit lane does the scalar calculation
+// for a different vertex(or, for MVMVA, matrix row); lane 3 is padding, and never contributes to FLAGS.
+//
+// They're only used when the translation/color vectors are far enough from the A_MV() limits that no sum can reach
+// them(see NoMVOverflow()), which leaves nothing to flag or wrap, and lets the 44-bit sums be done in 32-bit lanes.
+//
+static INLINE bool NoMVOverflow(const int32_t *crv)
+{
+   // (crv << 12) plus at most 3 * 2**30 of products.
+   for(unsigned i = 0; i < 3; i++)
+   {
+      if(crv[i] <= -0x7FF00000 || crv[i] >= 0x7FF00000)
+         return false;
+   }
+
+   return true;
+}
+
+// 32-bit products of 16-bit lanes 0-3.
+static INLINE __m128i Mul16_SSE2(__m128i a, __m128i b)
+{
+   return _mm_unpacklo_epi16(_mm_mullo_epi16(a, b), _mm_mulhi_epi16(a, b));
+}
+
+// Low 32 bits of ((c << 12) + p[0] + ... + p[n - 1]) >> sf; for sf = 12, as c + (the sum of the products >> 12).
+static INLINE __m128i SumProducts_SSE2(const __m128i *p, unsigned n, __m128i c, uint32_t sf)
+{
+   if(sf)
+   {
+      const __m128i low_mask = _mm_set1_epi32(0xFFF);
+      __m128i hi = c;
+      __m128i lo = _mm_setzero_si128();
+
+      for(unsigned k = 0; k < n; k++)
+      {
+         hi = _mm_add_epi32(hi, _mm_srai_epi32(p[k], 12));
+         lo = _mm_add_epi32(lo, _mm_and_si128(p[k], low_mask));
+      }
+
+      return _mm_add_epi32(hi, _mm_srai_epi32(lo, 12));
+   }
+   else
+   {
+      __m128i sum = _mm_slli_epi32(c, 12);
+
+      for(unsigned k = 0; k < n; k++)
+         sum = _mm_add_epi32(sum, p[k]);
+
+      return sum;
+   }
+}
+
+// Lanes 0-2 of a 32-bit lane mask, as bits 0-2.
+static INLINE unsigned LaneMask_SSE2(__m128i m)
+{
+   return _mm_movemask_ps(_mm_castsi128_ps(m)) & 0x7;
+}
+
+// Lm_B() of 32-bit lanes, clamped into 16-bit lanes 0-3 of *ir; returns the lanes that were out of range.
+static INLINE unsigned Lm_B_SSE2(__m128i value, int lm, __m128i *ir)
+{
+   const __m128i lower = _mm_set1_epi32(lm ? 0 : -32768);
+   const __m128i out = _mm_or_si128(_mm_cmplt_epi32(value, lower), _mm_cmpgt_epi32(value, _mm_set1_epi32(32767)));
+
+   *ir = _mm_max_epi16(_mm_packs_epi32(value, value), _mm_packs_epi32(lower, lower));
+
+   return LaneMask_SSE2(out);
+}
+
+//
+// MultiplyMatrixByVector() of three vectors at once; v[k] holds component k of each vector in 16-bit lanes 0-2.
+// Leaves MAC in mac[i] and IR in ir[i](16-bit lanes), for row i of the matrix.
+//
+static INLINE void MultiplyMatrixByVectors_SSE2(const gtematrix *matrix, const __m128i *vec, const int32_t *crv, uint32_t sf, int lm, __m128i *mac, __m128i *ir)
+{
+   const __m128i v[3] = { vec[0], vec[1], vec[2] };	// vec may be ir
+
+   for(unsigned i = 0; i < 3; i++)
+   {
+      __m128i p[3];
+
+      for(unsigned k = 0; k < 3; k++)
+         p[k] = Mul16_SSE2(_mm_set1_epi16(matrix->MX[i][k]), v[k]);
+
+      mac[i] = SumProducts_SSE2(p, 3, _mm_set1_epi32(crv[i]), sf);
+
+      if(Lm_B_SSE2(mac[i], lm, &ir[i]))
+         FLAGS |= 1 << (24 - i);
+   }
+}
+
+static INLINE void StoreLanes_SSE2(const __m128i *mac, const __m128i *ir, int32_t mac_out[3][4], int16_t ir_out[3][8])
+{
+   for(unsigned i = 0; i < 3; i++)
+   {
+      _mm_storeu_si128((__m128i *)mac_out[i], mac[i]);
+      _mm_storeu_si128((__m128i *)ir_out[i], ir[i]);
+   }
+}
+
+// MAC and IR of lane v, as the last vertex of a triple command leaves them.
+static INLINE void LoadLane(const int32_t mac[3][4], const int16_t ir[3][8], unsigned v)
+{
+   MAC[1] = mac[0][v];
+   MAC[2] = mac[1][v];
+   MAC[3] = mac[2][v];
+
+   IR1 = ir[0][v];
+   IR2 = ir[1][v];
+   IR3 = ir[2][v];
+}
+
+enum
+{
+   NORM_COLOR = 0,
+   NORM_COLOR_COLOR,
+   NORM_COLOR_DEPTH_CUE
+};
+
+// NCT, NCCT and NCDT; returns false, having done nothing, if they have to be done the scalar way.
+static INLINE bool NormColor3_SSE2(unsigned mode, uint32_t sf, int lm)
+{
+   __m128i v[3], mac[3], ir[3];
+   int32_t mac_out[3][4];
+   int16_t ir_out[3][8];
+
+   if(!NoMVOverflow(CRVectors.B) || (mode == NORM_COLOR_DEPTH_CUE && !NoMVOverflow(CRVectors.FC)))
+      return false;
+
+   for(unsigned k = 0; k < 3; k++)
+      v[k] = _mm_setr_epi16(Vectors[0][k], Vectors[1][k], Vectors[2][k], 0, 0, 0, 0, 0);
+
+   MultiplyMatrixByVectors_SSE2(&Matrices.Light, v, CRVectors.Null, sf, lm, mac, ir);
+   MultiplyMatrixByVectors_SSE2(&Matrices.Color, ir, CRVectors.B, sf, lm, mac, ir);
+
+   for(unsigned i = 0; i < 3; i++)
+   {
+      const __m128i rgb = _mm_set1_epi16(RGB.Raw8[i] << 4);
+
+      if(mode == NORM_COLOR_COLOR)
+      {
+         mac[i] = _mm_sra_epi32(Mul16_SSE2(rgb, ir[i]), _mm_cvtsi32_si128(sf));
+
+         if(Lm_B_SSE2(mac[i], lm, &ir[i]))
+            FLAGS |= 1 << (24 - i);
+      }
+      else if(mode == NORM_COLOR_DEPTH_CUE)
+      {
+         // DepthCue(TRUE, FALSE, sf, lm); the second sum is done in 32 bits by the scalar version too.
+         const __m128i rgb_ir = Mul16_SSE2(rgb, ir[i]);
+         const __m128i neg_rgb_ir = _mm_sub_epi32(_mm_setzero_si128(), rgb_ir);
+         __m128i lm_b;
+
+         if(Lm_B_SSE2(SumProducts_SSE2(&neg_rgb_ir, 1, _mm_set1_epi32(CRVectors.FC[i]), sf), FALSE, &lm_b))
+            FLAGS |= 1 << (24 - i);
+
+         mac[i] = _mm_sra_epi32(_mm_add_epi32(rgb_ir, Mul16_SSE2(_mm_set1_epi16(IR0), lm_b)), _mm_cvtsi32_si128(sf));
+
+         if(Lm_B_SSE2(mac[i], lm, &ir[i]))
+            FLAGS |= 1 << (24 - i);
+      }
+   }
+
+   StoreLanes_SSE2(mac, ir, mac_out, ir_out);
+
+   for(unsigned vn = 0; vn < 3; vn++)
+   {
+      LoadLane(mac_out, ir_out, vn);
+      MAC_to_RGB_FIFO();
+   }
+
+   return true;
+}
+
+// MultiplyMatrixByVector_PT() of the three vectors and the new Z FIFO entries, for RTPT; returns false, having done
+// nothing, if it has to be done the scalar way.
+static INLINE bool MultiplyMatrixByVectors_PT_SSE2(uint32_t sf, int lm, int32_t mac_out[3][4], int16_t ir_out[3][8], int32_t *ftv)
+{
+   __m128i v[3], mac[3], ir[3];
+
+   if(!NoMVOverflow(CRVectors.T))
+      return false;
+
+   for(unsigned k = 0; k < 3; k++)
+      v[k] = _mm_setr_epi16(Vectors[0][k], Vectors[1][k], Vectors[2][k], 0, 0, 0, 0, 0);
+
+   for(unsigned i = 0; i < 3; i++)
+   {
+      const __m128i c = _mm_set1_epi32(CRVectors.T[i]);
+      __m128i p[3];
+
+      for(unsigned k = 0; k < 3; k++)
+         p[k] = Mul16_SSE2(_mm_set1_epi16(Matrices.Rot.MX[i][k]), v[k]);
+
+      mac[i] = SumProducts_SSE2(p, 3, c, sf);
+
+      if(i < 2)
+      {
+         if(Lm_B_SSE2(mac[i], lm, &ir[i]))
+            FLAGS |= 1 << (24 - i);
+      }
+      else
+      {
+         // Lm_B_PTZ()
+         const __m128i z = sf ? mac[i] : SumProducts_SSE2(p, 3, c, 12);
+
+         Lm_B_SSE2(mac[i], lm, &ir[i]);
+
+         if(LaneMask_SSE2(_mm_or_si128(_mm_cmplt_epi32(z, _mm_set1_epi32(-32768)), _mm_cmpgt_epi32(z, _mm_set1_epi32(32767)))))
+            FLAGS |= 1 << 22;
+
+         _mm_storeu_si128((__m128i *)ftv, z);
+      }
+   }
+
+   StoreLanes_SSE2(mac, ir, mac_out, ir_out);
+
+   return true;
+}
+
+// MVMVA, with the matrix rows in lanes 0-2; returns false, having done nothing, if it has to be done the scalar way.
+static INLINE bool MultiplyMatrixByVector_SSE2(const gtematrix *matrix, const int16_t *v, const int32_t *crv, uint32_t sf, int lm)
+{
+   __m128i a[3], p[3], c, mac, ir;
+   int32_t mac_out[4];
+   int16_t ir_out[8];
+
+   if(!NoMVOverflow(crv))
+      return false;
+
+   if(MDFN_LIKELY(matrix != &Matrices.AbbyNormal))
+   {
+      for(unsigned k = 0; k < 3; k++)
+         a[k] = _mm_setr_epi16(matrix->MX[0][k], matrix->MX[1][k], matrix->MX[2][k], 0, 0, 0, 0, 0);
+   }
+   else
+   {
+      a[0] = _mm_setr_epi16(-(RGB.R << 4), (int16_t)CR[1], (int16_t)CR[2], 0, 0, 0, 0, 0);
+      a[1] = _mm_setr_epi16(RGB.R << 4, (int16_t)CR[1], (int16_t)CR[2], 0, 0, 0, 0, 0);
+      a[2] = _mm_setr_epi16(IR0, (int16_t)CR[1], (int16_t)CR[2], 0, 0, 0, 0, 0);
+   }
+
+   for(unsigned k = 0; k < 3; k++)
+      p[k] = Mul16_SSE2(a[k], _mm_set1_epi16(v[k]));
+
+   c = _mm_setr_epi32(crv[0], crv[1], crv[2], 0);
+
+   if(crv == CRVectors.FC)
+   {
+      // Only the first product is added to the far color, and that only goes to Lm_B()'s flags.
+      __m128i dummy;
+      unsigned lanes = Lm_B_SSE2(SumProducts_SSE2(&p[0], 1, c, sf), FALSE, &dummy);
+
+      for(unsigned i = 0; i < 3; i++)
+      {
+         if(lanes & (1 << i))
+            FLAGS |= 1 << (24 - i);
+      }
+
+      mac = SumProducts_SSE2(&p[1], 2, _mm_setzero_si128(), sf);
+   }
+   else
+      mac = SumProducts_SSE2(p, 3, c, sf);
+
+   {
+      const unsigned lanes = Lm_B_SSE2(mac, lm, &ir);
+
+      for(unsigned i = 0; i < 3; i++)
+      {
+         if(lanes & (1 << i))
+            FLAGS |= 1 << (24 - i);
+      }
+   }
+
+   _mm_storeu_si128((__m128i *)mac_out, mac);
+   _mm_storeu_si128((__m128i *)ir_out, ir);
+
+   MAC[1] = mac_out[0];
+   MAC[2] = mac_out[1];
+   MAC[3] = mac_out[2];
+
+   IR1 = ir_out[0];
+   IR2 = ir_out[1];
+   IR3 = ir_out[2];
+
+   return true;
+}
+#endif
+
 static int32_t SQR(uint32_t instr)
 {
    const uint32_t sf = (instr & (1 << 19)) ? 12 : 0;
@@ -1012,6 +1429,9 @@ static int32_t MVMVA(uint32_t instr)
       v[2] = Vectors[v_i][2];
    }
 
+#if defined(__SSE2__)
+   if(!MultiplyMatrixByVector_SSE2(&Matrices.All[mx], v, cv, sf, lm))
+#endif
    MultiplyMatrixByVector(&Matrices.All[mx], v, cv, sf, lm);
 
    return(8);
@@ -1103,6 +1523,39 @@ static int32_t RTPT(uint32_t instr)
    const uint32_t sf = (instr & (1 << 19)) ? 12 : 0;
    const int      lm = (instr >> 10) & 1;
 
+#if defined(__SSE2__)
+   int32_t mac[3][4];
+   int16_t ir[3][8];
+   int32_t ftv[4];
+
+   // The matrix products of all three vertices at once, then the division and screen transform one at a time.
+   if(MultiplyMatrixByVectors_PT_SSE2(sf, lm, mac, ir, ftv))
+   {
+      for(i = 0; i < 3; i++)
+      {
+         int64_t h_div_sz;
+
+         LoadLane(mac, ir, i);
+
+         Z_FIFO[0] = Z_FIFO[1];
+         Z_FIFO[1] = Z_FIFO[2];
+         Z_FIFO[2] = Z_FIFO[3];
+         Z_FIFO[3] = Lm_D(ftv[i], TRUE);
+
+         h_div_sz = Divide(H, Z_FIFO[3]);
+
+         float precise_h_div_sz = (float)H / (float)Z_FIFO[3];
+
+         TransformXY(h_div_sz, precise_h_div_sz, Z_FIFO[3]);
+
+         if(i == 2)
+            TransformDQ(h_div_sz);
+      }
+
+      return(23);
+   }
+#endif
+
    for(i = 0; i < 3; i++)
    {
       int64_t h_div_sz;
@@ -1149,6 +1602,9 @@ static int32_t NCT(uint32_t instr)
    const uint32_t sf = (instr & (1 << 19)) ? 12 : 0;
    const int      lm = (instr >> 10) & 1;
 
+#if defined(__SSE2__)
+   if(!NormColor3_SSE2(NORM_COLOR, sf, lm))
+#endif
    for(i = 0; i < 3; i++)
       NormColor(sf, lm, i);
 
@@ -1189,6 +1645,9 @@ static int32_t NCCT(uint32_t instr)
    const uint32_t sf = (instr & (1 << 19)) ? 12 : 0;
    const int      lm = (instr >> 10) & 1;
 
+#if defined(__SSE2__)
+   if(!NormColor3_SSE2(NORM_COLOR_COLOR, sf, lm))
+#endif
    for(i = 0; i < 3; i++)
       NormColorColor(i, sf, lm);
 
@@ -1323,6 +1782,9 @@ static int32_t NCDT(uint32_t instr)
    const uint32_t sf = (instr & (1 << 19)) ? 12 : 0;
    const int      lm = (instr >> 10) & 1;
 
+#if defined(__SSE2__)
+   if(!NormColor3_SSE2(NORM_COLOR_DEPTH_CUE, sf, lm))
+#endif
    for(i = 0; i < 3; i++)
       NormColorDepthCue(i, sf, lm);
 
@@ -1721,5 +2183,10 @@ int32_t GTE_Instruction(uint32_t instr)
 
    CR[31] = FLAGS;
 
+#ifdef WANT_GTE_TRACE
+   if(TraceFile)
+      TraceInstruction(instr, ret - 1);
+#endif
+
    return(ret - 1);
 }
@@ -13,4 +13,9 @@ void GTE_WriteDR(unsigned int which, uint32_t value);
 uint32_t GTE_ReadCR(unsigned int which);
 uint32_t GTE_ReadDR(unsigned int which);
 
+#ifdef WANT_GTE_TRACE
+bool GTE_TraceOpen(const char *path);
+void GTE_TraceClose(void);
+#endif
+
 #endif
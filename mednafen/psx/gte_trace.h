@@ -0,0 +1,53 @@
+#ifndef __MDFN_PSX_GTE_TRACE_H
+#define __MDFN_PSX_GTE_TRACE_H
+
+/*
+ GTE command trace format, written by the core when built with GTE_TRACE=1, and replayed by tools/gte_replay.cpp.
+
+ After the 8-byte magic and a 32-bit version, the file is a sequence of records, each starting with a tag byte
+ whose upper 3 bits are the record type.  All multi-byte values are little-endian.
+
+  GTE_TRACE_WRITE_CR, GTE_TRACE_WRITE_DR:	register number in the lower 5 bits of the tag; 32-bit value.
+
+  GTE_TRACE_INSTRUCTION:	GTE_TRACE_FLAG_* in the lower 5 bits of the tag; 32-bit instruction, 8-bit return
+				value of GTE_Instruction(), and 32-bit GTE_TraceHash() of the registers afterwards.
+
+  GTE_TRACE_STATE:		all 32 control registers, then all 32 data registers, as GTE_ReadCR()/GTE_ReadDR()
+				return them; written when tracing starts, on power-up, and on save state load.
+*/
+
+#define GTE_TRACE_MAGIC		"GTETRACE"
+#define GTE_TRACE_VERSION	1
+
+enum
+{
+   GTE_TRACE_WRITE_CR = 0,
+   GTE_TRACE_WRITE_DR,
+   GTE_TRACE_INSTRUCTION,
+   GTE_TRACE_STATE
+};
+
+#define GTE_TRACE_TYPE_SHIFT		5
+#define GTE_TRACE_ARG_MASK		0x1F
+
+// Settings that change GTE_Instruction()'s results.
+#define GTE_TRACE_FLAG_OVERCLOCK	0x01
+#define GTE_TRACE_FLAG_WIDESCREEN	0x02
+
+// FNV-1a of all the registers, as GTE_ReadCR()/GTE_ReadDR() return them.
+static INLINE uint32_t GTE_TraceHash(void)
+{
+   uint32_t hash = 2166136261U;
+
+   for(unsigned i = 0; i < 64; i++)
+   {
+      const uint32_t value = (i < 32) ? GTE_ReadCR(i) : GTE_ReadDR(i - 32);
+
+      for(unsigned b = 0; b < 32; b += 8)
+         hash = (hash ^ ((value >> b) & 0xFF)) * 16777619U;
+   }
+
+   return hash;
+}
+
+#endif
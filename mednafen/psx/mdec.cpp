@@ -60,11 +60,21 @@
 #include "FastFIFO.h"
 #include <math.h>
 
+#include <rthreads/rthreads.h>
+
 #if defined(__SSE2__)
 #include <xmmintrin.h>
 #include <emmintrin.h>
 #endif
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #if defined(ARCH_POWERPC_ALTIVEC) && defined(HAVE_ALTIVEC_H)
  #include <altivec.h>
 #endif
@@ -88,18 +98,26 @@ static uint32 QMIndex;
 static int16 IDCTMatrix[64] MDFN_ALIGN(16);
 static uint32 IDCTMIndex;
 
+// IDCTMatrix reordered for the IDCT, with the coefficients each output applies to inputs 2p and 2p+1 adjacent; [p][x][2].
+static int16 IDCTPairs[64] MDFN_ALIGN(32);
+
+// Chroma contributions to R, G and B over the current macroblock; see CalcChroma().
+static int16 ChromaRGB[3][16][16] MDFN_ALIGN(16);
+
 static uint8 QScale;
 
 static int16 Coeff[64] MDFN_ALIGN(16);
 static uint32 CoeffIndex;
 static uint32 DecodeWB;
 
-static union
+union mdec_pixels
 {
  uint32 pix32[48];
  uint16 pix16[96];
  uint8   pix8[192];
-} PixelBuffer;
+};
+
+static mdec_pixels PixelBuffer;
 static uint32 PixelBufferReadOffset;
 static uint32 PixelBufferCount32;
 
@@ -109,6 +127,10 @@ static uint8 RAMOffsetY;
 static uint8 RAMOffsetCounter;
 static uint8 RAMOffsetWWS;
 
+static void RebuildIDCTPairs(void);
+static void CalcChroma(void);
+static void SyncDecodeThread(void);
+
 static const uint8 ZigZag[64] =
 {
  0x00, 0x08, 0x01, 0x02, 0x09, 0x10, 0x18, 0x11, 
@@ -123,6 +145,8 @@ static const uint8 ZigZag[64] =
 
 void MDEC_Power(void)
 {
+   SyncDecodeThread();
+
    ClockCounter = 0;
    MDRPhase = 0;
 
@@ -132,6 +156,7 @@ void MDEC_Power(void)
    memset(block_y, 0, sizeof(block_y));
    memset(block_cb, 0, sizeof(block_cb));
    memset(block_cr, 0, sizeof(block_cr));
+   memset(ChromaRGB, 0, sizeof(ChromaRGB));
 
    Control = 0;
    Command = 0;
@@ -141,6 +166,7 @@ void MDEC_Power(void)
    QMIndex = 0;
 
    memset(IDCTMatrix, 0, sizeof(IDCTMatrix));
+   memset(IDCTPairs, 0, sizeof(IDCTPairs));
    IDCTMIndex = 0;
 
    QScale = 0;
@@ -162,6 +188,8 @@ void MDEC_Power(void)
 
 int MDEC_StateAction(StateMem *sm, int load, int data_only)
 {
+   SyncDecodeThread();
+
    SFORMAT StateRegs[] =
    {
       SFVAR(ClockCounter),
@@ -215,6 +243,9 @@ int MDEC_StateAction(StateMem *sm, int load, int data_only)
    {
       InFIFO.SaveStatePostLoad();
       OutFIFO.SaveStatePostLoad();
+
+      RebuildIDCTPairs();
+      CalcChroma();
    }
 
    return(ret);
@@ -233,76 +264,236 @@ static INLINE int8 Mask9ClampS8(int32 v)
    return v;
 }
 
-template<typename T>
-static void IDCT_1D_Multi(int16 *in_coeff, T *out_coeff)
+static INLINE void SetIDCTMatrix(unsigned index, int16 value)
+{
+   IDCTMatrix[index] = value;
+   IDCTPairs[((index & 0x6) << 3) | ((index >> 3) << 1) | (index & 0x1)] = value;
+}
+
+static void RebuildIDCTPairs(void)
+{
+   for(unsigned i = 0; i < 64; i++)
+      SetIDCTMatrix(i, IDCTMatrix[i]);
+}
+
+//
+// Each 1D pass computes one row of 8 outputs at a time as a sum of its inputs times the matrix columns, so every
+// output's products and rounding are exactly those of the plain 8x8 matrix multiply.  The first pass's output is
+// transposed afterwards for the second pass.
+//
+static INLINE void IDCT_StoreRow(int8 *out, const int32 *sum)
 {
+   for(unsigned x = 0; x < 8; x++)
+      out[x] = Mask9ClampS8((sum[x] + 0x4000) >> 15);
+}
+
+static INLINE void IDCT_StoreRow(int16 *out, const int32 *sum)
+{
+   for(unsigned x = 0; x < 8; x++)
+      out[x] = (sum[x] + 0x4000) >> 15;
+}
+
 #if defined(__SSE2__)
+template<unsigned p>
+static INLINE __m128i IDCT_SplatPair_SSE2(__m128i c)
 {
- for(unsigned col = 0; col < 8; col++)
- {
-  __m128i c =  _mm_load_si128((__m128i *)&in_coeff[(col * 8)]);
+   return _mm_shuffle_epi32(c, p * 0x55);
+}
 
-  for(unsigned x = 0; x < 8; x++)
-  {
-   __m128i sum;
-   __m128i m;
-   int32 tmp[4] MDFN_ALIGN(16);
+static INLINE void IDCT_StoreRow_SSE2(int8 *out, __m128i lo, __m128i hi)
+{
+   const __m128i bias = _mm_set1_epi32(0x4000);
 
-   m = _mm_load_si128((__m128i *)&IDCTMatrix[(x * 8)]);
-   sum = _mm_madd_epi16(m, c);
-   sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, (3 << 0) | (2 << 2) | (1 << 4) | (0 << 6)));
-   sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, (1 << 0) | (0 << 2)));
+   lo = _mm_srai_epi32(_mm_add_epi32(lo, bias), 15);
+   hi = _mm_srai_epi32(_mm_add_epi32(hi, bias), 15);
 
-   //_mm_store_ss((float *)&tmp[0], (__m128)sum);
-   _mm_store_si128((__m128i*)tmp, sum);
+   // Mask9ClampS8(); the clamp is the saturation of the packs.
+   lo = _mm_srai_epi32(_mm_slli_epi32(lo, 23), 23);
+   hi = _mm_srai_epi32(_mm_slli_epi32(hi, 23), 23);
+   lo = _mm_packs_epi32(lo, hi);
 
-   if(sizeof(T) == 1)
-    out_coeff[(col * 8) + x] = Mask9ClampS8((tmp[0] + 0x4000) >> 15);
-   else
-    out_coeff[(x * 8) + col] = (tmp[0] + 0x4000) >> 15;
-  }
- }
+   _mm_storel_epi64((__m128i *)out, _mm_packs_epi16(lo, lo));
 }
-#else
- for(unsigned col = 0; col < 8; col++)
- {
-  for(unsigned x = 0; x < 8; x++)
-  {
-   int32 sum = 0;
 
-   for(unsigned u = 0; u < 8; u++)
+static INLINE void IDCT_StoreRow_SSE2(int16 *out, __m128i lo, __m128i hi)
+{
+   const __m128i bias = _mm_set1_epi32(0x4000);
+
+   lo = _mm_srai_epi32(_mm_add_epi32(lo, bias), 15);
+   hi = _mm_srai_epi32(_mm_add_epi32(hi, bias), 15);
+
+   // Truncate to 16 bits, rather than saturate.
+   lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+   hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+
+   _mm_storeu_si128((__m128i *)out, _mm_packs_epi32(lo, hi));
+}
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+static INLINE void IDCT_StoreRow_NEON(int8 *out, int32x4_t lo, int32x4_t hi)
+{
+   lo = vshrq_n_s32(vaddq_s32(lo, vdupq_n_s32(0x4000)), 15);
+   hi = vshrq_n_s32(vaddq_s32(hi, vdupq_n_s32(0x4000)), 15);
+
+   lo = vshrq_n_s32(vshlq_n_s32(lo, 23), 23);
+   hi = vshrq_n_s32(vshlq_n_s32(hi, 23), 23);
+
+   vst1_s8(out, vqmovn_s16(vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi))));
+}
+
+static INLINE void IDCT_StoreRow_NEON(int16 *out, int32x4_t lo, int32x4_t hi)
+{
+   lo = vshrq_n_s32(vaddq_s32(lo, vdupq_n_s32(0x4000)), 15);
+   hi = vshrq_n_s32(vaddq_s32(hi, vdupq_n_s32(0x4000)), 15);
+
+   vst1q_s16(out, vcombine_s16(vmovn_s32(lo), vmovn_s32(hi)));
+}
+#endif
+
+template<typename T>
+static void IDCT_1D_Multi(const int16 *in_coeff, T *out_coeff)
+{
+   for(unsigned col = 0; col < 8; col++)
    {
-    sum += (in_coeff[(col * 8) + u] * IDCTMatrix[(x * 8) + u]);
+      const int16 *c = &in_coeff[col * 8];
+      T *out = &out_coeff[col * 8];
+#if defined(__AVX2__)
+      const __m128i cv = _mm_loadu_si128((const __m128i *)c);
+      __m256i sum;
+
+      sum = _mm256_madd_epi16(_mm256_broadcastd_epi32(IDCT_SplatPair_SSE2<0>(cv)), _mm256_loadu_si256((const __m256i *)&IDCTPairs[0x00]));
+      sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_broadcastd_epi32(IDCT_SplatPair_SSE2<1>(cv)), _mm256_loadu_si256((const __m256i *)&IDCTPairs[0x10])));
+      sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_broadcastd_epi32(IDCT_SplatPair_SSE2<2>(cv)), _mm256_loadu_si256((const __m256i *)&IDCTPairs[0x20])));
+      sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_broadcastd_epi32(IDCT_SplatPair_SSE2<3>(cv)), _mm256_loadu_si256((const __m256i *)&IDCTPairs[0x30])));
+
+      IDCT_StoreRow_SSE2(out, _mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+#elif defined(__SSE2__)
+      const __m128i cv = _mm_loadu_si128((const __m128i *)c);
+      const __m128i *m = (const __m128i *)IDCTPairs;
+      __m128i lo, hi, cp;
+
+      cp = IDCT_SplatPair_SSE2<0>(cv);
+      lo = _mm_madd_epi16(cp, _mm_loadu_si128(&m[0]));
+      hi = _mm_madd_epi16(cp, _mm_loadu_si128(&m[1]));
+
+      cp = IDCT_SplatPair_SSE2<1>(cv);
+      lo = _mm_add_epi32(lo, _mm_madd_epi16(cp, _mm_loadu_si128(&m[2])));
+      hi = _mm_add_epi32(hi, _mm_madd_epi16(cp, _mm_loadu_si128(&m[3])));
+
+      cp = IDCT_SplatPair_SSE2<2>(cv);
+      lo = _mm_add_epi32(lo, _mm_madd_epi16(cp, _mm_loadu_si128(&m[4])));
+      hi = _mm_add_epi32(hi, _mm_madd_epi16(cp, _mm_loadu_si128(&m[5])));
+
+      cp = IDCT_SplatPair_SSE2<3>(cv);
+      lo = _mm_add_epi32(lo, _mm_madd_epi16(cp, _mm_loadu_si128(&m[6])));
+      hi = _mm_add_epi32(hi, _mm_madd_epi16(cp, _mm_loadu_si128(&m[7])));
+
+      IDCT_StoreRow_SSE2(out, lo, hi);
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+      int32x4_t lo = vdupq_n_s32(0);
+      int32x4_t hi = vdupq_n_s32(0);
+
+      for(unsigned p = 0; p < 4; p++)
+      {
+         const int16x8x2_t m = vld2q_s16(&IDCTPairs[p * 16]);
+
+         lo = vmlal_n_s16(lo, vget_low_s16(m.val[0]), c[p * 2 + 0]);
+         hi = vmlal_n_s16(hi, vget_high_s16(m.val[0]), c[p * 2 + 0]);
+         lo = vmlal_n_s16(lo, vget_low_s16(m.val[1]), c[p * 2 + 1]);
+         hi = vmlal_n_s16(hi, vget_high_s16(m.val[1]), c[p * 2 + 1]);
+      }
+
+      IDCT_StoreRow_NEON(out, lo, hi);
+#else
+      int32 sum[8] = { 0 };
+
+      for(unsigned u = 0; u < 8; u++)
+      {
+         for(unsigned x = 0; x < 8; x++)
+            sum[x] += c[u] * IDCTMatrix[(x * 8) + u];
+      }
+
+      IDCT_StoreRow(out, sum);
+#endif
    }
+}
 
-   if(sizeof(T) == 1)
-    out_coeff[(col * 8) + x] = Mask9ClampS8((sum + 0x4000) >> 15);
-   else
-    out_coeff[(x * 8) + col] = (sum + 0x4000) >> 15;
-  }
- }
+static INLINE void Transpose8x8(int16 *buf)
+{
+#if defined(__SSE2__)
+   __m128i *b = (__m128i *)buf;
+   const __m128i a0 = _mm_loadu_si128(&b[0]), a1 = _mm_loadu_si128(&b[1]);
+   const __m128i a2 = _mm_loadu_si128(&b[2]), a3 = _mm_loadu_si128(&b[3]);
+   const __m128i a4 = _mm_loadu_si128(&b[4]), a5 = _mm_loadu_si128(&b[5]);
+   const __m128i a6 = _mm_loadu_si128(&b[6]), a7 = _mm_loadu_si128(&b[7]);
+   const __m128i b0 = _mm_unpacklo_epi16(a0, a1), b1 = _mm_unpackhi_epi16(a0, a1);
+   const __m128i b2 = _mm_unpacklo_epi16(a2, a3), b3 = _mm_unpackhi_epi16(a2, a3);
+   const __m128i b4 = _mm_unpacklo_epi16(a4, a5), b5 = _mm_unpackhi_epi16(a4, a5);
+   const __m128i b6 = _mm_unpacklo_epi16(a6, a7), b7 = _mm_unpackhi_epi16(a6, a7);
+   const __m128i c0 = _mm_unpacklo_epi32(b0, b2), c1 = _mm_unpackhi_epi32(b0, b2);
+   const __m128i c2 = _mm_unpacklo_epi32(b1, b3), c3 = _mm_unpackhi_epi32(b1, b3);
+   const __m128i c4 = _mm_unpacklo_epi32(b4, b6), c5 = _mm_unpackhi_epi32(b4, b6);
+   const __m128i c6 = _mm_unpacklo_epi32(b5, b7), c7 = _mm_unpackhi_epi32(b5, b7);
+
+   _mm_storeu_si128(&b[0], _mm_unpacklo_epi64(c0, c4));
+   _mm_storeu_si128(&b[1], _mm_unpackhi_epi64(c0, c4));
+   _mm_storeu_si128(&b[2], _mm_unpacklo_epi64(c1, c5));
+   _mm_storeu_si128(&b[3], _mm_unpackhi_epi64(c1, c5));
+   _mm_storeu_si128(&b[4], _mm_unpacklo_epi64(c2, c6));
+   _mm_storeu_si128(&b[5], _mm_unpackhi_epi64(c2, c6));
+   _mm_storeu_si128(&b[6], _mm_unpacklo_epi64(c3, c7));
+   _mm_storeu_si128(&b[7], _mm_unpackhi_epi64(c3, c7));
+#else
+   for(unsigned y = 0; y < 8; y++)
+   {
+      for(unsigned x = y + 1; x < 8; x++)
+         std::swap(buf[(y * 8) + x], buf[(x * 8) + y]);
+   }
 #endif
 }
 
-static void IDCT(int16 *in_coeff, int8 *out_coeff)
+static void IDCT(const int16 *in_coeff, int8 *out_coeff)
 {
    int16 tmpbuf[64] MDFN_ALIGN(16);
 
    IDCT_1D_Multi<int16>(in_coeff, tmpbuf);
+   Transpose8x8(tmpbuf);
    IDCT_1D_Multi<int8>(tmpbuf, out_coeff);
 }
 
-static INLINE void YCbCr_to_RGB(const int8 y, const int8 cb, const int8 cr, int &r, int &g, int &b)
+//
+// The chroma half of YCbCr to RGB, for the whole current macroblock at once(after its Cb block is decoded), at
+// full resolution; [y][x].
+//
+static void CalcChroma(void)
 {
-   // The formula for green is still a bit off(precision/rounding issues when both cb and cr are non-zero).
-   r = Mask9ClampS8(y + (((359 * cr) + 0x80) >> 8));
-   //g = Mask9ClampS8(y + (((-88 * cb) + (-183 * cr) + 0x80) >> 8));
-   g = Mask9ClampS8(y + ((((-88 * cb) &~ 0x1F) + ((-183 * cr) &~ 0x07) + 0x80) >> 8));
-   b = Mask9ClampS8(y + (((454 * cb) + 0x80) >> 8));
+   for(unsigned cy = 0; cy < 8; cy++)
+   {
+      for(unsigned cx = 0; cx < 8; cx++)
+      {
+         const int cb = block_cb[cy][cx];
+         const int cr = block_cr[cy][cx];
+         // The formula for green is still a bit off(precision/rounding issues when both cb and cr are non-zero).
+         const int16 r = ((359 * cr) + 0x80) >> 8;
+         //const int16 g = ((-88 * cb) + (-183 * cr) + 0x80) >> 8;
+         const int16 g = (((-88 * cb) &~ 0x1F) + ((-183 * cr) &~ 0x07) + 0x80) >> 8;
+         const int16 b = ((454 * cb) + 0x80) >> 8;
+
+         for(unsigned i = 0; i < 4; i++)
+         {
+            const unsigned y = (cy << 1) + (i >> 1);
+            const unsigned x = (cx << 1) + (i & 1);
 
-   r ^= 0x80;
-   g ^= 0x80;
-   b ^= 0x80;
+            ChromaRGB[0][y][x] = r;
+            ChromaRGB[1][y][x] = g;
+            ChromaRGB[2][y][x] = b;
+         }
+      }
+   }
+}
+
+static INLINE uint8 YCbCr_to_RGB(const int8 y, const int16 chroma)
+{
+   return Mask9ClampS8(y + chroma) ^ 0x80;
 }
 
 static INLINE uint16 RGB_to_RGB555(uint8 r, uint8 g, uint8 b)
@@ -323,18 +514,88 @@ static INLINE uint16 RGB_to_RGB555(uint8 r, uint8 g, uint8 b)
    return((r << 0) | (g << 5) | (b << 10));
 }
 
-static void EncodeImage(const unsigned ybn)
+#if defined(__SSE2__)
+// YCbCr_to_RGB() of one component of 8 pixels, in 16-bit lanes.
+static INLINE __m128i YCbCr_to_RGB_SSE2(__m128i y, const int16 *chroma)
 {
-   //printf("ENCODE, %d\n", (Command & 0x08000000) ? 256 : 384);
+   __m128i v = _mm_add_epi16(y, _mm_loadu_si128((const __m128i *)chroma));
 
-   PixelBufferCount32 = 0;
+   v = _mm_srai_epi16(_mm_slli_epi16(v, 7), 7);
+   v = _mm_min_epi16(_mm_max_epi16(v, _mm_set1_epi16(-128)), _mm_set1_epi16(127));
 
-   switch((Command >> 27) & 0x3)
+   return _mm_add_epi16(v, _mm_set1_epi16(0x80));
+}
+
+static INLINE __m128i RGB_to_RGB555_SSE2(__m128i v)
+{
+   return _mm_min_epi16(_mm_srli_epi16(_mm_add_epi16(v, _mm_set1_epi16(4)), 3), _mm_set1_epi16(0x1F));
+}
+#endif
+
+//
+// Converts the 8x8 Y block ybn(0 = top-left ... 3 = bottom-right) of the current macroblock to RGB.  Each component
+// is stored 8 pixels per row, in the low bytes of rgb if rgb555 is NULL, or packed into rgb555 otherwise.
+//
+static INLINE void YBlock_to_RGB(const unsigned ybn, uint8 rgb[3][64], uint16 *rgb555, const uint16 rgb555_xor)
+{
+   const unsigned cx = (ybn & 1) << 3;
+   const unsigned cy = (ybn & 2) << 2;
+
+   for(unsigned y = 0; y < 8; y++)
+   {
+#if defined(__SSE2__)
+      const __m128i yv = _mm_loadl_epi64((const __m128i *)&block_y[y][0]);
+      const __m128i y16 = _mm_srai_epi16(_mm_unpacklo_epi8(yv, yv), 8);
+      const __m128i r = YCbCr_to_RGB_SSE2(y16, &ChromaRGB[0][cy + y][cx]);
+      const __m128i g = YCbCr_to_RGB_SSE2(y16, &ChromaRGB[1][cy + y][cx]);
+      const __m128i b = YCbCr_to_RGB_SSE2(y16, &ChromaRGB[2][cy + y][cx]);
+
+      if(rgb555)
+      {
+         __m128i p = RGB_to_RGB555_SSE2(r);
+
+         p = _mm_or_si128(p, _mm_slli_epi16(RGB_to_RGB555_SSE2(g), 5));
+         p = _mm_or_si128(p, _mm_slli_epi16(RGB_to_RGB555_SSE2(b), 10));
+         p = _mm_xor_si128(p, _mm_set1_epi16(rgb555_xor));
+
+         _mm_storeu_si128((__m128i *)&rgb555[y * 8], p);
+      }
+      else
+      {
+         _mm_storel_epi64((__m128i *)&rgb[0][y * 8], _mm_packus_epi16(r, r));
+         _mm_storel_epi64((__m128i *)&rgb[1][y * 8], _mm_packus_epi16(g, g));
+         _mm_storel_epi64((__m128i *)&rgb[2][y * 8], _mm_packus_epi16(b, b));
+      }
+#else
+      for(unsigned x = 0; x < 8; x++)
+      {
+         const uint8 r = YCbCr_to_RGB(block_y[y][x], ChromaRGB[0][cy + y][cx + x]);
+         const uint8 g = YCbCr_to_RGB(block_y[y][x], ChromaRGB[1][cy + y][cx + x]);
+         const uint8 b = YCbCr_to_RGB(block_y[y][x], ChromaRGB[2][cy + y][cx + x]);
+
+         if(rgb555)
+            StoreU16_LE(&rgb555[y * 8 + x], rgb555_xor ^ RGB_to_RGB555(r, g, b));
+         else
+         {
+            rgb[0][y * 8 + x] = r;
+            rgb[1][y * 8 + x] = g;
+            rgb[2][y * 8 + x] = b;
+         }
+      }
+#endif
+   }
+}
+
+static void EncodeImage(const unsigned ybn, const uint32 command, mdec_pixels *out)
+{
+   //printf("ENCODE, %d\n", (command & 0x08000000) ? 256 : 384);
+
+   switch((command >> 27) & 0x3)
    {
       case 0:	// 4bpp
          {
-            const uint8 us_xor = (Command & (1U << 26)) ? 0x00 : 0x88;
-            uint8* pix_out = PixelBuffer.pix8;
+            const uint8 us_xor = (command & (1U << 26)) ? 0x00 : 0x88;
+            uint8* pix_out = out->pix8;
 
             for(int y = 0; y < 8; y++)
             {
@@ -347,15 +608,14 @@ static void EncodeImage(const unsigned ybn)
                   pix_out++;
                }
             }
-            PixelBufferCount32 = 8;
          }
          break;
 
 
       case 1:	// 8bpp
          {
-            const uint8 us_xor = (Command & (1U << 26)) ? 0x00 : 0x80;
-            uint8* pix_out = PixelBuffer.pix8;
+            const uint8 us_xor = (command & (1U << 26)) ? 0x00 : 0x80;
+            uint8* pix_out = out->pix8;
 
             for(int y = 0; y < 8; y++)
             {
@@ -365,62 +625,229 @@ static void EncodeImage(const unsigned ybn)
                   pix_out++;
                }
             }
-            PixelBufferCount32 = 16;
          }
          break;
 
       case 2:	// 24bpp
          {
-            const uint8 rgb_xor = (Command & (1U << 26)) ? 0x80 : 0x00;
-            uint8* pix_out = PixelBuffer.pix8;
-
-            for(int y = 0; y < 8; y++)
-            {
-               const int8* by = &block_y[y][0];
-               const int8* cb = &block_cb[(y >> 1) | ((ybn & 2) << 1)][(ybn & 1) << 2];
-               const int8* cr = &block_cr[(y >> 1) | ((ybn & 2) << 1)][(ybn & 1) << 2];
+            const uint8 rgb_xor = (command & (1U << 26)) ? 0x80 : 0x00;
+            uint8* pix_out = out->pix8;
+            uint8 rgb[3][64] MDFN_ALIGN(16);
 
-               for(int x = 0; x < 8; x++)
-               {
-                  int r, g, b;
+            YBlock_to_RGB(ybn, rgb, NULL, 0);
 
-                  YCbCr_to_RGB(by[x], cb[x >> 1], cr[x >> 1], r, g, b);
-
-                  pix_out[0] = r ^ rgb_xor;
-                  pix_out[1] = g ^ rgb_xor;
-                  pix_out[2] = b ^ rgb_xor;
-                  pix_out += 3;
-               }
+            for(int i = 0; i < 64; i++)
+            {
+               pix_out[0] = rgb[0][i] ^ rgb_xor;
+               pix_out[1] = rgb[1][i] ^ rgb_xor;
+               pix_out[2] = rgb[2][i] ^ rgb_xor;
+               pix_out += 3;
             }
-            PixelBufferCount32 = 48;
          }
          break;
 
       case 3:	// 16bpp
          {
-            uint16 pixel_xor = ((Command & 0x02000000) ? 0x8000 : 0x0000) | ((Command & (1U << 26)) ? 0x4210 : 0x0000);
-            uint16* pix_out = PixelBuffer.pix16;
+            uint16 pixel_xor = ((command & 0x02000000) ? 0x8000 : 0x0000) | ((command & (1U << 26)) ? 0x4210 : 0x0000);
 
-            for(int y = 0; y < 8; y++)
-            {
-               const int8* by = &block_y[y][0];
-               const int8* cb = &block_cb[(y >> 1) | ((ybn & 2) << 1)][(ybn & 1) << 2];
-               const int8* cr = &block_cr[(y >> 1) | ((ybn & 2) << 1)][(ybn & 1) << 2];
+            YBlock_to_RGB(ybn, NULL, out->pix16, pixel_xor);
+         }
+         break;
 
-               for(int x = 0; x < 8; x++)
-               {
-                  int r, g, b;
+   }
+}
 
-                  YCbCr_to_RGB(by[x], cb[x >> 1], cr[x >> 1], r, g, b);
+// Size of what EncodeImage() outputs for one block, in 32-bit units.
+static INLINE uint32 EncodedSize32(const uint32 command)
+{
+   static const uint8 size32[4] = { 8, 16, 48, 32 };
 
-                  StoreU16_LE(pix_out, pixel_xor ^ RGB_to_RGB555(r, g, b));
-                  pix_out++;
-               }
-            }
-            PixelBufferCount32 = 32;
-         }
+   return size32[(command >> 27) & 0x3];
+}
+
+static void DecodeBlock(const int16 *coeff, const uint32 wb, const uint32 command, mdec_pixels *out)
+{
+   switch(wb)
+   {
+      case 0:
+         IDCT(coeff, &block_cr[0][0]);
+         break;
+      case 1:
+         IDCT(coeff, &block_cb[0][0]);
+         CalcChroma();
          break;
+      case 2:
+      case 3:
+      case 4:
+      case 5:
+         IDCT(coeff, &block_y[0][0]);
+         break;
+   }
+
+   if(wb >= 2)
+      EncodeImage((wb + 4) % 6, command, out);
+}
+
+//
+// Optional decode thread.  Run-length decoding, dequantization and all of the timing stay in MDEC_Run(); only
+// DecodeBlock() of each complete block is handed off, in order, and MDEC_Run() waits for a block's pixels right
+// before it moves them into the OutFIFO.  The decoding thread owns block_y/cb/cr, ChromaRGB and IDCTPairs while
+// blocks are outstanding, so anything else that touches those waits for it to catch up first(SyncDecodeThread()).
+//
+struct mdec_block_job
+{
+   int16 Coeff[64];
+   uint32 WB;
+   uint32 Command;
+   mdec_pixels Pixels;
+};
+
+enum { DecodeRingSize = 16 };
+
+static mdec_block_job DecodeRing[DecodeRingSize];
+
+// Protected by DecodeMutex; free-running, index the ring modulo DecodeRingSize.
+static uint32 DecodeWritePos;
+static uint32 DecodeDonePos;
+static bool DecodeExit;
+
+static slock_t *DecodeMutex = NULL;
+static scond_t *DecodeWorkCond = NULL;
+static scond_t *DecodeDoneCond = NULL;
+static sthread_t *DecodeThread = NULL;
+
+// Emulation thread only: the job whose pixels PixelBuffer is still waiting on.
+static uint32 PixelBufferJob;
+static bool PixelBufferPending = false;
+
+static void DecodeThreadEntry(void *data)
+{
+   slock_lock(DecodeMutex);
+
+   while(!DecodeExit)
+   {
+      if(DecodeDonePos == DecodeWritePos)
+      {
+         scond_wait(DecodeWorkCond, DecodeMutex);
+         continue;
+      }
+
+      mdec_block_job *job = &DecodeRing[DecodeDonePos % DecodeRingSize];
+
+      slock_unlock(DecodeMutex);
+      DecodeBlock(job->Coeff, job->WB, job->Command, &job->Pixels);
+      slock_lock(DecodeMutex);
+
+      DecodeDonePos++;
+      scond_broadcast(DecodeDoneCond);
+   }
+
+   slock_unlock(DecodeMutex);
+}
+
+static void QueueBlock(void)
+{
+   if(!DecodeThread)
+   {
+      DecodeBlock(Coeff, DecodeWB, Command, &PixelBuffer);
+      return;
+   }
+
+   slock_lock(DecodeMutex);
+   while((DecodeWritePos - DecodeDonePos) >= DecodeRingSize)
+      scond_wait(DecodeDoneCond, DecodeMutex);
+   slock_unlock(DecodeMutex);
+
+   // The thread doesn't look at the slot until DecodeWritePos moves past it.
+   mdec_block_job *job = &DecodeRing[DecodeWritePos % DecodeRingSize];
+
+   memcpy(job->Coeff, Coeff, sizeof(job->Coeff));
+   job->WB = DecodeWB;
+   job->Command = Command;
 
+   if(DecodeWB >= 2)
+   {
+      PixelBufferJob = DecodeWritePos;
+      PixelBufferPending = true;
+   }
+
+   slock_lock(DecodeMutex);
+   DecodeWritePos++;
+   scond_signal(DecodeWorkCond);
+   slock_unlock(DecodeMutex);
+}
+
+// Waits for the pixels of the last block queued, if PixelBuffer doesn't have them yet.
+static void FinishPixelBuffer(void)
+{
+   if(!PixelBufferPending)
+      return;
+
+   slock_lock(DecodeMutex);
+   while((int32)(DecodeDonePos - PixelBufferJob) <= 0)
+      scond_wait(DecodeDoneCond, DecodeMutex);
+   slock_unlock(DecodeMutex);
+
+   memcpy(&PixelBuffer, &DecodeRing[PixelBufferJob % DecodeRingSize].Pixels, sizeof(PixelBuffer));
+   PixelBufferPending = false;
+}
+
+static void SyncDecodeThread(void)
+{
+   if(!DecodeThread)
+      return;
+
+   slock_lock(DecodeMutex);
+   while(DecodeDonePos != DecodeWritePos)
+      scond_wait(DecodeDoneCond, DecodeMutex);
+   slock_unlock(DecodeMutex);
+
+   FinishPixelBuffer();
+}
+
+void MDEC_EnableDecodeThread(bool enable)
+{
+   if(enable == (DecodeThread != NULL))
+      return;
+
+   if(!enable)
+   {
+      SyncDecodeThread();
+
+      slock_lock(DecodeMutex);
+      DecodeExit = true;
+      scond_signal(DecodeWorkCond);
+      slock_unlock(DecodeMutex);
+
+      sthread_join(DecodeThread);
+      DecodeThread = NULL;
+
+      scond_free(DecodeDoneCond);
+      scond_free(DecodeWorkCond);
+      slock_free(DecodeMutex);
+      DecodeDoneCond = NULL;
+      DecodeWorkCond = NULL;
+      DecodeMutex = NULL;
+      return;
+   }
+
+   DecodeWritePos = 0;
+   DecodeDonePos = 0;
+   DecodeExit = false;
+
+   DecodeMutex = slock_new();
+   DecodeWorkCond = scond_new();
+   DecodeDoneCond = scond_new();
+   DecodeThread = sthread_create(DecodeThreadEntry, NULL);
+
+   if(!DecodeThread)
+   {
+      scond_free(DecodeDoneCond);
+      scond_free(DecodeWorkCond);
+      slock_free(DecodeMutex);
+      DecodeDoneCond = NULL;
+      DecodeWorkCond = NULL;
+      DecodeMutex = NULL;
    }
 }
 
@@ -496,21 +923,10 @@ static INLINE void WriteImageData(uint16 V, int32* eat_cycles)
 
       //printf("Block %d finished\n", DecodeWB);
 
-      switch(DecodeWB)
-      {
-         case 0:
-            IDCT(Coeff, &block_cr[0][0]);
-            break;
-         case 1:
-            IDCT(Coeff, &block_cb[0][0]);
-            break;
-         case 2:
-         case 3:
-         case 4:
-         case 5:
-            IDCT(Coeff, &block_y[0][0]);
-            break;
-      }   
+      if(DecodeWB >= 2)
+         PixelBufferCount32 = EncodedSize32(Command);
+
+      QueueBlock();
 
       // Timing in the actual PS1 MDEC is complex due to (apparent) pipelining, but the average when decoding a large number of blocks is
       // about 512.  We'll go with a lower value here to be conservative due to timing granularity and other timing deficiencies in Mednafen.  BUT, don't
@@ -518,9 +934,6 @@ static INLINE void WriteImageData(uint16 V, int32* eat_cycles)
       //
       *eat_cycles += 474;
 
-      if(DecodeWB >= 2)
-         EncodeImage((DecodeWB + 4) % 6);
-
       DecodeWB++;
       if(DecodeWB == (((Command >> 27) & 2) ? 6 : 3))
          DecodeWB = ((Command >> 27) & 2) ? 0 : 2;
@@ -598,6 +1011,8 @@ void MDEC_Run(int32 clocks)
 
                { ClockCounter -= (need_eat); { case 7: if(!(ClockCounter > 0)) { MDRPhase = 8 - MDRPhaseBias - 1; return; } }; };
 
+               FinishPixelBuffer();
+
                PixelBufferReadOffset = 0;
                while(PixelBufferReadOffset != PixelBufferCount32)
                {
@@ -639,6 +1054,8 @@ void MDEC_Run(int32 clocks)
             IDCTMIndex = 0;
             InCounter = 0x20;
 
+            SyncDecodeThread();
+
             InCounter--;
             do
             {
@@ -649,7 +1066,7 @@ void MDEC_Run(int32 clocks)
 
                for(unsigned i = 0; i < 2; i++)
                {
-                  IDCTMatrix[((IDCTMIndex & 0x7) << 3) | ((IDCTMIndex >> 3) & 0x7)] = (int16)(tfr & 0xFFFF) >> 3;
+                  SetIDCTMatrix(((IDCTMIndex & 0x7) << 3) | ((IDCTMIndex >> 3) & 0x7), (int16)(tfr & 0xFFFF) >> 3);
                   IDCTMIndex = (IDCTMIndex + 1) & 0x3F;
 
                   tfr >>= 16;
@@ -726,6 +1143,7 @@ void MDEC_Write(const int32_t timestamp, uint32 A, uint32 V)
          InCommand = false;
 
          PixelBufferCount32 = 0;
+         PixelBufferPending = false;
          ClockCounter = 0;
          QMIndex = 0;
          IDCTMIndex = 0;
@@ -16,4 +16,6 @@ void MDEC_Run(int32 clocks);
 
 int MDEC_StateAction(StateMem *sm, int load, int data_only);
 
+void MDEC_EnableDecodeThread(bool enable);
+
 #endif
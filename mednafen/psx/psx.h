@@ -64,21 +64,28 @@ void ForceEventUpdates(const int32_t timestamp);
 
 enum
 {
-   PSX_EVENT__SYNFIRST = 0,
-   PSX_EVENT_GPU,
+   PSX_EVENT_GPU = 0,
    PSX_EVENT_CDC,
    //PSX_EVENT_SPU,
    PSX_EVENT_TIMER,
    PSX_EVENT_DMA,
    PSX_EVENT_FIO,
-   PSX_EVENT__SYNLAST,
    PSX_EVENT__COUNT
 };
 
 #define PSX_EVENT_MAXTS       		0x20000000
+
+// Called when an event comes due, with the time it was scheduled for, and
+// returns the time of the next one.
+typedef int32_t (*PSX_EventHandlerFunc)(const int32_t timestamp);
+
+void PSX_RegisterEvent(const int type, PSX_EventHandlerFunc handler);
+
+// (Re)schedules an event, in O(log n). PSX_EVENT_MAXTS cancels it.
 void PSX_SetEventNT(const int type, const int32_t next_timestamp);
 
 void PSX_SetDMACycleSteal(unsigned stealage);
+extern unsigned DMACycleSteal;
 
 void PSX_GPULineHook(const int32_t timestamp, const int32_t line_timestamp, bool vsync, uint32_t *pixels, const MDFN_PixelFormat* const format, const unsigned width, const unsigned pix_clock_offset, const unsigned pix_clock, const unsigned pix_clock_divide);
 
@@ -99,5 +106,6 @@ extern PS_GPU *GPU;
 extern PS_CDC *CDC;
 extern PS_SPU *SPU;
 extern MultiAccessSizeMem<2048 * 1024, uint32_t, false> MainRAM;
+extern StateDirtyMap MainRAMDirty;
 
 #endif
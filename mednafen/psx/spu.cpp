@@ -71,6 +71,11 @@
 #include "spu.h"
 #include "../../libretro.h"
 
+#if defined(__SSE2__)
+#include <xmmintrin.h>
+#include <emmintrin.h>
+#endif
+
 uint32_t IntermediateBufferPos;
 int16_t IntermediateBuffer[4096][2];
 
@@ -85,7 +90,7 @@ static const int16 FIR_Table[256][4] =
 #include "spu_fir_table.inc"
 };
 
-PS_SPU::PS_SPU()
+PS_SPU::PS_SPU() : SPURAMDirty(sizeof(SPURAM), 12)
 {
    IntermediateBufferPos = 0;
    memset(IntermediateBuffer, 0, sizeof(IntermediateBuffer));
@@ -101,6 +106,7 @@ void PS_SPU::Power(void)
    clock_divider = 768;
 
    memset(SPURAM, 0, sizeof(SPURAM));
+   SPURAMDirty.MarkAll();
 
    for(int i = 0; i < 24; i++)
    {
@@ -560,6 +566,7 @@ INLINE void PS_SPU::WriteSPURAM(uint32 addr, uint16 value)
 {
    CheckIRQAddr(addr);
 
+   SPURAMDirty.Mark(addr << 1);
    SPURAM[addr] = value;
 }
 
@@ -778,6 +785,131 @@ INLINE void PS_SPU::RunNoise(void)
    }
 }
 
+// Gaussian interpolation of a voice's decoded samples at its current phase.
+static INLINE int32 InterpolateVoice(const SPU_Voice *voice)
+{
+   const int si = voice->DecodeReadPos;
+   const int pi = ((voice->CurPhase & 0xFFF) >> 4);
+
+   return ((voice->DecodeBuffer[(si + 0) & 0x1F] * FIR_Table[pi][0]) +
+         (voice->DecodeBuffer[(si + 1) & 0x1F] * FIR_Table[pi][1]) +
+         (voice->DecodeBuffer[(si + 2) & 0x1F] * FIR_Table[pi][2]) +
+         (voice->DecodeBuffer[(si + 3) & 0x1F] * FIR_Table[pi][3])) >> 15;
+}
+
+// Output of one voice after enveloping.
+INLINE int32 PS_SPU::CalcVoiceSample(unsigned voice_num)
+{
+   const SPU_Voice *voice = &Voices[voice_num];
+   int32 voice_pvs;
+
+   if(Noise_Mode & (1 << voice_num))
+      voice_pvs = (int16)LFSR;
+   else
+      voice_pvs = InterpolateVoice(voice);
+
+   return (voice_pvs * (int16)voice->ADSR.EnvLevel) >> 15;
+}
+
+// Whether a voice about to decode may read from where voices 1 and 3 are
+// captured to(0x800-0xFFF in bytes).
+static INLINE bool ReadsCaptureArea(const SPU_Voice *voice)
+{
+   return (uint32)(voice->CurAddr - 0x3FF) < 0x401 || (uint32)((voice->LoopAddr & ~0x7) - 0x3FF) < 0x401;
+}
+
+#if defined(__SSE2__)
+// Gaussian interpolation of two voices; 32-bit sums of tap pairs.
+static INLINE __m128i InterpolateVoicePair_SSE2(const SPU_Voice *voices)
+{
+   __m128i taps[2], coefs[2];
+
+   for(unsigned i = 0; i < 2; i++)
+   {
+      const SPU_Voice *voice = &voices[i];
+      const unsigned si = voice->DecodeReadPos;
+      const unsigned pi = ((voice->CurPhase & 0xFFF) >> 4);
+
+      if(si <= 0x1C)
+         taps[i] = _mm_loadl_epi64((const __m128i *)&voice->DecodeBuffer[si]);
+      else
+         taps[i] = _mm_setr_epi16(voice->DecodeBuffer[si], voice->DecodeBuffer[(si + 1) & 0x1F], voice->DecodeBuffer[(si + 2) & 0x1F], voice->DecodeBuffer[(si + 3) & 0x1F], 0, 0, 0, 0);
+
+      coefs[i] = _mm_loadl_epi64((const __m128i *)FIR_Table[pi]);
+   }
+
+   return _mm_madd_epi16(_mm_unpacklo_epi64(taps[0], taps[1]), _mm_unpacklo_epi64(coefs[0], coefs[1]));
+}
+
+// Gaussian interpolation of all 24 voices, eight at a time.  The sum of the
+// absolute values of any row of FIR_Table is under 0x8000, so the results
+// fit in 16 bits and saturating them changes nothing.
+static INLINE void InterpolateVoices_SSE2(const SPU_Voice *voices, int16 *out)
+{
+   for(unsigned voice_num = 0; voice_num < 24; voice_num += 8)
+   {
+      const SPU_Voice *v = &voices[voice_num];
+      const __m128 m01 = _mm_castsi128_ps(InterpolateVoicePair_SSE2(&v[0]));
+      const __m128 m23 = _mm_castsi128_ps(InterpolateVoicePair_SSE2(&v[2]));
+      const __m128 m45 = _mm_castsi128_ps(InterpolateVoicePair_SSE2(&v[4]));
+      const __m128 m67 = _mm_castsi128_ps(InterpolateVoicePair_SSE2(&v[6]));
+      const __m128i lo = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(m01, m23, _MM_SHUFFLE(2, 0, 2, 0))),
+            _mm_castps_si128(_mm_shuffle_ps(m01, m23, _MM_SHUFFLE(3, 1, 3, 1))));
+      const __m128i hi = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(m45, m67, _MM_SHUFFLE(2, 0, 2, 0))),
+            _mm_castps_si128(_mm_shuffle_ps(m45, m67, _MM_SHUFFLE(3, 1, 3, 1))));
+
+      _mm_storeu_si128((__m128i *)&out[voice_num], _mm_packs_epi32(_mm_srai_epi32(lo, 15), _mm_srai_epi32(hi, 15)));
+   }
+}
+
+// Full 32-bit products of eight pairs of 16-bit values.
+static INLINE void Mul16_SSE2(__m128i a, __m128i b, __m128i *lo, __m128i *hi)
+{
+   const __m128i pl = _mm_mullo_epi16(a, b);
+   const __m128i ph = _mm_mulhi_epi16(a, b);
+
+   *lo = _mm_unpacklo_epi16(pl, ph);
+   *hi = _mm_unpackhi_epi16(pl, ph);
+}
+
+// voice * volume >> 15, where voice is a 32-bit enveloped sample.  That is
+// 0x8000 only for -0x8000 * -0x8000; it's saturated to 0x7FFF for the 16-bit
+// multiply, and the missing 1 * volume added back in.
+static INLINE __m128i ApplyVolume_SSE2(__m128i pvs, __m128i pvs16, __m128i vol, bool high)
+{
+   const __m128i vol32 = _mm_srai_epi32(high ? _mm_unpackhi_epi16(vol, vol) : _mm_unpacklo_epi16(vol, vol), 16);
+   const __m128i carry = _mm_and_si128(_mm_cmpeq_epi32(pvs, _mm_set1_epi32(0x8000)), vol32);
+   __m128i lo, hi;
+
+   Mul16_SSE2(pvs16, vol, &lo, &hi);
+
+   return _mm_srai_epi32(_mm_add_epi32(high ? hi : lo, carry), 15);
+}
+
+// Enveloping and L/R volume of all 24 voices, eight at a time.
+static INLINE void MixVoices_SSE2(const int16 *in, const int16 *env, const int16 *vol_l, const int16 *vol_r, int32 *pvs_out, int32 *l_out, int32 *r_out)
+{
+   for(unsigned voice_num = 0; voice_num < 24; voice_num += 8)
+   {
+      const __m128i vl = _mm_loadu_si128((const __m128i *)&vol_l[voice_num]);
+      const __m128i vr = _mm_loadu_si128((const __m128i *)&vol_r[voice_num]);
+      __m128i lo, hi, pvs16;
+
+      Mul16_SSE2(_mm_loadu_si128((const __m128i *)&in[voice_num]), _mm_loadu_si128((const __m128i *)&env[voice_num]), &lo, &hi);
+      lo = _mm_srai_epi32(lo, 15);
+      hi = _mm_srai_epi32(hi, 15);
+      pvs16 = _mm_packs_epi32(lo, hi);
+
+      _mm_storeu_si128((__m128i *)&pvs_out[voice_num + 0], lo);
+      _mm_storeu_si128((__m128i *)&pvs_out[voice_num + 4], hi);
+      _mm_storeu_si128((__m128i *)&l_out[voice_num + 0], ApplyVolume_SSE2(lo, pvs16, vl, false));
+      _mm_storeu_si128((__m128i *)&l_out[voice_num + 4], ApplyVolume_SSE2(hi, pvs16, vl, true));
+      _mm_storeu_si128((__m128i *)&r_out[voice_num + 0], ApplyVolume_SSE2(lo, pvs16, vr, false));
+      _mm_storeu_si128((__m128i *)&r_out[voice_num + 4], ApplyVolume_SSE2(hi, pvs16, vr, true));
+   }
+}
+#endif
+
 int32 PS_SPU::UpdateFromCDC(int32 clocks)
 {
    //int32 clocks = timestamp - lastts;
@@ -841,53 +973,88 @@ int32 PS_SPU::UpdateFromCDC(int32 clocks)
       if(Regs[0xD6] == 0x4)	// TODO: Investigate more(case 0x2C in global regs r/w handler)
          SPUStatus |= (CWA & 0x100) ? 0x800 : 0x000;
 
+      //
+      // Decode new samples if necessary, then interpolate all voices at once.
+      // Voices 1 and 3 are captured to SPU RAM after that, unless a later
+      // voice is about to decode from the capture area, in which case the
+      // capture write goes out first, as it would have in voice order.
+      //
+      unsigned captured = 0;	// Bit 0 = voice 1, bit 1 = voice 3
+
       for(int voice_num = 0; voice_num < 24; voice_num++)
       {
          SPU_Voice *voice = &Voices[voice_num];
-         int32 voice_pvs;
-
-         voice->PreLRSample = 0;
 
          //PSX_WARNING("[SPU] Voice %d CurPhase=%08x, pitch=%04x, CurAddr=%08x", voice_num, voice->CurPhase, voice->Pitch, voice->CurAddr);
 
-         //
-         // Decode new samples if necessary.
-         //
-         RunDecoder(voice);
+         if(voice->DecodeAvail < 11)
+         {
+            if(voice_num > 1 && captured != 3 && ReadsCaptureArea(voice))
+            {
+               if(!(captured & 1))
+               {
+                  WriteSPURAM(0x400 | CWA, CalcVoiceSample(1));
+                  captured |= 1;
+               }
 
+               if(voice_num > 3 && !(captured & 2))
+               {
+                  WriteSPURAM(0x600 | CWA, CalcVoiceSample(3));
+                  captured |= 2;
+               }
+            }
 
-         //
-         //
-         //
-         int l, r;
+            RunDecoder(voice);
+         }
+         else if(SPUControl & 0x40)	// Only to check for an IRQ.
+            RunDecoder(voice);
+      }
 
-         if(Noise_Mode & (1 << voice_num))
-            voice_pvs = (int16)LFSR;
-         else
+#if defined(__SSE2__)
+      int32 mixed_pvs[24], mixed[2][24];
+
+      {
+         int16 interp[24], env[24], vol[2][24];
+
+         InterpolateVoices_SSE2(Voices, interp);
+
+         for(int voice_num = 0; voice_num < 24; voice_num++)
          {
-            const int si = voice->DecodeReadPos;
-            const int pi = ((voice->CurPhase & 0xFFF) >> 4);
+            SPU_Voice *voice = &Voices[voice_num];
 
-            voice_pvs = ((voice->DecodeBuffer[(si + 0) & 0x1F] * FIR_Table[pi][0]) +
-                  (voice->DecodeBuffer[(si + 1) & 0x1F] * FIR_Table[pi][1]) +
-                  (voice->DecodeBuffer[(si + 2) & 0x1F] * FIR_Table[pi][2]) +   
-                  (voice->DecodeBuffer[(si + 3) & 0x1F] * FIR_Table[pi][3])) >> 15;
+            if(Noise_Mode & (1 << voice_num))
+               interp[voice_num] = (int16)LFSR;
+
+            env[voice_num] = (int16)voice->ADSR.EnvLevel;
+            vol[0][voice_num] = voice->Sweep[0].ReadVolume();
+            vol[1][voice_num] = voice->Sweep[1].ReadVolume();
          }
 
-         voice_pvs = (voice_pvs * (int16)voice->ADSR.EnvLevel) >> 15;
+         MixVoices_SSE2(interp, env, vol[0], vol[1], mixed_pvs, mixed[0], mixed[1]);
+      }
+#endif
+
+      for(int voice_num = 0; voice_num < 24; voice_num++)
+      {
+         SPU_Voice *voice = &Voices[voice_num];
+#if defined(__SSE2__)
+         const int32 voice_pvs = mixed_pvs[voice_num];
+         const int32 l = mixed[0][voice_num];
+         const int32 r = mixed[1][voice_num];
+#else
+         const int32 voice_pvs = CalcVoiceSample(voice_num);
+         const int32 l = (voice_pvs * voice->Sweep[0].ReadVolume()) >> 15;
+         const int32 r = (voice_pvs * voice->Sweep[1].ReadVolume()) >> 15;
+#endif
+
          voice->PreLRSample = voice_pvs;
 
          if(voice_num == 1 || voice_num == 3)
          {
-            int index = voice_num >> 1;
-
-            WriteSPURAM(0x400 | (index * 0x200) | CWA, voice_pvs);
+            if(!(captured & (voice_num >> 1 ? 2 : 1)))
+               WriteSPURAM(0x400 | ((voice_num >> 1) * 0x200) | CWA, voice_pvs);
          }
 
-
-         l = (voice_pvs * voice->Sweep[0].ReadVolume()) >> 15;
-         r = (voice_pvs * voice->Sweep[1].ReadVolume()) >> 15;
-
          accum[0] += l;
          accum[1] += r;
 
@@ -1456,7 +1623,7 @@ int PS_SPU::StateAction(StateMem *sm, int load, int data_only)
 
       SFVAR(clock_divider),
 
-      SFARRAY16(SPURAM, 524288 / sizeof(uint16)),
+      SFARRAY16DIRTYN(SPURAM, 524288 / sizeof(uint16), "SPURAM", SPURAMDirty),
       SFEND
    };
 #undef SFSWEEP
@@ -1487,6 +1654,7 @@ uint16 PS_SPU::PeekSPURAM(uint32 address)
 
 void PS_SPU::PokeSPURAM(uint32 address, uint16 value)
 {
+   SPURAMDirty.Mark((address & 0x3FFFF) << 1);
    SPURAM[address & 0x3FFFF] = value;
 }
 
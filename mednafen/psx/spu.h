@@ -125,6 +125,8 @@ class PS_SPU
       void ReleaseEnvelope(SPU_Voice *voice);
       void RunEnvelope(SPU_Voice *voice);
 
+      int32 CalcVoiceSample(unsigned voice_num);
+
 
       void RunReverb(const int32* in, int32* out);
       void RunNoise(void);
@@ -238,6 +240,8 @@ class PS_SPU
       int32_t clock_divider;
 
       uint16_t SPURAM[524288 / sizeof(uint16)];
+      // 4KiB pages of SPURAM written since the last delta base state
+      StateDirtyMap SPURAMDirty;
 
       int last_rate;
       uint32_t last_quality;
@@ -33,6 +33,7 @@ uint32_t setting_psx_multitap_port_1 = 0;
 uint32_t setting_psx_multitap_port_2 = 0;
 uint32_t setting_psx_analog_toggle = 0;
 uint32_t setting_psx_fastboot = 1;
+uint32_t setting_pbp_cache_blocks = 16;
 
 extern char retro_cd_base_name[4096];
 extern char retro_save_directory[4096];
@@ -47,6 +48,8 @@ uint64_t MDFN_GetSettingUI(const char *name)
 {
    if (!strcmp("psx.spu.resamp_quality", name)) /* make configurable */
       return 4;
+   if (!strcmp("cdrom.pbp_cache_blocks", name))
+      return setting_pbp_cache_blocks;
 
    fprintf(stderr, "unhandled setting UI: %s\n", name);
    return 0;
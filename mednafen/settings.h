@@ -7,6 +7,7 @@ extern uint32_t setting_psx_multitap_port_1;
 extern uint32_t setting_psx_multitap_port_2;
 extern uint32_t setting_psx_analog_toggle;
 extern uint32_t setting_psx_fastboot;
+extern uint32_t setting_pbp_cache_blocks;
 extern int setting_initial_scanline;
 extern int setting_initial_scanline_pal;
 extern int setting_last_scanline;
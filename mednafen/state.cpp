@@ -15,17 +15,28 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#include "mednafen.h"
+
 #include <string.h>
+#include <time.h>
 
-#include <map>
+#include <vector>
+#include <list>
+#include <algorithm>
+
+#include <zlib.h>
+#include <rthreads/rthreads.h>
 
-#include "mednafen.h"
 #include "driver.h"
 #include "general.h"
 #include "state.h"
 #include "video.h"
 #include <compat/msvc.h>
 
+#include "../libretro.h"
+
+extern retro_log_printf_t log_cb;
+
 #define RLSB 		MDFNSTATE_RLSB	//0x80000000
 
 int32_t smem_read(StateMem *st, void *buffer, uint32_t len)
@@ -41,6 +52,16 @@ int32_t smem_read(StateMem *st, void *buffer, uint32_t len)
 
 int32_t smem_write(StateMem *st, void *buffer, uint32_t len)
 {
+   if ((len + st->loc) > st->malloced && st->fixed)
+   {
+      st->loc += len;
+
+      if (st->loc > st->len)
+         st->len = st->loc;
+
+      return(0);
+   }
+
    if ((len + st->loc) > st->malloced)
    {
       uint32_t newsize = (st->malloced >= 32768) ? st->malloced : (st->initial_malloc ? st->initial_malloc : 32768);
@@ -118,332 +139,881 @@ int smem_read32le(StateMem *st, uint32_t *b)
    return(4);
 }
 
-static bool SubWrite(StateMem *st, SFORMAT *sf, const char *name_prefix = NULL)
+// All live dirty maps, so MDFNSS_SaveDeltaSM() can tell how much changed.
+static std::vector<StateDirtyMap *> &DirtyMaps(void)
 {
-   while(sf->size || sf->name)	// Size can sometimes be zero, so also check for the text name.  These two should both be zero only at the end of a struct.
-   {
-      if(!sf->size || !sf->v)
-      {
-         sf++;
-         continue;
-      }
+   static std::vector<StateDirtyMap *> maps;
+   return maps;
+}
 
-      if(sf->size == (uint32_t)~0)		/* Link to another struct.	*/
-      {
-         if(!SubWrite(st, (SFORMAT *)sf->v, name_prefix))
-            return(0);
+// A delta base that is no longer the current one, deflated. Older deltas
+// may still refer to it, e.g. when rewinding past a rebase.
+struct StateRetiredBase
+{
+   uint32_t id;
+   std::vector<StateDirtyMap *> maps;
+   std::vector<std::vector<uint8_t> > packed; // Contents of each of maps
+   uint32_t bytes;
+};
 
-         sf++;
-         continue;
-      }
+struct StateDeltaContext
+{
+   uint32_t current;                       // Base the dirty maps are relative to: the latest one, or the
+                                           // one of the last delta state loaded. 0 until the first.
+   std::list<StateRetiredBase> retired;    // Least recently used first
+   uint32_t retired_bytes;
+};
+
+static StateDeltaContext DeltaContexts[MDFNSS_CONTEXTS];
+
+// ID of the latest base state, of any context.
+static uint32_t DeltaNewID = 0;
+
+StateDirtyMap::StateDirtyMap(uint32_t size, unsigned page_shift)
+{
+   assert(!(size & ((1 << page_shift) - 1)));
 
-      int32_t bytesize = sf->size;
+   this->size       = size;
+   this->page_shift = page_shift;
+   this->page_count = size >> page_shift;
+   this->pages      = (uint8_t *)calloc(page_count, 1);
+   this->loaded     = (uint8_t *)calloc(page_count, 1);
+   this->untracked  = NULL;
 
-      char nameo[1 + 256];
-      int slen;
+   for(unsigned c = 0; c < MDFNSS_CONTEXTS; c++)
+   {
+      this->changed[c] = (uint8_t *)calloc(page_count, 1);
+      this->base[c]    = NULL;
+      this->base_id[c] = 0;
+   }
+
+   DirtyMaps().push_back(this);
+}
 
-      slen = snprintf(nameo + 1, 256, "%s%s", name_prefix ? name_prefix : "", sf->name);
-      nameo[0] = slen;
+StateDirtyMap::~StateDirtyMap()
+{
+   std::vector<StateDirtyMap *> &maps = DirtyMaps();
 
-      if(slen >= 255)
+   for(std::vector<StateDirtyMap *>::iterator it = maps.begin(); it != maps.end(); it++)
+   {
+      if(*it == this)
       {
-         printf("Warning:  state variable name possibly too long: %s %s %s %d\n", sf->name, name_prefix, nameo, slen);
-         slen = 255;
+         maps.erase(it);
+         break;
       }
+   }
 
-      smem_write(st, nameo, 1 + nameo[0]);
-      smem_write32le(st, bytesize);
+   free(pages);
+   free(loaded);
 
-#ifdef MSB_FIRST
-      /* Flip the byte order... */
-      if(sf->flags & MDFNSTATE_BOOL)
-      {
+   for(unsigned c = 0; c < MDFNSS_CONTEXTS; c++)
+   {
+      std::list<StateRetiredBase> &retired = DeltaContexts[c].retired;
 
-      }
-      else if(sf->flags & MDFNSTATE_RLSB64)
-         Endian_A64_NE_to_LE(sf->v, bytesize / sizeof(uint64_t));
-      else if(sf->flags & MDFNSTATE_RLSB32)
-         Endian_A32_NE_to_LE(sf->v, bytesize / sizeof(uint32_t));
-      else if(sf->flags & MDFNSTATE_RLSB16)
-         Endian_A16_NE_to_LE(sf->v, bytesize / sizeof(uint16_t));
-      else if(sf->flags & RLSB)
-         Endian_V_NE_to_LE(sf->v, bytesize);
-#endif
+      free(changed[c]);
+      free(base[c]);
 
-      // Special case for the evil bool type, to convert bool to 1-byte elements.
-      // Don't do it if we're only saving the raw data.
-      if(sf->flags & MDFNSTATE_BOOL)
+      for(std::list<StateRetiredBase>::iterator it = retired.begin(); it != retired.end(); it++)
       {
-         for(int32_t bool_monster = 0; bool_monster < bytesize; bool_monster++)
+         for(size_t i = 0; i < it->maps.size(); i++)
          {
-            uint8_t tmp_bool = ((bool *)sf->v)[bool_monster];
-            //printf("Bool write: %.31s\n", sf->name);
-            smem_write(st, &tmp_bool, 1);
+            if(it->maps[i] == this)
+            {
+               it->maps[i] = NULL;
+               std::vector<uint8_t>().swap(it->packed[i]);
+            }
          }
       }
-      else
-         smem_write(st, (uint8_t *)sf->v, bytesize);
+   }
+}
 
-#ifdef MSB_FIRST
-      /* Now restore the original byte order. */
-      if(sf->flags & MDFNSTATE_BOOL)
+void StateDirtyMap::MarkAll(void)
+{
+   memset(pages, 1, page_count);
+}
+
+// Hands the pages marked since the last call on to every context.
+static void CollectDirtyPages(void)
+{
+   std::vector<StateDirtyMap *> &maps = DirtyMaps();
+
+   for(std::vector<StateDirtyMap *>::iterator it = maps.begin(); it != maps.end(); it++)
+   {
+      StateDirtyMap *m = *it;
+
+      for(uint32_t p = 0; p < m->page_count; p++)
       {
+         if(!m->pages[p])
+            continue;
+
+         for(unsigned c = 0; c < MDFNSS_CONTEXTS; c++)
+            m->changed[c][p] = 1;
 
+         m->pages[p] = 0;
       }
-      else if(sf->flags & MDFNSTATE_RLSB64)
-         Endian_A64_LE_to_NE(sf->v, bytesize / sizeof(uint64_t));
-      else if(sf->flags & MDFNSTATE_RLSB32)
-         Endian_A32_LE_to_NE(sf->v, bytesize / sizeof(uint32_t));
-      else if(sf->flags & MDFNSTATE_RLSB16)
-         Endian_A16_LE_to_NE(sf->v, bytesize / sizeof(uint16_t));
-      else if(sf->flags & RLSB)
-         Endian_V_LE_to_NE(sf->v, bytesize);
-#endif
-      sf++; 
    }
-
-   return(TRUE);
 }
 
-static int WriteStateChunk(StateMem *st, const char *sname, SFORMAT *sf)
+// Copies the current contents of a tracked array into the base state being
+// saved.
+static void RebaseDirtyMap(StateDirtyMap *m, const uint8_t *data, unsigned c)
 {
-   int32_t data_start_pos;
-   int32_t end_pos;
-
-   uint8_t sname_tmp[32];
-
-   memset(sname_tmp, 0, sizeof(sname_tmp));
-   strncpy((char *)sname_tmp, sname, 32);
+   const StateDeltaContext *ctx = &DeltaContexts[c];
+   const uint32_t page_size     = 1 << m->page_shift;
 
-   if(strlen(sname) > 32)
-      printf("Warning: section name is too long: %s\n", sname);
+   if(m->base[c] && ctx->current && m->base_id[c] == ctx->current)
+   {
+      // Only the pages written since the previous base can differ from it.
+      for(uint32_t p = 0; p < m->page_count; p++)
+      {
+         if(m->changed[c][p])
+            memcpy(m->base[c] + (p << m->page_shift), data + (p << m->page_shift), page_size);
+      }
+   }
+   else
+   {
+      if(!m->base[c])
+         m->base[c] = (uint8_t *)malloc(m->size);
 
-   smem_write(st, sname_tmp, 32);
+      memcpy(m->base[c], data, m->size);
+   }
 
-   smem_write32le(st, 0);                // We'll come back and write this later.
+   memset(m->changed[c], 0, m->page_count);
+   m->base_id[c] = DeltaNewID;
+}
 
-   data_start_pos = smem_tell(st);
+// Whether m->base[c] holds the context's current base.
+static INLINE bool HasCurrentBase(const StateDirtyMap *m, unsigned c)
+{
+   return(m->base[c] && DeltaContexts[c].current && m->base_id[c] == DeltaContexts[c].current);
+}
 
-   if(!SubWrite(st, sf))
-      return(0);
+// Arrays that are also written behind Mark()'s back (e.g. by cheats) get
+// their clean pages compared against the base, to catch those writes.
+static void CheckUntracked(StateDirtyMap *m, unsigned c)
+{
+   if(!m->untracked || !HasCurrentBase(m, c))
+      return;
 
-   end_pos = smem_tell(st);
+   for(uint32_t p = 0; p < m->page_count; p++)
+   {
+      if(!m->changed[c][p])
+         m->changed[c][p] = memcmp(m->untracked + (p << m->page_shift), m->base[c] + (p << m->page_shift), 1 << m->page_shift) != 0;
+   }
+}
 
-   smem_seek(st, data_start_pos - 4, SEEK_SET);
-   smem_write32le(st, end_pos - data_start_pos);
-   smem_seek(st, end_pos, SEEK_SET);
+// Drops the least recently used retired bases until the context is within
+// MDFNSS_DELTA_BASE_MEMORY again.
+static void TrimRetiredBases(StateDeltaContext *ctx)
+{
+   while(ctx->retired_bytes > MDFNSS_DELTA_BASE_MEMORY && !ctx->retired.empty())
+   {
+      log_cb(RETRO_LOG_WARN, "Dropping delta base state %u, delta states made on it can't be loaded anymore.\n",
+            ctx->retired.front().id);
 
-   return(end_pos - data_start_pos);
+      ctx->retired_bytes -= ctx->retired.front().bytes;
+      ctx->retired.pop_front();
+   }
 }
 
-struct compare_cstr
+// Keeps a deflated copy of the context's current base before the dirty maps
+// move on to another one, unless there is one already.
+static void RetireCurrentBase(unsigned c)
 {
-   bool operator()(const char *s1, const char *s2) const
+   StateDeltaContext *ctx = &DeltaContexts[c];
+   std::vector<StateDirtyMap *> &maps = DirtyMaps();
+
+   // Run-ahead only ever goes back to its last snapshot.
+   if(c != MDFNSS_CONTEXT_FRONTEND || !ctx->current)
+      return;
+
+   for(std::list<StateRetiredBase>::iterator it = ctx->retired.begin(); it != ctx->retired.end(); it++)
    {
-      return(strcmp(s1, s2) < 0);
+      if(it->id == ctx->current)
+         return;
    }
-};
 
-typedef std::map<const char *, SFORMAT *, compare_cstr> SFMap_t;
+   ctx->retired.push_back(StateRetiredBase());
 
-static void MakeSFMap(SFORMAT *sf, SFMap_t &sfmap)
-{
-   while(sf->size || sf->name) // Size can sometimes be zero, so also check for the text name.  These two should both be zero only at the end of a struct.
+   StateRetiredBase &r = ctx->retired.back();
+
+   r.id    = ctx->current;
+   r.bytes = 0;
+
+   for(std::vector<StateDirtyMap *>::iterator it = maps.begin(); it != maps.end(); it++)
    {
-      if(!sf->size || !sf->v)
-      {
-         sf++;
+      StateDirtyMap *m = *it;
+      uLongf len;
+
+      if(!HasCurrentBase(m, c))
          continue;
-      }
 
-      if(sf->size == (uint32_t)~0)            /* Link to another SFORMAT structure. */
-         MakeSFMap((SFORMAT *)sf->v, sfmap);
-      else
-      {
-         assert(sf->name);
+      r.maps.push_back(m);
+      r.packed.push_back(std::vector<uint8_t>(compressBound(m->size)));
 
-         if(sfmap.find(sf->name) != sfmap.end())
-            printf("Duplicate save state variable in internal emulator structures(CLUB THE PROGRAMMERS WITH BREADSTICKS): %s\n", sf->name);
+      len = r.packed.back().size();
 
-         sfmap[sf->name] = sf;
+      if(compress2(&r.packed.back()[0], &len, m->base[c], m->size, Z_BEST_SPEED) != Z_OK)
+      {
+         log_cb(RETRO_LOG_ERROR, "Could not keep delta base state %u.\n", r.id);
+         ctx->retired.pop_back();
+         return;
       }
 
-      sf++;
+      r.packed.back().resize(len);
+      r.bytes += len;
    }
+
+   ctx->retired_bytes += r.bytes;
+   TrimRetiredBases(ctx);
 }
 
-// Fast raw chunk reader
-static void DOReadChunk(StateMem *st, SFORMAT *sf)
+// Makes a retired base the context's current one again. Nothing is known
+// about what differs from it, so every page counts as changed.
+static bool RestoreRetiredBase(unsigned c, uint32_t id)
 {
-   while(sf->size || sf->name)       // Size can sometimes be zero, so also check for the text name.  
-      // These two should both be zero only at the end of a struct.
+   StateDeltaContext *ctx = &DeltaContexts[c];
+   std::list<StateRetiredBase>::iterator it;
+
+   for(it = ctx->retired.begin(); it != ctx->retired.end(); it++)
    {
-      if(!sf->size || !sf->v)
+      if(it->id == id)
+         break;
+   }
+
+   if(it == ctx->retired.end())
+      return(false);
+
+   RetireCurrentBase(c);
+
+   // The current base may have pushed the one being restored out.
+   for(it = ctx->retired.begin(); it != ctx->retired.end(); it++)
+   {
+      if(it->id == id)
+         break;
+   }
+
+   if(it == ctx->retired.end())
+      return(false);
+
+   for(size_t i = 0; i < it->maps.size(); i++)
+   {
+      StateDirtyMap *m = it->maps[i];
+      uLongf len;
+
+      if(!m)
+         continue;
+
+      if(!m->base[c])
+         m->base[c] = (uint8_t *)malloc(m->size);
+
+      len = m->size;
+
+      if(uncompress(m->base[c], &len, &it->packed[i][0], it->packed[i].size()) != Z_OK || len != m->size)
       {
-         sf++;
+         m->base_id[c] = 0;
          continue;
       }
 
-      if(sf->size == (uint32_t) ~0) // Link to another SFORMAT struct
+      memset(m->changed[c], 1, m->page_count);
+      m->base_id[c] = id;
+   }
+
+   ctx->current = id;
+   ctx->retired.splice(ctx->retired.end(), ctx->retired, it);
+
+   return(true);
+}
+
+// After a full state load, works out which pages differ from the base (if
+// any), so that loading e.g. the base state itself doesn't invalidate the
+// deltas built on it.
+static void CompareDirtyMap(StateDirtyMap *m, const uint8_t *data)
+{
+   for(unsigned c = 0; c < MDFNSS_CONTEXTS; c++)
+   {
+      if(!HasCurrentBase(m, c))
       {
-         DOReadChunk(st, (SFORMAT *)sf->v);
-         sf++;
+         memset(m->changed[c], 1, m->page_count);
          continue;
       }
 
-      int32_t bytesize = sf->size;
+      for(uint32_t p = 0; p < m->page_count; p++)
+         m->changed[c][p] = memcmp(data + (p << m->page_shift), m->base[c] + (p << m->page_shift), 1 << m->page_shift) != 0;
+   }
+}
 
-      // Loading raw data, bool types are stored as they appear in memory, not as single bytes in the full state format.
-      // In the SFORMAT structure, the size member for bool entries is the number of bool elements, not the total in-memory size,
-      // so we adjust it here.
-      if(sf->flags & MDFNSTATE_BOOL)
-         bytesize *= sizeof(bool);
+// In delta states, tracked arrays are saved as a page count followed by the
+// index and contents of each page changed since the base.
+static void WriteDirtyPages(StateMem *st, const StateDirtyMap *m, uint8_t *data)
+{
+   const uint8_t *changed = m->changed[st->context];
+   uint32_t count = 0;
 
-      smem_read(st, (uint8_t *)sf->v, bytesize);
-      sf++;
+   for(uint32_t p = 0; p < m->page_count; p++)
+      count += (changed[p] != 0);
+
+   smem_write32le(st, count);
+
+   for(uint32_t p = 0; p < m->page_count; p++)
+   {
+      if(!changed[p])
+         continue;
+
+      smem_write32le(st, p);
+      smem_write(st, data + (p << m->page_shift), 1 << m->page_shift);
    }
 }
 
-static int ReadStateChunk(StateMem *st, SFORMAT *sf, int size)
+// Loads a delta-encoded array in place: the pages written since the base are
+// copied back from it, then the pages saved in the state are applied.
+static bool ReadDirtyPages(StateMem *st, SFORMAT *sf)
 {
-   int temp;
+   const unsigned c             = st->context;
+   StateDirtyMap *m             = sf->dirty;
+   uint8_t *data                = (uint8_t *)sf->v;
+   uint8_t *changed             = m->changed[c];
+   const uint32_t page_size     = 1 << m->page_shift;
+   uint32_t count;
+
+   if(!HasCurrentBase(m, c) || m->size != sf->size)
+   {
+      log_cb(RETRO_LOG_ERROR, "No delta state base for: %s\n", sf->name);
+      return(false);
+   }
 
+   CheckUntracked(m, c);
+
+   for(uint32_t p = 0; p < m->page_count; p++)
    {
-      SFMap_t sfmap;
-      SFMap_t sfmap_found;	// Used for identifying variables that are missing in the save state.
+      m->loaded[p] = changed[p];
 
-      MakeSFMap(sf, sfmap);
+      if(changed[p])
+         memcpy(data + (p << m->page_shift), m->base[c] + (p << m->page_shift), page_size);
 
-      temp = smem_tell(st);
-      while(smem_tell(st) < (temp + size))
-      {
-         uint32_t recorded_size;	// In bytes
-         uint8_t toa[1 + 256];	// Don't change to char unless cast toa[0] to unsigned to smem_read() and other places.
+      changed[p] = 0;
+   }
 
-         if(smem_read(st, toa, 1) != 1)
-         {
-            puts("Unexpected EOF");
-            return(0);
-         }
+   if(smem_read32le(st, &count) != 4 || count > m->page_count)
+   {
+      log_cb(RETRO_LOG_ERROR, "Bad delta page list for: %s\n", sf->name);
+      return(false);
+   }
 
-         if(smem_read(st, toa + 1, toa[0]) != toa[0])
-         {
-            puts("Unexpected EOF?");
-            return 0;
-         }
+   for(uint32_t i = 0; i < count; i++)
+   {
+      uint32_t p;
 
-         toa[1 + toa[0]] = 0;
+      if(smem_read32le(st, &p) != 4 || p >= m->page_count ||
+            smem_read(st, data + (p << m->page_shift), page_size) != (int32_t)page_size)
+      {
+         log_cb(RETRO_LOG_ERROR, "Bad delta page for: %s\n", sf->name);
+         return(false);
+      }
 
-         smem_read32le(st, &recorded_size);
+#ifdef MSB_FIRST
+      if(sf->flags & MDFNSTATE_RLSB64)
+         Endian_A64_LE_to_NE(data + (p << m->page_shift), page_size / sizeof(uint64_t));
+      else if(sf->flags & MDFNSTATE_RLSB32)
+         Endian_A32_LE_to_NE(data + (p << m->page_shift), page_size / sizeof(uint32_t));
+      else if(sf->flags & MDFNSTATE_RLSB16)
+         Endian_A16_LE_to_NE(data + (p << m->page_shift), page_size / sizeof(uint16_t));
+#endif
 
-         SFMap_t::iterator sfmit;
+      changed[p]   = 1;
+      m->loaded[p] = 1;
+   }
 
-         sfmit = sfmap.find((char *)toa + 1);
+   // To the other contexts, whatever the load overwrote was just written.
+   for(unsigned o = 0; o < MDFNSS_CONTEXTS; o++)
+   {
+      if(o == c)
+         continue;
 
-         if(sfmit != sfmap.end())
-         {
-            SFORMAT *tmp = sfmit->second;
-            uint32_t expected_size = tmp->size;	// In bytes
+      for(uint32_t p = 0; p < m->page_count; p++)
+         m->changed[o][p] |= m->loaded[p];
+   }
 
-            if(recorded_size != expected_size)
-            {
-               printf("Variable in save state wrong size: %s.  Need: %d, got: %d\n", toa + 1, expected_size, recorded_size);
-               if(smem_seek(st, recorded_size, SEEK_CUR) < 0)
-               {
-                  puts("Seek error");
-                  return(0);
-               }
-            }
-            else
-            {
-               sfmap_found[tmp->name] = tmp;
+   return(true);
+}
 
-               smem_read(st, (uint8_t *)tmp->v, expected_size);
+// Saves the contents of one variable, little endian and with bools as
+// single bytes.
+static void WriteEntry(StateMem *st, SFORMAT *sf)
+{
+   int32_t bytesize = sf->size;
 
-               if(tmp->flags & MDFNSTATE_BOOL)
-               {
-                  // Converting downwards is necessary for the case of sizeof(bool) > 1
-                  for(int32_t bool_monster = expected_size - 1; bool_monster >= 0; bool_monster--)
-                  {
-                     ((bool *)tmp->v)[bool_monster] = ((uint8_t *)tmp->v)[bool_monster];
-                  }
-               }
 #ifdef MSB_FIRST
-               if(tmp->flags & MDFNSTATE_RLSB64)
-                  Endian_A64_LE_to_NE(tmp->v, expected_size / sizeof(uint64_t));
-               else if(tmp->flags & MDFNSTATE_RLSB32)
-                  Endian_A32_LE_to_NE(tmp->v, expected_size / sizeof(uint32_t));
-               else if(tmp->flags & MDFNSTATE_RLSB16)
-                  Endian_A16_LE_to_NE(tmp->v, expected_size / sizeof(uint16_t));
-               else if(tmp->flags & RLSB)
-                  Endian_V_LE_to_NE(tmp->v, expected_size);
+   /* Flip the byte order... */
+   if(sf->flags & MDFNSTATE_BOOL)
+   {
+
+   }
+   else if(sf->flags & MDFNSTATE_RLSB64)
+      Endian_A64_NE_to_LE(sf->v, bytesize / sizeof(uint64_t));
+   else if(sf->flags & MDFNSTATE_RLSB32)
+      Endian_A32_NE_to_LE(sf->v, bytesize / sizeof(uint32_t));
+   else if(sf->flags & MDFNSTATE_RLSB16)
+      Endian_A16_NE_to_LE(sf->v, bytesize / sizeof(uint16_t));
+   else if(sf->flags & RLSB)
+      Endian_V_NE_to_LE(sf->v, bytesize);
 #endif
-            }
-         }
-         else
-         {
-            printf("Unknown variable in save state: %s\n", toa + 1);
-            if(smem_seek(st, recorded_size, SEEK_CUR) < 0)
-            {
-               puts("Seek error");
-               return(0);
-            }
-         }
-      } // while(...)
 
-      for(SFMap_t::const_iterator it = sfmap.begin(); it != sfmap.end(); it++)
+   // Special case for the evil bool type, to convert bool to 1-byte elements.
+   if(sf->dirty && st->delta == MDFNSS_DELTA_PAGES)
+      WriteDirtyPages(st, sf->dirty, (uint8_t *)sf->v);
+   else if(sf->flags & MDFNSTATE_BOOL)
+   {
+      for(int32_t bool_monster = 0; bool_monster < bytesize; bool_monster++)
       {
-         if(sfmap_found.find(it->second->name) == sfmap_found.end())
-         {
-            printf("Variable missing from save state: %s\n", it->second->name);
-         }
+         uint8_t tmp_bool = ((bool *)sf->v)[bool_monster];
+         smem_write(st, &tmp_bool, 1);
       }
+   }
+   else
+      smem_write(st, (uint8_t *)sf->v, bytesize);
+
+#ifdef MSB_FIRST
+   /* Now restore the original byte order. */
+   if(sf->flags & MDFNSTATE_BOOL)
+   {
 
-      assert(smem_tell(st) == (temp + size));
    }
-   return 1;
-}
+   else if(sf->flags & MDFNSTATE_RLSB64)
+      Endian_A64_LE_to_NE(sf->v, bytesize / sizeof(uint64_t));
+   else if(sf->flags & MDFNSTATE_RLSB32)
+      Endian_A32_LE_to_NE(sf->v, bytesize / sizeof(uint32_t));
+   else if(sf->flags & MDFNSTATE_RLSB16)
+      Endian_A16_LE_to_NE(sf->v, bytesize / sizeof(uint16_t));
+   else if(sf->flags & RLSB)
+      Endian_V_LE_to_NE(sf->v, bytesize);
+#endif
 
-static int CurrentState = 0;
+   if(sf->dirty && st->delta == MDFNSS_DELTA_BASE)
+   {
+      assert(sf->dirty->size == sf->size);
+      RebaseDirtyMap(sf->dirty, (const uint8_t *)sf->v, st->context);
+   }
+}
 
-/* This function is called by the game driver(NES, GB, GBA) to save a state. */
-int MDFNSS_StateAction(void *st_p, int load, int data_only, std::vector <SSDescriptor> &sections)
+// Loads the contents of one variable saved by WriteEntry().
+static bool ReadEntry(StateMem *st, SFORMAT *sf)
 {
-   StateMem *st = (StateMem*)st_p;
-   std::vector<SSDescriptor>::iterator section;
+   uint32_t expected_size = sf->size;
 
-   if(load)
+   if(sf->dirty && st->delta == MDFNSS_DELTA_PAGES)
+      return(ReadDirtyPages(st, sf));
+
+   if(smem_read(st, (uint8_t *)sf->v, expected_size) != (int32_t)expected_size)
+   {
+      printf("Unexpected EOF reading: %s\n", sf->name);
+      return(false);
+   }
+
+   if(sf->flags & MDFNSTATE_BOOL)
    {
+      // Converting downwards is necessary for the case of sizeof(bool) > 1
+      for(int32_t bool_monster = expected_size - 1; bool_monster >= 0; bool_monster--)
       {
-         char sname[32];
+         ((bool *)sf->v)[bool_monster] = ((uint8_t *)sf->v)[bool_monster];
+      }
+   }
+#ifdef MSB_FIRST
+   if(sf->flags & MDFNSTATE_RLSB64)
+      Endian_A64_LE_to_NE(sf->v, expected_size / sizeof(uint64_t));
+   else if(sf->flags & MDFNSTATE_RLSB32)
+      Endian_A32_LE_to_NE(sf->v, expected_size / sizeof(uint32_t));
+   else if(sf->flags & MDFNSTATE_RLSB16)
+      Endian_A16_LE_to_NE(sf->v, expected_size / sizeof(uint16_t));
+   else if(sf->flags & RLSB)
+      Endian_V_LE_to_NE(sf->v, expected_size);
+#endif
 
-         for(section = sections.begin(); section != sections.end(); section++)
-         {
-            int found = 0;
-            uint32_t tmp_size;
-            uint32_t total = 0;
+   if(sf->dirty)
+      CompareDirtyMap(sf->dirty, (const uint8_t *)sf->v);
 
-            while(smem_read(st, (uint8_t *)sname, 32) == 32)
-            {
-               if(smem_read32le(st, &tmp_size) != 4)
-                  return(0);
+   return(true);
+}
 
-               total += tmp_size + 32 + 4;
+// In MDFNSS_FORMAT_INDEXED states, each section starts with a table of the
+// names and sizes of its variables, in the order the SFORMAT structures list
+// them, followed by the contents of all of them in that same order. A
+// signature sums up the table: when it matches the emulator's own, which is
+// always the case for states made by the same build, loading the section is
+// a plain sequence of reads into the variables and the names are never
+// looked at. Otherwise (and for the older, name-keyed states) variables are
+// matched by name through a hash of the emulator's table.
+struct StateLayout
+{
+   std::vector<SFORMAT *> entries; // Links followed, empty entries dropped
+   std::vector<int32_t> index;     // Hash of the names, -1 for free slots
+   std::vector<uint8_t> found;     // Variables loaded by a name-keyed read
+   uint32_t signature;
+   uint32_t table_size;            // Size of the name table in the state
+};
 
-               // Yay, we found the section
-               if(!strncmp(sname, section->name, 32))
-               {
-                  if(!ReadStateChunk(st, section->sf, tmp_size))
-                  {
-                     printf("Error reading chunk: %s\n", section->name);
-                     return(0);
-                  }
-                  found = 1;
-                  break;
-               } 
-               else
-               {
-                  if(smem_seek(st, tmp_size, SEEK_CUR) < 0)
+static uint32_t HashName(const char *name, uint32_t len)
+{
+   uint32_t h = 2166136261U;
+
+   for(uint32_t i = 0; i < len; i++)
+      h = (h ^ (uint8_t)name[i]) * 16777619U;
+
+   return(h);
+}
+
+static uint32_t NameLength(const char *name)
+{
+   size_t len = strlen(name);
+
+   if(len > 255)
+   {
+      printf("Warning:  state variable name possibly too long: %s %u\n", name, (unsigned)len);
+      len = 255;
+   }
+
+   return(len);
+}
+
+static void FlattenSF(SFORMAT *sf, std::vector<SFORMAT *> &entries)
+{
+   while(sf->size || sf->name) // Size can sometimes be zero, so also check for the text name.  These two should both be zero only at the end of a struct.
+   {
+      if(!sf->size || !sf->v)
+      {
+         sf++;
+         continue;
+      }
+
+      if(sf->size == (uint32_t)~0)            /* Link to another SFORMAT structure. */
+         FlattenSF((SFORMAT *)sf->v, entries);
+      else
+      {
+         assert(sf->name);
+         entries.push_back(sf);
+      }
+
+      sf++;
+   }
+}
+
+// Sections are saved and loaded one at a time, so they all share one layout.
+static StateLayout &MakeLayout(SFORMAT *sf)
+{
+   static StateLayout layout;
+
+   layout.entries.clear();
+   FlattenSF(sf, layout.entries);
+
+   layout.signature  = 2166136261U;
+   layout.table_size = 0;
+
+   for(size_t i = 0; i < layout.entries.size(); i++)
+   {
+      const SFORMAT *e = layout.entries[i];
+      const uint32_t len = NameLength(e->name);
+      const uint32_t desc[2] = { e->size, e->flags };
+
+      layout.signature = (layout.signature ^ HashName(e->name, len)) * 16777619U;
+      layout.signature = (layout.signature ^ HashName((const char *)desc, sizeof(desc))) * 16777619U;
+      layout.table_size += 1 + len + 4;
+   }
+
+   return(layout);
+}
+
+static void IndexLayout(StateLayout &layout)
+{
+   const size_t count = layout.entries.size();
+   uint32_t slots = 16;
+
+   while(slots < count * 2)
+      slots <<= 1;
+
+   layout.index.assign(slots, -1);
+   layout.found.assign(count, 0);
+
+   for(size_t i = 0; i < count; i++)
+   {
+      const char *name = layout.entries[i]->name;
+      uint32_t h = HashName(name, strlen(name)) & (slots - 1);
+
+      while(layout.index[h] >= 0)
+      {
+         if(!strcmp(layout.entries[layout.index[h]]->name, name))
+         {
+            printf("Duplicate save state variable in internal emulator structures(CLUB THE PROGRAMMERS WITH BREADSTICKS): %s\n", name);
+            break;
+         }
+
+         h = (h + 1) & (slots - 1);
+      }
+
+      layout.index[h] = i;
+   }
+}
+
+static int32_t FindLayoutEntry(const StateLayout &layout, const char *name)
+{
+   const uint32_t mask = layout.index.size() - 1;
+   uint32_t h = HashName(name, strlen(name)) & mask;
+
+   while(layout.index[h] >= 0)
+   {
+      if(!strcmp(layout.entries[layout.index[h]]->name, name))
+         return(layout.index[h]);
+
+      h = (h + 1) & mask;
+   }
+
+   return(-1);
+}
+
+static int WriteStateChunk(StateMem *st, const char *sname, SFORMAT *sf)
+{
+   int32_t data_start_pos;
+   int32_t end_pos;
+
+   uint8_t sname_tmp[32];
+
+   memset(sname_tmp, 0, sizeof(sname_tmp));
+   strncpy((char *)sname_tmp, sname, 32);
+
+   if(strlen(sname) > 32)
+      printf("Warning: section name is too long: %s\n", sname);
+
+   smem_write(st, sname_tmp, 32);
+
+   smem_write32le(st, 0);                // We'll come back and write this later.
+
+   data_start_pos = smem_tell(st);
+
+   StateLayout &layout = MakeLayout(sf);
+
+   smem_write32le(st, layout.signature);
+   smem_write32le(st, layout.table_size);
+
+   for(size_t i = 0; i < layout.entries.size(); i++)
+   {
+      SFORMAT *e = layout.entries[i];
+      uint8_t len = NameLength(e->name);
+
+      smem_write(st, &len, 1);
+      smem_write(st, (void *)e->name, len);
+      smem_write32le(st, e->size);
+   }
+
+   for(size_t i = 0; i < layout.entries.size(); i++)
+      WriteEntry(st, layout.entries[i]);
+
+   end_pos = smem_tell(st);
+
+   smem_seek(st, data_start_pos - 4, SEEK_SET);
+   smem_write32le(st, end_pos - data_start_pos);
+   smem_seek(st, end_pos, SEEK_SET);
+
+   return(end_pos - data_start_pos);
+}
+
+// Loads a variable that was found by name, or skips it.
+static bool ReadNamedEntry(StateMem *st, StateLayout &layout, const char *name, uint32_t recorded_size)
+{
+   int32_t i = FindLayoutEntry(layout, name);
+
+   if(i < 0)
+      printf("Unknown variable in save state: %s\n", name);
+   else if(recorded_size != layout.entries[i]->size)
+      printf("Variable in save state wrong size: %s.  Need: %d, got: %d\n", name, layout.entries[i]->size, recorded_size);
+   else
+   {
+      layout.found[i] = 1;
+      return(ReadEntry(st, layout.entries[i]));
+   }
+
+   if(smem_seek(st, recorded_size, SEEK_CUR) < 0)
+   {
+      puts("Seek error");
+      return(false);
+   }
+
+   return(true);
+}
+
+static void ReportMissingEntries(const StateLayout &layout)
+{
+   for(size_t i = 0; i < layout.entries.size(); i++)
+   {
+      if(!layout.found[i])
+         printf("Variable missing from save state: %s\n", layout.entries[i]->name);
+   }
+}
+
+// Old states, where each variable is saved along with its name and size.
+static bool ReadNamedChunk(StateMem *st, StateLayout &layout, int32_t end)
+{
+   IndexLayout(layout);
+
+   while(smem_tell(st) < end)
+   {
+      uint32_t recorded_size;	// In bytes
+      uint8_t toa[1 + 256];	// Don't change to char unless cast toa[0] to unsigned to smem_read() and other places.
+
+      if(smem_read(st, toa, 1) != 1)
+      {
+         puts("Unexpected EOF");
+         return(false);
+      }
+
+      if(smem_read(st, toa + 1, toa[0]) != toa[0])
+      {
+         puts("Unexpected EOF?");
+         return(false);
+      }
+
+      toa[1 + toa[0]] = 0;
+
+      smem_read32le(st, &recorded_size);
+
+      if(!ReadNamedEntry(st, layout, (char *)toa + 1, recorded_size))
+         return(false);
+   }
+
+   ReportMissingEntries(layout);
+
+   return(true);
+}
+
+// States whose name table doesn't match ours, e.g. from another build.
+static bool ReadTableChunk(StateMem *st, StateLayout &layout, uint32_t table_size)
+{
+   static std::vector<uint8_t> table;
+   uint32_t pos = 0;
+
+   table.resize(table_size + 1);
+
+   if(smem_read(st, &table[0], table_size) != (int32_t)table_size)
+   {
+      puts("Unexpected EOF");
+      return(false);
+   }
+
+   IndexLayout(layout);
+
+   while(pos < table_size)
+   {
+      const uint32_t len = table[pos];
+      char name[1 + 256];
+      uint32_t recorded_size;
+
+      if(pos + 1 + len + 4 > table_size)
+      {
+         puts("Bad variable table");
+         return(false);
+      }
+
+      memcpy(name, &table[pos + 1], len);
+      name[len] = 0;
+      recorded_size = MDFN_de32lsb(&table[pos + 1 + len]);
+      pos += 1 + len + 4;
+
+      if(!ReadNamedEntry(st, layout, name, recorded_size))
+         return(false);
+   }
+
+   ReportMissingEntries(layout);
+
+   return(true);
+}
+
+static int ReadStateChunk(StateMem *st, SFORMAT *sf, int size)
+{
+   StateLayout &layout = MakeLayout(sf);
+   const int32_t end = smem_tell(st) + size;
+   uint32_t signature;
+   uint32_t table_size;
+
+   if(st->format == MDFNSS_FORMAT_NAMED)
+   {
+      if(!ReadNamedChunk(st, layout, end))
+         return(0);
+   }
+   else if(smem_read32le(st, &signature) != 4 || smem_read32le(st, &table_size) != 4)
+   {
+      puts("Unexpected EOF");
+      return(0);
+   }
+   else if(signature == layout.signature && table_size == layout.table_size)
+   {
+      if(smem_seek(st, table_size, SEEK_CUR) < 0)
+      {
+         puts("Seek error");
+         return(0);
+      }
+
+      for(size_t i = 0; i < layout.entries.size(); i++)
+      {
+         if(!ReadEntry(st, layout.entries[i]))
+            return(0);
+      }
+   }
+   else if(st->delta == MDFNSS_DELTA_PAGES)
+   {
+      // Can't happen within one session, which is all deltas are good for
+      log_cb(RETRO_LOG_ERROR, "Delta state variables don't match.\n");
+      return(0);
+   }
+   else if(!ReadTableChunk(st, layout, table_size))
+      return(0);
+
+   if(smem_tell(st) != end)
+   {
+      puts("Section size mismatch");
+      return(0);
+   }
+
+   return 1;
+}
+
+static int CurrentState = 0;
+
+/* This function is called by the game driver(NES, GB, GBA) to save a state. */
+int MDFNSS_StateAction(void *st_p, int load, int data_only, std::vector <SSDescriptor> &sections)
+{
+   StateMem *st = (StateMem*)st_p;
+   std::vector<SSDescriptor>::iterator section;
+
+   if(load)
+   {
+      {
+         char sname[32];
+
+         for(section = sections.begin(); section != sections.end(); section++)
+         {
+            int found = 0;
+            uint32_t tmp_size;
+            uint32_t total = 0;
+
+            while(smem_read(st, (uint8_t *)sname, 32) == 32)
+            {
+               if(smem_read32le(st, &tmp_size) != 4)
+                  return(0);
+
+               total += tmp_size + 32 + 4;
+
+               // Yay, we found the section
+               if(!strncmp(sname, section->name, 32))
+               {
+                  if(!ReadStateChunk(st, section->sf, tmp_size))
+                  {
+                     printf("Error reading chunk: %s\n", section->name);
+                     return(0);
+                  }
+                  found = 1;
+                  break;
+               } 
+               else
+               {
+                  if(smem_seek(st, tmp_size, SEEK_CUR) < 0)
                   {
                      puts("Chunk seek failure");
                      return(0);
@@ -484,16 +1054,20 @@ int MDFNSS_StateAction(void *st_p, int load, int data_only, SFORMAT *sf, const c
    return(MDFNSS_StateAction(st, load, 0, love));
 }
 
-int MDFNSS_SaveSM(void *st_p, int, int, const void*, const void*, const void*)
+static int SaveSM(StateMem *st, const char *header_magic)
 {
    uint8_t header[32];
-   StateMem *st = (StateMem*)st_p;
-   static const char *header_magic = "MDFNSVST";
    int neowidth = 0, neoheight = 0;
 
    memset(header, 0, sizeof(header));
    memcpy(header, header_magic, 8);
 
+   if(st->delta == MDFNSS_DELTA_PAGES)
+   {
+      MDFN_en32lsb(header + 8, DeltaContexts[st->context].current);
+      MDFN_en32lsb(header + 12, st->context);
+   }
+
    MDFN_en32lsb(header + 16, MEDNAFEN_VERSION_NUMERIC);
    MDFN_en32lsb(header + 24, neowidth);
    MDFN_en32lsb(header + 28, neoheight);
@@ -509,6 +1083,77 @@ int MDFNSS_SaveSM(void *st_p, int, int, const void*, const void*, const void*)
    return(1);
 }
 
+int MDFNSS_SaveSM(void *st_p, int, int, const void*, const void*, const void*)
+{
+   StateMem *st = (StateMem*)st_p;
+
+   st->delta = MDFNSS_DELTA_NONE;
+
+   return(SaveSM(st, "MDFNSVIX"));
+}
+
+int MDFNSS_SaveDeltaSM(void *st_p, unsigned context)
+{
+   StateMem *st = (StateMem*)st_p;
+   StateDeltaContext *ctx = &DeltaContexts[context];
+   std::vector<StateDirtyMap *> &maps = DirtyMaps();
+   uint64_t changed = 0;
+   uint64_t total = 0;
+   bool rebase = !ctx->current;
+
+   CollectDirtyPages();
+
+   for(std::vector<StateDirtyMap *>::iterator it = maps.begin(); it != maps.end(); it++)
+   {
+      StateDirtyMap *m = *it;
+
+      CheckUntracked(m, context);
+
+      if(m->base_id[context] != ctx->current)
+         rebase = true;
+
+      for(uint32_t p = 0; p < m->page_count; p++)
+      {
+         if(m->changed[context][p])
+            changed += 1 << m->page_shift;
+      }
+
+      total += m->size;
+   }
+
+   // Past this point a delta barely beats a full state, and only keeps
+   // growing from there.
+   if(changed * 2 > total)
+      rebase = true;
+
+   st->context = context;
+
+   if(rebase)
+   {
+      int ret;
+
+      // Deltas of the base being replaced may still be loaded later on.
+      RetireCurrentBase(context);
+
+      DeltaNewID = DeltaNewID ? DeltaNewID + 1 : ((uint32_t)time(NULL) | 1);
+      st->delta  = MDFNSS_DELTA_BASE;
+
+      // Base states are plain full states to everyone else.
+      ret = SaveSM(st, "MDFNSVIX");
+
+      // A failed save may have left the base half overwritten.
+      ctx->current = ret ? DeltaNewID : 0;
+
+      return(ret);
+   }
+
+   st->delta = MDFNSS_DELTA_PAGES;
+
+   return(SaveSM(st, "MDFNSVDL"));
+}
+
+static int LoadCompressedSM(StateMem *st, const uint8_t *header);
+
 int MDFNSS_LoadSM(void *st_p, int, int)
 {
    uint8_t header[32];
@@ -517,10 +1162,470 @@ int MDFNSS_LoadSM(void *st_p, int, int)
 
    smem_read(st, header, 32);
 
-   if(memcmp(header, "MEDNAFENSVESTATE", 16) && memcmp(header, "MDFNSVST", 8))
+   st->delta  = MDFNSS_DELTA_NONE;
+   st->format = MDFNSS_FORMAT_INDEXED;
+
+   CollectDirtyPages();
+
+   if(!memcmp(header, "MDFNSVDL", 8))
+   {
+      const uint32_t base_id = MDFN_de32lsb(header + 8);
+      const uint32_t context = MDFN_de32lsb(header + 12);
+
+      if(context >= MDFNSS_CONTEXTS || !base_id ||
+            (base_id != DeltaContexts[context].current && !RestoreRetiredBase(context, base_id)))
+      {
+         log_cb(RETRO_LOG_ERROR, "Delta state's base state %u is gone, it can't be loaded.\n", base_id);
+         return(0);
+      }
+
+      // The dirty maps follow, see ReadDirtyPages()
+      st->delta   = MDFNSS_DELTA_PAGES;
+      st->context = context;
+   }
+   else if(!memcmp(header, "MDFNSVZ1", 8))
+      return(LoadCompressedSM(st, header));
+   else if(!memcmp(header, "MEDNAFENSVESTATE", 16) || !memcmp(header, "MDFNSVST", 8))
+      st->format = MDFNSS_FORMAT_NAMED;
+   else if(memcmp(header, "MDFNSVIX", 8))
       return(0);
 
    stateversion = MDFN_de32lsb(header + 16);
 
    return(MDFNGameInfo->StateAction(st, stateversion, 0));
 }
+
+// Compressed states wrap a regular (or delta) state:
+//
+//  0  "MDFNSVZ1"
+//  8  ID of the XOR keyframe the state was filtered against, 0 if none
+// 12  uncompressed size
+// 16  uncompressed size of the first half
+// 20  total size
+// 24  compressed size of the first half
+// 28  compressed size of the second half
+// 32  both halves, as separate zlib streams
+//
+// The two halves are (de)compressed at the same time, the second one on a
+// worker thread that is started by the first compressed save or load.
+//
+// With the XOR prefilter, states are XORed with the last keyframe first,
+// which leaves mostly zeroes for the deflater. Keyframes are states saved
+// unfiltered, a new one is picked when the filter stops paying off, but no
+// more than once every XorKeyInterval saves. Replaced keyframes are kept
+// as they were saved, compressed, so that the states filtered against them
+// still load, until they take more than XorKeyMemory. Like delta states,
+// filtered states can only be loaded back within the session that saved
+// them.
+
+struct StateZBlock
+{
+   z_stream z;                // Deflater, kept between saves
+   bool z_init;
+   const uint8_t *src;
+   uint32_t src_len;
+   uint8_t *dst;
+   uLongf dst_len;            // Compressed size when saving, expected size when loading
+   std::vector<uint8_t> packed;
+   bool ok;
+};
+
+struct StateXorKey
+{
+   uint32_t id;
+   std::vector<uint8_t> data;    // Uncompressed, only for the current (or last restored) keyframe
+   std::vector<uint8_t> packed;  // The keyframe as it was saved
+};
+
+static StateMem ZRaw;         // Uncompressed state, kept to avoid reallocating it
+static StateZBlock ZBlocks[2];
+static StateXorKey XorKey;                   // Current keyframe
+static StateXorKey XorLoaded;                // Replaced keyframe, last one a state was loaded against
+static std::list<StateXorKey> XorRetired;    // Replaced keyframes, least recently used first
+static uint32_t XorRetiredBytes = 0;
+static bool XorRekey = false;
+static uint32_t XorSaves = 0;   // Since the current keyframe
+enum { XorKeyInterval = 64, XorKeyMemory = 64 << 20 };
+
+static slock_t *ZMutex = NULL;
+static scond_t *ZCond = NULL;
+static sthread_t *ZThread = NULL;
+static void (*ZJob)(void *) = NULL;   // Runs on ZBlocks[1], NULL once done
+static bool ZExit;
+
+static void CompressBlock(void *data)
+{
+   StateZBlock *b = (StateZBlock *)data;
+
+   b->ok = false;
+
+   if(!b->z_init)
+   {
+      memset(&b->z, 0, sizeof(b->z));
+
+      if(deflateInit(&b->z, Z_BEST_SPEED) != Z_OK)
+         return;
+
+      b->z_init = true;
+   }
+   else
+      deflateReset(&b->z);
+
+   b->packed.resize(compressBound(b->src_len));
+   b->dst = &b->packed[0];
+
+   b->z.next_in   = (Bytef *)b->src;
+   b->z.avail_in  = b->src_len;
+   b->z.next_out  = b->dst;
+   b->z.avail_out = b->packed.size();
+
+   if(deflate(&b->z, Z_FINISH) != Z_STREAM_END)
+      return;
+
+   b->dst_len = b->z.total_out;
+   b->ok      = true;
+}
+
+static void DecompressBlock(void *data)
+{
+   StateZBlock *b = (StateZBlock *)data;
+   uLongf len     = b->dst_len;
+
+   b->ok = uncompress(b->dst, &len, b->src, b->src_len) == Z_OK && len == b->dst_len;
+}
+
+static void ZThreadEntry(void *arg)
+{
+   slock_lock(ZMutex);
+
+   for(;;)
+   {
+      void (*func)(void *);
+
+      while(!ZJob && !ZExit)
+         scond_wait(ZCond, ZMutex);
+
+      if(!ZJob)
+         break;
+
+      func = ZJob;
+      slock_unlock(ZMutex);
+
+      func(&ZBlocks[1]);
+
+      slock_lock(ZMutex);
+      ZJob = NULL;
+      scond_signal(ZCond);
+   }
+
+   slock_unlock(ZMutex);
+}
+
+static void StartZThread(void)
+{
+   ZExit  = false;
+   ZJob   = NULL;
+
+   ZMutex  = slock_new();
+   ZCond   = scond_new();
+   ZThread = sthread_create(ZThreadEntry, NULL);
+
+   if(!ZThread)
+   {
+      scond_free(ZCond);
+      slock_free(ZMutex);
+      ZCond  = NULL;
+      ZMutex = NULL;
+   }
+}
+
+static void StopZThread(void)
+{
+   if(!ZThread)
+      return;
+
+   slock_lock(ZMutex);
+   ZExit = true;
+   scond_signal(ZCond);
+   slock_unlock(ZMutex);
+
+   sthread_join(ZThread);
+   ZThread = NULL;
+
+   scond_free(ZCond);
+   slock_free(ZMutex);
+   ZCond  = NULL;
+   ZMutex = NULL;
+}
+
+static bool RunBlocks(void (*func)(void *))
+{
+   if(!ZThread)
+      StartZThread();
+
+   if(!ZThread)
+   {
+      func(&ZBlocks[0]);
+      func(&ZBlocks[1]);
+
+      return(ZBlocks[0].ok && ZBlocks[1].ok);
+   }
+
+   slock_lock(ZMutex);
+   ZJob = func;
+   scond_signal(ZCond);
+   slock_unlock(ZMutex);
+
+   func(&ZBlocks[0]);
+
+   slock_lock(ZMutex);
+   while(ZJob)
+      scond_wait(ZCond, ZMutex);
+   slock_unlock(ZMutex);
+
+   return(ZBlocks[0].ok && ZBlocks[1].ok);
+}
+
+// Inflates a compressed state, minus its header, into dst (raw_len bytes,
+// from the header).
+static bool InflateState(const uint8_t *header, const uint8_t *src, uint32_t src_len, uint8_t *dst)
+{
+   const uint32_t raw_len  = MDFN_de32lsb(header + 12);
+   const uint32_t half     = MDFN_de32lsb(header + 16);
+   const uint32_t packed_0 = MDFN_de32lsb(header + 24);
+   const uint32_t packed_1 = MDFN_de32lsb(header + 28);
+
+   if(half > raw_len || packed_0 > src_len || packed_1 > src_len - packed_0)
+      return(false);
+
+   ZBlocks[0].src     = src;
+   ZBlocks[0].src_len = packed_0;
+   ZBlocks[0].dst     = dst;
+   ZBlocks[0].dst_len = half;
+   ZBlocks[1].src     = src + packed_0;
+   ZBlocks[1].src_len = packed_1;
+   ZBlocks[1].dst     = dst + half;
+   ZBlocks[1].dst_len = raw_len - half;
+
+   return(RunBlocks(DecompressBlock));
+}
+
+// Finds the keyframe a state was filtered against, inflating it back if it
+// was replaced since.
+static const StateXorKey *FindXorKey(uint32_t id)
+{
+   std::list<StateXorKey>::iterator it;
+
+   if(XorKey.id == id)
+      return(&XorKey);
+
+   if(XorLoaded.id == id)
+      return(&XorLoaded);
+
+   for(it = XorRetired.begin(); it != XorRetired.end(); it++)
+   {
+      if(it->id == id)
+         break;
+   }
+
+   if(it == XorRetired.end())
+      return(NULL);
+
+   XorRetired.splice(XorRetired.end(), XorRetired, it);
+   XorLoaded.id = 0;
+   XorLoaded.data.resize(MDFN_de32lsb(&it->packed[12]));
+
+   if(XorLoaded.data.empty() || !InflateState(&it->packed[0], &it->packed[32], it->packed.size() - 32, &XorLoaded.data[0]))
+      return(NULL);
+
+   XorLoaded.id = id;
+
+   return(&XorLoaded);
+}
+
+// Keeps the current keyframe around before a new one replaces it.
+static void RetireXorKey(void)
+{
+   if(!XorKey.id || XorKey.packed.empty())
+      return;
+
+   XorRetired.push_back(StateXorKey());
+   XorRetired.back().id = XorKey.id;
+   XorRetired.back().packed.swap(XorKey.packed);
+   XorRetiredBytes += XorRetired.back().packed.size();
+
+   while(XorRetiredBytes > XorKeyMemory)
+   {
+      log_cb(RETRO_LOG_WARN, "Dropping XOR keyframe %u, compressed states filtered against it can't be loaded anymore.\n",
+            XorRetired.front().id);
+
+      XorRetiredBytes -= XorRetired.front().packed.size();
+      XorRetired.pop_front();
+   }
+}
+
+static void XorState(uint8_t *data, uint32_t len, const std::vector<uint8_t> &ref)
+{
+   const uint32_t n = std::min<uint32_t>(len, ref.size());
+
+   for(uint32_t i = 0; i < n; i++)
+      data[i] ^= ref[i];
+}
+
+uint32_t MDFNSS_CompressedSize(uint32_t raw_size)
+{
+   const uint32_t half = raw_size / 2;
+
+   return(32 + compressBound(half) + compressBound(raw_size - half));
+}
+
+int MDFNSS_SaveCompressedSM(void *st_p, bool delta, bool prefilter)
+{
+   StateMem *st = (StateMem*)st_p;
+   uint8_t header[32];
+   uint32_t ref_id = 0;
+   bool keyframe   = false;
+
+   ZRaw.loc = 0;
+   ZRaw.len = 0;
+
+   if(!(delta ? MDFNSS_SaveDeltaSM(&ZRaw, MDFNSS_CONTEXT_FRONTEND) : MDFNSS_SaveSM(&ZRaw, 0, 0, NULL, NULL, NULL)))
+      return(0);
+
+   st->delta = ZRaw.delta;
+
+   if(prefilter)
+   {
+      if(!XorKey.id || XorRekey)
+      {
+         const uint32_t prev_id = XorKey.id;
+
+         RetireXorKey();
+
+         XorKey.data.assign(ZRaw.data, ZRaw.data + ZRaw.len);
+         XorKey.id = prev_id ? prev_id + 1 : ((uint32_t)time(NULL) | 1);
+         XorRekey  = false;
+         XorSaves  = 0;
+         keyframe  = true;
+      }
+      else
+      {
+         ref_id = XorKey.id;
+         XorState(ZRaw.data, ZRaw.len, XorKey.data);
+      }
+   }
+
+   ZBlocks[0].src     = ZRaw.data;
+   ZBlocks[0].src_len = ZRaw.len / 2;
+   ZBlocks[1].src     = ZRaw.data + ZBlocks[0].src_len;
+   ZBlocks[1].src_len = ZRaw.len - ZBlocks[0].src_len;
+
+   if(!RunBlocks(CompressBlock))
+   {
+      log_cb(RETRO_LOG_ERROR, "State compression failed.\n");
+
+      // The keyframe was never handed out, pick another one.
+      if(keyframe)
+      {
+         XorKey.packed.clear();
+         XorRekey = true;
+      }
+      return(0);
+   }
+
+   const uint32_t packed = 32 + ZBlocks[0].dst_len + ZBlocks[1].dst_len;
+
+   if(prefilter && ref_id && ++XorSaves >= XorKeyInterval && packed >= XorKey.packed.size())
+      XorRekey = true;   // The filter has stopped paying off
+
+   memset(header, 0, sizeof(header));
+   memcpy(header, "MDFNSVZ1", 8);
+   MDFN_en32lsb(header + 8, ref_id);
+   MDFN_en32lsb(header + 12, ZRaw.len);
+   MDFN_en32lsb(header + 16, ZBlocks[0].src_len);
+   MDFN_en32lsb(header + 20, packed);
+   MDFN_en32lsb(header + 24, ZBlocks[0].dst_len);
+   MDFN_en32lsb(header + 28, ZBlocks[1].dst_len);
+
+   smem_write(st, header, 32);
+   smem_write(st, ZBlocks[0].dst, ZBlocks[0].dst_len);
+   smem_write(st, ZBlocks[1].dst, ZBlocks[1].dst_len);
+
+   if(keyframe)
+   {
+      XorKey.packed.assign(header, header + 32);
+      XorKey.packed.insert(XorKey.packed.end(), ZBlocks[0].dst, ZBlocks[0].dst + ZBlocks[0].dst_len);
+      XorKey.packed.insert(XorKey.packed.end(), ZBlocks[1].dst, ZBlocks[1].dst + ZBlocks[1].dst_len);
+   }
+
+   return(1);
+}
+
+// The halves are inflated into ZRaw, and loaded from there. Inflating
+// straight into the state variables would save a copy, but sections are
+// found by seeking around the state (see MDFNSS_StateAction()), and the XOR
+// filter needs the whole keyframe-sized buffer anyway.
+static int LoadCompressedSM(StateMem *st, const uint8_t *header)
+{
+   const uint32_t ref_id   = MDFN_de32lsb(header + 8);
+   const uint32_t raw_len  = MDFN_de32lsb(header + 12);
+   const StateXorKey *ref  = NULL;
+   StateMem raw;
+
+   if(ref_id && !(ref = FindXorKey(ref_id)))
+   {
+      log_cb(RETRO_LOG_ERROR, "Compressed state's XOR keyframe %u is gone, it can't be loaded.\n", ref_id);
+      return(0);
+   }
+
+   if(ZRaw.malloced < raw_len)
+   {
+      ZRaw.data     = (uint8_t *)realloc(ZRaw.data, raw_len);
+      ZRaw.malloced = raw_len;
+   }
+
+   if(!InflateState(header, st->data + st->loc, st->len - st->loc, ZRaw.data))
+   {
+      log_cb(RETRO_LOG_ERROR, "Bad compressed state.\n");
+      return(0);
+   }
+
+   if(ref)
+      XorState(ZRaw.data, raw_len, ref->data);
+
+   memset(&raw, 0, sizeof(raw));
+   raw.data = ZRaw.data;
+   raw.len  = raw_len;
+
+   const int ret = MDFNSS_LoadSM(&raw, 0, 0);
+
+   st->delta = raw.delta;
+
+   return(ret);
+}
+
+void MDFNSS_CloseCompression(void)
+{
+   StopZThread();
+
+   for(unsigned i = 0; i < 2; i++)
+   {
+      if(ZBlocks[i].z_init)
+         deflateEnd(&ZBlocks[i].z);
+
+      ZBlocks[i].z_init = false;
+      std::vector<uint8_t>().swap(ZBlocks[i].packed);
+   }
+
+   free(ZRaw.data);
+   memset(&ZRaw, 0, sizeof(ZRaw));
+
+   XorKey.id = 0;
+   std::vector<uint8_t>().swap(XorKey.data);
+   std::vector<uint8_t>().swap(XorKey.packed);
+   XorLoaded.id = 0;
+   std::vector<uint8_t>().swap(XorLoaded.data);
+   XorRetired.clear();
+   XorRetiredBytes = 0;
+   XorRekey = false;
+}
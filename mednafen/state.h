@@ -8,8 +8,29 @@ typedef struct
    uint32_t len;
    uint32_t malloced;
    uint32_t initial_malloc; // A setting!
+   uint32_t delta;          // One of MDFNSS_DELTA_*
+   uint32_t format;         // One of MDFNSS_FORMAT_*, set while loading
+   uint32_t context;        // One of MDFNSS_CONTEXT_*, for delta states
+   bool fixed;              // data is a caller buffer of malloced bytes: it's never
+                            // reallocated, writes past its end are dropped but still
+                            // counted in len (so data = NULL just measures the state)
 } StateMem;
 
+// StateMem::delta values
+#define MDFNSS_DELTA_NONE         0 // Plain full state
+#define MDFNSS_DELTA_BASE         1 // Full state, becomes the base of the following deltas
+#define MDFNSS_DELTA_PAGES        2 // Dirty-tracked arrays only hold the pages changed since the base
+
+// StateMem::context values: delta state users, each with bases and page
+// tracking of its own so that they don't rebase each other's states
+#define MDFNSS_CONTEXT_FRONTEND   0 // retro_serialize()
+#define MDFNSS_CONTEXT_RUNAHEAD   1 // Run-ahead snapshots
+#define MDFNSS_CONTEXTS           2
+
+// StateMem::format values
+#define MDFNSS_FORMAT_NAMED       0 // "MDFNSVST": every variable is saved along with its name
+#define MDFNSS_FORMAT_INDEXED     1 // "MDFNSVIX"/"MDFNSVDL": names are saved once per section, in a table
+
 // Eh, we abuse the smem_* in-memory stream code
 // in a few other places. :)
 int32_t smem_read(StateMem *st, void *buffer, uint32_t len);
@@ -23,6 +44,35 @@ int smem_read32le(StateMem *st, uint32_t *b);
 int MDFNSS_SaveSM(void *st, int, int, const void*, const void*, const void*);
 int MDFNSS_LoadSM(void *st, int, int);
 
+// Saves a delta state: arrays with a StateDirtyMap only contribute the pages
+// written since the last base state, everything else is saved in full. A new
+// base (full) state is written instead when there is no base yet or when
+// most of the tracked memory has changed since.
+//
+// Delta states are loaded back in place with MDFNSS_LoadSM(), within the
+// session that saved them. Replaced bases are kept deflated so that deltas
+// of any of them still load, until they take more than
+// MDFNSS_DELTA_BASE_MEMORY and the least recently used ones are dropped.
+// Loading a delta also makes its base the current one again. Run-ahead
+// keeps a single base, it only ever goes back to its last snapshot.
+int MDFNSS_SaveDeltaSM(void *st, unsigned context);
+
+// Saves a zlib compressed state ("MDFNSVZ1"), built on a full state or, with
+// delta set, on a delta state. With prefilter set, states are XORed against a
+// keyframe state first, which is only good for rewind/rollback buffers (see
+// MDFNSS_SaveDeltaSM()). Compressed states are loaded with MDFNSS_LoadSM().
+int MDFNSS_SaveCompressedSM(void *st, bool delta, bool prefilter);
+
+// Stops the compression worker thread and frees the XOR keyframes, the
+// states filtered against them can't be loaded afterwards.
+void MDFNSS_CloseCompression(void);
+
+// Memory, in bytes, for the deflated copies of replaced delta bases.
+#define MDFNSS_DELTA_BASE_MEMORY  (64 << 20)
+
+// Largest compressed state for raw_size bytes of uncompressed state.
+uint32_t MDFNSS_CompressedSize(uint32_t raw_size);
+
 // Flag for a single, >= 1 byte native-endian variable
 #define MDFNSTATE_RLSB            0x80000000
 
@@ -37,6 +87,33 @@ int MDFNSS_LoadSM(void *st, int, int);
 
 #define MDFNSTATE_BOOL		  0x08000000
 
+// Page-granular record of which parts of a large state array (MainRAM, VRAM,
+// ...) were modified since the last delta base state. The owner flags pages
+// from its write paths, the state code does the rest.
+class StateDirtyMap
+{
+   public:
+      StateDirtyMap(uint32_t size, unsigned page_shift);
+      ~StateDirtyMap();
+
+      INLINE void Mark(uint32_t offset)
+      {
+         pages[offset >> page_shift] = 1;
+      }
+
+      void MarkAll(void);
+
+      uint8_t *pages;      // Pages written since a delta state was last saved or loaded
+      uint8_t *changed[MDFNSS_CONTEXTS]; // Per context, pages changed since its base
+      uint8_t *loaded;     // Pages overwritten by the last delta state load
+      const uint8_t *untracked; // The array, once it also has writers that bypass Mark()
+      uint8_t *base[MDFNSS_CONTEXTS];    // Array contents as of the base, NULL until needed
+      uint32_t base_id[MDFNSS_CONTEXTS]; // Base that base[] and changed[] are relative to
+      uint32_t size;
+      uint32_t page_count;
+      unsigned page_shift;
+};
+
 typedef struct {
    void *v;		// Pointer to the variable/array
    uint32_t size;		// Length, in bytes, of the data to be saved EXCEPT:
@@ -44,6 +121,7 @@ typedef struct {
    // If 0, the subchunk isn't saved.
    uint32_t flags;	// Flags
    const char *name;	// Name
+   StateDirtyMap *dirty;	// Page tracking for delta states, NULL if the variable isn't tracked.
    //uint32_t struct_size;	// Only used for MDFNSTATE_ARRAYOFS, sizeof(struct) that members of the linked SFORMAT struct are in.
 } SFORMAT;
 
@@ -87,7 +165,11 @@ INLINE uint32_t SF_FORCE_D(double *) { return(0); }
 #define SFARRAYDN(x, l, n) { (x), (uint32_t)((l) * 8), MDFNSTATE_RLSB64 | SF_FORCE_D(x), n }
 #define SFARRAYD(x, l) SFARRAYDN((x), (l), #x)
 
-#define SFEND { 0, 0, 0, 0 }
+// Arrays whose writes are tracked in a StateDirtyMap
+#define SFARRAYDIRTYN(x, l, n, d) { (x), (uint32_t)(l), 0 | SF_FORCE_A8(x), n, &(d) }
+#define SFARRAY16DIRTYN(x, l, n, d) { (x), (uint32_t)((l) * sizeof(uint16_t)), MDFNSTATE_RLSB16 | SF_FORCE_A16(x), n, &(d) }
+
+#define SFEND { 0, 0, 0, 0, 0 }
 
 #include <vector>
 
@@ -0,0 +1,311 @@
+/*
+ gte_replay - replays a GTE command trace(see mednafen/psx/gte_trace.h) through gte.cpp, checking every instruction's
+ results against the ones recorded, and reporting throughput per opcode.
+
+ Record a trace by building the core with "make GTE_TRACE=1", which writes <content name>.gtetrace to the save
+ directory while a game runs; build this tool with "make gte_replay".
+
+ Usage: gte_replay [-r repeats] trace.gtetrace
+
+ Exits with 0 if the trace replayed without any differences, 1 if there were differences, and 2 on errors.
+*/
+
+#include "mednafen/psx/psx.h"
+#include "mednafen/psx/gte.h"
+#include "mednafen/psx/gte_trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+// What gte.cpp needs from the rest of the emulator.
+bool psx_cpu_overclock = false;
+extern "C" unsigned char widescreen_hack;
+unsigned char widescreen_hack = 0;
+PS_GPU *GPU = NULL;
+
+int MDFNSS_StateAction(void *st, int load, int data_only, SFORMAT *sf, const char *name, bool optional)
+{
+   return(1);
+}
+
+static const char *OpcodeNames[0x40] =
+{
+   /* 0x00 */ "RTPS", "RTPS", NULL, NULL, NULL, NULL, "NCLIP", NULL,
+   /* 0x08 */ NULL, NULL, NULL, NULL, "OP", NULL, NULL, NULL,
+   /* 0x10 */ "DPCS", "INTPL", "MVMVA", "NCDS", "CDP", NULL, "NCDT", NULL,
+   /* 0x18 */ NULL, NULL, "DCPL", "NCCS", "CC", NULL, "NCS", NULL,
+   /* 0x20 */ "NCT", NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+   /* 0x28 */ "SQR", "DCPL", "DPCT", NULL, NULL, "AVSZ3", "AVSZ4", NULL,
+   /* 0x30 */ "RTPT", NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+   /* 0x38 */ NULL, NULL, NULL, NULL, NULL, "GPF", "GPL", "NCCT",
+};
+
+struct OpcodeStats
+{
+   uint64_t count;
+   double ns;
+};
+
+static const uint8_t *Trace;
+static size_t TraceSize;
+
+static INLINE size_t RecordSize(uint8_t tag)
+{
+   switch(tag >> GTE_TRACE_TYPE_SHIFT)
+   {
+      case GTE_TRACE_WRITE_CR:
+      case GTE_TRACE_WRITE_DR:
+         return(1 + 4);
+
+      case GTE_TRACE_INSTRUCTION:
+         return(1 + 4 + 1 + 4);
+
+      case GTE_TRACE_STATE:
+         return(1 + 64 * 4);
+   }
+
+   return(0);
+}
+
+// Puts the GTE into the state of a GTE_TRACE_STATE record; returns the number of registers that don't read back the
+// same(which shouldn't happen).
+static unsigned RestoreState(const uint8_t *regs)
+{
+   unsigned bad = 0;
+
+   GTE_Power();
+
+   for(unsigned i = 0; i < 32; i++)
+      GTE_WriteCR(i, MDFN_de32lsb(&regs[i * 4]));
+
+   for(unsigned i = 0; i < 31; i++)
+   {
+      // 15 pushes onto the XY FIFO(14 sets the top of it), 28 overwrites IR1-3, and 29 and 31 are read-only.
+      if(i == 15 || i == 28 || i == 29)
+         continue;
+
+      // Power-up leaves LZCR at 0, which writing LZCS can't.
+      if(i == 30 && !MDFN_de32lsb(&regs[(32 + 30) * 4]) && !MDFN_de32lsb(&regs[(32 + 31) * 4]))
+         continue;
+
+      GTE_WriteDR(i, MDFN_de32lsb(&regs[(32 + i) * 4]));
+   }
+
+   for(unsigned i = 0; i < 64; i++)
+   {
+      const uint32_t value = (i < 32) ? GTE_ReadCR(i) : GTE_ReadDR(i - 32);
+
+      if(value != MDFN_de32lsb(&regs[i * 4]))
+         bad++;
+   }
+
+   return(bad);
+}
+
+// Replays the whole trace once; with stats, times each instruction, and with verify, checks its results.
+static uint64_t Replay(OpcodeStats *stats, double timer_overhead, bool verify)
+{
+   uint64_t mismatches = 0;
+   uint64_t instr_index = 0;
+
+   for(size_t pos = 12; pos < TraceSize; pos += RecordSize(Trace[pos]))
+   {
+      const uint8_t tag = Trace[pos];
+      const uint8_t *data = &Trace[pos + 1];
+
+      switch(tag >> GTE_TRACE_TYPE_SHIFT)
+      {
+         case GTE_TRACE_WRITE_CR:
+            GTE_WriteCR(tag & GTE_TRACE_ARG_MASK, MDFN_de32lsb(data));
+            break;
+
+         case GTE_TRACE_WRITE_DR:
+            GTE_WriteDR(tag & GTE_TRACE_ARG_MASK, MDFN_de32lsb(data));
+            break;
+
+         case GTE_TRACE_STATE:
+            if(RestoreState(data) && verify)
+               fprintf(stderr, "State at offset %u doesn't restore exactly.\n", (unsigned)pos);
+            break;
+
+         case GTE_TRACE_INSTRUCTION:
+            {
+               const uint32_t instr = MDFN_de32lsb(data);
+               int32 ret;
+
+               psx_cpu_overclock = (tag & GTE_TRACE_FLAG_OVERCLOCK) != 0;
+               widescreen_hack = (tag & GTE_TRACE_FLAG_WIDESCREEN) != 0;
+
+               if(stats)
+               {
+                  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+                  ret = GTE_Instruction(instr);
+
+                  stats[instr & 0x3F].ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() - timer_overhead;
+                  stats[instr & 0x3F].count++;
+               }
+               else
+                  ret = GTE_Instruction(instr);
+
+               if(verify)
+               {
+                  const uint8_t expected_ret = data[4];
+                  const uint32_t expected_hash = MDFN_de32lsb(&data[5]);
+                  const uint32_t hash = GTE_TraceHash();
+
+                  if((uint8_t)ret != expected_ret || hash != expected_hash)
+                  {
+                     if(mismatches < 10)
+                     {
+                        const char *name = OpcodeNames[instr & 0x3F];
+
+                        fprintf(stderr, "Instruction %llu(offset %u, %s, 0x%08x): returned %d, hash 0x%08x; expected %d, hash 0x%08x\n",
+                              (unsigned long long)instr_index, (unsigned)pos, name ? name : "unknown", instr,
+                              (uint8_t)ret, hash, expected_ret, expected_hash);
+                     }
+
+                     mismatches++;
+                  }
+               }
+
+               instr_index++;
+            }
+            break;
+      }
+   }
+
+   return(mismatches);
+}
+
+int main(int argc, char *argv[])
+{
+   const char *path = NULL;
+   unsigned repeats = 5;
+   std::vector<uint8_t> data;
+   FILE *fp;
+   long size;
+   uint64_t instructions = 0;
+   uint64_t mismatches;
+   double timer_overhead;
+   double best_pass_ns = 0;
+   OpcodeStats stats[0x40];
+
+   for(int i = 1; i < argc; i++)
+   {
+      if(!strcmp(argv[i], "-r") && (i + 1) < argc)
+         repeats = atoi(argv[++i]);
+      else
+         path = argv[i];
+   }
+
+   if(!path || !repeats)
+   {
+      fprintf(stderr, "Usage: %s [-r repeats] trace.gtetrace\n", argv[0]);
+      return(2);
+   }
+
+   if(!(fp = fopen(path, "rb")))
+   {
+      fprintf(stderr, "Could not open %s\n", path);
+      return(2);
+   }
+
+   fseek(fp, 0, SEEK_END);
+   size = ftell(fp);
+   fseek(fp, 0, SEEK_SET);
+
+   if(size > 0)
+   {
+      data.resize(size);
+      if(fread(&data[0], 1, size, fp) != (size_t)size)
+         size = 0;
+   }
+   fclose(fp);
+
+   if(size < 12 || memcmp(&data[0], GTE_TRACE_MAGIC, 8) || MDFN_de32lsb(&data[8]) != GTE_TRACE_VERSION)
+   {
+      fprintf(stderr, "%s is not a version %d GTE trace.\n", path, GTE_TRACE_VERSION);
+      return(2);
+   }
+
+   Trace = &data[0];
+   TraceSize = size;
+
+   // Drop a partial record at the end, e.g. from a trace that wasn't closed properly.
+   {
+      size_t pos = 12;
+
+      while(pos < TraceSize && RecordSize(Trace[pos]) && (pos + RecordSize(Trace[pos])) <= TraceSize)
+      {
+         if((Trace[pos] >> GTE_TRACE_TYPE_SHIFT) == GTE_TRACE_INSTRUCTION)
+            instructions++;
+
+         pos += RecordSize(Trace[pos]);
+      }
+
+      if(pos != TraceSize)
+         fprintf(stderr, "Ignoring the %u bytes from offset %u.\n", (unsigned)(TraceSize - pos), (unsigned)pos);
+
+      TraceSize = pos;
+   }
+
+   // Zeroed out, so that it isn't caching subpixel vertices.
+   GPU = (PS_GPU *)calloc(1, sizeof(PS_GPU));
+
+   GTE_Init();
+   GTE_Power();
+
+   mismatches = Replay(NULL, 0, true);
+
+   printf("%s: %llu instructions, %llu with different results.\n", path, (unsigned long long)instructions, (unsigned long long)mismatches);
+
+   if(!instructions)
+      return(mismatches ? 1 : 0);
+
+   {
+      const unsigned samples = 1 << 20;
+      const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+      for(unsigned i = 0; i < samples; i++)
+         std::chrono::steady_clock::now();
+
+      timer_overhead = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / samples;
+   }
+
+   memset(stats, 0, sizeof(stats));
+
+   for(unsigned r = 0; r < repeats; r++)
+   {
+      const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      double pass_ns;
+
+      Replay(NULL, 0, false);
+
+      pass_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+      if(!r || pass_ns < best_pass_ns)
+         best_pass_ns = pass_ns;
+
+      Replay(stats, timer_overhead, false);
+   }
+
+   printf("Whole trace: %.1f ns per instruction(including register writes), best of %u.\n\n", best_pass_ns / instructions, repeats);
+   printf("Opcode      Count   ns/instr   Minstr/s\n");
+
+   for(unsigned op = 0; op < 0x40; op++)
+   {
+      const double ns = stats[op].ns / stats[op].count;
+
+      if(!stats[op].count)
+         continue;
+
+      printf("0x%02x %-5s %8llu %10.1f %10.2f\n", op, OpcodeNames[op] ? OpcodeNames[op] : "?",
+            (unsigned long long)(stats[op].count / repeats), ns, (ns > 0) ? 1000.0 / ns : 0.0);
+   }
+
+   return(mismatches ? 1 : 0);
+}